@@ -31,19 +31,58 @@
 #define nDPId_ICMP_IDLE_TIME TIME_S_TO_US(120u) /* 120 sec */
 #define nDPId_TCP_IDLE_TIME TIME_S_TO_US(7440u) /* 7440 sec */
 #define nDPId_UDP_IDLE_TIME TIME_S_TO_US(180u) /* 180 sec */
+#define nDPId_UDP_TRANSACTION_TIME TIME_S_TO_US(5u) /* 5 sec */
 #define nDPId_TCP_POST_END_FLOW_TIME TIME_S_TO_US(120u) /* 120 sec */
+#define nDPId_TCP_EMBRYONIC_TIME TIME_S_TO_US(30u) /* 30 sec */
+#define nDPId_TCP_POST_CLOSE_TIME TIME_S_TO_US(0u) /* free'd with the next flow scan */
+#define nDPId_TCP_RST_SEQ_WINDOW 65535u /* max. unscaled TCP window */
 #define nDPId_THREAD_DISTRIBUTION_SEED 0x03dd018b
 #define nDPId_PACKETS_PER_FLOW_TO_SEND 15u
 #define nDPId_PACKETS_PER_FLOW_TO_PROCESS NDPI_DEFAULT_MAX_NUM_PKTS_PER_FLOW_TO_DISSECT
 #define nDPId_PACKETS_PER_FLOW_TO_ANALYZE 32u
+#define nDPId_SERVICE_CACHE_SIZE 0u /* disabled, must be a power of two */
+#define nDPId_SERVICE_CACHE_WAYS 4u
+#define nDPId_SERVICE_CACHE_MAX_AGE TIME_S_TO_US(300u) /* 300 sec */
+#define nDPId_ADAPTIVE_MIN_IDLE_TIME 0u /* disabled */
+#define nDPId_ADAPTIVE_MAX_IDLE_TIME TIME_S_TO_US(600u) /* 600 sec */
+#define nDPId_IDLE_SKETCHES 256u /* per thread, one for every l7/l4 protocol pair, must be a power of two */
+#define nDPId_IDLE_SKETCH_BUCKETS 96u /* four per power of two msec, the last one from 7 << 22 msec (~8.2h) on */
+#define nDPId_IDLE_SKETCH_DECAY 1024u /* halve all counts after that many samples */
+#define nDPId_IDLE_SKETCH_MIN_SAMPLES 32u
+#define nDPId_IDLE_SKETCH_QUANTILE 99u /* percent */
+#define nDPId_IDLE_SKETCH_FACTOR 2u
+#define nDPId_IDLE_SKETCH_FLOOR_DIVISOR 32u /* learned idle times >= static idle time / 32 */
+#define nDPId_MAX_TUNNEL_DEPTH 2u
+#define nDPId_VXLAN_PORT 4789u
+#define nDPId_GTP_U_PORT 2152u
+#define nDPId_SKIPPED_FLOWS_SET_SIZE 65536u /* per thread, must be a power of two */
+#define nDPId_SKIPPED_FLOWS_EXPIRE_SLOTS 8192u /* per flow-scan-interval, must divide the set size */
+#define nDPId_SKIPPED_FLOWS_EVICT_PROBES 8u
 #define nDPId_ANALYZE_PLEN_MAX 1504u
 #define nDPId_ANALYZE_PLEN_BIN_LEN 32u
 #define nDPId_ANALYZE_PLEN_NUM_BINS 48u
 #define nDPId_FLOW_STRUCT_SEED 0x5defc104
+#define nDPId_COLLECTOR_BATCH_SIZE (NETWORK_BUFFER_MAX_SIZE * 2u)
+#define nDPId_COLLECTOR_RECONNECT_INTERVAL TIME_S_TO_US(5u) /* 5 sec */
 
 /* nDPIsrvd default config options */
 #define nDPIsrvd_PIDFILE "/tmp/ndpisrvd.pid"
 #define nDPIsrvd_MAX_REMOTE_DESCRIPTORS 32
 #define nDPIsrvd_MAX_WRITE_BUFFERS 1024
+#define nDPIsrvd_IO_URING_ENTRIES 256
+#define nDPIsrvd_CATCHUP_RING_SIZE (4u * 1024u * 1024u) /* 4 MiB */
+#define nDPIsrvd_CATCHUP_MAX_AGE 30u /* 30 sec */
+#define nDPIsrvd_AGGREGATION_INTERIM_INTERVAL 0u /* disabled */
+#define nDPIsrvd_STATS_EVENT_INTERVAL 0u /* disabled */
+#define nDPIsrvd_METRICS_SEND_TIMEOUT TIME_S_TO_US(5u) /* 5 sec */
+#define nDPIsrvd_FLOW_TABLE_MIN_SIZE 64u /* must be a power of two */
+#define nDPIsrvd_FLOW_POOL_CHUNK_FLOWS 256u
+#define nDPIsrvd_TIMER_WHEEL_SLOTS 256u
+#define nDPIsrvd_TIMER_WHEEL_TICK TIME_S_TO_US(1u) /* 1 sec */
+#define nDPIsrvd_FLOW_TIMEOUT_GRACE TIME_S_TO_US(60u) /* 60 sec */
+#define nDPIsrvd_DISPATCH_RING_SIZE (1024u * 1024u) /* per worker, must be a power of two */
+#define nDPIsrvd_MULTI_MAX_SOURCES 64u
+#define nDPIsrvd_MULTI_RECONNECT_BACKOFF_MIN TIME_S_TO_US(1u) /* 1 sec */
+#define nDPIsrvd_MULTI_RECONNECT_BACKOFF_MAX TIME_S_TO_US(30u) /* 30 sec */
 
 #endif
@@ -20,13 +20,23 @@
 
 #include "config.h"
 #include "jsmn.h"
+#include "nDPIsrvd_keys.h"
 #include "utarray.h"
 #include "uthash.h"
+#include "utlist.h"
 
 #ifdef ENABLE_MEMORY_PROFILING
 #include <stdarg.h>
 #endif
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #define nDPIsrvd_MAX_JSON_TOKENS 512
 #define nDPIsrvd_JSON_KEY_STRLEN 32
 
@@ -119,27 +129,66 @@ typedef int nDPIsrvd_hashkey;
 
 struct nDPIsrvd_flow
 {
-    nDPIsrvd_hashkey flow_key;
     nDPIsrvd_ull id_as_ull;
     nDPIsrvd_hashkey thread_id;
     nDPIsrvd_ull last_seen;
     nDPIsrvd_ull idle_time;
-    UT_hash_handle hh;
+    struct nDPIsrvd_flow * prev;
+    struct nDPIsrvd_flow * next; /* also links unused flows of the flow pool */
+    nDPIsrvd_ull timer_expiry; /* last_seen + idle_time or the end of the grace period if the flow is overdue */
+    int timer_overdue;
+    struct nDPIsrvd_flow ** timer_slot; /* timer wheel slot of the thread data, NULL if not scheduled */
+    struct nDPIsrvd_flow * timer_prev;
+    struct nDPIsrvd_flow * timer_next;
     uint8_t flow_user_data[0];
 };
 
+struct nDPIsrvd_flow_slot
+{
+    nDPIsrvd_ull flow_id;
+    nDPIsrvd_hashkey thread_id;
+    struct nDPIsrvd_flow * flow; /* NULL if the slot is empty */
+};
+
+/*
+ * Open addressing (linear probing) table keyed by thread id and numeric flow id.
+ * Slots only reference pooled flows, flow pointers stay valid if the table grows.
+ */
+struct nDPIsrvd_flow_table
+{
+    struct nDPIsrvd_flow_slot * slots;
+    size_t size; /* power of two */
+    size_t used;
+    struct nDPIsrvd_flow * flows; /* doubly linked list of all flows in the table, see utlist.h */
+};
+
+struct nDPIsrvd_flow_pool
+{
+    void * chunks;
+    struct nDPIsrvd_flow * unused_flows;
+    size_t flow_size;
+};
+
 struct nDPIsrvd_thread_data
 {
     nDPIsrvd_hashkey thread_key;
     nDPIsrvd_ull most_recent_flow_time;
+    /*
+     * hashed timer wheel of all flows of this thread, keyed on the flow timer expiry,
+     * every slot before timer_tick was already checked for timed out flows
+     */
+    nDPIsrvd_ull timer_tick;
+    struct nDPIsrvd_flow * timer_wheel[nDPIsrvd_TIMER_WHEEL_SLOTS];
     UT_hash_handle hh;
     uint8_t thread_user_data[0];
 };
 
 struct nDPIsrvd_instance
 {
-    nDPIsrvd_hashkey alias_source_key;
-    struct nDPIsrvd_flow * flow_table;
+    nDPIsrvd_hashkey alias_source_key; /* informational only, instances are looked up by alias and source */
+    char * alias_source;               /* alias and source separated by a zero byte */
+    size_t alias_source_length;
+    struct nDPIsrvd_flow_table flow_table;
     struct nDPIsrvd_thread_data * thread_data_table;
     UT_hash_handle hh;
     uint8_t instance_user_data[0];
@@ -152,9 +201,41 @@ struct nDPIsrvd_json_token
     int key_length;
     int value_length;
     int token_index;
+    nDPIsrvd_ull generation; /* value is only valid if this equals the generation of the current line */
     UT_hash_handle hh;
 };
 
+/* numeric value of a typed event view, converted on first access by nDPIsrvd_number_to_ull() */
+struct nDPIsrvd_json_number
+{
+    struct nDPIsrvd_json_token const * token;
+    enum nDPIsrvd_conversion_return conversion; /* 0 if not converted yet */
+    nDPIsrvd_ull value;
+};
+
+static inline struct nDPIsrvd_json_token const * nDPIsrvd_event_token(
+    struct nDPIsrvd_json_token const * const tokens, nDPIsrvd_ull generation, enum nDPIsrvd_known_key key)
+{
+    if (tokens[key].generation != generation || tokens[key].value_length == 0)
+    {
+        return NULL;
+    }
+
+    return &tokens[key];
+}
+
+static inline void nDPIsrvd_event_number(struct nDPIsrvd_json_number * const number,
+                                         struct nDPIsrvd_json_token const * const tokens,
+                                         nDPIsrvd_ull generation,
+                                         enum nDPIsrvd_known_key key)
+{
+    number->token = nDPIsrvd_event_token(tokens, generation, key);
+    number->conversion = 0;
+    number->value = 0;
+}
+
+#include "nDPIsrvd_events.h"
+
 struct nDPIsrvd_socket;
 static inline void * nDPIsrvd_calloc(size_t const n, size_t const size);
 static inline void * nDPIsrvd_malloc(size_t const size);
@@ -169,6 +250,11 @@ typedef enum nDPIsrvd_callback_return (*json_callback)(struct nDPIsrvd_socket *
                                                        struct nDPIsrvd_instance * const instance,
                                                        struct nDPIsrvd_thread_data * const thread_data,
                                                        struct nDPIsrvd_flow * const flow);
+typedef enum nDPIsrvd_callback_return (*event_callback)(struct nDPIsrvd_socket * const sock,
+                                                        struct nDPIsrvd_instance * const instance,
+                                                        struct nDPIsrvd_thread_data * const thread_data,
+                                                        struct nDPIsrvd_flow * const flow,
+                                                        struct nDPIsrvd_event * const event);
 typedef void (*instance_cleanup_callback)(struct nDPIsrvd_socket * const sock,
                                           struct nDPIsrvd_instance * const instance,
                                           enum nDPIsrvd_cleanup_reason reason);
@@ -204,6 +290,7 @@ struct nDPIsrvd_buffer
 struct nDPIsrvd_json_buffer
 {
     struct nDPIsrvd_buffer buf;
+    size_t read_offset; /* start of the next unparsed line, the buffer gets compacted once per nDPIsrvd_read() */
     char * json_string;
     size_t json_string_start;
     nDPIsrvd_ull json_string_length;
@@ -214,6 +301,7 @@ struct nDPIsrvd_jsmn
     jsmn_parser parser;
     jsmntok_t tokens[nDPIsrvd_MAX_JSON_TOKENS];
     int tokens_found;
+    int structural_scan; /* see nDPIsrvd_set_structural_scan() */
 };
 
 struct nDPIsrvd_socket
@@ -226,19 +314,30 @@ struct nDPIsrvd_socket
     size_t thread_user_data_size;
     size_t flow_user_data_size;
     struct nDPIsrvd_instance * instance_table;
+    struct nDPIsrvd_flow_pool flow_pool;
     json_callback json_callback;
+    event_callback event_callback;
     instance_cleanup_callback instance_cleanup_callback;
     flow_cleanup_callback flow_cleanup_callback;
+    int callbacks_suppressed; /* skips the json and event callback, flows are still managed (see nDPIsrvd_dispatch.h) */
 
     struct nDPIsrvd_json_buffer buffer;
     struct nDPIsrvd_jsmn jsmn;
+    struct nDPIsrvd_buffer decode_buffer; /* see nDPIsrvd_token_base64decode_pooled(), allocated on first use */
 
-    /* easy and fast JSON key/value access via hash table and a static array */
+    /*
+     * easy and fast JSON key/value access:
+     * keys listed in the schema files map to fixed slots via a perfect hash (see nDPIsrvd_keys.h),
+     * all other keys are stored in a hash table backed by a static array
+     */
     struct
     {
+        nDPIsrvd_ull generation;
+        struct nDPIsrvd_json_token known_tokens[nDPIsrvd_KNOWN_KEYS];
         UT_array * tokens;
         struct nDPIsrvd_json_token * token_table;
     } json;
+    struct nDPIsrvd_event event; /* typed view of the current line, only filled if an event callback is set */
 
     size_t global_user_data_size;
     uint8_t global_user_data[0];
@@ -250,9 +349,49 @@ static inline void nDPIsrvd_socket_free(struct nDPIsrvd_socket ** const sock);
 #define WHITESPACE 64
 #define EQUALS 65
 #define INVALID 66
-static inline int nDPIsrvd_base64decode(char * in, size_t inLen, unsigned char * out, size_t * outLen)
+#define nDPIsrvd_BASE64_DECODED_SIZE(base64_length) (((base64_length) + 3) / 4 * 3)
+
+#if defined(__SSSE3__)
+/*
+ * Decodes 16 base64 characters into 12 bytes (16 bytes are stored) with the nibble lookup of Wojciech Mula,
+ * returns 0 if the block contains anything else than the 64 alphabet characters.
+ */
+static inline int nDPIsrvd_base64decode_block16(char const * const in, unsigned char * const out)
+{
+    __m128i const lut_lo = _mm_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    __m128i const lut_hi = _mm_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    __m128i const lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    __m128i const mask_2f = _mm_set1_epi8(0x2F);
+    __m128i str = _mm_loadu_si128((__m128i const *)in);
+    __m128i const hi_nibbles = _mm_and_si128(_mm_srli_epi32(str, 4), mask_2f);
+    __m128i const lo = _mm_shuffle_epi8(lut_lo, _mm_and_si128(str, mask_2f));
+    __m128i const hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0xFFFF)
+    {
+        return 0;
+    }
+
+    str = _mm_add_epi8(str, _mm_shuffle_epi8(lut_roll, _mm_add_epi8(_mm_cmpeq_epi8(str, mask_2f), hi_nibbles)));
+    str = _mm_madd_epi16(_mm_maddubs_epi16(str, _mm_set1_epi32(0x01400140)), _mm_set1_epi32(0x00011000));
+    str = _mm_shuffle_epi8(str, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    _mm_storeu_si128((__m128i *)out, str);
+
+    return 1;
+}
+#endif
+
+/*
+ * Decodes inLen base64 characters into out, *outLen is the size of out on input and the decoded length on output.
+ * Never writes more than *outLen bytes, nDPIsrvd_BASE64_DECODED_SIZE(inLen) is always sufficient.
+ * Runs of plain base64 are decoded 4 characters at once or 16 with SSSE3 if enabled at compile time,
+ * escapes, whitespace and padding are handled one character at a time.
+ */
+static inline int nDPIsrvd_base64decode(char const * in, size_t inLen, unsigned char * out, size_t * outLen)
 {
-    char * end = in + inLen;
+    char const * const end = in + inLen;
     char iter = 0;
     uint32_t buf = 0;
     size_t len = 0;
@@ -274,7 +413,44 @@ static inline int nDPIsrvd_base64decode(char * in, size_t inLen, unsigned char *
 
     while (in < end)
     {
-        unsigned char c = d[*(unsigned char *)in++];
+        /* fast paths, only between complete quadruples */
+        if (iter == 0)
+        {
+#if defined(__SSSE3__)
+            while (end - in >= 16 && *outLen - len >= 16 && nDPIsrvd_base64decode_block16(in, out) != 0)
+            {
+                in += 16;
+                out += 12;
+                len += 12;
+            }
+#endif
+            while (end - in >= 4 && *outLen - len >= 3)
+            {
+                unsigned char const c0 = d[(unsigned char)in[0]];
+                unsigned char const c1 = d[(unsigned char)in[1]];
+                unsigned char const c2 = d[(unsigned char)in[2]];
+                unsigned char const c3 = d[(unsigned char)in[3]];
+
+                if ((c0 | c1 | c2 | c3) >= 64)
+                {
+                    break;
+                }
+
+                buf = (uint32_t)c0 << 18 | (uint32_t)c1 << 12 | (uint32_t)c2 << 6 | c3;
+                *(out++) = (buf >> 16) & 255;
+                *(out++) = (buf >> 8) & 255;
+                *(out++) = buf & 255;
+                len += 3;
+                in += 4;
+            }
+            buf = 0;
+            if (in == end)
+            {
+                break;
+            }
+        }
+
+        unsigned char c = d[*(unsigned char const *)in++];
 
         switch (c)
         {
@@ -404,6 +580,7 @@ static inline int nDPIsrvd_json_buffer_init(struct nDPIsrvd_json_buffer * const
     int ret = nDPIsrvd_buffer_init(&json_buffer->buf, json_buffer_size);
     if (ret == 0)
     {
+        json_buffer->read_offset = 0ul;
         json_buffer->json_string_start = 0ul;
         json_buffer->json_string_length = 0ull;
         json_buffer->json_string = NULL;
@@ -415,6 +592,7 @@ static inline int nDPIsrvd_json_buffer_init(struct nDPIsrvd_json_buffer * const
 static inline void nDPIsrvd_json_buffer_free(struct nDPIsrvd_json_buffer * const json_buffer)
 {
     nDPIsrvd_buffer_free(&json_buffer->buf);
+    json_buffer->read_offset = 0ul;
     json_buffer->json_string_start = 0ul;
     json_buffer->json_string_length = 0ull;
     json_buffer->json_string = NULL;
@@ -431,11 +609,6 @@ static inline struct nDPIsrvd_socket * nDPIsrvd_socket_init(size_t global_user_d
     static const UT_icd packet_data_icd = {sizeof(struct nDPIsrvd_json_token), NULL, NULL, NULL};
     struct nDPIsrvd_socket * sock = (struct nDPIsrvd_socket *)nDPIsrvd_calloc(1, sizeof(*sock) + global_user_data_size);
 
-    if (json_cb == NULL)
-    {
-        goto error;
-    }
-
     if (sock != NULL)
     {
         sock->fd = -1;
@@ -451,6 +624,7 @@ static inline struct nDPIsrvd_socket * nDPIsrvd_socket_init(size_t global_user_d
         sock->instance_user_data_size = instance_user_data_size;
         sock->thread_user_data_size = thread_user_data_size;
         sock->flow_user_data_size = flow_user_data_size;
+        sock->flow_pool.flow_size = (sizeof(struct nDPIsrvd_flow) + flow_user_data_size + 15u) & ~(size_t)15u;
 
         sock->json_callback = json_cb;
         sock->instance_cleanup_callback = instance_cleanup_cb;
@@ -463,6 +637,13 @@ static inline struct nDPIsrvd_socket * nDPIsrvd_socket_init(size_t global_user_d
         }
         utarray_reserve(sock->json.tokens, nDPIsrvd_MAX_JSON_TOKENS);
 
+        sock->json.generation = 1;
+        for (size_t i = 0; i < nDPIsrvd_KNOWN_KEYS; ++i)
+        {
+            sock->json.known_tokens[i].key_length = nDPIsrvd_known_key_lengths[i];
+            snprintf(sock->json.known_tokens[i].key, nDPIsrvd_JSON_KEY_STRLEN, "%s", nDPIsrvd_known_keys[i]);
+        }
+
         sock->global_user_data_size = global_user_data_size;
     }
 
@@ -473,6 +654,68 @@ error:
     return NULL;
 }
 
+/*
+ * The event callback is invoked after the json callback (if any) with a typed view of the current line.
+ * The json callback passed to nDPIsrvd_socket_init() may be NULL if an event callback is set.
+ */
+static inline void nDPIsrvd_set_event_callback(struct nDPIsrvd_socket * const sock, event_callback event_cb)
+{
+    sock->event_callback = event_cb;
+}
+
+/*
+ * Tokenizes lines with nDPIsrvd_scan_line() instead of jsmn: only members of the top-level object become tokens,
+ * nested objects and arrays (e.g. "ndpi" or "data_analysis") are skipped until nDPIsrvd_json_descend() is called.
+ * Their members are not available via token_get() before. If an event callback is set, all nested values are
+ * descended before the callbacks are invoked, so that the typed event view is complete.
+ */
+static inline void nDPIsrvd_set_structural_scan(struct nDPIsrvd_socket * const sock, int enable)
+{
+    sock->jsmn.structural_scan = (enable != 0);
+}
+
+/*
+ * Decodes a base64 token value (e.g. "pkt" of packet events) directly from the receive buffer.
+ * out and out_length as for nDPIsrvd_base64decode(), nDPIsrvd_BASE64_DECODED_SIZE(token->value_length) bytes
+ * are always sufficient.
+ */
+static inline int nDPIsrvd_token_base64decode(struct nDPIsrvd_json_token const * const token,
+                                              unsigned char * const out,
+                                              size_t * const out_length)
+{
+    if (token == NULL || token->value_length <= 0)
+    {
+        return 1;
+    }
+
+    return nDPIsrvd_base64decode(token->value, token->value_length, out, out_length);
+}
+
+/*
+ * Same as nDPIsrvd_token_base64decode(), but decodes into a buffer owned by the socket.
+ * Returns NULL on error, the decoded data is valid until the next call.
+ */
+static inline uint8_t const * nDPIsrvd_token_base64decode_pooled(struct nDPIsrvd_socket * const sock,
+                                                                 struct nDPIsrvd_json_token const * const token,
+                                                                 size_t * const decoded_length)
+{
+    if (sock->decode_buffer.ptr.raw == NULL &&
+        nDPIsrvd_buffer_init(&sock->decode_buffer, nDPIsrvd_BASE64_DECODED_SIZE(NETWORK_BUFFER_MAX_SIZE)) != 0)
+    {
+        return NULL;
+    }
+
+    sock->decode_buffer.used = sock->decode_buffer.max;
+    if (nDPIsrvd_token_base64decode(token, sock->decode_buffer.ptr.raw, &sock->decode_buffer.used) != 0)
+    {
+        sock->decode_buffer.used = 0;
+        return NULL;
+    }
+
+    *decoded_length = sock->decode_buffer.used;
+    return sock->decode_buffer.ptr.raw;
+}
+
 static inline int nDPIsrvd_set_read_timeout(struct nDPIsrvd_socket * const sock,
                                             time_t seconds,
                                             suseconds_t micro_seconds)
@@ -512,6 +755,198 @@ static inline int nDPIsrvd_set_nonblock(struct nDPIsrvd_socket * const sock)
     return (fcntl(sock->fd, F_SETFL, flags | O_NONBLOCK) != 0);
 }
 
+static inline struct nDPIsrvd_flow * nDPIsrvd_flow_pool_get(struct nDPIsrvd_flow_pool * const pool)
+{
+    struct nDPIsrvd_flow * flow;
+
+    if (pool->unused_flows == NULL)
+    {
+        /* the first 16 bytes of a chunk link to the previously allocated chunk */
+        uint8_t * const chunk = (uint8_t *)nDPIsrvd_malloc(16u + pool->flow_size * nDPIsrvd_FLOW_POOL_CHUNK_FLOWS);
+        if (chunk == NULL)
+        {
+            return NULL;
+        }
+
+        *(void **)chunk = pool->chunks;
+        pool->chunks = chunk;
+        for (size_t i = nDPIsrvd_FLOW_POOL_CHUNK_FLOWS; i > 0; --i)
+        {
+            flow = (struct nDPIsrvd_flow *)(chunk + 16u + pool->flow_size * (i - 1));
+            flow->next = pool->unused_flows;
+            pool->unused_flows = flow;
+        }
+    }
+
+    flow = pool->unused_flows;
+    pool->unused_flows = flow->next;
+    memset(flow, 0, pool->flow_size);
+
+    return flow;
+}
+
+static inline void nDPIsrvd_flow_pool_put(struct nDPIsrvd_flow_pool * const pool, struct nDPIsrvd_flow * const flow)
+{
+    flow->next = pool->unused_flows;
+    pool->unused_flows = flow;
+}
+
+static inline void nDPIsrvd_flow_pool_free(struct nDPIsrvd_flow_pool * const pool)
+{
+    while (pool->chunks != NULL)
+    {
+        void * const chunk = pool->chunks;
+
+        pool->chunks = *(void **)chunk;
+        nDPIsrvd_free(chunk);
+    }
+    pool->unused_flows = NULL;
+}
+
+static inline size_t nDPIsrvd_flow_table_index(struct nDPIsrvd_flow_table const * const table,
+                                               nDPIsrvd_ull flow_id,
+                                               nDPIsrvd_hashkey thread_id)
+{
+    /* flow ids are sequential per thread, a multiplicative hash spreads them over the whole table */
+    nDPIsrvd_ull const hash = (flow_id ^ ((nDPIsrvd_ull)(uint32_t)thread_id << 40)) * 0x9E3779B97F4A7C15ull;
+
+    return (size_t)(hash >> 32) & (table->size - 1);
+}
+
+static inline struct nDPIsrvd_flow * nDPIsrvd_flow_table_find(struct nDPIsrvd_flow_table const * const table,
+                                                              nDPIsrvd_ull flow_id,
+                                                              nDPIsrvd_hashkey thread_id)
+{
+    if (table->used == 0)
+    {
+        return NULL;
+    }
+
+    for (size_t i = nDPIsrvd_flow_table_index(table, flow_id, thread_id);; i = (i + 1) & (table->size - 1))
+    {
+        struct nDPIsrvd_flow_slot const * const slot = &table->slots[i];
+
+        if (slot->flow == NULL)
+        {
+            return NULL;
+        }
+        if (slot->flow_id == flow_id && slot->thread_id == thread_id)
+        {
+            return slot->flow;
+        }
+    }
+}
+
+static inline void nDPIsrvd_flow_table_insert_slot(struct nDPIsrvd_flow_table * const table,
+                                                   nDPIsrvd_ull flow_id,
+                                                   nDPIsrvd_hashkey thread_id,
+                                                   struct nDPIsrvd_flow * const flow)
+{
+    size_t i = nDPIsrvd_flow_table_index(table, flow_id, thread_id);
+
+    while (table->slots[i].flow != NULL)
+    {
+        i = (i + 1) & (table->size - 1);
+    }
+    table->slots[i].flow_id = flow_id;
+    table->slots[i].thread_id = thread_id;
+    table->slots[i].flow = flow;
+}
+
+/* The flow must not be in the table already. */
+static inline int nDPIsrvd_flow_table_add(struct nDPIsrvd_flow_table * const table, struct nDPIsrvd_flow * const flow)
+{
+    /* keep the load factor at or below 1/2 to keep probe sequences short */
+    if ((table->used + 1) * 2 > table->size)
+    {
+        struct nDPIsrvd_flow_table grown = {.slots = NULL,
+                                            .size = (table->size == 0 ? nDPIsrvd_FLOW_TABLE_MIN_SIZE : table->size * 2),
+                                            .used = table->used,
+                                            .flows = table->flows};
+
+        grown.slots = (struct nDPIsrvd_flow_slot *)nDPIsrvd_calloc(grown.size, sizeof(*grown.slots));
+        if (grown.slots == NULL)
+        {
+            return 1;
+        }
+        for (size_t i = 0; i < table->size; ++i)
+        {
+            if (table->slots[i].flow != NULL)
+            {
+                nDPIsrvd_flow_table_insert_slot(
+                    &grown, table->slots[i].flow_id, table->slots[i].thread_id, table->slots[i].flow);
+            }
+        }
+        nDPIsrvd_free(table->slots);
+        *table = grown;
+    }
+
+    nDPIsrvd_flow_table_insert_slot(table, flow->id_as_ull, flow->thread_id, flow);
+    DL_PREPEND(table->flows, flow);
+    table->used++;
+
+    return 0;
+}
+
+static inline void nDPIsrvd_flow_table_remove(struct nDPIsrvd_flow_table * const table,
+                                              struct nDPIsrvd_flow * const flow)
+{
+    size_t const mask = table->size - 1;
+    size_t hole = nDPIsrvd_flow_table_index(table, flow->id_as_ull, flow->thread_id);
+
+    while (table->slots[hole].flow != flow)
+    {
+        hole = (hole + 1) & mask;
+    }
+
+    /* backward shift deletion: no tombstones, so lookups of absent flows stop at the first empty slot */
+    for (size_t next = (hole + 1) & mask; table->slots[next].flow != NULL; next = (next + 1) & mask)
+    {
+        size_t const home = nDPIsrvd_flow_table_index(table, table->slots[next].flow_id, table->slots[next].thread_id);
+
+        if (((next - home) & mask) >= ((next - hole) & mask))
+        {
+            table->slots[hole] = table->slots[next];
+            hole = next;
+        }
+    }
+    table->slots[hole].flow = NULL;
+
+    DL_DELETE(table->flows, flow);
+    table->used--;
+}
+
+static inline void nDPIsrvd_flow_timer_cancel(struct nDPIsrvd_flow * const flow)
+{
+    if (flow->timer_slot != NULL)
+    {
+        DL_DELETE2(*flow->timer_slot, flow, timer_prev, timer_next);
+        flow->timer_slot = NULL;
+    }
+}
+
+static inline void nDPIsrvd_flow_timer_schedule(struct nDPIsrvd_thread_data * const thread_data,
+                                                struct nDPIsrvd_flow * const flow,
+                                                nDPIsrvd_ull expiry)
+{
+    nDPIsrvd_ull tick = expiry / nDPIsrvd_TIMER_WHEEL_TICK;
+
+    flow->timer_expiry = expiry;
+
+    if (tick < thread_data->timer_tick)
+    {
+        tick = thread_data->timer_tick;
+    }
+
+    struct nDPIsrvd_flow ** const timer_slot = &thread_data->timer_wheel[tick % nDPIsrvd_TIMER_WHEEL_SLOTS];
+    if (flow->timer_slot != timer_slot)
+    {
+        nDPIsrvd_flow_timer_cancel(flow);
+        DL_PREPEND2(*timer_slot, flow, timer_prev, timer_next);
+        flow->timer_slot = timer_slot;
+    }
+}
+
 static inline void nDPIsrvd_cleanup_flow(struct nDPIsrvd_socket * const sock,
                                          struct nDPIsrvd_instance * const instance,
                                          struct nDPIsrvd_thread_data * const thread_data,
@@ -522,8 +957,60 @@ static inline void nDPIsrvd_cleanup_flow(struct nDPIsrvd_socket * const sock,
     {
         sock->flow_cleanup_callback(sock, instance, thread_data, flow, reason);
     }
-    HASH_DEL(instance->flow_table, flow);
-    nDPIsrvd_free(flow);
+    nDPIsrvd_flow_timer_cancel(flow);
+    nDPIsrvd_flow_table_remove(&instance->flow_table, flow);
+    nDPIsrvd_flow_pool_put(&sock->flow_pool, flow);
+}
+
+/*
+ * Times out flows of a thread whose last_seen + idle_time is older than the most recent flow time.
+ * nDPId reports idle flows only on its next flow scan, which may happen a while after a time step.
+ * Overdue flows are therefore rescheduled for a grace period first and only timed out if they did not
+ * receive any event (e.g. idle or end) in the meantime.
+ * Every slot of the timer wheel is visited once per tick, flows scheduled more than one wheel turn ahead are kept.
+ */
+static inline void nDPIsrvd_expire_flows(struct nDPIsrvd_socket * const sock,
+                                         struct nDPIsrvd_instance * const instance,
+                                         struct nDPIsrvd_thread_data * const thread_data)
+{
+    nDPIsrvd_ull const now_tick = thread_data->most_recent_flow_time / nDPIsrvd_TIMER_WHEEL_TICK;
+    nDPIsrvd_ull tick = thread_data->timer_tick;
+
+    if (now_tick <= tick)
+    {
+        return;
+    }
+    if (now_tick - tick > nDPIsrvd_TIMER_WHEEL_SLOTS)
+    {
+        tick = now_tick - nDPIsrvd_TIMER_WHEEL_SLOTS;
+    }
+    /* advance first, flows rescheduled by a cleanup callback must not land in an already visited slot */
+    thread_data->timer_tick = now_tick;
+
+    for (; tick < now_tick; ++tick)
+    {
+        struct nDPIsrvd_flow * current_flow;
+        struct nDPIsrvd_flow * ftmp;
+
+        DL_FOREACH_SAFE2(thread_data->timer_wheel[tick % nDPIsrvd_TIMER_WHEEL_SLOTS], current_flow, ftmp, timer_next)
+        {
+            if (current_flow->timer_expiry >= thread_data->most_recent_flow_time)
+            {
+                continue;
+            }
+            if (current_flow->timer_overdue == 0)
+            {
+                current_flow->timer_overdue = 1;
+                nDPIsrvd_flow_timer_schedule(
+                    thread_data, current_flow, thread_data->most_recent_flow_time + nDPIsrvd_FLOW_TIMEOUT_GRACE);
+                continue;
+            }
+#ifdef ENABLE_MEMORY_PROFILING
+            nDPIsrvd_memprof_log("Flow %llu expired: %zu bytes.", current_flow->id_as_ull, sock->flow_pool.flow_size);
+#endif
+            nDPIsrvd_cleanup_flow(sock, instance, thread_data, current_flow, CLEANUP_REASON_FLOW_TIMEOUT);
+        }
+    }
 }
 
 static inline void nDPIsrvd_cleanup_flows(struct nDPIsrvd_socket * const sock,
@@ -534,7 +1021,7 @@ static inline void nDPIsrvd_cleanup_flows(struct nDPIsrvd_socket * const sock,
     struct nDPIsrvd_flow * current_flow;
     struct nDPIsrvd_flow * ftmp;
 
-    if (instance->flow_table != NULL)
+    if (instance->flow_table.flows != NULL)
     {
 #ifdef ENABLE_MEMORY_PROFILING
         nDPIsrvd_memprof_log("Cleaning up flows for instance 0x%x and thread %d.",
@@ -542,7 +1029,7 @@ static inline void nDPIsrvd_cleanup_flows(struct nDPIsrvd_socket * const sock,
                              thread_data->thread_key);
 #endif
 
-        HASH_ITER(hh, instance->flow_table, current_flow, ftmp)
+        DL_FOREACH_SAFE(instance->flow_table.flows, current_flow, ftmp)
         {
             if (current_flow->thread_id == thread_data->thread_key)
             {
@@ -579,6 +1066,7 @@ static inline void nDPIsrvd_cleanup_instance(struct nDPIsrvd_socket * const sock
             }
             instance->thread_data_table = NULL;
         }
+        nDPIsrvd_free(instance->flow_table.slots);
 
         HASH_DEL(sock->instance_table, instance);
         nDPIsrvd_free(instance);
@@ -616,8 +1104,10 @@ static inline void nDPIsrvd_socket_free(struct nDPIsrvd_socket ** const sock)
         nDPIsrvd_cleanup_instance(*sock, current_instance, CLEANUP_REASON_APP_SHUTDOWN);
     }
     (*sock)->instance_table = NULL;
+    nDPIsrvd_flow_pool_free(&(*sock)->flow_pool);
 
     nDPIsrvd_json_buffer_free(&(*sock)->buffer);
+    nDPIsrvd_buffer_free(&(*sock)->decode_buffer);
     nDPIsrvd_free(*sock);
 
     *sock = NULL;
@@ -711,8 +1201,24 @@ static inline enum nDPIsrvd_connect_return nDPIsrvd_connect(struct nDPIsrvd_sock
     return CONNECT_OK;
 }
 
+static inline void nDPIsrvd_json_buffer_compact(struct nDPIsrvd_json_buffer * const json_buffer)
+{
+    if (json_buffer->read_offset == 0)
+    {
+        return;
+    }
+
+    memmove(json_buffer->buf.ptr.raw,
+            json_buffer->buf.ptr.raw + json_buffer->read_offset,
+            json_buffer->buf.used - json_buffer->read_offset);
+    json_buffer->buf.used -= json_buffer->read_offset;
+    json_buffer->read_offset = 0;
+}
+
 static inline enum nDPIsrvd_read_return nDPIsrvd_read(struct nDPIsrvd_socket * const sock)
 {
+    nDPIsrvd_json_buffer_compact(&sock->buffer);
+
     if (sock->buffer.buf.used == sock->buffer.buf.max)
     {
         return READ_OK;
@@ -762,14 +1268,39 @@ static inline int jsmn_token_is_jsmn_type(struct nDPIsrvd_socket const * const s
     return sock->jsmn.tokens[current_token_index].type == type_to_check;
 }
 
+static inline struct nDPIsrvd_json_token * token_find(struct nDPIsrvd_socket * const sock,
+                                                      char const * const key,
+                                                      size_t key_length)
+{
+    struct nDPIsrvd_json_token * token = NULL;
+    int const known_key_index = nDPIsrvd_known_key_index(key, key_length);
+
+    if (known_key_index >= 0)
+    {
+        return &sock->json.known_tokens[known_key_index];
+    }
+
+    HASH_FIND(hh, sock->json.token_table, key, key_length, token);
+    return token;
+}
+
 static inline struct nDPIsrvd_json_token const * token_get(struct nDPIsrvd_socket const * const sock,
                                                            char const * const key,
                                                            size_t key_length)
 {
-    struct nDPIsrvd_json_token * token = NULL;
+    struct nDPIsrvd_json_token const * token = NULL;
+    int const known_key_index = nDPIsrvd_known_key_index(key, key_length);
 
-    HASH_FIND(hh, sock->json.token_table, key, key_length, token);
-    if (token != NULL && token->value_length > 0 && token->value != NULL)
+    if (known_key_index >= 0)
+    {
+        token = &sock->json.known_tokens[known_key_index];
+    }
+    else
+    {
+        HASH_FIND(hh, sock->json.token_table, key, key_length, token);
+    }
+
+    if (token != NULL && token->generation == sock->json.generation && token->value_length > 0)
     {
         return token;
     }
@@ -882,6 +1413,18 @@ static inline enum nDPIsrvd_conversion_return token_value_to_ull(struct nDPIsrvd
     return str_value_to_ull(token->value, value);
 }
 
+static inline enum nDPIsrvd_conversion_return nDPIsrvd_number_to_ull(struct nDPIsrvd_json_number * const number,
+                                                                     nDPIsrvd_ull_ptr const value)
+{
+    if (number->conversion == 0)
+    {
+        number->conversion = token_value_to_ull(number->token, &number->value);
+    }
+    *value = number->value;
+
+    return number->conversion;
+}
+
 static inline nDPIsrvd_hashkey nDPIsrvd_build_key(char const * str, int len)
 {
     uint32_t hash = 5381;
@@ -911,16 +1454,14 @@ static inline int nDPIsrvd_build_instance_key(struct nDPIsrvd_json_token const *
 }
 
 static inline int nDPIsrvd_build_flow_key(struct nDPIsrvd_json_token const * const flow_id_token,
-                                          nDPIsrvd_hashkey * const flow_key)
+                                          nDPIsrvd_ull * const flow_key)
 {
     if (flow_id_token == NULL)
     {
         return 1;
     }
 
-    *flow_key = nDPIsrvd_build_key(flow_id_token->value, flow_id_token->value_length);
-
-    return 0;
+    return (TOKEN_VALUE_TO_ULL(flow_id_token, flow_key) != CONVERSION_OK);
 }
 
 static inline struct nDPIsrvd_instance * nDPIsrvd_get_instance(struct nDPIsrvd_socket * const sock,
@@ -929,24 +1470,43 @@ static inline struct nDPIsrvd_instance * nDPIsrvd_get_instance(struct nDPIsrvd_s
 {
     struct nDPIsrvd_instance * instance;
     nDPIsrvd_hashkey alias_source_key;
+    char key_buffer[256];
+    char * key = key_buffer;
 
     if (nDPIsrvd_build_instance_key(alias, source, &alias_source_key) != 0)
     {
         return NULL;
     }
 
-    HASH_FIND_INT(sock->instance_table, &alias_source_key, instance);
+    size_t const key_length = alias->value_length + 1 + source->value_length;
+    if (key_length > sizeof(key_buffer))
+    {
+        key = (char *)nDPIsrvd_malloc(key_length);
+        if (key == NULL)
+        {
+            return NULL;
+        }
+    }
+    memcpy(key, alias->value, alias->value_length);
+    key[alias->value_length] = '\0';
+    memcpy(key + alias->value_length + 1, source->value, source->value_length);
+
+    HASH_FIND(hh, sock->instance_table, key, key_length, instance);
 
     if (instance == NULL)
     {
-        instance = (struct nDPIsrvd_instance *)nDPIsrvd_calloc(1, sizeof(*instance) + sock->instance_user_data_size);
+        instance = (struct nDPIsrvd_instance *)nDPIsrvd_calloc(
+            1, sizeof(*instance) + sock->instance_user_data_size + key_length);
         if (instance == NULL)
         {
-            return NULL;
+            goto out;
         }
 
         instance->alias_source_key = alias_source_key;
-        HASH_ADD_INT(sock->instance_table, alias_source_key, instance);
+        instance->alias_source = (char *)instance->instance_user_data + sock->instance_user_data_size;
+        instance->alias_source_length = key_length;
+        memcpy(instance->alias_source, key, key_length);
+        HASH_ADD_KEYPTR(hh, sock->instance_table, instance->alias_source, instance->alias_source_length, instance);
 #ifdef ENABLE_MEMORY_PROFILING
         nDPIsrvd_memprof_log("Instance alias \"%.*s\" with source \"%.*s\" added: %zu bytes.",
                              alias->value_length,
@@ -957,6 +1517,11 @@ static inline struct nDPIsrvd_instance * nDPIsrvd_get_instance(struct nDPIsrvd_s
 #endif
     }
 
+out:
+    if (key != key_buffer)
+    {
+        nDPIsrvd_free(key);
+    }
     return instance;
 }
 
@@ -1038,7 +1603,7 @@ static inline struct nDPIsrvd_flow * nDPIsrvd_get_flow(struct nDPIsrvd_socket *
         TOKEN_FLOW_DST_LAST_PKT_TIME,
         TOKEN_FLOW_IDLE_TIME
     };
-    nDPIsrvd_hashkey flow_key;
+    nDPIsrvd_ull flow_key;
 
     *instance = nDPIsrvd_get_instance(sock, tokens[TOKEN_ALIAS], tokens[TOKEN_SOURCE]);
     if (*instance == NULL)
@@ -1056,23 +1621,25 @@ static inline struct nDPIsrvd_flow * nDPIsrvd_get_flow(struct nDPIsrvd_socket *
     {
         return NULL;
     }
-    HASH_FIND_INT((*instance)->flow_table, &flow_key, flow);
+    flow = nDPIsrvd_flow_table_find(&(*instance)->flow_table, flow_key, (*thread_data)->thread_key);
 
     if (flow == NULL)
     {
-        flow = (struct nDPIsrvd_flow *)nDPIsrvd_calloc(1, sizeof(*flow) + sock->flow_user_data_size);
+        flow = nDPIsrvd_flow_pool_get(&sock->flow_pool);
         if (flow == NULL)
         {
             return NULL;
         }
 
-        flow->flow_key = flow_key;
+        flow->id_as_ull = flow_key;
         flow->thread_id = (*thread_data)->thread_key;
-
-        TOKEN_VALUE_TO_ULL(tokens[TOKEN_FLOW_ID], &flow->id_as_ull);
-        HASH_ADD_INT((*instance)->flow_table, flow_key, flow);
+        if (nDPIsrvd_flow_table_add(&(*instance)->flow_table, flow) != 0)
+        {
+            nDPIsrvd_flow_pool_put(&sock->flow_pool, flow);
+            return NULL;
+        }
 #ifdef ENABLE_MEMORY_PROFILING
-        nDPIsrvd_memprof_log("Flow %llu added: %zu bytes.", flow->id_as_ull, sizeof(*flow) + sock->flow_user_data_size);
+        nDPIsrvd_memprof_log("Flow %llu added: %zu bytes.", flow->id_as_ull, sock->flow_pool.flow_size);
 #endif
     }
 
@@ -1102,6 +1669,9 @@ static inline struct nDPIsrvd_flow * nDPIsrvd_get_flow(struct nDPIsrvd_socket *
         flow->idle_time = flow_idle_time;
     }
 
+    flow->timer_overdue = 0;
+    nDPIsrvd_flow_timer_schedule(*thread_data, flow, flow->last_seen + flow->idle_time);
+
     return flow;
 }
 
@@ -1144,7 +1714,7 @@ static inline int nDPIsrvd_check_flow_end(struct nDPIsrvd_socket * const sock,
 #ifdef ENABLE_MEMORY_PROFILING
         nDPIsrvd_memprof_log("Flow %llu deleted: %zu bytes.",
                              current_flow->id_as_ull,
-                             sizeof(*current_flow) + sock->flow_user_data_size);
+                             sock->flow_pool.flow_size);
 #endif
         nDPIsrvd_cleanup_flow(sock,
                               instance,
@@ -1160,7 +1730,7 @@ static inline int nDPIsrvd_check_flow_end(struct nDPIsrvd_socket * const sock,
             "Flow %llu timed out: %zu bytes. Last seen [%llu] + idle time [%llu] < most recent flow time [%llu]. Diff: "
             "[%llu]",
             current_flow->id_as_ull,
-            sizeof(*current_flow) + sock->flow_user_data_size,
+            sock->flow_pool.flow_size,
             current_flow->last_seen,
             current_flow->idle_time,
             thread_data->most_recent_flow_time,
@@ -1172,28 +1742,31 @@ static inline int nDPIsrvd_check_flow_end(struct nDPIsrvd_socket * const sock,
     return 0;
 }
 
-static inline enum nDPIsrvd_parse_return nDPIsrvd_parse_line(struct nDPIsrvd_json_buffer * const json_buffer,
-                                                             struct nDPIsrvd_jsmn * const jsmn)
+/* Checks the framing of the next line in the buffer, does not tokenize it. */
+static inline enum nDPIsrvd_parse_return nDPIsrvd_frame_line(struct nDPIsrvd_json_buffer * const json_buffer)
 {
-    if (json_buffer->buf.used < NETWORK_BUFFER_LENGTH_DIGITS + 1)
+    char * const line = json_buffer->buf.ptr.text + json_buffer->read_offset;
+    size_t const line_available = json_buffer->buf.used - json_buffer->read_offset;
+
+    if (line_available < NETWORK_BUFFER_LENGTH_DIGITS + 1)
     {
         return PARSE_NEED_MORE_DATA;
     }
-    if (json_buffer->buf.ptr.text[NETWORK_BUFFER_LENGTH_DIGITS] != '{')
+    if (line[NETWORK_BUFFER_LENGTH_DIGITS] != '{')
     {
         return PARSE_INVALID_OPENING_CHAR;
     }
 
     errno = 0;
-    json_buffer->json_string_length = strtoull((const char *)json_buffer->buf.ptr.text, &json_buffer->json_string, 10);
-    json_buffer->json_string_length += json_buffer->json_string - json_buffer->buf.ptr.text;
-    json_buffer->json_string_start = json_buffer->json_string - json_buffer->buf.ptr.text;
+    json_buffer->json_string_length = strtoull((const char *)line, &json_buffer->json_string, 10);
+    json_buffer->json_string_length += json_buffer->json_string - line;
+    json_buffer->json_string_start = json_buffer->json_string - line;
 
     if (errno == ERANGE)
     {
         return PARSE_SIZE_EXCEEDS_CONVERSION_LIMIT;
     }
-    if (json_buffer->json_string == json_buffer->buf.ptr.text)
+    if (json_buffer->json_string == line)
     {
         return PARSE_SIZE_MISSING;
     }
@@ -1201,19 +1774,318 @@ static inline enum nDPIsrvd_parse_return nDPIsrvd_parse_line(struct nDPIsrvd_jso
     {
         return PARSE_STRING_TOO_BIG;
     }
-    if (json_buffer->json_string_length > json_buffer->buf.used)
+    if (json_buffer->json_string_length > line_available)
     {
         return PARSE_NEED_MORE_DATA;
     }
-    if (json_buffer->buf.ptr.text[json_buffer->json_string_length - 2] != '}' ||
-        json_buffer->buf.ptr.text[json_buffer->json_string_length - 1] != '\n')
+    if (line[json_buffer->json_string_length - 2] != '}' || line[json_buffer->json_string_length - 1] != '\n')
     {
         return PARSE_INVALID_CLOSING_CHAR;
     }
 
+    return PARSE_OK;
+}
+
+/*
+ * Structural scanner: a replacement for jsmn_parse() that creates tokens for the members of the top-level object
+ * only. Strings are searched for their closing quote and nested values for their closing brace in blocks of 16/32
+ * bytes with SSE2/AVX2 compares, the scalar loops handle the remaining bytes and non-x86 targets.
+ * This skips the base64 "pkt" of packet events and all nested objects without looking at every byte twice.
+ */
+#if defined(__AVX2__)
+#define nDPIsrvd_SCAN_BLOCK_SIZE 32
+
+/* bit set for every '"' or '\\' */
+static inline uint32_t nDPIsrvd_scan_block_string(char const * const p)
+{
+    __m256i const block = _mm256_loadu_si256((__m256i const *)p);
+
+    return (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8('"')),
+                                                          _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\\'))));
+}
+
+/* bit set for every '"', '{', '}', '[' or ']' ('[' | 0x20 == '{' and ']' | 0x20 == '}') */
+static inline uint32_t nDPIsrvd_scan_block_nested(char const * const p)
+{
+    __m256i const block = _mm256_loadu_si256((__m256i const *)p);
+    __m256i const folded = _mm256_or_si256(block, _mm256_set1_epi8(0x20));
+
+    return (uint32_t)_mm256_movemask_epi8(
+        _mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8('"')),
+                        _mm256_or_si256(_mm256_cmpeq_epi8(folded, _mm256_set1_epi8('{')),
+                                        _mm256_cmpeq_epi8(folded, _mm256_set1_epi8('}')))));
+}
+#elif defined(__SSE2__)
+#define nDPIsrvd_SCAN_BLOCK_SIZE 16
+
+static inline uint32_t nDPIsrvd_scan_block_string(char const * const p)
+{
+    __m128i const block = _mm_loadu_si128((__m128i const *)p);
+
+    return (uint32_t)_mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('"')), _mm_cmpeq_epi8(block, _mm_set1_epi8('\\'))));
+}
+
+static inline uint32_t nDPIsrvd_scan_block_nested(char const * const p)
+{
+    __m128i const block = _mm_loadu_si128((__m128i const *)p);
+    __m128i const folded = _mm_or_si128(block, _mm_set1_epi8(0x20));
+
+    return (uint32_t)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('"')),
+                                                    _mm_or_si128(_mm_cmpeq_epi8(folded, _mm_set1_epi8('{')),
+                                                                 _mm_cmpeq_epi8(folded, _mm_set1_epi8('}')))));
+}
+#endif
+
+/* Returns the closing quote of the string starting at p (after the opening quote) or NULL. */
+static inline char const * nDPIsrvd_scan_string_end(char const * p, char const * const end)
+{
+    while (p < end)
+    {
+#ifdef nDPIsrvd_SCAN_BLOCK_SIZE
+        while (end - p >= nDPIsrvd_SCAN_BLOCK_SIZE)
+        {
+            uint32_t const mask = nDPIsrvd_scan_block_string(p);
+
+            if (mask != 0)
+            {
+                p += __builtin_ctz(mask);
+                break;
+            }
+            p += nDPIsrvd_SCAN_BLOCK_SIZE;
+        }
+#endif
+        while (p < end && *p != '"' && *p != '\\')
+        {
+            p++;
+        }
+        if (p >= end)
+        {
+            break;
+        }
+        if (*p == '"')
+        {
+            return p;
+        }
+        /* skip the escaped character */
+        p += 2;
+    }
+
+    return NULL;
+}
+
+/* Returns the end (one past the closing brace) of the object or array starting at p or NULL. */
+static inline char const * nDPIsrvd_scan_nested_end(char const * p, char const * const end)
+{
+    int depth = 0;
+
+    while (p < end)
+    {
+#ifdef nDPIsrvd_SCAN_BLOCK_SIZE
+        while (end - p >= nDPIsrvd_SCAN_BLOCK_SIZE)
+        {
+            uint32_t const mask = nDPIsrvd_scan_block_nested(p);
+
+            if (mask != 0)
+            {
+                p += __builtin_ctz(mask);
+                break;
+            }
+            p += nDPIsrvd_SCAN_BLOCK_SIZE;
+        }
+#endif
+        while (p < end && *p != '"' && (*p | 0x20) != '{' && (*p | 0x20) != '}')
+        {
+            p++;
+        }
+        if (p >= end)
+        {
+            break;
+        }
+
+        switch (*p)
+        {
+            case '"':
+                p = nDPIsrvd_scan_string_end(p + 1, end);
+                if (p == NULL)
+                {
+                    return NULL;
+                }
+                break;
+            case '{':
+            case '[':
+                depth++;
+                break;
+            default:
+                if (--depth == 0)
+                {
+                    return p + 1;
+                }
+                break;
+        }
+        p++;
+    }
+
+    return NULL;
+}
+
+static inline char const * nDPIsrvd_scan_whitespace(char const * p, char const * const end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+    {
+        p++;
+    }
+
+    return p;
+}
+
+static inline int nDPIsrvd_scan_add_token(struct nDPIsrvd_jsmn * const jsmn,
+                                          jsmntype_t type,
+                                          int start,
+                                          int end,
+                                          int size,
+                                          int parent)
+{
+    if (jsmn->tokens_found == nDPIsrvd_MAX_JSON_TOKENS)
+    {
+        return -1;
+    }
+
+    jsmn->tokens[jsmn->tokens_found].type = type;
+    jsmn->tokens[jsmn->tokens_found].start = start;
+    jsmn->tokens[jsmn->tokens_found].end = end;
+    jsmn->tokens[jsmn->tokens_found].size = size;
+    jsmn->tokens[jsmn->tokens_found].parent = parent;
+
+    return jsmn->tokens_found++;
+}
+
+/*
+ * Tokenizes the top-level object of a framed line with the same token layout jsmn_parse() would produce.
+ * Nested objects and arrays become a single token with a size of -1, see nDPIsrvd_json_descend().
+ */
+static inline enum nDPIsrvd_parse_return nDPIsrvd_scan_line(struct nDPIsrvd_json_buffer const * const json_buffer,
+                                                            struct nDPIsrvd_jsmn * const jsmn)
+{
+    char const * const json = json_buffer->json_string;
+    char const * const end = json + (json_buffer->json_string_length - json_buffer->json_string_start);
+    char const * p = nDPIsrvd_scan_whitespace(json + 1, end);
+    int members = 0;
+
+    /* the framing guarantees the opening and closing brace */
+    jsmn->tokens_found = 0;
+    nDPIsrvd_scan_add_token(jsmn, JSMN_OBJECT, 0, end - json - 1, 0, -1);
+
+    while (p < end && *p != '}')
+    {
+        char const * value_end;
+        int key_index;
+
+        if (*p != '"' || (value_end = nDPIsrvd_scan_string_end(p + 1, end)) == NULL)
+        {
+            return PARSE_JSMN_INVALID;
+        }
+        key_index = nDPIsrvd_scan_add_token(jsmn, JSMN_STRING, p + 1 - json, value_end - json, 1, 0);
+        if (key_index < 0)
+        {
+            return PARSE_JSMN_NOMEM;
+        }
+
+        p = nDPIsrvd_scan_whitespace(value_end + 1, end);
+        if (p == end || *p != ':')
+        {
+            return PARSE_JSMN_INVALID;
+        }
+        p = nDPIsrvd_scan_whitespace(p + 1, end);
+        if (p == end)
+        {
+            return PARSE_JSMN_INVALID;
+        }
+
+        int value_index;
+        switch (*p)
+        {
+            case '"':
+                value_end = nDPIsrvd_scan_string_end(p + 1, end);
+                if (value_end == NULL)
+                {
+                    return PARSE_JSMN_INVALID;
+                }
+                value_index = nDPIsrvd_scan_add_token(jsmn, JSMN_STRING, p + 1 - json, value_end - json, 0, key_index);
+                value_end++;
+                break;
+            case '{':
+            case '[':
+                value_end = nDPIsrvd_scan_nested_end(p, end);
+                if (value_end == NULL)
+                {
+                    return PARSE_JSMN_INVALID;
+                }
+                value_index = nDPIsrvd_scan_add_token(
+                    jsmn, (*p == '{' ? JSMN_OBJECT : JSMN_ARRAY), p - json, value_end - json, -1, key_index);
+                break;
+            default:
+                value_end = p;
+                while (value_end < end && *value_end != ',' && *value_end != '}' && *value_end != ' ' &&
+                       *value_end != '\t' && *value_end != '\r' && *value_end != '\n')
+                {
+                    value_end++;
+                }
+                if (value_end == p)
+                {
+                    return PARSE_JSMN_INVALID;
+                }
+                value_index = nDPIsrvd_scan_add_token(jsmn, JSMN_PRIMITIVE, p - json, value_end - json, 0, key_index);
+                break;
+        }
+        if (value_index < 0)
+        {
+            return PARSE_JSMN_NOMEM;
+        }
+        members++;
+
+        p = nDPIsrvd_scan_whitespace(value_end, end);
+        if (p < end && *p == ',')
+        {
+            p = nDPIsrvd_scan_whitespace(p + 1, end);
+            if (p < end && *p == '}')
+            {
+                return PARSE_JSMN_INVALID;
+            }
+        }
+        else if (p == end || *p != '}')
+        {
+            return PARSE_JSMN_INVALID;
+        }
+    }
+
+    if (p == end || nDPIsrvd_scan_whitespace(p + 1, end) != end)
+    {
+        return PARSE_JSMN_INVALID;
+    }
+    jsmn->tokens[0].size = members;
+
+    return PARSE_OK;
+}
+
+static inline enum nDPIsrvd_parse_return nDPIsrvd_parse_line(struct nDPIsrvd_json_buffer * const json_buffer,
+                                                             struct nDPIsrvd_jsmn * const jsmn)
+{
+    enum nDPIsrvd_parse_return const ret = nDPIsrvd_frame_line(json_buffer);
+
+    if (ret != PARSE_OK)
+    {
+        return ret;
+    }
+
+    if (jsmn->structural_scan != 0)
+    {
+        return nDPIsrvd_scan_line(json_buffer, jsmn);
+    }
+
     jsmn_init(&jsmn->parser);
     jsmn->tokens_found = jsmn_parse(&jsmn->parser,
-                                    json_buffer->buf.ptr.text + json_buffer->json_string_start,
+                                    json_buffer->json_string,
                                     json_buffer->json_string_length - json_buffer->json_string_start,
                                     jsmn->tokens,
                                     nDPIsrvd_MAX_JSON_TOKENS);
@@ -1235,105 +2107,223 @@ static inline enum nDPIsrvd_parse_return nDPIsrvd_parse_line(struct nDPIsrvd_jso
     return PARSE_OK;
 }
 
+/*
+ * Skips the line returned by the last successful nDPIsrvd_parse_line().
+ * No data is moved here, the consumed part is discarded by nDPIsrvd_json_buffer_compact() before the next read.
+ */
 static inline void nDPIsrvd_drain_buffer(struct nDPIsrvd_json_buffer * const json_buffer)
 {
-    memmove(json_buffer->buf.ptr.raw,
-            json_buffer->buf.ptr.raw + json_buffer->json_string_length,
-            json_buffer->buf.used - json_buffer->json_string_length);
-    json_buffer->buf.used -= json_buffer->json_string_length;
+    json_buffer->read_offset += json_buffer->json_string_length;
+    if (json_buffer->read_offset == json_buffer->buf.used)
+    {
+        json_buffer->buf.used = 0;
+        json_buffer->read_offset = 0;
+    }
     json_buffer->json_string_length = 0;
     json_buffer->json_string_start = 0;
 }
 
-static inline enum nDPIsrvd_parse_return nDPIsrvd_parse_all(struct nDPIsrvd_socket * const sock)
+/* Makes the key/value pairs of the jsmn tokens [first_token, last_token) accessible via token_get(). */
+static inline enum nDPIsrvd_parse_return nDPIsrvd_json_add_tokens(struct nDPIsrvd_socket * const sock,
+                                                                  int first_token,
+                                                                  int last_token)
 {
     enum nDPIsrvd_parse_return ret = PARSE_OK;
-
-    while (ret == PARSE_OK && (ret = nDPIsrvd_parse_line(&sock->buffer, &sock->jsmn)) == PARSE_OK)
+    char const * key = NULL;
+    int key_length = 0;
+    for (int current_token = first_token; current_token < last_token; current_token++)
     {
-        char const * key = NULL;
-        int key_length = 0;
-        for (int current_token = 1; current_token < sock->jsmn.tokens_found; current_token++)
+        if (jsmn_token_is_key(current_token) == 1)
         {
-            if (jsmn_token_is_key(current_token) == 1)
+            if (key != NULL)
             {
-                if (key != NULL)
-                {
-                    ret = PARSE_JSMN_KEY_MISSING;
-                    break;
-                }
+                ret = PARSE_JSMN_KEY_MISSING;
+                break;
+            }
 
-                key = jsmn_token_get(sock, current_token);
-                key_length = jsmn_token_size(sock, current_token);
+            key = jsmn_token_get(sock, current_token);
+            key_length = jsmn_token_size(sock, current_token);
 
-                if (key == NULL)
-                {
-                    ret = PARSE_JSMN_KEY_MISSING;
-                    break;
-                }
+            if (key == NULL)
+            {
+                ret = PARSE_JSMN_KEY_MISSING;
+                break;
+            }
+        }
+        else
+        {
+            struct nDPIsrvd_json_token * const token = token_find(sock, key, (size_t)key_length);
+
+            if (token != NULL)
+            {
+                token->value = jsmn_token_get(sock, current_token);
+                token->value_length = jsmn_token_size(sock, current_token);
+                token->token_index = current_token - 1;
+                token->generation = sock->json.generation;
             }
             else
             {
-                struct nDPIsrvd_json_token * token = NULL;
-                HASH_FIND(hh, sock->json.token_table, key, (size_t)key_length, token);
-
-                if (token != NULL)
-                {
-                    token->value = jsmn_token_get(sock, current_token);
-                    token->value_length = jsmn_token_size(sock, current_token);
-                }
-                else
+                struct nDPIsrvd_json_token jt = {.value = jsmn_token_get(sock, current_token),
+                                                 .value_length = jsmn_token_size(sock, current_token),
+                                                 .token_index = current_token - 1,
+                                                 .generation = sock->json.generation,
+                                                 .hh = {}};
+
+                if (key == NULL || key_length > nDPIsrvd_JSON_KEY_STRLEN ||
+                    utarray_len(sock->json.tokens) == nDPIsrvd_MAX_JSON_TOKENS)
                 {
-                    struct nDPIsrvd_json_token jt = {.value = jsmn_token_get(sock, current_token),
-                                                     .value_length = jsmn_token_size(sock, current_token),
-                                                     .token_index = current_token - 1,
-                                                     .hh = {}};
-
-                    if (key == NULL || key_length > nDPIsrvd_JSON_KEY_STRLEN ||
-                        utarray_len(sock->json.tokens) == nDPIsrvd_MAX_JSON_TOKENS)
-                    {
-                        ret = PARSE_JSON_MGMT_ERROR;
-                        break;
-                    }
-
-                    jt.key_length = key_length;
-                    snprintf(jt.key, nDPIsrvd_JSON_KEY_STRLEN, "%.*s", key_length, key);
-                    utarray_push_back(sock->json.tokens, &jt);
-                    HASH_ADD_STR(sock->json.token_table,
-                                 key,
-                                 (struct nDPIsrvd_json_token *)utarray_back(sock->json.tokens));
+                    ret = PARSE_JSON_MGMT_ERROR;
+                    break;
                 }
 
-                key = NULL;
-                key_length = 0;
+                jt.key_length = key_length;
+                snprintf(jt.key, nDPIsrvd_JSON_KEY_STRLEN, "%.*s", key_length, key);
+                utarray_push_back(sock->json.tokens, &jt);
+                HASH_ADD_STR(sock->json.token_table,
+                             key,
+                             (struct nDPIsrvd_json_token *)utarray_back(sock->json.tokens));
             }
+
+            key = NULL;
+            key_length = 0;
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * Tokenizes the nested object or array that was skipped by nDPIsrvd_scan_line() for the given key token.
+ * Its members become accessible via token_get() and token_get_next_child() for the rest of the current line.
+ * Does nothing if the value was tokenized already (always the case without nDPIsrvd_set_structural_scan()).
+ */
+static inline enum nDPIsrvd_parse_return nDPIsrvd_json_descend(struct nDPIsrvd_socket * const sock,
+                                                               struct nDPIsrvd_json_token const * const token)
+{
+    struct nDPIsrvd_jsmn * const jsmn = &sock->jsmn;
+
+    if (token == NULL || token->generation != sock->json.generation || token->token_index + 1 >= jsmn->tokens_found)
+    {
+        return PARSE_OK;
+    }
+
+    int const value_index = token->token_index + 1;
+    jsmntok_t const value = jsmn->tokens[value_index];
+    if (value.size >= 0)
+    {
+        return PARSE_OK;
+    }
+
+    /* keep keys at odd token indices, token_get_next_child() and nDPIsrvd_json_add_tokens() rely on it */
+    if ((jsmn->tokens_found & 1) == 0 && nDPIsrvd_scan_add_token(jsmn, JSMN_UNDEFINED, 0, 0, 0, -1) < 0)
+    {
+        return PARSE_JSMN_NOMEM;
+    }
+
+    /*
+     * jsmn stores the nested value itself at the last existing token, which is restored afterwards,
+     * so that its members are appended with parent indices relative to the whole line
+     */
+    int const root_index = jsmn->tokens_found - 1;
+    jsmntok_t const root_backup = jsmn->tokens[root_index];
+    jsmn_init(&jsmn->parser);
+    int const tokens_found = jsmn_parse(&jsmn->parser,
+                                        sock->buffer.json_string + value.start,
+                                        value.end - value.start,
+                                        &jsmn->tokens[root_index],
+                                        nDPIsrvd_MAX_JSON_TOKENS - root_index);
+    if (tokens_found < 1)
+    {
+        jsmn->tokens[root_index] = root_backup;
+        switch ((enum jsmnerr)tokens_found)
+        {
+            case JSMN_ERROR_NOMEM:
+                return PARSE_JSMN_NOMEM;
+            case JSMN_ERROR_INVAL:
+                return PARSE_JSMN_INVALID;
+            case JSMN_ERROR_PART:
+                return PARSE_JSMN_PARTIAL;
+        }
+        return PARSE_JSMN_UNKNOWN_ERROR;
+    }
+
+    jsmn->tokens[value_index].size = jsmn->tokens[root_index].size;
+    jsmn->tokens[root_index] = root_backup;
+    for (int i = root_index + 1; i < root_index + tokens_found; ++i)
+    {
+        jsmn->tokens[i].start += value.start;
+        jsmn->tokens[i].end += value.start;
+        jsmn->tokens[i].parent = (jsmn->tokens[i].parent == 0 ? value_index : jsmn->tokens[i].parent + root_index);
+    }
+    jsmn->tokens_found = root_index + tokens_found;
+
+    return nDPIsrvd_json_add_tokens(sock, root_index + 1, jsmn->tokens_found);
+}
+
+/* Descends into all nested values of the top-level object skipped by nDPIsrvd_scan_line(). */
+static inline enum nDPIsrvd_parse_return nDPIsrvd_json_descend_all(struct nDPIsrvd_socket * const sock)
+{
+    enum nDPIsrvd_parse_return ret = PARSE_OK;
+    int const top_level_tokens = 1 + 2 * sock->jsmn.tokens[0].size;
+
+    for (int i = 2; i < top_level_tokens && ret == PARSE_OK; i += 2)
+    {
+        if (sock->jsmn.tokens[i].size < 0)
+        {
+            struct nDPIsrvd_json_token const * const token =
+                token_get(sock, jsmn_token_get(sock, i - 1), jsmn_token_size(sock, i - 1));
+
+            ret = nDPIsrvd_json_descend(sock, token);
+        }
+    }
+
+    return ret;
+}
+
+static inline enum nDPIsrvd_parse_return nDPIsrvd_parse_all(struct nDPIsrvd_socket * const sock)
+{
+    enum nDPIsrvd_parse_return ret = PARSE_OK;
+
+    while (ret == PARSE_OK && (ret = nDPIsrvd_parse_line(&sock->buffer, &sock->jsmn)) == PARSE_OK)
+    {
+        ret = nDPIsrvd_json_add_tokens(sock, 1, sock->jsmn.tokens_found);
+        if (ret == PARSE_OK && sock->jsmn.structural_scan != 0 && sock->callbacks_suppressed == 0 &&
+            sock->event_callback != NULL)
+        {
+            /* the typed event view includes nested members */
+            ret = nDPIsrvd_json_descend_all(sock);
         }
 
         struct nDPIsrvd_instance * instance = NULL;
         struct nDPIsrvd_thread_data * thread_data = NULL;
         struct nDPIsrvd_flow * flow = NULL;
         flow = nDPIsrvd_get_flow(sock, &instance, &thread_data);
-        if (ret == PARSE_OK && sock->json_callback(sock, instance, thread_data, flow) != CALLBACK_OK)
+        if (ret == PARSE_OK && sock->callbacks_suppressed == 0 && sock->json_callback != NULL &&
+            sock->json_callback(sock, instance, thread_data, flow) != CALLBACK_OK)
         {
             ret = PARSE_JSON_CALLBACK_ERROR;
         }
+        if (ret == PARSE_OK && sock->callbacks_suppressed == 0 && sock->event_callback != NULL)
+        {
+            nDPIsrvd_decode_event(sock->json.known_tokens, sock->json.generation, &sock->event);
+            if (sock->event_callback(sock, instance, thread_data, flow, &sock->event) != CALLBACK_OK)
+            {
+                ret = PARSE_JSON_CALLBACK_ERROR;
+            }
+        }
         if (nDPIsrvd_check_flow_end(sock, instance, thread_data, flow) != 0)
         {
             ret = PARSE_FLOW_MGMT_ERROR;
         }
-
-        sock->jsmn.tokens_found = 0;
+        if (instance != NULL && thread_data != NULL)
         {
-            struct nDPIsrvd_json_token * current_token = NULL;
-            struct nDPIsrvd_json_token * jtmp = NULL;
-
-            HASH_ITER(hh, sock->json.token_table, current_token, jtmp)
-            {
-                current_token->value = NULL;
-                current_token->value_length = 0;
-            }
+            nDPIsrvd_expire_flows(sock, instance, thread_data);
         }
 
+        sock->jsmn.tokens_found = 0;
+        /* invalidates all token values of this line at once */
+        sock->json.generation++;
+
         nDPIsrvd_drain_buffer(&sock->buffer);
     }
 
@@ -1418,9 +2408,8 @@ static inline int nDPIsrvd_verify_flows(struct nDPIsrvd_instance * const instanc
 {
     int retval = 0;
     struct nDPIsrvd_flow const * current_flow;
-    struct nDPIsrvd_flow const * ftmp;
 
-    HASH_ITER(hh, instance->flow_table, current_flow, ftmp)
+    DL_FOREACH(instance->flow_table.flows, current_flow)
     {
         struct nDPIsrvd_thread_data * current_thread_data;
 
@@ -1466,15 +2455,14 @@ static inline void nDPIsrvd_flow_info(struct nDPIsrvd_socket const * const sock,
     struct nDPIsrvd_instance const * itmp;
     struct nDPIsrvd_thread_data * current_thread_data;
     struct nDPIsrvd_flow const * current_flow;
-    struct nDPIsrvd_flow const * ftmp;
 
     if (sock->instance_table != NULL)
     {
         HASH_ITER(hh, sock->instance_table, current_instance, itmp)
         {
-            if (current_instance->flow_table != NULL)
+            if (current_instance->flow_table.flows != NULL)
             {
-                HASH_ITER(hh, current_instance->flow_table, current_flow, ftmp)
+                DL_FOREACH(current_instance->flow_table.flows, current_flow)
                 {
                     HASH_FIND_INT(current_instance->thread_data_table, &current_flow->thread_id, current_thread_data);
                     info_cb(sock, current_instance, current_thread_data, current_flow, user_data);
@@ -0,0 +1,454 @@
+#ifndef NDPISRVD_DISPATCH_H
+#define NDPISRVD_DISPATCH_H 1
+
+#include <pthread.h>
+
+#include "nDPIsrvd.h"
+
+/*
+ * Optional multi-threaded callback dispatch for nDPIsrvd.h consumers, link with -pthread.
+ *
+ * The thread calling nDPIsrvd_read() and nDPIsrvd_dispatch_all() only frames lines and routes each one by its
+ * alias, source and flow_id to one of N worker threads through single producer/single consumer rings.
+ * Every worker owns a socket cloned from the I/O socket (same user data sizes and callbacks) which parses the lines
+ * and runs the callbacks. All lines of a flow are handled by the same worker in the order they were received,
+ * flow user data is therefore only accessed by a single thread.
+ *
+ * Daemon events are delivered to all workers, so that every worker can manage its own share of flows.
+ * The json and event callback are invoked only by one worker for those lines.
+ * Other lines without a flow_id are handled by the worker owning the instance.
+ *
+ * Global, instance and thread user data exist per worker socket, see nDPIsrvd_dispatcher_worker_socket().
+ */
+
+#define nDPIsrvd_DISPATCH_RECORD_HEADER 8u
+#define nDPIsrvd_DISPATCH_RECORD_WRAP 0x01u
+#define nDPIsrvd_DISPATCH_RECORD_COPY 0x02u
+
+struct nDPIsrvd_dispatch_ring
+{
+    uint8_t * data;
+    size_t size; /* power of two */
+    /* padding keeps the positions written by different threads in different cache lines */
+    uint8_t padding0[64];
+    size_t head; /* written by the I/O thread */
+    uint8_t padding1[64 - sizeof(size_t)];
+    size_t tail; /* written by the worker thread */
+    uint8_t padding2[64 - sizeof(size_t)];
+    int consumer_waiting;
+    int producer_waiting;
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+};
+
+struct nDPIsrvd_dispatcher;
+
+struct nDPIsrvd_dispatch_worker
+{
+    pthread_t thread;
+    struct nDPIsrvd_dispatcher * dispatcher;
+    struct nDPIsrvd_socket * sock;
+    struct nDPIsrvd_dispatch_ring ring;
+    enum nDPIsrvd_parse_return error; /* first parse error of this worker, PARSE_OK if none */
+};
+
+struct nDPIsrvd_dispatcher
+{
+    struct nDPIsrvd_socket * sock;
+    int stop;
+    size_t worker_count;
+    struct nDPIsrvd_dispatch_worker workers[0];
+};
+
+static inline int nDPIsrvd_dispatch_ring_wait(struct nDPIsrvd_dispatch_ring * const ring,
+                                              int * const waiting,
+                                              pthread_cond_t * const cond,
+                                              size_t const * const position,
+                                              size_t value,
+                                              int const * const stop)
+{
+    pthread_mutex_lock(&ring->mutex);
+    __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(position, __ATOMIC_SEQ_CST) == value && __atomic_load_n(stop, __ATOMIC_SEQ_CST) == 0)
+    {
+        pthread_cond_wait(cond, &ring->mutex);
+    }
+    __atomic_store_n(waiting, 0, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&ring->mutex);
+
+    return (__atomic_load_n(position, __ATOMIC_SEQ_CST) == value);
+}
+
+static inline void nDPIsrvd_dispatch_ring_wake(struct nDPIsrvd_dispatch_ring * const ring,
+                                               int const * const waiting,
+                                               pthread_cond_t * const cond)
+{
+    if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST) != 0)
+    {
+        pthread_mutex_lock(&ring->mutex);
+        pthread_cond_signal(cond);
+        pthread_mutex_unlock(&ring->mutex);
+    }
+}
+
+static inline size_t nDPIsrvd_dispatch_record_size(size_t length)
+{
+    return (nDPIsrvd_DISPATCH_RECORD_HEADER + length + 7u) & ~(size_t)7u;
+}
+
+/* Blocks while the ring is full. The worker is woken up by nDPIsrvd_dispatch_all() once per batch of lines. */
+static inline void nDPIsrvd_dispatch_ring_push(struct nDPIsrvd_dispatcher * const dispatcher,
+                                               struct nDPIsrvd_dispatch_ring * const ring,
+                                               char const * const line,
+                                               size_t length,
+                                               uint32_t flags)
+{
+    size_t const record_size = nDPIsrvd_dispatch_record_size(length);
+    size_t head = ring->head;
+    size_t const offset = head & (ring->size - 1);
+    size_t const wrap_size = (ring->size - offset < record_size ? ring->size - offset : 0);
+
+    for (;;)
+    {
+        size_t const tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+        if (head + wrap_size + record_size - tail <= ring->size)
+        {
+            break;
+        }
+        nDPIsrvd_dispatch_ring_wake(ring, &ring->consumer_waiting, &ring->not_empty);
+        nDPIsrvd_dispatch_ring_wait(
+            ring, &ring->producer_waiting, &ring->not_full, &ring->tail, tail, &dispatcher->stop);
+    }
+
+    if (wrap_size != 0)
+    {
+        uint32_t const wrap_header[2] = {0, nDPIsrvd_DISPATCH_RECORD_WRAP};
+        memcpy(ring->data + offset, wrap_header, sizeof(wrap_header));
+        head += wrap_size;
+    }
+
+    uint32_t const header[2] = {(uint32_t)length, flags};
+    uint8_t * const record = ring->data + (head & (ring->size - 1));
+    memcpy(record, header, sizeof(header));
+    memcpy(record + nDPIsrvd_DISPATCH_RECORD_HEADER, line, length);
+
+    __atomic_store_n(&ring->head, head + record_size, __ATOMIC_SEQ_CST);
+}
+
+static inline void * nDPIsrvd_dispatch_worker_thread(void * const arg)
+{
+    struct nDPIsrvd_dispatch_worker * const worker = (struct nDPIsrvd_dispatch_worker *)arg;
+    struct nDPIsrvd_dispatcher * const dispatcher = worker->dispatcher;
+    struct nDPIsrvd_dispatch_ring * const ring = &worker->ring;
+    struct nDPIsrvd_socket * const sock = worker->sock;
+    size_t tail = ring->tail;
+
+    for (;;)
+    {
+        if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail &&
+            nDPIsrvd_dispatch_ring_wait(
+                ring, &ring->consumer_waiting, &ring->not_empty, &ring->head, tail, &dispatcher->stop) != 0)
+        {
+            /* stopped and drained */
+            break;
+        }
+
+        uint32_t header[2];
+        uint8_t const * const record = ring->data + (tail & (ring->size - 1));
+        memcpy(header, record, sizeof(header));
+
+        if ((header[1] & nDPIsrvd_DISPATCH_RECORD_WRAP) != 0)
+        {
+            tail += ring->size - (tail & (ring->size - 1));
+            __atomic_store_n(&ring->tail, tail, __ATOMIC_SEQ_CST);
+            nDPIsrvd_dispatch_ring_wake(ring, &ring->producer_waiting, &ring->not_full);
+            continue;
+        }
+
+        if (worker->error == PARSE_OK)
+        {
+            /* the buffer is always empty here, every record carries exactly one complete line */
+            memcpy(sock->buffer.buf.ptr.text, record + nDPIsrvd_DISPATCH_RECORD_HEADER, header[0]);
+            sock->buffer.buf.used = header[0];
+            sock->callbacks_suppressed = ((header[1] & nDPIsrvd_DISPATCH_RECORD_COPY) != 0);
+
+            enum nDPIsrvd_parse_return const ret = nDPIsrvd_parse_all(sock);
+            if (ret != PARSE_NEED_MORE_DATA)
+            {
+                __atomic_store_n(&worker->error, ret, __ATOMIC_SEQ_CST);
+            }
+        }
+
+        tail += nDPIsrvd_dispatch_record_size(header[0]);
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_SEQ_CST);
+        nDPIsrvd_dispatch_ring_wake(ring, &ring->producer_waiting, &ring->not_full);
+    }
+
+    return NULL;
+}
+
+static inline void nDPIsrvd_dispatcher_free(struct nDPIsrvd_dispatcher ** const dispatcher);
+
+/*
+ * Creates worker_count worker threads for the socket. Worker sockets are cloned from sock, set callbacks before.
+ * The socket itself is only used for reading, use nDPIsrvd_dispatch_all() instead of nDPIsrvd_parse_all().
+ */
+static inline struct nDPIsrvd_dispatcher * nDPIsrvd_dispatcher_init(struct nDPIsrvd_socket * const sock,
+                                                                    size_t worker_count)
+{
+    struct nDPIsrvd_dispatcher * dispatcher;
+
+    if (worker_count == 0)
+    {
+        return NULL;
+    }
+
+    dispatcher = (struct nDPIsrvd_dispatcher *)nDPIsrvd_calloc(
+        1, sizeof(*dispatcher) + worker_count * sizeof(dispatcher->workers[0]));
+    if (dispatcher == NULL)
+    {
+        return NULL;
+    }
+    dispatcher->sock = sock;
+
+    for (size_t i = 0; i < worker_count; ++i)
+    {
+        struct nDPIsrvd_dispatch_worker * const worker = &dispatcher->workers[i];
+
+        worker->dispatcher = dispatcher;
+        worker->error = PARSE_OK;
+        worker->sock = nDPIsrvd_socket_init(sock->global_user_data_size,
+                                            sock->instance_user_data_size,
+                                            sock->thread_user_data_size,
+                                            sock->flow_user_data_size,
+                                            sock->json_callback,
+                                            sock->instance_cleanup_callback,
+                                            sock->flow_cleanup_callback);
+        if (worker->sock == NULL)
+        {
+            goto error;
+        }
+        nDPIsrvd_set_event_callback(worker->sock, sock->event_callback);
+        nDPIsrvd_set_structural_scan(worker->sock, sock->jsmn.structural_scan);
+
+        worker->ring.size = nDPIsrvd_DISPATCH_RING_SIZE;
+        worker->ring.data = (uint8_t *)nDPIsrvd_malloc(worker->ring.size);
+        if (worker->ring.data == NULL)
+        {
+            nDPIsrvd_socket_free(&worker->sock);
+            goto error;
+        }
+        pthread_mutex_init(&worker->ring.mutex, NULL);
+        pthread_cond_init(&worker->ring.not_empty, NULL);
+        pthread_cond_init(&worker->ring.not_full, NULL);
+
+        if (pthread_create(&worker->thread, NULL, nDPIsrvd_dispatch_worker_thread, worker) != 0)
+        {
+            pthread_mutex_destroy(&worker->ring.mutex);
+            pthread_cond_destroy(&worker->ring.not_empty);
+            pthread_cond_destroy(&worker->ring.not_full);
+            nDPIsrvd_free(worker->ring.data);
+            nDPIsrvd_socket_free(&worker->sock);
+            goto error;
+        }
+        dispatcher->worker_count++;
+    }
+
+    return dispatcher;
+error:
+    nDPIsrvd_dispatcher_free(&dispatcher);
+    return NULL;
+}
+
+/* Waits until the workers processed all dispatched lines, then joins them and frees the worker sockets. */
+static inline void nDPIsrvd_dispatcher_free(struct nDPIsrvd_dispatcher ** const dispatcher)
+{
+    if (dispatcher == NULL || *dispatcher == NULL)
+    {
+        return;
+    }
+
+    __atomic_store_n(&(*dispatcher)->stop, 1, __ATOMIC_SEQ_CST);
+    for (size_t i = 0; i < (*dispatcher)->worker_count; ++i)
+    {
+        struct nDPIsrvd_dispatch_worker * const worker = &(*dispatcher)->workers[i];
+
+        pthread_mutex_lock(&worker->ring.mutex);
+        pthread_cond_signal(&worker->ring.not_empty);
+        pthread_mutex_unlock(&worker->ring.mutex);
+        pthread_join(worker->thread, NULL);
+
+        pthread_mutex_destroy(&worker->ring.mutex);
+        pthread_cond_destroy(&worker->ring.not_empty);
+        pthread_cond_destroy(&worker->ring.not_full);
+        nDPIsrvd_free(worker->ring.data);
+        nDPIsrvd_socket_free(&worker->sock);
+    }
+
+    nDPIsrvd_free(*dispatcher);
+    *dispatcher = NULL;
+}
+
+/*
+ * Waits until the workers processed all dispatched lines.
+ * Returns PARSE_OK or the first error reported by a worker.
+ */
+static inline enum nDPIsrvd_parse_return nDPIsrvd_dispatcher_flush(struct nDPIsrvd_dispatcher * const dispatcher)
+{
+    enum nDPIsrvd_parse_return ret = PARSE_OK;
+
+    for (size_t i = 0; i < dispatcher->worker_count; ++i)
+    {
+        struct nDPIsrvd_dispatch_ring * const ring = &dispatcher->workers[i].ring;
+        size_t tail;
+
+        while ((tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) != ring->head)
+        {
+            nDPIsrvd_dispatch_ring_wake(ring, &ring->consumer_waiting, &ring->not_empty);
+            nDPIsrvd_dispatch_ring_wait(
+                ring, &ring->producer_waiting, &ring->not_full, &ring->tail, tail, &dispatcher->stop);
+        }
+        if (ret == PARSE_OK)
+        {
+            ret = __atomic_load_n(&dispatcher->workers[i].error, __ATOMIC_SEQ_CST);
+        }
+    }
+
+    return ret;
+}
+
+static inline struct nDPIsrvd_socket * nDPIsrvd_dispatcher_worker_socket(
+    struct nDPIsrvd_dispatcher const * const dispatcher, size_t worker_index)
+{
+    if (worker_index >= dispatcher->worker_count)
+    {
+        return NULL;
+    }
+
+    return dispatcher->workers[worker_index].sock;
+}
+
+/* Returns a pointer to the value of a top level string or number key, the key has to include the quotes. */
+static inline char const * nDPIsrvd_dispatch_find_value(char const * const line,
+                                                        size_t length,
+                                                        char const * const key,
+                                                        size_t key_length)
+{
+    char const * const found = (char const *)memmem(line, length, key, key_length);
+
+    if (found == NULL || found + key_length >= line + length || found[key_length] != ':')
+    {
+        return NULL;
+    }
+
+    return found + key_length + 1;
+}
+
+static inline nDPIsrvd_ull nDPIsrvd_dispatch_hash_string(nDPIsrvd_ull hash,
+                                                         char const * const line,
+                                                         size_t length,
+                                                         char const * const key,
+                                                         size_t key_length)
+{
+    char const * value = nDPIsrvd_dispatch_find_value(line, length, key, key_length);
+
+    if (value == NULL || *value != '"')
+    {
+        return hash;
+    }
+
+    for (++value; value < line + length && *value != '"'; ++value)
+    {
+        hash = ((hash << 5) + hash) + (uint8_t)*value; /* hash * 33 + c */
+    }
+
+    return hash;
+}
+
+#define nDPIsrvd_DISPATCH_FIND_VALUE_SZ(line, length, key)                                                             \
+    nDPIsrvd_dispatch_find_value(line, length, "\"" key "\"", nDPIsrvd_STRLEN_SZ(key) + 2)
+#define nDPIsrvd_DISPATCH_HASH_STRING_SZ(hash, line, length, key)                                                      \
+    nDPIsrvd_dispatch_hash_string(hash, line, length, "\"" key "\"", nDPIsrvd_STRLEN_SZ(key) + 2)
+
+static inline enum nDPIsrvd_parse_return nDPIsrvd_dispatch_line(struct nDPIsrvd_dispatcher * const dispatcher,
+                                                                char const * const line,
+                                                                size_t length)
+{
+    nDPIsrvd_ull hash = 5381;
+
+    hash = nDPIsrvd_DISPATCH_HASH_STRING_SZ(hash, line, length, "alias");
+    hash = nDPIsrvd_DISPATCH_HASH_STRING_SZ(hash, line, length, "source");
+    size_t const instance_worker = (size_t)(hash % dispatcher->worker_count);
+
+    char const * const flow_id = nDPIsrvd_DISPATCH_FIND_VALUE_SZ(line, length, "flow_id");
+    if (flow_id != NULL)
+    {
+        nDPIsrvd_ull const id = strtoull(flow_id, NULL, 10);
+        nDPIsrvd_ull const flow_hash = (hash ^ id) * 0x9E3779B97F4A7C15ull;
+        size_t const flow_worker = (size_t)((flow_hash >> 32) % dispatcher->worker_count);
+
+        nDPIsrvd_dispatch_ring_push(dispatcher, &dispatcher->workers[flow_worker].ring, line, length, 0);
+    }
+    else if (nDPIsrvd_DISPATCH_FIND_VALUE_SZ(line, length, "daemon_event_name") != NULL)
+    {
+        for (size_t i = 0; i < dispatcher->worker_count; ++i)
+        {
+            nDPIsrvd_dispatch_ring_push(dispatcher,
+                                        &dispatcher->workers[i].ring,
+                                        line,
+                                        length,
+                                        (i == instance_worker ? 0 : nDPIsrvd_DISPATCH_RECORD_COPY));
+        }
+    }
+    else
+    {
+        nDPIsrvd_dispatch_ring_push(dispatcher, &dispatcher->workers[instance_worker].ring, line, length, 0);
+    }
+
+    return PARSE_OK;
+}
+
+/*
+ * Dispatches all complete lines of the socket buffer to the workers.
+ * Returns PARSE_NEED_MORE_DATA on success like nDPIsrvd_parse_all(), or the first error reported by a worker.
+ */
+static inline enum nDPIsrvd_parse_return nDPIsrvd_dispatch_all(struct nDPIsrvd_dispatcher * const dispatcher)
+{
+    struct nDPIsrvd_json_buffer * const json_buffer = &dispatcher->sock->buffer;
+    enum nDPIsrvd_parse_return ret;
+
+    for (size_t i = 0; i < dispatcher->worker_count; ++i)
+    {
+        enum nDPIsrvd_parse_return const error = __atomic_load_n(&dispatcher->workers[i].error, __ATOMIC_SEQ_CST);
+
+        if (error != PARSE_OK)
+        {
+            return error;
+        }
+    }
+
+    while ((ret = nDPIsrvd_frame_line(json_buffer)) == PARSE_OK)
+    {
+        char const * const line = json_buffer->buf.ptr.text + json_buffer->read_offset;
+
+        ret = nDPIsrvd_dispatch_line(dispatcher, line, json_buffer->json_string_length);
+        if (ret != PARSE_OK)
+        {
+            break;
+        }
+        nDPIsrvd_drain_buffer(json_buffer);
+    }
+
+    for (size_t i = 0; i < dispatcher->worker_count; ++i)
+    {
+        struct nDPIsrvd_dispatch_ring * const ring = &dispatcher->workers[i].ring;
+
+        nDPIsrvd_dispatch_ring_wake(ring, &ring->consumer_waiting, &ring->not_empty);
+    }
+
+    return ret;
+}
+
+#endif
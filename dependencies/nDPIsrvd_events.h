@@ -0,0 +1,440 @@
+/* Generated by scripts/gen-nDPIsrvd-schema.py from the JSON schema files, do not edit. */
+#ifndef NDPISRVD_EVENTS_H
+#define NDPISRVD_EVENTS_H 1
+
+/*
+ * Typed views of the events described by the schema files, filled by nDPIsrvd_parse_all() once per line
+ * if an event callback was set with nDPIsrvd_set_event_callback().
+ * String, boolean and object values are tokens, numbers are converted on first access via nDPIsrvd_number_to_ull().
+ * Members are NULL / have no token if the key was not part of the current line.
+ * This file is included by nDPIsrvd.h and requires its token types and helpers.
+ */
+
+enum nDPIsrvd_event_type
+{
+    nDPIsrvd_EVENT_UNKNOWN = 0,
+    nDPIsrvd_EVENT_DAEMON,
+    nDPIsrvd_EVENT_ERROR,
+    nDPIsrvd_EVENT_FLOW,
+    nDPIsrvd_EVENT_PACKET,
+};
+
+struct nDPIsrvd_daemon_event
+{
+    struct nDPIsrvd_json_token const * alias;
+    struct nDPIsrvd_json_token const * source;
+    struct nDPIsrvd_json_number thread_id;
+    struct nDPIsrvd_json_number packet_id;
+    struct nDPIsrvd_json_number daemon_event_id;
+    struct nDPIsrvd_json_token const * daemon_event_name;
+    struct nDPIsrvd_json_number max_flows_per_thread;
+    struct nDPIsrvd_json_number max_idle_flows_per_thread;
+    struct nDPIsrvd_json_number reader_thread_count;
+    struct nDPIsrvd_json_number flow_scan_interval;
+    struct nDPIsrvd_json_number generic_max_idle_time;
+    struct nDPIsrvd_json_number icmp_max_idle_time;
+    struct nDPIsrvd_json_number udp_max_idle_time;
+    struct nDPIsrvd_json_number tcp_max_idle_time;
+    struct nDPIsrvd_json_number max_packets_per_flow_to_process;
+    struct nDPIsrvd_json_number max_packets_per_flow_to_send;
+    struct nDPIsrvd_json_number max_packets_per_flow_to_analyse;
+    struct nDPIsrvd_json_number startup_time;
+    struct nDPIsrvd_json_number detection_memory;
+    struct nDPIsrvd_json_number packets_captured;
+    struct nDPIsrvd_json_number packets_processed;
+    struct nDPIsrvd_json_number total_skipped_flows;
+    struct nDPIsrvd_json_number total_l4_payload_len;
+    struct nDPIsrvd_json_number total_not_detected_flows;
+    struct nDPIsrvd_json_number total_guessed_flows;
+    struct nDPIsrvd_json_number total_detected_flows;
+    struct nDPIsrvd_json_number total_detection_updates;
+    struct nDPIsrvd_json_number total_updates;
+    struct nDPIsrvd_json_number current_active_flows;
+    struct nDPIsrvd_json_number total_active_flows;
+    struct nDPIsrvd_json_number total_idle_flows;
+    struct nDPIsrvd_json_number total_compressions;
+    struct nDPIsrvd_json_number total_compression_diff;
+    struct nDPIsrvd_json_number current_compression_diff;
+    struct nDPIsrvd_json_number total_events_serialized;
+    struct nDPIsrvd_json_token const * adaptive_idle_times;
+    struct nDPIsrvd_json_number global_ts_usec;
+};
+
+struct nDPIsrvd_error_event
+{
+    struct nDPIsrvd_json_token const * alias;
+    struct nDPIsrvd_json_token const * source;
+    struct nDPIsrvd_json_number thread_id;
+    struct nDPIsrvd_json_number packet_id;
+    struct nDPIsrvd_json_number error_event_id;
+    struct nDPIsrvd_json_token const * error_event_name;
+    struct nDPIsrvd_json_number datalink;
+    struct nDPIsrvd_json_number layer_type;
+    struct nDPIsrvd_json_number l4_data_len;
+    struct nDPIsrvd_json_token const * reason;
+    struct nDPIsrvd_json_number protocol;
+    struct nDPIsrvd_json_number size;
+    struct nDPIsrvd_json_number expected;
+    struct nDPIsrvd_json_number current_active;
+    struct nDPIsrvd_json_number current_idle;
+    struct nDPIsrvd_json_number max_active;
+    struct nDPIsrvd_json_number max_idle;
+    struct nDPIsrvd_json_number global_ts_usec;
+};
+
+struct nDPIsrvd_flow_event
+{
+    struct nDPIsrvd_json_token const * alias;
+    struct nDPIsrvd_json_token const * source;
+    struct nDPIsrvd_json_number thread_id;
+    struct nDPIsrvd_json_number packet_id;
+    struct nDPIsrvd_json_number flow_event_id;
+    struct nDPIsrvd_json_token const * flow_event_name;
+    struct nDPIsrvd_json_number flow_id;
+    struct nDPIsrvd_json_token const * flow_state;
+    struct nDPIsrvd_json_number flow_datalink;
+    struct nDPIsrvd_json_number flow_src_packets_processed;
+    struct nDPIsrvd_json_number flow_dst_packets_processed;
+    struct nDPIsrvd_json_number flow_max_packets;
+    struct nDPIsrvd_json_token const * flow_tunnel;
+    struct nDPIsrvd_json_number flow_tunnel_id;
+    struct nDPIsrvd_json_token const * flow_end_reason;
+    struct nDPIsrvd_json_number flow_first_seen;
+    struct nDPIsrvd_json_number flow_src_last_pkt_time;
+    struct nDPIsrvd_json_number flow_dst_last_pkt_time;
+    struct nDPIsrvd_json_number flow_idle_time;
+    struct nDPIsrvd_json_number flow_src_min_l4_payload_len;
+    struct nDPIsrvd_json_number flow_dst_min_l4_payload_len;
+    struct nDPIsrvd_json_number flow_src_max_l4_payload_len;
+    struct nDPIsrvd_json_number flow_dst_max_l4_payload_len;
+    struct nDPIsrvd_json_number flow_src_tot_l4_payload_len;
+    struct nDPIsrvd_json_number flow_dst_tot_l4_payload_len;
+    struct nDPIsrvd_json_token const * l3_proto;
+    struct nDPIsrvd_json_token const * l4_proto;
+    struct nDPIsrvd_json_number midstream;
+    struct nDPIsrvd_json_number thread_ts_usec;
+    struct nDPIsrvd_json_token const * src_ip;
+    struct nDPIsrvd_json_token const * dst_ip;
+    struct nDPIsrvd_json_number src_port;
+    struct nDPIsrvd_json_number dst_port;
+    struct
+    {
+        struct nDPIsrvd_json_token const * token;
+        struct nDPIsrvd_json_token const * proto;
+        struct nDPIsrvd_json_token const * proto_id;
+        struct nDPIsrvd_json_token const * category;
+        struct nDPIsrvd_json_number category_id;
+        struct nDPIsrvd_json_number encrypted;
+        struct nDPIsrvd_json_token const * breed;
+        struct nDPIsrvd_json_token const * flow_risk;
+        struct nDPIsrvd_json_token const * confidence;
+        struct nDPIsrvd_json_number entropy;
+        struct nDPIsrvd_json_token const * hostname;
+        struct nDPIsrvd_json_token const * dhcp;
+        struct nDPIsrvd_json_token const * discord;
+        struct nDPIsrvd_json_token const * bittorrent;
+        struct nDPIsrvd_json_token const * mdns;
+        struct nDPIsrvd_json_token const * ntp;
+        struct nDPIsrvd_json_token const * ubntac2;
+        struct nDPIsrvd_json_token const * kerberos;
+        struct nDPIsrvd_json_token const * telnet;
+        struct nDPIsrvd_json_token const * tls;
+        struct nDPIsrvd_json_token const * quic;
+        struct nDPIsrvd_json_token const * imap;
+        struct nDPIsrvd_json_token const * http;
+        struct nDPIsrvd_json_token const * pop;
+        struct nDPIsrvd_json_token const * smtp;
+        struct nDPIsrvd_json_token const * dns;
+        struct nDPIsrvd_json_token const * ftp;
+        struct nDPIsrvd_json_token const * ssh;
+        struct nDPIsrvd_json_token const * stun;
+        struct nDPIsrvd_json_token const * softether;
+    } ndpi;
+    struct
+    {
+        struct nDPIsrvd_json_token const * token;
+        struct nDPIsrvd_json_token const * iat;
+        struct nDPIsrvd_json_token const * pktlen;
+        struct
+        {
+            struct nDPIsrvd_json_token const * token;
+            struct nDPIsrvd_json_token const * c_to_s;
+            struct nDPIsrvd_json_token const * s_to_c;
+        } bins;
+    } data_analysis;
+};
+
+struct nDPIsrvd_packet_event
+{
+    struct nDPIsrvd_json_token const * alias;
+    struct nDPIsrvd_json_token const * source;
+    struct nDPIsrvd_json_number thread_id;
+    struct nDPIsrvd_json_number packet_id;
+    struct nDPIsrvd_json_number packet_event_id;
+    struct nDPIsrvd_json_token const * packet_event_name;
+    struct nDPIsrvd_json_number flow_id;
+    struct nDPIsrvd_json_number flow_packet_id;
+    struct nDPIsrvd_json_number flow_src_last_pkt_time;
+    struct nDPIsrvd_json_number flow_dst_last_pkt_time;
+    struct nDPIsrvd_json_number flow_idle_time;
+    struct nDPIsrvd_json_number pkt_caplen;
+    struct nDPIsrvd_json_number pkt_type;
+    struct nDPIsrvd_json_token const * pkt_oversize;
+    struct nDPIsrvd_json_number pkt_l3_offset;
+    struct nDPIsrvd_json_number pkt_l4_len;
+    struct nDPIsrvd_json_number thread_ts_usec;
+    struct nDPIsrvd_json_number pkt_l4_offset;
+    struct nDPIsrvd_json_number pkt_len;
+    struct nDPIsrvd_json_token const * pkt;
+};
+
+struct nDPIsrvd_event
+{
+    enum nDPIsrvd_event_type type;
+    union
+    {
+        struct nDPIsrvd_daemon_event daemon;
+        struct nDPIsrvd_error_event error;
+        struct nDPIsrvd_flow_event flow;
+        struct nDPIsrvd_packet_event packet;
+    };
+};
+
+static inline void nDPIsrvd_decode_daemon_event(struct nDPIsrvd_json_token const * const tokens,
+                                                nDPIsrvd_ull generation,
+                                                struct nDPIsrvd_daemon_event * const event)
+{
+    event->alias = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_ALIAS);
+    event->source = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_SOURCE);
+    nDPIsrvd_event_number(&event->thread_id, tokens, generation, nDPIsrvd_KEY_THREAD_ID);
+    nDPIsrvd_event_number(&event->packet_id, tokens, generation, nDPIsrvd_KEY_PACKET_ID);
+    nDPIsrvd_event_number(&event->daemon_event_id, tokens, generation, nDPIsrvd_KEY_DAEMON_EVENT_ID);
+    event->daemon_event_name = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_DAEMON_EVENT_NAME);
+    nDPIsrvd_event_number(&event->max_flows_per_thread, tokens, generation, nDPIsrvd_KEY_MAX_FLOWS_PER_THREAD);
+    nDPIsrvd_event_number(&event->max_idle_flows_per_thread,
+                          tokens,
+                          generation,
+                          nDPIsrvd_KEY_MAX_IDLE_FLOWS_PER_THREAD);
+    nDPIsrvd_event_number(&event->reader_thread_count, tokens, generation, nDPIsrvd_KEY_READER_THREAD_COUNT);
+    nDPIsrvd_event_number(&event->flow_scan_interval, tokens, generation, nDPIsrvd_KEY_FLOW_SCAN_INTERVAL);
+    nDPIsrvd_event_number(&event->generic_max_idle_time, tokens, generation, nDPIsrvd_KEY_GENERIC_MAX_IDLE_TIME);
+    nDPIsrvd_event_number(&event->icmp_max_idle_time, tokens, generation, nDPIsrvd_KEY_ICMP_MAX_IDLE_TIME);
+    nDPIsrvd_event_number(&event->udp_max_idle_time, tokens, generation, nDPIsrvd_KEY_UDP_MAX_IDLE_TIME);
+    nDPIsrvd_event_number(&event->tcp_max_idle_time, tokens, generation, nDPIsrvd_KEY_TCP_MAX_IDLE_TIME);
+    nDPIsrvd_event_number(&event->max_packets_per_flow_to_process,
+                          tokens,
+                          generation,
+                          nDPIsrvd_KEY_MAX_PACKETS_PER_FLOW_TO_PROCESS);
+    nDPIsrvd_event_number(&event->max_packets_per_flow_to_send,
+                          tokens,
+                          generation,
+                          nDPIsrvd_KEY_MAX_PACKETS_PER_FLOW_TO_SEND);
+    nDPIsrvd_event_number(&event->max_packets_per_flow_to_analyse,
+                          tokens,
+                          generation,
+                          nDPIsrvd_KEY_MAX_PACKETS_PER_FLOW_TO_ANALYSE);
+    nDPIsrvd_event_number(&event->startup_time, tokens, generation, nDPIsrvd_KEY_STARTUP_TIME);
+    nDPIsrvd_event_number(&event->detection_memory, tokens, generation, nDPIsrvd_KEY_DETECTION_MEMORY);
+    nDPIsrvd_event_number(&event->packets_captured, tokens, generation, nDPIsrvd_KEY_PACKETS_CAPTURED);
+    nDPIsrvd_event_number(&event->packets_processed, tokens, generation, nDPIsrvd_KEY_PACKETS_PROCESSED);
+    nDPIsrvd_event_number(&event->total_skipped_flows, tokens, generation, nDPIsrvd_KEY_TOTAL_SKIPPED_FLOWS);
+    nDPIsrvd_event_number(&event->total_l4_payload_len, tokens, generation, nDPIsrvd_KEY_TOTAL_L4_PAYLOAD_LEN);
+    nDPIsrvd_event_number(&event->total_not_detected_flows, tokens, generation, nDPIsrvd_KEY_TOTAL_NOT_DETECTED_FLOWS);
+    nDPIsrvd_event_number(&event->total_guessed_flows, tokens, generation, nDPIsrvd_KEY_TOTAL_GUESSED_FLOWS);
+    nDPIsrvd_event_number(&event->total_detected_flows, tokens, generation, nDPIsrvd_KEY_TOTAL_DETECTED_FLOWS);
+    nDPIsrvd_event_number(&event->total_detection_updates, tokens, generation, nDPIsrvd_KEY_TOTAL_DETECTION_UPDATES);
+    nDPIsrvd_event_number(&event->total_updates, tokens, generation, nDPIsrvd_KEY_TOTAL_UPDATES);
+    nDPIsrvd_event_number(&event->current_active_flows, tokens, generation, nDPIsrvd_KEY_CURRENT_ACTIVE_FLOWS);
+    nDPIsrvd_event_number(&event->total_active_flows, tokens, generation, nDPIsrvd_KEY_TOTAL_ACTIVE_FLOWS);
+    nDPIsrvd_event_number(&event->total_idle_flows, tokens, generation, nDPIsrvd_KEY_TOTAL_IDLE_FLOWS);
+    nDPIsrvd_event_number(&event->total_compressions, tokens, generation, nDPIsrvd_KEY_TOTAL_COMPRESSIONS);
+    nDPIsrvd_event_number(&event->total_compression_diff, tokens, generation, nDPIsrvd_KEY_TOTAL_COMPRESSION_DIFF);
+    nDPIsrvd_event_number(&event->current_compression_diff, tokens, generation, nDPIsrvd_KEY_CURRENT_COMPRESSION_DIFF);
+    nDPIsrvd_event_number(&event->total_events_serialized, tokens, generation, nDPIsrvd_KEY_TOTAL_EVENTS_SERIALIZED);
+    event->adaptive_idle_times = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_ADAPTIVE_IDLE_TIMES);
+    nDPIsrvd_event_number(&event->global_ts_usec, tokens, generation, nDPIsrvd_KEY_GLOBAL_TS_USEC);
+}
+
+static inline void nDPIsrvd_decode_error_event(struct nDPIsrvd_json_token const * const tokens,
+                                               nDPIsrvd_ull generation,
+                                               struct nDPIsrvd_error_event * const event)
+{
+    event->alias = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_ALIAS);
+    event->source = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_SOURCE);
+    nDPIsrvd_event_number(&event->thread_id, tokens, generation, nDPIsrvd_KEY_THREAD_ID);
+    nDPIsrvd_event_number(&event->packet_id, tokens, generation, nDPIsrvd_KEY_PACKET_ID);
+    nDPIsrvd_event_number(&event->error_event_id, tokens, generation, nDPIsrvd_KEY_ERROR_EVENT_ID);
+    event->error_event_name = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_ERROR_EVENT_NAME);
+    nDPIsrvd_event_number(&event->datalink, tokens, generation, nDPIsrvd_KEY_DATALINK);
+    nDPIsrvd_event_number(&event->layer_type, tokens, generation, nDPIsrvd_KEY_LAYER_TYPE);
+    nDPIsrvd_event_number(&event->l4_data_len, tokens, generation, nDPIsrvd_KEY_L4_DATA_LEN);
+    event->reason = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_REASON);
+    nDPIsrvd_event_number(&event->protocol, tokens, generation, nDPIsrvd_KEY_PROTOCOL);
+    nDPIsrvd_event_number(&event->size, tokens, generation, nDPIsrvd_KEY_SIZE);
+    nDPIsrvd_event_number(&event->expected, tokens, generation, nDPIsrvd_KEY_EXPECTED);
+    nDPIsrvd_event_number(&event->current_active, tokens, generation, nDPIsrvd_KEY_CURRENT_ACTIVE);
+    nDPIsrvd_event_number(&event->current_idle, tokens, generation, nDPIsrvd_KEY_CURRENT_IDLE);
+    nDPIsrvd_event_number(&event->max_active, tokens, generation, nDPIsrvd_KEY_MAX_ACTIVE);
+    nDPIsrvd_event_number(&event->max_idle, tokens, generation, nDPIsrvd_KEY_MAX_IDLE);
+    nDPIsrvd_event_number(&event->global_ts_usec, tokens, generation, nDPIsrvd_KEY_GLOBAL_TS_USEC);
+}
+
+static inline void nDPIsrvd_decode_flow_event(struct nDPIsrvd_json_token const * const tokens,
+                                              nDPIsrvd_ull generation,
+                                              struct nDPIsrvd_flow_event * const event)
+{
+    event->alias = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_ALIAS);
+    event->source = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_SOURCE);
+    nDPIsrvd_event_number(&event->thread_id, tokens, generation, nDPIsrvd_KEY_THREAD_ID);
+    nDPIsrvd_event_number(&event->packet_id, tokens, generation, nDPIsrvd_KEY_PACKET_ID);
+    nDPIsrvd_event_number(&event->flow_event_id, tokens, generation, nDPIsrvd_KEY_FLOW_EVENT_ID);
+    event->flow_event_name = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_FLOW_EVENT_NAME);
+    nDPIsrvd_event_number(&event->flow_id, tokens, generation, nDPIsrvd_KEY_FLOW_ID);
+    event->flow_state = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_FLOW_STATE);
+    nDPIsrvd_event_number(&event->flow_datalink, tokens, generation, nDPIsrvd_KEY_FLOW_DATALINK);
+    nDPIsrvd_event_number(&event->flow_src_packets_processed,
+                          tokens,
+                          generation,
+                          nDPIsrvd_KEY_FLOW_SRC_PACKETS_PROCESSED);
+    nDPIsrvd_event_number(&event->flow_dst_packets_processed,
+                          tokens,
+                          generation,
+                          nDPIsrvd_KEY_FLOW_DST_PACKETS_PROCESSED);
+    nDPIsrvd_event_number(&event->flow_max_packets, tokens, generation, nDPIsrvd_KEY_FLOW_MAX_PACKETS);
+    event->flow_tunnel = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_FLOW_TUNNEL);
+    nDPIsrvd_event_number(&event->flow_tunnel_id, tokens, generation, nDPIsrvd_KEY_FLOW_TUNNEL_ID);
+    event->flow_end_reason = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_FLOW_END_REASON);
+    nDPIsrvd_event_number(&event->flow_first_seen, tokens, generation, nDPIsrvd_KEY_FLOW_FIRST_SEEN);
+    nDPIsrvd_event_number(&event->flow_src_last_pkt_time, tokens, generation, nDPIsrvd_KEY_FLOW_SRC_LAST_PKT_TIME);
+    nDPIsrvd_event_number(&event->flow_dst_last_pkt_time, tokens, generation, nDPIsrvd_KEY_FLOW_DST_LAST_PKT_TIME);
+    nDPIsrvd_event_number(&event->flow_idle_time, tokens, generation, nDPIsrvd_KEY_FLOW_IDLE_TIME);
+    nDPIsrvd_event_number(&event->flow_src_min_l4_payload_len,
+                          tokens,
+                          generation,
+                          nDPIsrvd_KEY_FLOW_SRC_MIN_L4_PAYLOAD_LEN);
+    nDPIsrvd_event_number(&event->flow_dst_min_l4_payload_len,
+                          tokens,
+                          generation,
+                          nDPIsrvd_KEY_FLOW_DST_MIN_L4_PAYLOAD_LEN);
+    nDPIsrvd_event_number(&event->flow_src_max_l4_payload_len,
+                          tokens,
+                          generation,
+                          nDPIsrvd_KEY_FLOW_SRC_MAX_L4_PAYLOAD_LEN);
+    nDPIsrvd_event_number(&event->flow_dst_max_l4_payload_len,
+                          tokens,
+                          generation,
+                          nDPIsrvd_KEY_FLOW_DST_MAX_L4_PAYLOAD_LEN);
+    nDPIsrvd_event_number(&event->flow_src_tot_l4_payload_len,
+                          tokens,
+                          generation,
+                          nDPIsrvd_KEY_FLOW_SRC_TOT_L4_PAYLOAD_LEN);
+    nDPIsrvd_event_number(&event->flow_dst_tot_l4_payload_len,
+                          tokens,
+                          generation,
+                          nDPIsrvd_KEY_FLOW_DST_TOT_L4_PAYLOAD_LEN);
+    event->l3_proto = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_L3_PROTO);
+    event->l4_proto = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_L4_PROTO);
+    nDPIsrvd_event_number(&event->midstream, tokens, generation, nDPIsrvd_KEY_MIDSTREAM);
+    nDPIsrvd_event_number(&event->thread_ts_usec, tokens, generation, nDPIsrvd_KEY_THREAD_TS_USEC);
+    event->src_ip = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_SRC_IP);
+    event->dst_ip = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_DST_IP);
+    nDPIsrvd_event_number(&event->src_port, tokens, generation, nDPIsrvd_KEY_SRC_PORT);
+    nDPIsrvd_event_number(&event->dst_port, tokens, generation, nDPIsrvd_KEY_DST_PORT);
+    event->ndpi.token = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_NDPI);
+    event->ndpi.proto = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_PROTO);
+    event->ndpi.proto_id = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_PROTO_ID);
+    event->ndpi.category = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_CATEGORY);
+    nDPIsrvd_event_number(&event->ndpi.category_id, tokens, generation, nDPIsrvd_KEY_CATEGORY_ID);
+    nDPIsrvd_event_number(&event->ndpi.encrypted, tokens, generation, nDPIsrvd_KEY_ENCRYPTED);
+    event->ndpi.breed = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_BREED);
+    event->ndpi.flow_risk = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_FLOW_RISK);
+    event->ndpi.confidence = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_CONFIDENCE);
+    nDPIsrvd_event_number(&event->ndpi.entropy, tokens, generation, nDPIsrvd_KEY_ENTROPY);
+    event->ndpi.hostname = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_HOSTNAME);
+    event->ndpi.dhcp = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_DHCP);
+    event->ndpi.discord = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_DISCORD);
+    event->ndpi.bittorrent = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_BITTORRENT);
+    event->ndpi.mdns = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_MDNS);
+    event->ndpi.ntp = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_NTP);
+    event->ndpi.ubntac2 = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_UBNTAC2);
+    event->ndpi.kerberos = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_KERBEROS);
+    event->ndpi.telnet = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_TELNET);
+    event->ndpi.tls = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_TLS);
+    event->ndpi.quic = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_QUIC);
+    event->ndpi.imap = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_IMAP);
+    event->ndpi.http = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_HTTP);
+    event->ndpi.pop = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_POP);
+    event->ndpi.smtp = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_SMTP);
+    event->ndpi.dns = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_DNS);
+    event->ndpi.ftp = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_FTP);
+    event->ndpi.ssh = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_SSH);
+    event->ndpi.stun = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_STUN);
+    event->ndpi.softether = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_SOFTETHER);
+    event->data_analysis.token = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_DATA_ANALYSIS);
+    event->data_analysis.iat = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_IAT);
+    event->data_analysis.pktlen = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_PKTLEN);
+    event->data_analysis.bins.token = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_BINS);
+    event->data_analysis.bins.c_to_s = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_C_TO_S);
+    event->data_analysis.bins.s_to_c = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_S_TO_C);
+}
+
+static inline void nDPIsrvd_decode_packet_event(struct nDPIsrvd_json_token const * const tokens,
+                                                nDPIsrvd_ull generation,
+                                                struct nDPIsrvd_packet_event * const event)
+{
+    event->alias = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_ALIAS);
+    event->source = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_SOURCE);
+    nDPIsrvd_event_number(&event->thread_id, tokens, generation, nDPIsrvd_KEY_THREAD_ID);
+    nDPIsrvd_event_number(&event->packet_id, tokens, generation, nDPIsrvd_KEY_PACKET_ID);
+    nDPIsrvd_event_number(&event->packet_event_id, tokens, generation, nDPIsrvd_KEY_PACKET_EVENT_ID);
+    event->packet_event_name = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_PACKET_EVENT_NAME);
+    nDPIsrvd_event_number(&event->flow_id, tokens, generation, nDPIsrvd_KEY_FLOW_ID);
+    nDPIsrvd_event_number(&event->flow_packet_id, tokens, generation, nDPIsrvd_KEY_FLOW_PACKET_ID);
+    nDPIsrvd_event_number(&event->flow_src_last_pkt_time, tokens, generation, nDPIsrvd_KEY_FLOW_SRC_LAST_PKT_TIME);
+    nDPIsrvd_event_number(&event->flow_dst_last_pkt_time, tokens, generation, nDPIsrvd_KEY_FLOW_DST_LAST_PKT_TIME);
+    nDPIsrvd_event_number(&event->flow_idle_time, tokens, generation, nDPIsrvd_KEY_FLOW_IDLE_TIME);
+    nDPIsrvd_event_number(&event->pkt_caplen, tokens, generation, nDPIsrvd_KEY_PKT_CAPLEN);
+    nDPIsrvd_event_number(&event->pkt_type, tokens, generation, nDPIsrvd_KEY_PKT_TYPE);
+    event->pkt_oversize = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_PKT_OVERSIZE);
+    nDPIsrvd_event_number(&event->pkt_l3_offset, tokens, generation, nDPIsrvd_KEY_PKT_L3_OFFSET);
+    nDPIsrvd_event_number(&event->pkt_l4_len, tokens, generation, nDPIsrvd_KEY_PKT_L4_LEN);
+    nDPIsrvd_event_number(&event->thread_ts_usec, tokens, generation, nDPIsrvd_KEY_THREAD_TS_USEC);
+    nDPIsrvd_event_number(&event->pkt_l4_offset, tokens, generation, nDPIsrvd_KEY_PKT_L4_OFFSET);
+    nDPIsrvd_event_number(&event->pkt_len, tokens, generation, nDPIsrvd_KEY_PKT_LEN);
+    event->pkt = nDPIsrvd_event_token(tokens, generation, nDPIsrvd_KEY_PKT);
+}
+
+static inline enum nDPIsrvd_event_type nDPIsrvd_decode_event(struct nDPIsrvd_json_token const * const tokens,
+                                                             nDPIsrvd_ull generation,
+                                                             struct nDPIsrvd_event * const event)
+{
+    if (tokens[nDPIsrvd_KEY_DAEMON_EVENT_NAME].generation == generation)
+    {
+        event->type = nDPIsrvd_EVENT_DAEMON;
+        nDPIsrvd_decode_daemon_event(tokens, generation, &event->daemon);
+        return event->type;
+    }
+    if (tokens[nDPIsrvd_KEY_ERROR_EVENT_NAME].generation == generation)
+    {
+        event->type = nDPIsrvd_EVENT_ERROR;
+        nDPIsrvd_decode_error_event(tokens, generation, &event->error);
+        return event->type;
+    }
+    if (tokens[nDPIsrvd_KEY_FLOW_EVENT_NAME].generation == generation)
+    {
+        event->type = nDPIsrvd_EVENT_FLOW;
+        nDPIsrvd_decode_flow_event(tokens, generation, &event->flow);
+        return event->type;
+    }
+    if (tokens[nDPIsrvd_KEY_PACKET_EVENT_NAME].generation == generation)
+    {
+        event->type = nDPIsrvd_EVENT_PACKET;
+        nDPIsrvd_decode_packet_event(tokens, generation, &event->packet);
+        return event->type;
+    }
+
+    event->type = nDPIsrvd_EVENT_UNKNOWN;
+    return event->type;
+}
+
+#endif
@@ -0,0 +1,383 @@
+/* Generated by scripts/gen-nDPIsrvd-schema.py from the JSON schema files, do not edit. */
+#ifndef NDPISRVD_KEYS_H
+#define NDPISRVD_KEYS_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define nDPIsrvd_KNOWN_KEYS 145u
+#define nDPIsrvd_KEY_BUCKETS 64u
+#define nDPIsrvd_KEY_SLOT_BITS 8u
+#define nDPIsrvd_KEY_SLOTS (1u << nDPIsrvd_KEY_SLOT_BITS)
+
+enum nDPIsrvd_known_key
+{
+    nDPIsrvd_KEY_0 = 0,
+    nDPIsrvd_KEY_1 = 1,
+    nDPIsrvd_KEY_2 = 2,
+    nDPIsrvd_KEY_3 = 3,
+    nDPIsrvd_KEY_4 = 4,
+    nDPIsrvd_KEY_5 = 5,
+    nDPIsrvd_KEY_6 = 6,
+    nDPIsrvd_KEY_ADAPTIVE_IDLE_TIMES = 7,
+    nDPIsrvd_KEY_ALIAS = 8,
+    nDPIsrvd_KEY_BINS = 9,
+    nDPIsrvd_KEY_BITTORRENT = 10,
+    nDPIsrvd_KEY_BREED = 11,
+    nDPIsrvd_KEY_C_TO_S = 12,
+    nDPIsrvd_KEY_C_TO_S_AVG = 13,
+    nDPIsrvd_KEY_C_TO_S_MAX = 14,
+    nDPIsrvd_KEY_C_TO_S_MIN = 15,
+    nDPIsrvd_KEY_C_TO_S_STDDEV = 16,
+    nDPIsrvd_KEY_CATEGORY = 17,
+    nDPIsrvd_KEY_CATEGORY_ID = 18,
+    nDPIsrvd_KEY_CONFIDENCE = 19,
+    nDPIsrvd_KEY_CURRENT_ACTIVE_FLOWS = 20,
+    nDPIsrvd_KEY_CURRENT_COMPRESSION_DIFF = 21,
+    nDPIsrvd_KEY_CURRENT_ACTIVE = 22,
+    nDPIsrvd_KEY_CURRENT_IDLE = 23,
+    nDPIsrvd_KEY_DAEMON_EVENT_ID = 24,
+    nDPIsrvd_KEY_DAEMON_EVENT_NAME = 25,
+    nDPIsrvd_KEY_DATA_ANALYSIS = 26,
+    nDPIsrvd_KEY_DATALINK = 27,
+    nDPIsrvd_KEY_DETECTION_MEMORY = 28,
+    nDPIsrvd_KEY_DHCP = 29,
+    nDPIsrvd_KEY_DISCORD = 30,
+    nDPIsrvd_KEY_DNS = 31,
+    nDPIsrvd_KEY_DST_IP = 32,
+    nDPIsrvd_KEY_DST_PORT = 33,
+    nDPIsrvd_KEY_ENCRYPTED = 34,
+    nDPIsrvd_KEY_ENTROPY = 35,
+    nDPIsrvd_KEY_ERROR_EVENT_ID = 36,
+    nDPIsrvd_KEY_ERROR_EVENT_NAME = 37,
+    nDPIsrvd_KEY_EXPECTED = 38,
+    nDPIsrvd_KEY_FLOW_SCAN_INTERVAL = 39,
+    nDPIsrvd_KEY_FLOW_AVG = 40,
+    nDPIsrvd_KEY_FLOW_DATALINK = 41,
+    nDPIsrvd_KEY_FLOW_DST_LAST_PKT_TIME = 42,
+    nDPIsrvd_KEY_FLOW_DST_MAX_L4_PAYLOAD_LEN = 43,
+    nDPIsrvd_KEY_FLOW_DST_MIN_L4_PAYLOAD_LEN = 44,
+    nDPIsrvd_KEY_FLOW_DST_PACKETS_PROCESSED = 45,
+    nDPIsrvd_KEY_FLOW_DST_TOT_L4_PAYLOAD_LEN = 46,
+    nDPIsrvd_KEY_FLOW_END_REASON = 47,
+    nDPIsrvd_KEY_FLOW_EVENT_ID = 48,
+    nDPIsrvd_KEY_FLOW_EVENT_NAME = 49,
+    nDPIsrvd_KEY_FLOW_FIRST_SEEN = 50,
+    nDPIsrvd_KEY_FLOW_ID = 51,
+    nDPIsrvd_KEY_FLOW_IDLE_TIME = 52,
+    nDPIsrvd_KEY_FLOW_MAX = 53,
+    nDPIsrvd_KEY_FLOW_MAX_PACKETS = 54,
+    nDPIsrvd_KEY_FLOW_MIN = 55,
+    nDPIsrvd_KEY_FLOW_PACKET_ID = 56,
+    nDPIsrvd_KEY_FLOW_RISK = 57,
+    nDPIsrvd_KEY_FLOW_SRC_LAST_PKT_TIME = 58,
+    nDPIsrvd_KEY_FLOW_SRC_MAX_L4_PAYLOAD_LEN = 59,
+    nDPIsrvd_KEY_FLOW_SRC_MIN_L4_PAYLOAD_LEN = 60,
+    nDPIsrvd_KEY_FLOW_SRC_PACKETS_PROCESSED = 61,
+    nDPIsrvd_KEY_FLOW_SRC_TOT_L4_PAYLOAD_LEN = 62,
+    nDPIsrvd_KEY_FLOW_STATE = 63,
+    nDPIsrvd_KEY_FLOW_STDDEV = 64,
+    nDPIsrvd_KEY_FLOW_TUNNEL = 65,
+    nDPIsrvd_KEY_FLOW_TUNNEL_ID = 66,
+    nDPIsrvd_KEY_FTP = 67,
+    nDPIsrvd_KEY_GENERIC_MAX_IDLE_TIME = 68,
+    nDPIsrvd_KEY_GLOBAL_TS_USEC = 69,
+    nDPIsrvd_KEY_HOSTNAME = 70,
+    nDPIsrvd_KEY_HTTP = 71,
+    nDPIsrvd_KEY_IAT = 72,
+    nDPIsrvd_KEY_ICMP_MAX_IDLE_TIME = 73,
+    nDPIsrvd_KEY_IMAP = 74,
+    nDPIsrvd_KEY_KERBEROS = 75,
+    nDPIsrvd_KEY_L3_PROTO = 76,
+    nDPIsrvd_KEY_L4_DATA_LEN = 77,
+    nDPIsrvd_KEY_L4_PROTO = 78,
+    nDPIsrvd_KEY_LAYER_TYPE = 79,
+    nDPIsrvd_KEY_MAX_FLOWS_PER_THREAD = 80,
+    nDPIsrvd_KEY_MAX_IDLE_FLOWS_PER_THREAD = 81,
+    nDPIsrvd_KEY_MAX_PACKETS_PER_FLOW_TO_ANALYSE = 82,
+    nDPIsrvd_KEY_MAX_PACKETS_PER_FLOW_TO_PROCESS = 83,
+    nDPIsrvd_KEY_MAX_PACKETS_PER_FLOW_TO_SEND = 84,
+    nDPIsrvd_KEY_MAX_ACTIVE = 85,
+    nDPIsrvd_KEY_MAX_IDLE = 86,
+    nDPIsrvd_KEY_MDNS = 87,
+    nDPIsrvd_KEY_MIDSTREAM = 88,
+    nDPIsrvd_KEY_NDPI = 89,
+    nDPIsrvd_KEY_NTP = 90,
+    nDPIsrvd_KEY_PACKET_EVENT_ID = 91,
+    nDPIsrvd_KEY_PACKET_EVENT_NAME = 92,
+    nDPIsrvd_KEY_PACKET_ID = 93,
+    nDPIsrvd_KEY_PACKETS_CAPTURED = 94,
+    nDPIsrvd_KEY_PACKETS_PROCESSED = 95,
+    nDPIsrvd_KEY_PKT = 96,
+    nDPIsrvd_KEY_PKT_CAPLEN = 97,
+    nDPIsrvd_KEY_PKT_L3_OFFSET = 98,
+    nDPIsrvd_KEY_PKT_L4_LEN = 99,
+    nDPIsrvd_KEY_PKT_L4_OFFSET = 100,
+    nDPIsrvd_KEY_PKT_LEN = 101,
+    nDPIsrvd_KEY_PKT_OVERSIZE = 102,
+    nDPIsrvd_KEY_PKT_TYPE = 103,
+    nDPIsrvd_KEY_PKTLEN = 104,
+    nDPIsrvd_KEY_POP = 105,
+    nDPIsrvd_KEY_PROTO = 106,
+    nDPIsrvd_KEY_PROTO_ID = 107,
+    nDPIsrvd_KEY_PROTOCOL = 108,
+    nDPIsrvd_KEY_QUIC = 109,
+    nDPIsrvd_KEY_READER_THREAD_COUNT = 110,
+    nDPIsrvd_KEY_REASON = 111,
+    nDPIsrvd_KEY_S_TO_C = 112,
+    nDPIsrvd_KEY_S_TO_C_AVG = 113,
+    nDPIsrvd_KEY_S_TO_C_MAX = 114,
+    nDPIsrvd_KEY_S_TO_C_MIN = 115,
+    nDPIsrvd_KEY_S_TO_C_STDDEV = 116,
+    nDPIsrvd_KEY_SIZE = 117,
+    nDPIsrvd_KEY_SMTP = 118,
+    nDPIsrvd_KEY_SOFTETHER = 119,
+    nDPIsrvd_KEY_SOURCE = 120,
+    nDPIsrvd_KEY_SRC_IP = 121,
+    nDPIsrvd_KEY_SRC_PORT = 122,
+    nDPIsrvd_KEY_SSH = 123,
+    nDPIsrvd_KEY_STARTUP_TIME = 124,
+    nDPIsrvd_KEY_STUN = 125,
+    nDPIsrvd_KEY_TCP_MAX_IDLE_TIME = 126,
+    nDPIsrvd_KEY_TELNET = 127,
+    nDPIsrvd_KEY_THREAD_ID = 128,
+    nDPIsrvd_KEY_THREAD_TS_USEC = 129,
+    nDPIsrvd_KEY_TLS = 130,
+    nDPIsrvd_KEY_TOTAL_ACTIVE_FLOWS = 131,
+    nDPIsrvd_KEY_TOTAL_COMPRESSION_DIFF = 132,
+    nDPIsrvd_KEY_TOTAL_COMPRESSIONS = 133,
+    nDPIsrvd_KEY_TOTAL_DETECTED_FLOWS = 134,
+    nDPIsrvd_KEY_TOTAL_DETECTION_UPDATES = 135,
+    nDPIsrvd_KEY_TOTAL_EVENTS_SERIALIZED = 136,
+    nDPIsrvd_KEY_TOTAL_GUESSED_FLOWS = 137,
+    nDPIsrvd_KEY_TOTAL_IDLE_FLOWS = 138,
+    nDPIsrvd_KEY_TOTAL_L4_PAYLOAD_LEN = 139,
+    nDPIsrvd_KEY_TOTAL_NOT_DETECTED_FLOWS = 140,
+    nDPIsrvd_KEY_TOTAL_SKIPPED_FLOWS = 141,
+    nDPIsrvd_KEY_TOTAL_UPDATES = 142,
+    nDPIsrvd_KEY_UBNTAC2 = 143,
+    nDPIsrvd_KEY_UDP_MAX_IDLE_TIME = 144,
+};
+
+static char const * const nDPIsrvd_known_keys[nDPIsrvd_KNOWN_KEYS] = {
+    "0",
+    "1",
+    "2",
+    "3",
+    "4",
+    "5",
+    "6",
+    "adaptive-idle-times",
+    "alias",
+    "bins",
+    "bittorrent",
+    "breed",
+    "c_to_s",
+    "c_to_s_avg",
+    "c_to_s_max",
+    "c_to_s_min",
+    "c_to_s_stddev",
+    "category",
+    "category_id",
+    "confidence",
+    "current-active-flows",
+    "current-compression-diff",
+    "current_active",
+    "current_idle",
+    "daemon_event_id",
+    "daemon_event_name",
+    "data_analysis",
+    "datalink",
+    "detection-memory",
+    "dhcp",
+    "discord",
+    "dns",
+    "dst_ip",
+    "dst_port",
+    "encrypted",
+    "entropy",
+    "error_event_id",
+    "error_event_name",
+    "expected",
+    "flow-scan-interval",
+    "flow_avg",
+    "flow_datalink",
+    "flow_dst_last_pkt_time",
+    "flow_dst_max_l4_payload_len",
+    "flow_dst_min_l4_payload_len",
+    "flow_dst_packets_processed",
+    "flow_dst_tot_l4_payload_len",
+    "flow_end_reason",
+    "flow_event_id",
+    "flow_event_name",
+    "flow_first_seen",
+    "flow_id",
+    "flow_idle_time",
+    "flow_max",
+    "flow_max_packets",
+    "flow_min",
+    "flow_packet_id",
+    "flow_risk",
+    "flow_src_last_pkt_time",
+    "flow_src_max_l4_payload_len",
+    "flow_src_min_l4_payload_len",
+    "flow_src_packets_processed",
+    "flow_src_tot_l4_payload_len",
+    "flow_state",
+    "flow_stddev",
+    "flow_tunnel",
+    "flow_tunnel_id",
+    "ftp",
+    "generic-max-idle-time",
+    "global_ts_usec",
+    "hostname",
+    "http",
+    "iat",
+    "icmp-max-idle-time",
+    "imap",
+    "kerberos",
+    "l3_proto",
+    "l4_data_len",
+    "l4_proto",
+    "layer_type",
+    "max-flows-per-thread",
+    "max-idle-flows-per-thread",
+    "max-packets-per-flow-to-analyse",
+    "max-packets-per-flow-to-process",
+    "max-packets-per-flow-to-send",
+    "max_active",
+    "max_idle",
+    "mdns",
+    "midstream",
+    "ndpi",
+    "ntp",
+    "packet_event_id",
+    "packet_event_name",
+    "packet_id",
+    "packets-captured",
+    "packets-processed",
+    "pkt",
+    "pkt_caplen",
+    "pkt_l3_offset",
+    "pkt_l4_len",
+    "pkt_l4_offset",
+    "pkt_len",
+    "pkt_oversize",
+    "pkt_type",
+    "pktlen",
+    "pop",
+    "proto",
+    "proto_id",
+    "protocol",
+    "quic",
+    "reader-thread-count",
+    "reason",
+    "s_to_c",
+    "s_to_c_avg",
+    "s_to_c_max",
+    "s_to_c_min",
+    "s_to_c_stddev",
+    "size",
+    "smtp",
+    "softether",
+    "source",
+    "src_ip",
+    "src_port",
+    "ssh",
+    "startup-time",
+    "stun",
+    "tcp-max-idle-time",
+    "telnet",
+    "thread_id",
+    "thread_ts_usec",
+    "tls",
+    "total-active-flows",
+    "total-compression-diff",
+    "total-compressions",
+    "total-detected-flows",
+    "total-detection-updates",
+    "total-events-serialized",
+    "total-guessed-flows",
+    "total-idle-flows",
+    "total-l4-payload-len",
+    "total-not-detected-flows",
+    "total-skipped-flows",
+    "total-updates",
+    "ubntac2",
+    "udp-max-idle-time",
+};
+
+static uint8_t const nDPIsrvd_known_key_lengths[nDPIsrvd_KNOWN_KEYS] = {
+    1, 1, 1, 1, 1, 1, 1, 19, 5, 4, 10, 5, 6, 10, 10, 10,
+    13, 8, 11, 10, 20, 24, 14, 12, 15, 17, 13, 8, 16, 4, 7, 3,
+    6, 8, 9, 7, 14, 16, 8, 18, 8, 13, 22, 27, 27, 26, 27, 15,
+    13, 15, 15, 7, 14, 8, 16, 8, 14, 9, 22, 27, 27, 26, 27, 10,
+    11, 11, 14, 3, 21, 14, 8, 4, 3, 18, 4, 8, 8, 11, 8, 10,
+    20, 25, 31, 31, 28, 10, 8, 4, 9, 4, 3, 15, 17, 9, 16, 17,
+    3, 10, 13, 10, 13, 7, 12, 8, 6, 3, 5, 8, 8, 4, 19, 6,
+    6, 10, 10, 10, 13, 4, 4, 9, 6, 6, 8, 3, 12, 4, 17, 6,
+    9, 14, 3, 18, 22, 18, 20, 23, 23, 19, 16, 20, 24, 19, 13, 7,
+    17,
+};
+
+static uint16_t const nDPIsrvd_key_displacements[nDPIsrvd_KEY_BUCKETS] = {
+    3, 3, 1, 8, 7, 1, 1, 3, 2, 8, 7, 0, 3, 1, 3, 2,
+    1, 1, 1, 2, 1, 4, 5, 1, 1, 3, 4, 1, 1, 2, 0, 0,
+    1, 3, 1, 1, 5, 2, 5, 1, 1, 0, 1, 1, 1, 1, 2, 3,
+    4, 1, 1, 2, 4, 3, 4, 4, 0, 1, 3, 0, 5, 3, 0, 3,
+};
+
+static int16_t const nDPIsrvd_key_slots[nDPIsrvd_KEY_SLOTS] = {
+    105, -1, 57, 124, 127, 96, 10, 90, -1, -1, -1, 141, -1, -1, 0, 55,
+    120, 45, -1, 44, 126, 98, -1, -1, -1, 26, -1, -1, 78, -1, 29, 108,
+    97, -1, 101, -1, -1, -1, 144, -1, -1, 62, 19, 109, 87, 94, 135, 104,
+    -1, 30, -1, 72, -1, -1, -1, -1, 119, 7, -1, -1, -1, -1, 100, -1,
+    70, 4, -1, -1, -1, -1, 61, -1, 69, 3, 66, 33, -1, 21, -1, 16,
+    -1, -1, 71, -1, -1, -1, 73, 83, -1, -1, 46, 116, 51, -1, -1, 64,
+    -1, -1, 63, 37, 111, -1, 134, -1, 89, -1, -1, -1, 82, 110, 107, -1,
+    38, -1, 6, 67, -1, 49, -1, 129, 50, -1, 125, -1, 12, 58, 88, 84,
+    86, -1, 34, 91, -1, 25, 75, -1, -1, -1, 123, -1, 115, 142, 102, 56,
+    11, -1, 92, -1, -1, 39, 23, 27, 8, -1, -1, -1, 143, -1, 132, -1,
+    48, -1, -1, -1, -1, 15, 138, 53, -1, 112, -1, -1, 35, 24, 95, 136,
+    -1, 42, -1, 118, -1, 54, 43, 60, 9, 31, -1, 5, 81, 80, 32, -1,
+    -1, 117, 103, -1, 1, -1, 93, 68, 131, 76, 74, -1, -1, 52, -1, 20,
+    -1, -1, 18, 36, 113, -1, -1, 77, -1, 99, 128, -1, 121, 140, 114, 122,
+    40, 28, -1, 47, -1, 41, -1, 85, -1, -1, 65, 59, -1, 139, 13, 137,
+    106, -1, -1, -1, 2, -1, -1, 79, 14, 22, -1, -1, 17, 133, 130, -1,
+};
+
+static inline uint32_t nDPIsrvd_key_hash(char const * const key, size_t key_length)
+{
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < key_length; ++i)
+    {
+        hash ^= (uint8_t)key[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/*
+ * Returns the index of a key listed in the schema files or -1 if the key is unknown.
+ * Hash and displace: the key hash selects a bucket whose displacement was chosen so that all of its keys
+ * end up in distinct slots.
+ */
+static inline int nDPIsrvd_known_key_index(char const * const key, size_t key_length)
+{
+    uint32_t const hash = nDPIsrvd_key_hash(key, key_length);
+    uint32_t const displaced = hash ^ nDPIsrvd_key_displacements[hash % nDPIsrvd_KEY_BUCKETS];
+    int const index = nDPIsrvd_key_slots[(displaced * 2654435761u) >> (32u - nDPIsrvd_KEY_SLOT_BITS)];
+
+    if (index < 0 || nDPIsrvd_known_key_lengths[index] != key_length ||
+        memcmp(nDPIsrvd_known_keys[index], key, key_length) != 0)
+    {
+        return -1;
+    }
+
+    return index;
+}
+
+#endif
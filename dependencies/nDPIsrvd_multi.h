@@ -0,0 +1,347 @@
+#ifndef NDPISRVD_MULTI_H
+#define NDPISRVD_MULTI_H 1
+
+#include <sys/epoll.h>
+#include <time.h>
+
+#include "nDPIsrvd.h"
+
+/*
+ * Consumes events of many nDPIsrvd endpoints on a single thread.
+ *
+ * All sources share one nDPIsrvd_socket: its callbacks, global user data and instance/flow tables.
+ * Every source has its own receive buffer which is swapped into the shared socket while its lines are parsed,
+ * so callbacks see the same socket regardless of the endpoint a line was received from.
+ *
+ * Sources are non-blocking and registered edge-triggered in an epoll instance. The epoll fd returned by
+ * nDPIsrvd_multi_get_fd() can be added to an application event loop, nDPIsrvd_multi_dispatch() has to be called
+ * if it becomes readable and at least after nDPIsrvd_multi_next_timeout() milliseconds to handle reconnects.
+ * Lost or refused connections are retried with an exponential backoff.
+ */
+
+enum nDPIsrvd_source_state
+{
+    SOURCE_DISCONNECTED = 0,
+    SOURCE_CONNECTING,
+    SOURCE_CONNECTED
+};
+
+struct nDPIsrvd_source
+{
+    int fd;
+    enum nDPIsrvd_source_state state;
+    struct nDPIsrvd_address address;
+    struct nDPIsrvd_json_buffer buffer;
+
+    nDPIsrvd_ull reconnect_time;    /* monotonic time in usec */
+    nDPIsrvd_ull reconnect_backoff; /* usec */
+
+    int last_errno;
+    enum nDPIsrvd_parse_return last_parse_error; /* PARSE_OK if none */
+    unsigned long long int connects;
+    unsigned long long int disconnects;
+    unsigned long long int bytes_received;
+};
+
+struct nDPIsrvd_multi
+{
+    struct nDPIsrvd_socket * sock;
+    int epollfd;
+    size_t source_count;
+    struct nDPIsrvd_source * sources[nDPIsrvd_MULTI_MAX_SOURCES];
+};
+
+static inline nDPIsrvd_ull nDPIsrvd_multi_time_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (nDPIsrvd_ull)ts.tv_sec * 1000ull * 1000ull + ts.tv_nsec / 1000ull;
+}
+
+static inline void nDPIsrvd_multi_disconnect(struct nDPIsrvd_multi * const multi,
+                                             struct nDPIsrvd_source * const source,
+                                             int saved_errno)
+{
+    if (source->fd >= 0)
+    {
+        epoll_ctl(multi->epollfd, EPOLL_CTL_DEL, source->fd, NULL);
+        close(source->fd);
+        source->fd = -1;
+    }
+    if (source->state == SOURCE_CONNECTED)
+    {
+        source->disconnects++;
+    }
+    source->state = SOURCE_DISCONNECTED;
+    source->last_errno = saved_errno;
+
+    /* a partially received line is useless after a reconnect */
+    source->buffer.buf.used = 0;
+    source->buffer.read_offset = 0;
+
+    source->reconnect_time = nDPIsrvd_multi_time_usec() + source->reconnect_backoff;
+    source->reconnect_backoff *= 2;
+    if (source->reconnect_backoff > nDPIsrvd_MULTI_RECONNECT_BACKOFF_MAX)
+    {
+        source->reconnect_backoff = nDPIsrvd_MULTI_RECONNECT_BACKOFF_MAX;
+    }
+}
+
+static inline void nDPIsrvd_multi_connected(struct nDPIsrvd_source * const source)
+{
+    source->state = SOURCE_CONNECTED;
+    source->connects++;
+    source->last_errno = 0;
+    source->reconnect_backoff = nDPIsrvd_MULTI_RECONNECT_BACKOFF_MIN;
+}
+
+static inline void nDPIsrvd_multi_connect(struct nDPIsrvd_multi * const multi, struct nDPIsrvd_source * const source)
+{
+    source->fd = socket(source->address.raw.sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (source->fd < 0)
+    {
+        nDPIsrvd_multi_disconnect(multi, source, errno);
+        return;
+    }
+
+    struct epoll_event event = {.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = source};
+    if (epoll_ctl(multi->epollfd, EPOLL_CTL_ADD, source->fd, &event) != 0)
+    {
+        nDPIsrvd_multi_disconnect(multi, source, errno);
+        return;
+    }
+
+    if (connect(source->fd, &source->address.raw, source->address.size) != 0)
+    {
+        if (errno != EINPROGRESS)
+        {
+            nDPIsrvd_multi_disconnect(multi, source, errno);
+            return;
+        }
+        /* completion is signaled by EPOLLOUT */
+        source->state = SOURCE_CONNECTING;
+        return;
+    }
+
+    nDPIsrvd_multi_connected(source);
+}
+
+static inline struct nDPIsrvd_multi * nDPIsrvd_multi_init(struct nDPIsrvd_socket * const sock)
+{
+    struct nDPIsrvd_multi * const multi = (struct nDPIsrvd_multi *)nDPIsrvd_calloc(1, sizeof(*multi));
+
+    if (multi == NULL)
+    {
+        return NULL;
+    }
+
+    multi->sock = sock;
+    multi->epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if (multi->epollfd < 0)
+    {
+        nDPIsrvd_free(multi);
+        return NULL;
+    }
+
+    return multi;
+}
+
+/* Closes all sources, the shared socket has to be freed by the caller. */
+static inline void nDPIsrvd_multi_free(struct nDPIsrvd_multi ** const multi)
+{
+    if (multi == NULL || *multi == NULL)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < (*multi)->source_count; ++i)
+    {
+        struct nDPIsrvd_source * const source = (*multi)->sources[i];
+
+        if (source->fd >= 0)
+        {
+            close(source->fd);
+        }
+        nDPIsrvd_json_buffer_free(&source->buffer);
+        nDPIsrvd_free(source);
+    }
+    close((*multi)->epollfd);
+
+    nDPIsrvd_free(*multi);
+    *multi = NULL;
+}
+
+/*
+ * Adds an endpoint given as UNIX socket path or host:port (see nDPIsrvd_setup_address()).
+ * The connection is established asynchronously, a refused connection is retried later.
+ */
+static inline struct nDPIsrvd_source * nDPIsrvd_multi_add_source(struct nDPIsrvd_multi * const multi,
+                                                                 char const * const destination)
+{
+    struct nDPIsrvd_source * source;
+
+    if (multi->source_count == nDPIsrvd_MULTI_MAX_SOURCES)
+    {
+        return NULL;
+    }
+
+    source = (struct nDPIsrvd_source *)nDPIsrvd_calloc(1, sizeof(*source));
+    if (source == NULL)
+    {
+        return NULL;
+    }
+    source->fd = -1;
+    source->last_parse_error = PARSE_OK;
+    source->reconnect_backoff = nDPIsrvd_MULTI_RECONNECT_BACKOFF_MIN;
+
+    if (nDPIsrvd_setup_address(&source->address, destination) != 0 ||
+        nDPIsrvd_json_buffer_init(&source->buffer, NETWORK_BUFFER_MAX_SIZE) != 0)
+    {
+        nDPIsrvd_json_buffer_free(&source->buffer);
+        nDPIsrvd_free(source);
+        return NULL;
+    }
+
+    multi->sources[multi->source_count++] = source;
+    nDPIsrvd_multi_connect(multi, source);
+
+    return source;
+}
+
+static inline int nDPIsrvd_multi_get_fd(struct nDPIsrvd_multi const * const multi)
+{
+    return multi->epollfd;
+}
+
+/* Returns the number of milliseconds until the next reconnect attempt is due or -1 if there is none. */
+static inline int nDPIsrvd_multi_next_timeout(struct nDPIsrvd_multi const * const multi)
+{
+    nDPIsrvd_ull const now = nDPIsrvd_multi_time_usec();
+    int timeout = -1;
+
+    for (size_t i = 0; i < multi->source_count; ++i)
+    {
+        struct nDPIsrvd_source const * const source = multi->sources[i];
+
+        if (source->state == SOURCE_DISCONNECTED)
+        {
+            int const source_timeout =
+                (source->reconnect_time > now ? (int)((source->reconnect_time - now + 999) / 1000) : 0);
+
+            if (timeout < 0 || source_timeout < timeout)
+            {
+                timeout = source_timeout;
+            }
+        }
+    }
+
+    return timeout;
+}
+
+/* Reads until the socket would block (edge-triggered) and parses every complete line with the shared socket. */
+static inline void nDPIsrvd_multi_read_source(struct nDPIsrvd_multi * const multi,
+                                              struct nDPIsrvd_source * const source)
+{
+    struct nDPIsrvd_socket * const sock = multi->sock;
+    struct nDPIsrvd_json_buffer const sock_buffer = sock->buffer;
+    int const sock_fd = sock->fd;
+    enum nDPIsrvd_read_return read_ret;
+    enum nDPIsrvd_parse_return parse_ret = PARSE_NEED_MORE_DATA;
+    int saved_errno = 0;
+
+    sock->buffer = source->buffer;
+    sock->fd = source->fd;
+
+    do
+    {
+        size_t const used = sock->buffer.buf.used - sock->buffer.read_offset;
+
+        read_ret = nDPIsrvd_read(sock);
+        saved_errno = errno;
+        if (read_ret != READ_OK)
+        {
+            break;
+        }
+        source->bytes_received += sock->buffer.buf.used - used;
+        parse_ret = nDPIsrvd_parse_all(sock);
+    } while (parse_ret == PARSE_NEED_MORE_DATA);
+
+    source->buffer = sock->buffer;
+    sock->buffer = sock_buffer;
+    sock->fd = sock_fd;
+
+    if (parse_ret != PARSE_NEED_MORE_DATA)
+    {
+        source->last_parse_error = parse_ret;
+        nDPIsrvd_multi_disconnect(multi, source, 0);
+    }
+    else if (read_ret != READ_TIMEOUT)
+    {
+        nDPIsrvd_multi_disconnect(multi, source, (read_ret == READ_ERROR ? saved_errno : 0));
+    }
+}
+
+/*
+ * Handles all pending socket events and due reconnects, waits at most timeout milliseconds (-1 blocks).
+ * Returns the number of handled socket events or -1 if epoll_wait() failed.
+ */
+static inline int nDPIsrvd_multi_dispatch(struct nDPIsrvd_multi * const multi, int timeout)
+{
+    struct epoll_event events[32];
+    int const reconnect_timeout = nDPIsrvd_multi_next_timeout(multi);
+
+    if (reconnect_timeout >= 0 && (timeout < 0 || reconnect_timeout < timeout))
+    {
+        timeout = reconnect_timeout;
+    }
+
+    int const nready = epoll_wait(multi->epollfd, events, sizeof(events) / sizeof(events[0]), timeout);
+    if (nready < 0)
+    {
+        return (errno == EINTR ? 0 : -1);
+    }
+
+    for (int i = 0; i < nready; ++i)
+    {
+        struct nDPIsrvd_source * const source = (struct nDPIsrvd_source *)events[i].data.ptr;
+
+        if (source->state == SOURCE_CONNECTING)
+        {
+            int error = 0;
+            socklen_t error_len = sizeof(error);
+
+            if (getsockopt(source->fd, SOL_SOCKET, SO_ERROR, &error, &error_len) != 0)
+            {
+                error = errno;
+            }
+            if (error != 0)
+            {
+                nDPIsrvd_multi_disconnect(multi, source, error);
+                continue;
+            }
+            nDPIsrvd_multi_connected(source);
+        }
+
+        if (source->state == SOURCE_CONNECTED && (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0)
+        {
+            nDPIsrvd_multi_read_source(multi, source);
+        }
+    }
+
+    nDPIsrvd_ull const now = nDPIsrvd_multi_time_usec();
+    for (size_t i = 0; i < multi->source_count; ++i)
+    {
+        struct nDPIsrvd_source * const source = multi->sources[i];
+
+        if (source->state == SOURCE_DISCONNECTED && source->reconnect_time <= now)
+        {
+            nDPIsrvd_multi_connect(multi, source);
+        }
+    }
+
+    return nready;
+}
+
+#endif
@@ -26,18 +26,18 @@
 
 //#define VERBOSE
 #define DEFAULT_DATADIR "/tmp/nDPId-captured"
+#define DEFAULT_PACKET_MEMORY_LIMIT (64u * 1024u * 1024u) /* 64 MiB */
+#define PCAPNG_ROLL_SIZE (128u * 1024u * 1024u)         /* 128 MiB */
+#define PCAPNG_WRITE_BUFFER_SIZE (1024u * 1024u)
+#define PCAPNG_MAX_INTERFACES 8
 
 struct packet_data
 {
     nDPIsrvd_ull packet_ts_sec;
     nDPIsrvd_ull packet_ts_usec;
     nDPIsrvd_ull packet_len;
-    int base64_packet_size;
-    union
-    {
-        char * base64_packet;
-        char const * base64_packet_const;
-    };
+    size_t packet_size;
+    uint8_t * packet; /* decoded when received, owned by the array element */
 };
 
 struct flow_user_data
@@ -48,10 +48,16 @@ struct flow_user_data
     uint8_t detected;
     uint8_t risky;
     uint8_t midstream;
+    uint8_t packets_evicted;
+    nDPIsrvd_ull flow_id;
     nDPIsrvd_ull flow_datalink;
     nDPIsrvd_ull flow_max_packets;
     nDPIsrvd_ull flow_tot_l4_payload_len;
     UT_array * packets;
+    size_t packets_memory;
+    /* undecided flows with captured packets, oldest first */
+    struct flow_user_data * pending_prev;
+    struct flow_user_data * pending_next;
 };
 
 static struct nDPIsrvd_socket * sock = NULL;
@@ -70,6 +76,24 @@ static uint8_t process_undetected = 0;
 static ndpi_risk process_risky = NDPI_NO_RISK;
 static uint8_t process_midstream = 0;
 static uint8_t ignore_empty_flows = 0;
+static uint8_t pcapng_output = 0;
+
+/* all captured packets of undecided flows share one budget, the oldest flows are dropped first */
+static struct flow_user_data * pending_flows = NULL;
+static size_t packet_memory_used = 0;
+static nDPIsrvd_ull packet_memory_limit = DEFAULT_PACKET_MEMORY_LIMIT;
+
+/* rolling pcapng file shared by all flows, see pcapng_write_flow() */
+static struct
+{
+    FILE * fp;
+    time_t opened;
+    time_t last_flush;
+    size_t written;
+    unsigned int sequence;
+    size_t interface_count;
+    int interface_datalinks[PCAPNG_MAX_INTERFACES];
+} pcapng = {};
 
 #ifdef ENABLE_MEMORY_PROFILING
 void nDPIsrvd_memprof_log(char const * const format, ...)
@@ -84,35 +108,51 @@ void nDPIsrvd_memprof_log(char const * const format, ...)
 }
 #endif
 
-static void packet_data_copy(void * dst, const void * src)
+static void packet_data_dtor(void * elt)
 {
-    struct packet_data * const pd_dst = (struct packet_data *)dst;
-    struct packet_data const * const pd_src = (struct packet_data *)src;
-    *pd_dst = *pd_src;
-    if (pd_src->base64_packet != NULL && pd_src->base64_packet_size > 0)
+    struct packet_data * const pd_elt = (struct packet_data *)elt;
+    if (pd_elt->packet != NULL)
     {
-        pd_dst->base64_packet = strndup(pd_src->base64_packet, pd_src->base64_packet_size);
+        free(pd_elt->packet);
+        pd_elt->packet = NULL;
+        pd_elt->packet_size = 0;
     }
-    else
+}
+
+/* elements are copied shallow, utarray_push_back() passes the ownership of the packet buffer to the array */
+static const UT_icd packet_data_icd = {sizeof(struct packet_data), NULL, NULL, packet_data_dtor};
+
+static void flow_packets_free(struct flow_user_data * const flow_user)
+{
+    if (flow_user->packets == NULL)
     {
-        pd_dst->base64_packet = NULL;
-        pd_dst->base64_packet_size = 0;
+        return;
     }
+
+    DL_DELETE2(pending_flows, flow_user, pending_prev, pending_next);
+    packet_memory_used -= flow_user->packets_memory;
+    flow_user->packets_memory = 0;
+    utarray_free(flow_user->packets);
+    flow_user->packets = NULL;
 }
 
-static void packet_data_dtor(void * elt)
+static void packet_memory_evict(void)
 {
-    struct packet_data * const pd_elt = (struct packet_data *)elt;
-    if (pd_elt->base64_packet != NULL)
+    while (packet_memory_used > packet_memory_limit && pending_flows != NULL)
     {
-        free(pd_elt->base64_packet);
-        pd_elt->base64_packet = NULL;
-        pd_elt->base64_packet_size = 0;
+        struct flow_user_data * const oldest = pending_flows;
+
+        syslog(LOG_DAEMON | LOG_WARNING,
+               "flow %llu: Packet memory limit of %llu bytes reached, "
+               "dropping %u packets of the oldest undecided flow.",
+               oldest->flow_id,
+               packet_memory_limit,
+               utarray_len(oldest->packets));
+        oldest->packets_evicted = 1;
+        flow_packets_free(oldest);
     }
 }
 
-static const UT_icd packet_data_icd = {sizeof(struct packet_data), NULL, packet_data_copy, packet_data_dtor};
-
 static void set_ndpi_risk(ndpi_risk * const risk, nDPIsrvd_ull risk_to_add)
 {
     if (risk_to_add == 0)
@@ -142,6 +182,28 @@ static int has_ndpi_risk(ndpi_risk * const risk, nDPIsrvd_ull risk_to_check)
     return (*risk & (1ull << --risk_to_check)) != 0;
 }
 
+static char const * flow_type_to_string(struct flow_user_data const * const flow_user)
+{
+    if (flow_user->midstream != 0)
+    {
+        return "midstream";
+    }
+    else if (flow_user->guessed != 0)
+    {
+        return "guessed";
+    }
+    else if (flow_user->detected == 0)
+    {
+        return "undetected";
+    }
+    else if (flow_user->risky != 0)
+    {
+        return "risky";
+    }
+
+    return NULL;
+}
+
 static char * generate_pcap_filename(struct nDPIsrvd_flow const * const flow,
                                      struct flow_user_data const * const flow_user,
                                      char * const dest,
@@ -176,31 +238,9 @@ static char * generate_pcap_filename(struct nDPIsrvd_flow const * const flow,
         }
     }
 
-    if (flow_user->guessed != 0 || flow_user->detected == 0 || flow_user->risky != 0 || flow_user->midstream != 0)
+    char const * const flow_type = flow_type_to_string(flow_user);
+    if (flow_type != NULL)
     {
-        char const * flow_type = NULL;
-
-        if (flow_user->midstream != 0)
-        {
-            flow_type = "midstream";
-        }
-        else if (flow_user->guessed != 0)
-        {
-            flow_type = "guessed";
-        }
-        else if (flow_user->detected == 0)
-        {
-            flow_type = "undetected";
-        }
-        else if (flow_user->risky != 0)
-        {
-            flow_type = "risky";
-        }
-        else
-        {
-            flow_type = "unknown-type";
-        }
-
         int ret = snprintf(dest, size, "%s/flow-%s-%s.pcap", datadir, flow_type, appendix);
         if (ret <= 0 || (size_t)ret > size)
         {
@@ -219,7 +259,7 @@ static int packet_write_pcap_file(UT_array const * const pd_array, int pkt_datal
 {
     size_t const max_packet_len = 65535;
 
-    if (pd_array->icd.copy != packet_data_copy || pd_array->icd.dtor != packet_data_dtor)
+    if (pd_array->icd.dtor != packet_data_dtor)
     {
         return 1;
     }
@@ -261,29 +301,247 @@ static int packet_write_pcap_file(UT_array const * const pd_array, int pkt_datal
             break;
         }
 
-        unsigned char pkt_buf[max_packet_len];
-        size_t pkt_buf_len = sizeof(pkt_buf);
-        if (nDPIsrvd_base64decode(pd_elt->base64_packet, pd_elt->base64_packet_size, pkt_buf, &pkt_buf_len) != 0 ||
-            pkt_buf_len == 0)
+        struct pcap_pkthdr phdr;
+        phdr.ts.tv_sec = pd_elt->packet_ts_sec;
+        phdr.ts.tv_usec = pd_elt->packet_ts_usec;
+        phdr.caplen = (pd_elt->packet_size < max_packet_len ? pd_elt->packet_size : max_packet_len);
+        phdr.len = pd_elt->packet_size;
+        pcap_dump((unsigned char *)pd, &phdr, pd_elt->packet);
+    } while ((pd_elt = (struct packet_data *)utarray_next(pd_array, pd_elt)) != NULL);
+
+    pcap_dump_close(pd);
+    pcap_close(p);
+
+    return 0;
+}
+
+static void pcapng_put16(uint8_t * const dest, uint16_t value)
+{
+    memcpy(dest, &value, sizeof(value));
+}
+
+static void pcapng_put32(uint8_t * const dest, uint32_t value)
+{
+    memcpy(dest, &value, sizeof(value));
+}
+
+static int pcapng_write(void const * const data, size_t size)
+{
+    if (size > 0 && fwrite(data, size, 1, pcapng.fp) != 1)
+    {
+        syslog(LOG_DAEMON | LOG_ERR, "pcapng write failed: %s", strerror(errno));
+        return 1;
+    }
+    pcapng.written += size;
+
+    return 0;
+}
+
+static int pcapng_close(void)
+{
+    int retval = 0;
+
+    if (pcapng.fp != NULL)
+    {
+        retval = (fclose(pcapng.fp) != 0);
+        pcapng.fp = NULL;
+    }
+
+    return retval;
+}
+
+static int pcapng_open(time_t now)
+{
+    char timestamp[32];
+    char filename[PATH_MAX];
+    struct tm result;
+
+    if (localtime_r(&now, &result) == NULL ||
+        strftime(timestamp, sizeof(timestamp), "%d_%m_%y-%H_%M_%S", &result) == 0)
+    {
+        return 1;
+    }
+    int ret = snprintf(filename, sizeof(filename), "%s/flows-%s-%u.pcapng", datadir, timestamp, pcapng.sequence++);
+    if (ret <= 0 || (size_t)ret >= sizeof(filename))
+    {
+        return 1;
+    }
+
+    pcapng.fp = fopen(filename, "w");
+    if (pcapng.fp == NULL)
+    {
+        syslog(LOG_DAEMON | LOG_ERR, "Could not open %s: %s", filename, strerror(errno));
+        return 1;
+    }
+    /* flows are appended in small chunks, flushes are done by pcapng_write_flow() */
+    setvbuf(pcapng.fp, NULL, _IOFBF, PCAPNG_WRITE_BUFFER_SIZE);
+    pcapng.opened = now;
+    pcapng.last_flush = now;
+    pcapng.written = 0;
+    pcapng.interface_count = 0;
+
+    /* Section Header Block: byte-order magic, version 1.0, unknown section length */
+    uint8_t shb[28];
+    pcapng_put32(&shb[0], 0x0A0D0D0A);
+    pcapng_put32(&shb[4], sizeof(shb));
+    pcapng_put32(&shb[8], 0x1A2B3C4D);
+    pcapng_put16(&shb[12], 1);
+    pcapng_put16(&shb[14], 0);
+    memset(&shb[16], 0xFF, 8);
+    pcapng_put32(&shb[24], sizeof(shb));
+#ifdef VERBOSE
+    printf("writing flows to %s\n", filename);
+#endif
+
+    return pcapng_write(shb, sizeof(shb));
+}
+
+/*
+ * pcapng stores LINKTYPE_* values, nDPId reports the DLT_* value of its pcap handle.
+ * Both are equal except for a few types whose DLT_* value is platform specific.
+ */
+static uint16_t pcapng_linktype(int pkt_datalink)
+{
+    switch (pkt_datalink)
+    {
+#if defined(DLT_ATM_RFC1483) && DLT_ATM_RFC1483 != 100
+        case DLT_ATM_RFC1483:
+            return 100; /* LINKTYPE_ATM_RFC1483 */
+#endif
+#if defined(DLT_RAW) && DLT_RAW != 101
+        case DLT_RAW:
+            return 101; /* LINKTYPE_RAW */
+#endif
+#if defined(DLT_LOOP) && DLT_LOOP != 108
+        case DLT_LOOP:
+            return 108; /* LINKTYPE_LOOP */
+#endif
+        default:
+            return (uint16_t)pkt_datalink;
+    }
+}
+
+/* Every datalink type gets its own Interface Description Block, written before its first packet. */
+static int pcapng_interface_id(int pkt_datalink, uint32_t * const interface_id)
+{
+    for (size_t i = 0; i < pcapng.interface_count; ++i)
+    {
+        if (pcapng.interface_datalinks[i] == pkt_datalink)
         {
-            syslog(LOG_DAEMON | LOG_ERR,
-                   "packet base64 decode failed (%d bytes): %s",
-                   pd_elt->base64_packet_size,
-                   pd_elt->base64_packet);
+            *interface_id = i;
+            return 0;
         }
-        else
+    }
+    if (pcapng.interface_count == PCAPNG_MAX_INTERFACES)
+    {
+        return 1;
+    }
+
+    uint8_t idb[20];
+    pcapng_put32(&idb[0], 0x00000001);
+    pcapng_put32(&idb[4], sizeof(idb));
+    pcapng_put16(&idb[8], pcapng_linktype(pkt_datalink));
+    pcapng_put16(&idb[10], 0);
+    pcapng_put32(&idb[12], 65535);
+    pcapng_put32(&idb[16], sizeof(idb));
+    if (pcapng_write(idb, sizeof(idb)) != 0)
+    {
+        return 1;
+    }
+
+    pcapng.interface_datalinks[pcapng.interface_count] = pkt_datalink;
+    *interface_id = pcapng.interface_count++;
+
+    return 0;
+}
+
+/* Enhanced Packet Block with an opt_comment option naming the flow. */
+static int pcapng_write_packet(uint32_t interface_id,
+                               struct packet_data const * const pd_elt,
+                               char const * const comment,
+                               uint16_t comment_length)
+{
+    static uint8_t const padding[4] = {};
+    size_t const max_packet_len = 65535;
+    uint32_t const caplen = (pd_elt->packet_size < max_packet_len ? pd_elt->packet_size : max_packet_len);
+    uint32_t const packet_padding = (4 - caplen % 4) % 4;
+    uint32_t const comment_padding = (4 - comment_length % 4) % 4;
+    uint32_t const block_length = 28 + caplen + packet_padding + 4 + comment_length + comment_padding + 4 + 4;
+    uint64_t const ts = pd_elt->packet_ts_sec * 1000 * 1000 + pd_elt->packet_ts_usec;
+    uint8_t epb[28];
+    uint8_t option[4];
+    uint8_t trailer[8];
+
+    pcapng_put32(&epb[0], 0x00000006);
+    pcapng_put32(&epb[4], block_length);
+    pcapng_put32(&epb[8], interface_id);
+    pcapng_put32(&epb[12], ts >> 32);
+    pcapng_put32(&epb[16], ts & 0xFFFFFFFF);
+    pcapng_put32(&epb[20], caplen);
+    pcapng_put32(&epb[24], (pd_elt->packet_len > pd_elt->packet_size ? pd_elt->packet_len : pd_elt->packet_size));
+    pcapng_put16(&option[0], 1 /* opt_comment */);
+    pcapng_put16(&option[2], comment_length);
+    pcapng_put32(&trailer[0], 0 /* opt_endofopt */);
+    pcapng_put32(&trailer[4], block_length);
+
+    return pcapng_write(epb, sizeof(epb)) != 0 || pcapng_write(pd_elt->packet, caplen) != 0 ||
+           pcapng_write(padding, packet_padding) != 0 || pcapng_write(option, sizeof(option)) != 0 ||
+           pcapng_write(comment, comment_length) != 0 || pcapng_write(padding, comment_padding) != 0 ||
+           pcapng_write(trailer, sizeof(trailer)) != 0;
+}
+
+/*
+ * Appends all packets of a flow to the current pcapng file, which is shared by all flows.
+ * The file is rolled over after the -r interval or PCAPNG_ROLL_SIZE bytes.
+ */
+static int pcapng_write_flow(struct nDPIsrvd_flow const * const flow, struct flow_user_data const * const flow_user)
+{
+    time_t const now = time(NULL);
+    uint32_t interface_id;
+    char comment[64];
+
+    if (pcapng.fp != NULL &&
+        ((pcap_filename_rotation > 0 && now >= pcapng.opened + (time_t)pcap_filename_rotation) ||
+         pcapng.written >= PCAPNG_ROLL_SIZE || pcapng.interface_count == PCAPNG_MAX_INTERFACES) &&
+        pcapng_close() != 0)
+    {
+        syslog(LOG_DAEMON | LOG_ERR, "pcapng close failed: %s", strerror(errno));
+        return 1;
+    }
+    if (pcapng.fp == NULL && pcapng_open(now) != 0)
+    {
+        return 1;
+    }
+    if (pcapng_interface_id(flow_user->flow_datalink, &interface_id) != 0)
+    {
+        return 1;
+    }
+
+    int const comment_length =
+        snprintf(comment, sizeof(comment), "flow %llu %s", flow->id_as_ull, flow_type_to_string(flow_user));
+    if (comment_length <= 0 || (size_t)comment_length >= sizeof(comment))
+    {
+        return 1;
+    }
+
+    struct packet_data const * pd_elt = (struct packet_data *)utarray_front(flow_user->packets);
+    while (pd_elt != NULL)
+    {
+        if (pcapng_write_packet(interface_id, pd_elt, comment, comment_length) != 0)
         {
-            struct pcap_pkthdr phdr;
-            phdr.ts.tv_sec = pd_elt->packet_ts_sec;
-            phdr.ts.tv_usec = pd_elt->packet_ts_usec;
-            phdr.caplen = pkt_buf_len;
-            phdr.len = pkt_buf_len;
-            pcap_dump((unsigned char *)pd, &phdr, pkt_buf);
+            return 1;
         }
-    } while ((pd_elt = (struct packet_data *)utarray_next(pd_array, pd_elt)) != NULL);
+        pd_elt = (struct packet_data *)utarray_next(flow_user->packets, pd_elt);
+    }
 
-    pcap_dump_close(pd);
-    pcap_close(p);
+    if (now != pcapng.last_flush)
+    {
+        fflush(pcapng.fp);
+        pcapng.last_flush = now;
+    }
+#ifdef VERBOSE
+    printf("flow %llu saved to pcapng file %u\n", flow->id_as_ull, pcapng.sequence - 1);
+#endif
 
     return 0;
 }
@@ -291,7 +549,7 @@ static int packet_write_pcap_file(UT_array const * const pd_array, int pkt_datal
 #ifdef VERBOSE
 static void packet_data_print(UT_array const * const pd_array)
 {
-    if (pd_array->icd.copy != packet_data_copy || pd_array->icd.dtor != packet_data_dtor)
+    if (pd_array->icd.dtor != packet_data_dtor)
     {
         return;
     }
@@ -304,7 +562,7 @@ static void packet_data_print(UT_array const * const pd_array)
         {
             break;
         }
-        printf("\tpacket-data base64 length: %d\n", pd_elt->base64_packet_size);
+        printf("\tpacket-data length: %zu\n", pd_elt->packet_size);
     } while ((pd_elt = (struct packet_data *)utarray_next(pd_array, pd_elt)) != NULL);
 }
 #else
@@ -336,10 +594,11 @@ static enum nDPIsrvd_conversion_return perror_ull(enum nDPIsrvd_conversion_retur
     return retval;
 }
 
-static enum nDPIsrvd_callback_return captured_json_callback(struct nDPIsrvd_socket * const sock,
-                                                            struct nDPIsrvd_instance * const instance,
-                                                            struct nDPIsrvd_thread_data * const thread_data,
-                                                            struct nDPIsrvd_flow * const flow)
+static enum nDPIsrvd_callback_return captured_event_callback(struct nDPIsrvd_socket * const sock,
+                                                             struct nDPIsrvd_instance * const instance,
+                                                             struct nDPIsrvd_thread_data * const thread_data,
+                                                             struct nDPIsrvd_flow * const flow,
+                                                             struct nDPIsrvd_event * const event)
 {
     (void)instance;
     (void)thread_data;
@@ -356,56 +615,87 @@ static enum nDPIsrvd_callback_return captured_json_callback(struct nDPIsrvd_sock
         return CALLBACK_OK;
     }
 
-    if (TOKEN_VALUE_EQUALS_SZ(TOKEN_GET_SZ(sock, "packet_event_name"), "packet-flow") != 0)
+    if (event->type == nDPIsrvd_EVENT_PACKET &&
+        TOKEN_VALUE_EQUALS_SZ(event->packet.packet_event_name, "packet-flow") != 0)
     {
-        struct nDPIsrvd_json_token const * const pkt = TOKEN_GET_SZ(sock, "pkt");
+        struct nDPIsrvd_json_token const * const pkt = event->packet.pkt;
         if (pkt == NULL)
         {
             return CALLBACK_ERROR;
         }
-        if (flow_user->packets == NULL)
+        if (flow_user->packets_evicted != 0)
         {
-            utarray_new(flow_user->packets, &packet_data_icd);
+            /* an incomplete flow is not worth capturing anymore */
+            return CALLBACK_OK;
         }
         if (flow_user->packets == NULL)
         {
-            return CALLBACK_ERROR;
+            utarray_new(flow_user->packets, &packet_data_icd);
+            if (flow_user->packets == NULL)
+            {
+                return CALLBACK_ERROR;
+            }
+            flow_user->flow_id = flow->id_as_ull;
+            DL_APPEND2(pending_flows, flow_user, pending_prev, pending_next);
         }
 
         nDPIsrvd_ull thread_ts_usec = 0ull;
-        perror_ull(TOKEN_VALUE_TO_ULL(TOKEN_GET_SZ(sock, "thread_ts_usec"), &thread_ts_usec), "thread_ts_usec");
+        perror_ull(nDPIsrvd_number_to_ull(&event->packet.thread_ts_usec, &thread_ts_usec), "thread_ts_usec");
 
         nDPIsrvd_ull pkt_len = 0ull;
-        perror_ull(TOKEN_VALUE_TO_ULL(TOKEN_GET_SZ(sock, "pkt_len"), &pkt_len), "pkt_len");
+        perror_ull(nDPIsrvd_number_to_ull(&event->packet.pkt_len, &pkt_len), "pkt_len");
 
         nDPIsrvd_ull pkt_l4_len = 0ull;
-        perror_ull(TOKEN_VALUE_TO_ULL(TOKEN_GET_SZ(sock, "pkt_l4_len"), &pkt_l4_len), "pkt_l4_len");
+        perror_ull(nDPIsrvd_number_to_ull(&event->packet.pkt_l4_len, &pkt_l4_len), "pkt_l4_len");
 
         nDPIsrvd_ull pkt_l4_offset = 0ull;
-        perror_ull(TOKEN_VALUE_TO_ULL(TOKEN_GET_SZ(sock, "pkt_l4_offset"), &pkt_l4_offset), "pkt_l4_offset");
+        perror_ull(nDPIsrvd_number_to_ull(&event->packet.pkt_l4_offset, &pkt_l4_offset), "pkt_l4_offset");
+
+        /* decode straight from the receive buffer, the base64 text is never copied */
+        size_t packet_size = nDPIsrvd_BASE64_DECODED_SIZE(pkt->value_length);
+        uint8_t * const packet = (uint8_t *)malloc(packet_size);
+        if (packet == NULL)
+        {
+            return CALLBACK_ERROR;
+        }
+        if (nDPIsrvd_token_base64decode(pkt, packet, &packet_size) != 0 || packet_size == 0)
+        {
+            syslog(LOG_DAEMON | LOG_ERR,
+                   "packet base64 decode failed (%d bytes): %.*s",
+                   pkt->value_length,
+                   pkt->value_length,
+                   pkt->value);
+            free(packet);
+            return CALLBACK_OK;
+        }
 
         struct packet_data pd = {.packet_ts_sec = thread_ts_usec / (1000 * 1000),
                                  .packet_ts_usec = (thread_ts_usec % (1000 * 1000)),
                                  .packet_len = pkt_len,
-                                 .base64_packet_size = pkt->value_length,
-                                 .base64_packet_const = pkt->value};
+                                 .packet_size = packet_size,
+                                 .packet = packet};
         utarray_push_back(flow_user->packets, &pd);
+        flow_user->packets_memory += sizeof(pd) + packet_size;
+        packet_memory_used += sizeof(pd) + packet_size;
+        packet_memory_evict();
     }
 
     {
-        struct nDPIsrvd_json_token const * const flow_event_name = TOKEN_GET_SZ(sock, "flow_event_name");
+        /* all flow event members below are only valid if this is not NULL */
+        struct nDPIsrvd_json_token const * const flow_event_name =
+            (event->type == nDPIsrvd_EVENT_FLOW ? event->flow.flow_event_name : NULL);
 
         if (flow_event_name != NULL)
         {
             nDPIsrvd_ull nmb = 0;
 
-            perror_ull(TOKEN_VALUE_TO_ULL(TOKEN_GET_SZ(sock, "flow_src_tot_l4_payload_len"), &nmb),
+            perror_ull(nDPIsrvd_number_to_ull(&event->flow.flow_src_tot_l4_payload_len, &nmb),
                        "flow_src_tot_l4_payload_len");
             flow_user->flow_tot_l4_payload_len += nmb;
 
             nmb = 0;
 
-            perror_ull(TOKEN_VALUE_TO_ULL(TOKEN_GET_SZ(sock, "flow_dst_tot_l4_payload_len"), &nmb),
+            perror_ull(nDPIsrvd_number_to_ull(&event->flow.flow_dst_tot_l4_payload_len, &nmb),
                        "flow_dst_tot_l4_payload_len");
             flow_user->flow_tot_l4_payload_len += nmb;
         }
@@ -413,11 +703,11 @@ static enum nDPIsrvd_callback_return captured_json_callback(struct nDPIsrvd_sock
         if (TOKEN_VALUE_EQUALS_SZ(flow_event_name, "new") != 0)
         {
             flow_user->flow_new_seen = 1;
-            perror_ull(TOKEN_VALUE_TO_ULL(TOKEN_GET_SZ(sock, "flow_datalink"), &flow_user->flow_datalink),
+            perror_ull(nDPIsrvd_number_to_ull(&event->flow.flow_datalink, &flow_user->flow_datalink),
                        "flow_datalink");
-            perror_ull(TOKEN_VALUE_TO_ULL(TOKEN_GET_SZ(sock, "flow_max_packets"), &flow_user->flow_max_packets),
+            perror_ull(nDPIsrvd_number_to_ull(&event->flow.flow_max_packets, &flow_user->flow_max_packets),
                        "flow_max_packets");
-            if (TOKEN_VALUE_EQUALS_SZ(TOKEN_GET_SZ(sock, "midstream"), "1") != 0)
+            if (TOKEN_VALUE_EQUALS_SZ(event->flow.midstream.token, "1") != 0)
             {
                 flow_user->midstream = 1;
             }
@@ -436,7 +726,7 @@ static enum nDPIsrvd_callback_return captured_json_callback(struct nDPIsrvd_sock
         }
         else if (TOKEN_VALUE_EQUALS_SZ(flow_event_name, "detected") != 0)
         {
-            struct nDPIsrvd_json_token const * const flow_risk = TOKEN_GET_SZ(sock, "flow_risk");
+            struct nDPIsrvd_json_token const * const flow_risk = event->flow.ndpi.flow_risk;
             struct nDPIsrvd_json_token const * current = NULL;
             int next_child_index = -1;
 
@@ -465,7 +755,16 @@ static enum nDPIsrvd_callback_return captured_json_callback(struct nDPIsrvd_sock
 
         if (flow_user->packets == NULL || flow_user->flow_max_packets == 0 || utarray_len(flow_user->packets) == 0)
         {
-            syslog(LOG_DAEMON | LOG_ERR, "flow %llu: No packets captured.", flow->id_as_ull);
+            if (flow_user->packets_evicted == 0)
+            {
+                syslog(LOG_DAEMON | LOG_ERR, "flow %llu: No packets captured.", flow->id_as_ull);
+            }
+            else if (flow_user->detection_finished != 0)
+            {
+                syslog(LOG_DAEMON | LOG_WARNING,
+                       "flow %llu: Not saved, packets were dropped due to the packet memory limit.",
+                       flow->id_as_ull);
+            }
             return CALLBACK_OK;
         }
 
@@ -477,23 +776,36 @@ static enum nDPIsrvd_callback_return captured_json_callback(struct nDPIsrvd_sock
             packet_data_print(flow_user->packets);
             if (ignore_empty_flows == 0 || flow_user->flow_tot_l4_payload_len > 0)
             {
-                char pcap_filename[PATH_MAX];
-                if (generate_pcap_filename(flow, flow_user, pcap_filename, sizeof(pcap_filename)) == NULL)
+                if (pcapng_output != 0)
                 {
-                    syslog(LOG_DAEMON | LOG_ERR, "%s", "Internal error. Could not generate PCAP filename, exit ..");
-                    return CALLBACK_ERROR;
+                    if (pcapng_write_flow(flow, flow_user) != 0)
+                    {
+                        return CALLBACK_ERROR;
+                    }
                 }
+                else
+                {
+                    char pcap_filename[PATH_MAX];
+                    if (generate_pcap_filename(flow, flow_user, pcap_filename, sizeof(pcap_filename)) == NULL)
+                    {
+                        syslog(LOG_DAEMON | LOG_ERR, "%s", "Internal error. Could not generate PCAP filename, exit ..");
+                        return CALLBACK_ERROR;
+                    }
 #ifdef VERBOSE
-                printf("flow %llu saved to %s\n", flow->id_as_ull, pcap_filename);
+                    printf("flow %llu saved to %s\n", flow->id_as_ull, pcap_filename);
 #endif
-                if (packet_write_pcap_file(flow_user->packets, flow_user->flow_datalink, pcap_filename) != 0)
-                {
-                    return CALLBACK_ERROR;
+                    if (packet_write_pcap_file(flow_user->packets, flow_user->flow_datalink, pcap_filename) != 0)
+                    {
+                        return CALLBACK_ERROR;
+                    }
                 }
             }
+        }
 
-            utarray_free(flow_user->packets);
-            flow_user->packets = NULL;
+        if (flow_user->detection_finished != 0)
+        {
+            /* the verdict is final, packets of flows that are not saved do not have to wait for the flow end */
+            flow_packets_free(flow_user);
         }
     }
 
@@ -586,13 +898,12 @@ static void captured_flow_cleanup_callback(struct nDPIsrvd_socket * const sock,
     (void)reason;
 
 #ifdef VERBOSE
-    printf("flow %llu end, remaining flows: %u\n", flow->id_as_ull, sock->flow_table->hh.tbl->num_items);
+    printf("flow %llu end, remaining flows: %zu\n", flow->id_as_ull, instance->flow_table.used);
 #endif
     struct flow_user_data * const ud = (struct flow_user_data *)flow->flow_user_data;
-    if (ud != NULL && ud->packets != NULL)
+    if (ud != NULL)
     {
-        utarray_free(ud->packets);
-        ud->packets = NULL;
+        flow_packets_free(ud);
     }
 }
 
@@ -601,12 +912,17 @@ static void print_usage(char const * const arg0)
     static char const usage[] =
         "Usage: %s "
         "[-d] [-p pidfile] [-s host] [-r rotate-every-n-seconds]\n"
-        "\t  \t[-u user] [-g group] [-D dir] [-G] [-U] [-R risk] [-M]\n\n"
+        "\t  \t[-u user] [-g group] [-D dir] [-G] [-U] [-R risk] [-M] [-E]\n"
+        "\t  \t[-m packet-memory-limit] [-n]\n\n"
         "\t-d\tForking into background after initialization.\n"
         "\t-p\tWrite the daemon PID to the given file path.\n"
         "\t-s\tDestination where nDPIsrvd is listening on.\n"
         "\t  \tCan be either a path to UNIX socket or an IPv4/TCP-Port IPv6/TCP-Port tuple.\n"
         "\t-r\tRotate PCAP files every n seconds\n"
+        "\t-m\tMemory limit in bytes for captured packets of undecided flows (default: %u).\n"
+        "\t  \tPackets of the oldest undecided flows are dropped if the limit is exceeded.\n"
+        "\t-n\tWrite all flows to a rolling pcapng file with a per packet flow comment\n"
+        "\t  \tinstead of one PCAP file per flow. Rolled over by `-r' or every %u MiB.\n"
         "\t-u\tChange user.\n"
         "\t-g\tChange group.\n"
         "\t-D\tDatadir - Where to store PCAP files.\n"
@@ -619,7 +935,7 @@ static void print_usage(char const * const arg0)
         "risk):\n"
         "\t  \tExample: -R0 -R~15 would enable all risks except risk with id 15\n";
 
-    fprintf(stderr, usage, arg0);
+    fprintf(stderr, usage, arg0, DEFAULT_PACKET_MEMORY_LIMIT, PCAPNG_ROLL_SIZE / (1024u * 1024u));
 #ifndef LIBNDPI_STATIC
     fprintf(stderr, "\t\t%d - %s\n", 0, "Capture all risks");
 #else
@@ -639,7 +955,7 @@ static int parse_options(int argc, char ** argv)
 {
     int opt;
 
-    while ((opt = getopt(argc, argv, "hdp:s:r:u:g:D:GUR:ME")) != -1)
+    while ((opt = getopt(argc, argv, "hdp:s:r:m:nu:g:D:GUR:ME")) != -1)
     {
         switch (opt)
         {
@@ -662,6 +978,17 @@ static int parse_options(int argc, char ** argv)
                     return 1;
                 }
                 break;
+            case 'm':
+                if (perror_ull(str_value_to_ull(optarg, &packet_memory_limit), "packet_memory_limit") !=
+                    CONVERSION_OK)
+                {
+                    fprintf(stderr, "%s: Argument for `-m' is not a number: %s\n", argv[0], optarg);
+                    return 1;
+                }
+                break;
+            case 'n':
+                pcapng_output = 1;
+                break;
             case 'u':
                 free(user);
                 user = strdup(optarg);
@@ -795,13 +1122,13 @@ static int mainloop(void)
 
 int main(int argc, char ** argv)
 {
-    sock = nDPIsrvd_socket_init(
-        0, 0, 0, sizeof(struct flow_user_data), captured_json_callback, NULL, captured_flow_cleanup_callback);
+    sock = nDPIsrvd_socket_init(0, 0, 0, sizeof(struct flow_user_data), NULL, NULL, captured_flow_cleanup_callback);
     if (sock == NULL)
     {
         fprintf(stderr, "%s: nDPIsrvd socket memory allocation failed!\n", argv[0]);
         return 1;
     }
+    nDPIsrvd_set_event_callback(sock, captured_event_callback);
 
     if (parse_options(argc, argv) != 0)
     {
@@ -848,6 +1175,11 @@ int main(int argc, char ** argv)
     int retval = mainloop();
 
     nDPIsrvd_socket_free(&sock);
+    if (pcapng_close() != 0)
+    {
+        syslog(LOG_DAEMON | LOG_ERR, "pcapng close failed: %s", strerror(errno));
+        retval = 1;
+    }
     daemonize_shutdown(pidfile);
     closelog();
 
@@ -0,0 +1,184 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nDPIsrvd.h"
+#include "nDPIsrvd_multi.h"
+
+/*
+ * Consumes the events of several nDPIsrvd instances on a single thread (see nDPIsrvd_multi.h)
+ * and periodically prints the connection state of every source.
+ */
+
+struct multi_instance_stats
+{
+    unsigned long long int events;
+    unsigned long long int flow_events;
+};
+
+static int main_thread_shutdown = 0;
+
+#ifdef ENABLE_MEMORY_PROFILING
+void nDPIsrvd_memprof_log(char const * const format, ...)
+{
+    va_list ap;
+
+    va_start(ap, format);
+    fprintf(stderr, "%s", "nDPIsrvd MemoryProfiler: ");
+    vfprintf(stderr, format, ap);
+    fprintf(stderr, "%s\n", "");
+    va_end(ap);
+}
+#endif
+
+static enum nDPIsrvd_callback_return multi_json_callback(struct nDPIsrvd_socket * const sock,
+                                                         struct nDPIsrvd_instance * const instance,
+                                                         struct nDPIsrvd_thread_data * const thread_data,
+                                                         struct nDPIsrvd_flow * const flow)
+{
+    (void)sock;
+    (void)thread_data;
+
+    if (instance == NULL)
+    {
+        return CALLBACK_OK;
+    }
+
+    struct multi_instance_stats * const stats = (struct multi_instance_stats *)instance->instance_user_data;
+    stats->events++;
+    if (flow != NULL)
+    {
+        stats->flow_events++;
+    }
+
+    return CALLBACK_OK;
+}
+
+static char const * source_state_to_string(enum nDPIsrvd_source_state state)
+{
+    switch (state)
+    {
+        case SOURCE_DISCONNECTED:
+            return "disconnected";
+        case SOURCE_CONNECTING:
+            return "connecting";
+        case SOURCE_CONNECTED:
+            return "connected";
+    }
+
+    return "unknown";
+}
+
+static void print_status(struct nDPIsrvd_multi const * const multi, char ** const destinations)
+{
+    struct nDPIsrvd_instance * current_instance;
+    struct nDPIsrvd_instance * itmp;
+
+    for (size_t i = 0; i < multi->source_count; ++i)
+    {
+        struct nDPIsrvd_source const * const source = multi->sources[i];
+
+        printf("[%s] %s, %llu bytes received, %llu connects, %llu disconnects",
+               destinations[i],
+               source_state_to_string(source->state),
+               source->bytes_received,
+               source->connects,
+               source->disconnects);
+        if (source->state != SOURCE_CONNECTED && source->last_errno != 0)
+        {
+            printf(", last error: %s", strerror(source->last_errno));
+        }
+        if (source->last_parse_error != PARSE_OK)
+        {
+            printf(", last parse error: %s", nDPIsrvd_enum_to_string(source->last_parse_error));
+        }
+        printf("%s\n", "");
+    }
+
+    HASH_ITER(hh, multi->sock->instance_table, current_instance, itmp)
+    {
+        struct multi_instance_stats const * const stats =
+            (struct multi_instance_stats *)current_instance->instance_user_data;
+        /* alias and source are separated by a zero byte, the source is not zero terminated */
+        int const alias_length = (int)strlen(current_instance->alias_source);
+
+        printf("[%s/%.*s] %llu events, %llu flow events, %zu active flows\n",
+               current_instance->alias_source,
+               (int)current_instance->alias_source_length - alias_length - 1,
+               current_instance->alias_source + alias_length + 1,
+               stats->events,
+               stats->flow_events,
+               current_instance->flow_table.used);
+    }
+}
+
+static void sighandler(int signum)
+{
+    (void)signum;
+
+    main_thread_shutdown = 1;
+}
+
+int main(int argc, char ** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s [host:port|socket-path]...\n", argv[0]);
+        return 1;
+    }
+
+    signal(SIGINT, sighandler);
+    signal(SIGTERM, sighandler);
+    signal(SIGPIPE, SIG_IGN);
+
+    struct nDPIsrvd_socket * sock =
+        nDPIsrvd_socket_init(0, sizeof(struct multi_instance_stats), 0, 0, multi_json_callback, NULL, NULL);
+    if (sock == NULL)
+    {
+        return 1;
+    }
+
+    struct nDPIsrvd_multi * multi = nDPIsrvd_multi_init(sock);
+    if (multi == NULL)
+    {
+        nDPIsrvd_socket_free(&sock);
+        return 1;
+    }
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (nDPIsrvd_multi_add_source(multi, argv[i]) == NULL)
+        {
+            fprintf(stderr, "Could not add source %s\n", argv[i]);
+            nDPIsrvd_multi_free(&multi);
+            nDPIsrvd_socket_free(&sock);
+            return 1;
+        }
+    }
+
+    int retval = 0;
+    time_t last_status = time(NULL);
+    while (main_thread_shutdown == 0)
+    {
+        if (nDPIsrvd_multi_dispatch(multi, 1000) < 0)
+        {
+            perror("epoll_wait");
+            retval = 1;
+            break;
+        }
+
+        time_t const now = time(NULL);
+        if (now - last_status >= 5)
+        {
+            print_status(multi, argv + 1);
+            last_status = now;
+        }
+    }
+
+    nDPIsrvd_multi_free(&multi);
+    nDPIsrvd_socket_free(&sock);
+
+    return retval;
+}
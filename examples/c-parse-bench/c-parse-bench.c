@@ -0,0 +1,335 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nDPIsrvd.h"
+#include "nDPIsrvd_dispatch.h"
+
+/*
+ * Replays recorded nDPId JSON events (e.g. the *.out files in test/results) through nDPIsrvd_read() and
+ * nDPIsrvd_parse_all() and reports the parser throughput. The events are fed through a pipe in chunks of the same
+ * size a distributor read would return, so that lines are split at arbitrary positions like on a real socket.
+ * With -t, lines are dispatched to worker threads (see nDPIsrvd_dispatch.h), statistics are kept per socket.
+ * With -s, lines are tokenized by the structural scanner instead of jsmn (see nDPIsrvd_set_structural_scan()).
+ */
+
+struct parse_bench_stats
+{
+    unsigned long long int events;
+    unsigned long long int flow_events;
+    unsigned long long int bytes;
+    unsigned long long int typed_events;
+};
+
+#ifdef ENABLE_MEMORY_PROFILING
+void nDPIsrvd_memprof_log(char const * const format, ...)
+{
+    (void)format;
+}
+#endif
+
+static enum nDPIsrvd_callback_return parse_bench_json_callback(struct nDPIsrvd_socket * const sock,
+                                                               struct nDPIsrvd_instance * const instance,
+                                                               struct nDPIsrvd_thread_data * const thread_data,
+                                                               struct nDPIsrvd_flow * const flow)
+{
+    struct parse_bench_stats * const bench_stats = (struct parse_bench_stats *)sock->global_user_data;
+
+    (void)instance;
+    (void)thread_data;
+
+    /* token values point into the receive buffer, they have to be valid for the whole callback */
+    if (sock->buffer.json_string[0] != '{' ||
+        sock->buffer.json_string[sock->buffer.json_string_length - sock->buffer.json_string_start - 1] != '\n')
+    {
+        return CALLBACK_ERROR;
+    }
+
+    bench_stats->events++;
+    bench_stats->bytes += sock->buffer.json_string_length;
+    if (flow != NULL)
+    {
+        bench_stats->flow_events++;
+    }
+
+    return CALLBACK_OK;
+}
+
+static enum nDPIsrvd_callback_return parse_bench_event_callback(struct nDPIsrvd_socket * const sock,
+                                                                struct nDPIsrvd_instance * const instance,
+                                                                struct nDPIsrvd_thread_data * const thread_data,
+                                                                struct nDPIsrvd_flow * const flow,
+                                                                struct nDPIsrvd_event * const event)
+{
+    nDPIsrvd_ull thread_ts_usec = 0;
+
+    switch (event->type)
+    {
+        case nDPIsrvd_EVENT_FLOW:
+            nDPIsrvd_number_to_ull(&event->flow.thread_ts_usec, &thread_ts_usec);
+            break;
+        case nDPIsrvd_EVENT_PACKET:
+            nDPIsrvd_number_to_ull(&event->packet.thread_ts_usec, &thread_ts_usec);
+            break;
+        case nDPIsrvd_EVENT_DAEMON:
+        case nDPIsrvd_EVENT_ERROR:
+            break;
+        case nDPIsrvd_EVENT_UNKNOWN:
+            return parse_bench_json_callback(sock, instance, thread_data, flow);
+    }
+
+    ((struct parse_bench_stats *)sock->global_user_data)->typed_events++;
+    return parse_bench_json_callback(sock, instance, thread_data, flow);
+}
+
+static int load_corpus(char ** const corpus, size_t * const corpus_size, char const * const path)
+{
+    FILE * const fp = fopen(path, "r");
+    char * line = NULL;
+    size_t line_size = 0;
+    ssize_t line_length;
+
+    if (fp == NULL)
+    {
+        fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    while ((line_length = getline(&line, &line_size, fp)) > 0)
+    {
+        /* skip the nDPId-test summary, keep framed JSON lines only */
+        if (line_length < NETWORK_BUFFER_LENGTH_DIGITS + 1 || line[NETWORK_BUFFER_LENGTH_DIGITS] != '{')
+        {
+            continue;
+        }
+
+        char * const new_corpus = (char *)realloc(*corpus, *corpus_size + line_length);
+        if (new_corpus == NULL)
+        {
+            free(line);
+            fclose(fp);
+            return 1;
+        }
+        memcpy(new_corpus + *corpus_size, line, line_length);
+        *corpus = new_corpus;
+        *corpus_size += line_length;
+    }
+
+    free(line);
+    fclose(fp);
+    return 0;
+}
+
+static int run_parse_bench(struct nDPIsrvd_socket * const sock,
+                           struct nDPIsrvd_dispatcher * const dispatcher,
+                           char const * const corpus,
+                           size_t corpus_size,
+                           size_t chunk_size)
+{
+    int pipefds[2];
+    size_t written = 0;
+    int retval = 0;
+
+    if (pipe(pipefds) != 0)
+    {
+        perror("pipe");
+        return 1;
+    }
+    fcntl(pipefds[0], F_SETFL, fcntl(pipefds[0], F_GETFL) | O_NONBLOCK);
+    sock->fd = pipefds[0];
+
+    while (written < corpus_size)
+    {
+        size_t const to_write = (corpus_size - written < chunk_size ? corpus_size - written : chunk_size);
+        ssize_t const bytes_written = write(pipefds[1], corpus + written, to_write);
+        if (bytes_written <= 0)
+        {
+            perror("write");
+            retval = 1;
+            break;
+        }
+        written += bytes_written;
+
+        enum nDPIsrvd_read_return read_ret;
+        while ((read_ret = nDPIsrvd_read(sock)) == READ_OK)
+        {
+            enum nDPIsrvd_parse_return const parse_ret =
+                (dispatcher == NULL ? nDPIsrvd_parse_all(sock) : nDPIsrvd_dispatch_all(dispatcher));
+            if (parse_ret != PARSE_NEED_MORE_DATA)
+            {
+                fprintf(stderr, "JSON parsing failed: %s\n", nDPIsrvd_enum_to_string(parse_ret));
+                retval = 1;
+                break;
+            }
+        }
+        if (retval != 0 || read_ret != READ_TIMEOUT)
+        {
+            if (read_ret != READ_TIMEOUT)
+            {
+                fprintf(stderr, "Read failed: %s\n", nDPIsrvd_enum_to_string(read_ret));
+            }
+            retval = 1;
+            break;
+        }
+    }
+
+    close(pipefds[0]);
+    close(pipefds[1]);
+    sock->fd = -1;
+
+    return retval;
+}
+
+static void print_usage(char const * const arg0)
+{
+    fprintf(stderr,
+            "usage: %s [-r rounds] [-c chunk-size] [-e] [-s] [-t workers] [corpus-file...]\n"
+            "\t-r\tReplay the corpus N times (default: 10).\n"
+            "\t-c\tMaximum number of bytes available per nDPIsrvd_read() (default: %u).\n"
+            "\t-e\tUse the typed event callback instead of the json callback.\n"
+            "\t-s\tUse the structural scanner instead of jsmn, nested objects are only tokenized for -e.\n"
+            "\t-t\tDispatch lines to N worker threads (default: 0, parse inline).\n"
+            "\tThe corpus consists of recorded nDPId JSON events e.g. test/results/*.out\n",
+            arg0,
+            NETWORK_BUFFER_MAX_SIZE);
+}
+
+int main(int argc, char ** argv)
+{
+    char * corpus = NULL;
+    size_t corpus_size = 0;
+    unsigned long int rounds = 10;
+    size_t chunk_size = NETWORK_BUFFER_MAX_SIZE;
+    int use_event_callback = 0;
+    int use_structural_scan = 0;
+    size_t worker_count = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:c:est:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'r':
+                rounds = strtoul(optarg, NULL, 10);
+                break;
+            case 'c':
+                chunk_size = strtoul(optarg, NULL, 10);
+                break;
+            case 'e':
+                use_event_callback = 1;
+                break;
+            case 's':
+                use_structural_scan = 1;
+                break;
+            case 't':
+                worker_count = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind >= argc || rounds == 0 || chunk_size == 0 || chunk_size > NETWORK_BUFFER_MAX_SIZE)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    for (int i = optind; i < argc; ++i)
+    {
+        if (load_corpus(&corpus, &corpus_size, argv[i]) != 0)
+        {
+            free(corpus);
+            return 1;
+        }
+    }
+    if (corpus_size == 0)
+    {
+        fprintf(stderr, "%s\n", "No JSON events found in corpus.");
+        return 1;
+    }
+
+    struct nDPIsrvd_socket * sock = nDPIsrvd_socket_init(sizeof(struct parse_bench_stats),
+                                                         0,
+                                                         0,
+                                                         0,
+                                                         (use_event_callback == 0 ? parse_bench_json_callback : NULL),
+                                                         NULL,
+                                                         NULL);
+    if (sock == NULL)
+    {
+        fprintf(stderr, "%s\n", "nDPIsrvd socket init failed.");
+        free(corpus);
+        return 1;
+    }
+    if (use_event_callback != 0)
+    {
+        nDPIsrvd_set_event_callback(sock, parse_bench_event_callback);
+    }
+    nDPIsrvd_set_structural_scan(sock, use_structural_scan);
+
+    struct nDPIsrvd_dispatcher * dispatcher = NULL;
+    if (worker_count > 0)
+    {
+        dispatcher = nDPIsrvd_dispatcher_init(sock, worker_count);
+        if (dispatcher == NULL)
+        {
+            fprintf(stderr, "%s\n", "nDPIsrvd dispatcher init failed.");
+            nDPIsrvd_socket_free(&sock);
+            free(corpus);
+            return 1;
+        }
+    }
+
+    struct timespec start;
+    struct timespec end;
+    int retval = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned long int round = 0; round < rounds && retval == 0; ++round)
+    {
+        retval = run_parse_bench(sock, dispatcher, corpus, corpus_size, chunk_size);
+    }
+
+    if (dispatcher != NULL && retval == 0)
+    {
+        retval = (nDPIsrvd_dispatcher_flush(dispatcher) != PARSE_OK);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    struct parse_bench_stats bench_stats = *(struct parse_bench_stats *)sock->global_user_data;
+    for (size_t i = 0; i < worker_count; ++i)
+    {
+        struct parse_bench_stats const * const worker_stats =
+            (struct parse_bench_stats *)nDPIsrvd_dispatcher_worker_socket(dispatcher, i)->global_user_data;
+
+        bench_stats.events += worker_stats->events;
+        bench_stats.flow_events += worker_stats->flow_events;
+        bench_stats.bytes += worker_stats->bytes;
+        bench_stats.typed_events += worker_stats->typed_events;
+    }
+
+    double const elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    if (retval == 0)
+    {
+        printf("%llu events (%llu flow events, %llu typed), %.2f MiB in %.3f s: %.0f events/s, %.2f MiB/s\n",
+               bench_stats.events,
+               bench_stats.flow_events,
+               bench_stats.typed_events,
+               bench_stats.bytes / 1048576.0,
+               elapsed,
+               bench_stats.events / elapsed,
+               bench_stats.bytes / 1048576.0 / elapsed);
+    }
+
+    nDPIsrvd_dispatcher_free(&dispatcher);
+    nDPIsrvd_socket_free(&sock);
+    free(corpus);
+
+    return retval;
+}
@@ -211,7 +211,7 @@ static void * nDPIsrvd_mainloop_thread(void * const arg)
     strncpy(mock_arpa_desc->event_distributor_in.peer_addr,
             "arpa-mockup",
             sizeof(mock_arpa_desc->event_distributor_in.peer_addr));
-    mock_arpa_desc->event_distributor_in.peer.sin_port = 0;
+    mock_arpa_desc->event_distributor_in.peer_port = 0;
 
     if (add_in_event(epollfd, mock_json_desc) != 0 || add_in_event(epollfd, mock_test_desc) != 0 ||
         add_in_event(epollfd, mock_null_desc) != 0 || add_in_event(epollfd, mock_arpa_desc) != 0)
@@ -415,7 +415,7 @@ static enum nDPIsrvd_callback_return distributor_json_callback(struct nDPIsrvd_s
                 global_stats->flow_new_count++;
                 thread_stats->flow_new_count++;
 
-                unsigned int hash_count = HASH_COUNT(instance->flow_table);
+                unsigned int hash_count = instance->flow_table.used;
                 if (hash_count != global_stats->cur_active_flows)
                 {
                     logger(1,
@@ -472,13 +472,7 @@ static enum nDPIsrvd_callback_return distributor_json_callback(struct nDPIsrvd_s
                 global_stats->flow_update_count++;
             }
 
-            struct nDPIsrvd_flow * current_flow;
-            struct nDPIsrvd_flow * ftmp;
-            size_t flow_count = 0;
-            HASH_ITER(hh, instance->flow_table, current_flow, ftmp)
-            {
-                flow_count++;
-            }
+            size_t const flow_count = instance->flow_table.used;
             if (flow_count != global_stats->cur_active_flows + global_stats->cur_idle_flows)
             {
                 logger(1,
@@ -562,7 +556,7 @@ static void distributor_flow_cleanup_callback(struct nDPIsrvd_socket * const soc
             break;
     }
 
-    unsigned hash_count = HASH_COUNT(instance->flow_table);
+    unsigned hash_count = instance->flow_table.used;
     if (hash_count != global_stats->cur_active_flows + global_stats->cur_idle_flows)
     {
         logger(1,
@@ -757,10 +751,9 @@ static void * distributor_client_mainloop_thread(void * const arg)
     struct nDPIsrvd_instance * current_instance;
     struct nDPIsrvd_instance * itmp;
     struct nDPIsrvd_flow * current_flow;
-    struct nDPIsrvd_flow * ftmp;
     HASH_ITER(hh, mock_sock->instance_table, current_instance, itmp)
     {
-        HASH_ITER(hh, current_instance->flow_table, current_flow, ftmp)
+        DL_FOREACH(current_instance->flow_table.flows, current_flow)
         {
             logger(1, "Active flow found during client distributor shutdown with id: %llu", current_flow->id_as_ull);
             THREAD_ERROR(trv);
@@ -900,6 +893,10 @@ int main(int argc, char ** argv)
     nDPId_options.enable_zlib_compression = 1;
 #endif
     nDPId_options.memory_profiling_log_interval = (unsigned long long int)-1;
+    /* The recorded results were generated with the FIN/RST based TCP and without UDP transaction timeouts. */
+    nDPId_options.tcp_max_embryonic_time = nDPId_options.tcp_max_idle_time;
+    nDPId_options.tcp_max_post_close_time = nDPId_options.tcp_max_post_end_flow_time;
+    nDPId_options.udp_max_transaction_time = 0;
     nDPId_options.reader_thread_count = 1; /* Please do not change this! Generating meaningful pcap diff's relies on a
                                               single reader thread! */
     nDPId_options.instance_alias = strdup("nDPId-test");
@@ -2,6 +2,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <ifaddrs.h>
+#include <malloc.h>
 #include <net/ethernet.h>
 #include <net/if.h>
 #include <netinet/in.h>
@@ -16,10 +17,12 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <poll.h>
 #include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/signalfd.h>
 #include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 #ifdef ENABLE_ZLIB
 #include <zlib.h>
@@ -137,12 +140,32 @@ union nDPId_ip
 enum nDPId_flow_state
 {
     FS_UNKNOWN = 0, // should never happen, bug otherwise
-    FS_SKIPPED,     // flow should not be processed, see command line args -I and -E
+    FS_SKIPPED,     // flow should not be processed, see command line args -I, -E and -R; never stored
     FS_FINISHED,    // detection done and detection data free'd
     FS_INFO,        // detection in progress, detection data allocated
     FS_COUNT
 };
 
+enum nDPId_tcp_state
+{
+    TCP_STATE_NONE = 0,     // not a TCP flow or no packet processed yet
+    TCP_STATE_SYN_SENT,     // SYN seen, waiting for SYN-ACK
+    TCP_STATE_SYN_RECEIVED, // SYN-ACK seen, waiting for the handshake to complete
+    TCP_STATE_ESTABLISHED,  // handshake completed or midstream flow
+    TCP_STATE_CLOSING,      // FIN seen, waiting for both FINs to be acknowledged
+    TCP_STATE_CLOSED        // valid RST seen or both FINs acknowledged
+};
+
+enum nDPId_tunnel_type
+{
+    TUNNEL_NONE = 0,
+    TUNNEL_IPIP, // IPv4/IPv6 in IPv4/IPv6
+    TUNNEL_GRE,
+    TUNNEL_VXLAN,
+    TUNNEL_GTP, // GTP-U
+    TUNNEL_COUNT
+};
+
 enum nDPId_flow_direction
 {
     FD_SRC2DST = 0,
@@ -171,10 +194,19 @@ struct nDPId_flow_basic
     uint8_t l4_protocol;
     uint8_t tcp_fin_rst_seen : 1;
     uint8_t tcp_is_midstream_flow : 1;
-    uint8_t reserved_00 : 6;
-    uint8_t reserved_01[2];
+    uint8_t no_packet_events : 1;      // see flow policies
+    uint8_t udp_transaction_done : 1; // see udp_transaction_update()
+    uint8_t reserved_00 : 4;
+    uint8_t tcp_state; // enum nDPId_tcp_state
+    uint8_t tcp_fin_seen : 2;  // one bit per direction
+    uint8_t tcp_fin_acked : 2; // one bit per direction
+    uint8_t tcp_seq_seen : 2;  // one bit per direction, tcp_next_seq is valid
+    uint8_t reserved_01 : 2;
     uint16_t src_port;
     uint16_t dst_port;
+    uint32_t tcp_fin_ack_seq[FD_COUNT]; // ACK number that acknowledges the FIN of a direction
+    uint32_t tcp_next_seq[FD_COUNT];    // highest sequence number sent by a direction plus one, see tcp_rst_valid()
+    uint32_t tunnel_key;                // VXLAN VNI or GRE key, separates overlapping inner address spaces
     uint64_t last_pkt_time[FD_COUNT];
 };
 
@@ -198,14 +230,65 @@ struct nDPId_flow_extended
     struct nDPId_flow_analysis * flow_analysis;
     unsigned long long int total_l4_payload_len[FD_COUNT];
     struct ndpi_proto detected_l7_protocol;
+    uint64_t max_iat;    // largest gap between two packets of the flow, see idle_sketch_add()
+    uint32_t tunnel_id;  // VXLAN VNI, GRE key or GTP-U TEID of the first packet
+    uint8_t tunnel_type; // enum nDPId_tunnel_type
 };
 
 /*
- * Skipped flows need at least some information.
+ * Streaming quantile sketch of the largest packet gaps of finished flows with the same l7 and l4 protocol.
+ * Log-scale histogram with four buckets per power of two milliseconds, counts are halved every
+ * nDPId_IDLE_SKETCH_DECAY samples to follow changing traffic.
  */
-struct nDPId_flow_skipped
+struct nDPId_idle_sketch
 {
-    struct nDPId_flow_basic flow_basic;
+    uint16_t l7_protocol;
+    uint8_t l4_protocol;
+    uint8_t used;
+    uint32_t samples;
+    uint64_t idle_time; // 0 until nDPId_IDLE_SKETCH_MIN_SAMPLES were added
+    uint16_t buckets[nDPId_IDLE_SKETCH_BUCKETS];
+};
+
+/*
+ * Fingerprint of a skipped flow, see skipped_flow_lookup().
+ * The slot hash is kept to move entries back on deletion.
+ */
+struct nDPId_skipped_flow
+{
+    uint32_t slot_hash;
+    uint32_t fingerprint; // 0 marks an empty slot
+    uint64_t expires;
+};
+
+/*
+ * Fields of the ndpi flow struct which are part of detection events.
+ * Compared with memcmp() after every processed packet of a detected flow, see update_detection_snapshot().
+ * Variable length data is represented by its used length and a hash.
+ */
+struct nDPId_detection_snapshot
+{
+    ndpi_risk risk;
+    uint32_t metadata_hash;
+    uint32_t host_server_name_hash;
+    uint16_t master_protocol;
+    uint16_t app_protocol;
+    uint16_t category;
+    uint16_t host_server_name_len;
+    uint8_t confidence;
+    uint8_t reserved[7];
+};
+
+/*
+ * A libnDPI detection module and the number of flows in detection referencing it.
+ * A module replaced by a reload is retired and freed as soon as its last flow finished detection.
+ */
+struct nDPId_detection_module
+{
+    struct ndpi_detection_module_struct * ndpi_struct;
+    unsigned long long int flows;
+    uint8_t retired;
+    uint8_t reserved[7];
 };
 
 /*
@@ -214,7 +297,7 @@ struct nDPId_flow_skipped
  */
 struct nDPId_detection_data
 {
-    uint32_t last_ndpi_flow_struct_hash;
+    struct nDPId_detection_snapshot last_detection_snapshot;
     struct ndpi_proto guessed_l7_protocol;
     struct ndpi_flow_struct flow;
 };
@@ -223,6 +306,12 @@ struct nDPId_flow
 {
     struct nDPId_flow_extended flow_extended;
 
+    /*
+     * Module that detected this flow, kept until the flow is freed (even if it gets replaced by a reload)
+     * as protocol names of finished flows are resolved with it, see release_detection_module().
+     */
+    struct nDPId_detection_module * detection_module;
+
     union
     {
         struct
@@ -243,6 +332,55 @@ struct nDPId_flow
     };
 };
 
+/*
+ * Per prefix processing policy of new flows, see load_policy_file().
+ */
+enum nDPId_flow_policy
+{
+    FLOW_POLICY_SKIP = 0,    // flow is skipped like with -I / -E
+    FLOW_POLICY_TRACK,       // flow events only, no detection
+    FLOW_POLICY_DPI,         // flow and detection events
+    FLOW_POLICY_DPI_PACKETS, // flow, detection and packet events (default)
+
+    FLOW_POLICY_COUNT
+};
+
+struct nDPId_policy_rule
+{
+    uint32_t next; // next rule of the same prefix, 0 if none
+    uint16_t port; // 0 matches any port
+    uint8_t policy;
+    uint8_t reserved_00;
+};
+
+/* binary trie node, a prefix of length N is stored at depth N */
+struct nDPId_policy_node
+{
+    uint32_t child[2]; // 0 if none
+    uint32_t rule;     // first rule of this prefix, 0 if none
+};
+
+/*
+ * Service cache lookup key, the server is the destination of the first packet of a flow.
+ */
+struct nDPId_service_cache_key
+{
+    union nDPId_ip server;
+    uint16_t server_port;
+    uint8_t l4_protocol;
+    uint8_t l3_type;
+};
+
+struct nDPId_service_cache_entry
+{
+    struct nDPId_service_cache_key key;
+    uint8_t valid;
+    uint64_t inserted;
+    uint64_t last_used;
+    struct ndpi_proto l7_protocol;
+    ndpi_confidence_t confidence;
+};
+
 struct nDPId_workflow
 {
     pcap_t * pcap_handle;
@@ -265,6 +403,10 @@ struct nDPId_workflow
     unsigned long long int total_detected_flows;
     unsigned long long int total_flow_detection_updates;
     unsigned long long int total_flow_updates;
+    unsigned long long int total_service_cache_hits;
+
+    /* bytes allocated by libnDPI while the detection module was initialized, see init_detection_module() */
+    uint64_t detection_memory;
 
 #ifdef ENABLE_MEMORY_PROFILING
     uint64_t last_memory_usage_log_time;
@@ -294,8 +436,24 @@ struct nDPId_workflow
 
     unsigned long long int total_events_serialized;
 
+    /* set associative, nDPId_SERVICE_CACHE_WAYS entries per set, see service_cache_lookup() */
+    struct nDPId_service_cache_entry * service_cache;
+
+    /* nDPId_IDLE_SKETCHES open addressed sketches, see idle_sketch_lookup() */
+    struct nDPId_idle_sketch * idle_sketches;
+
+    /* nDPId_SKIPPED_FLOWS_SET_SIZE fingerprints, see skipped_flow_lookup() */
+    struct nDPId_skipped_flow * skipped_flows;
+    size_t skipped_flows_used;
+    size_t skipped_flows_expire_slot;
+    uint8_t skipped_flows_full;
+
     ndpi_serializer ndpi_serializer;
-    struct ndpi_detection_module_struct * ndpi_struct;
+    struct nDPId_detection_module * detection_module;
+
+    /* set by the main thread on SIGHUP, swapped in by the reader thread, see swap_detection_module() */
+    pthread_mutex_t pending_detection_module_mutex;
+    struct nDPId_detection_module * pending_detection_module;
 };
 
 struct nDPId_reader_thread
@@ -305,6 +463,14 @@ struct nDPId_reader_thread
     int collector_sockfd;
     int collector_sock_last_errno;
     size_t array_index;
+
+    /* TCP stream mode (-T) only */
+    int collector_connecting;
+    int collector_reconnecting;
+    uint64_t collector_last_connect_attempt;
+    char * collector_batch;
+    size_t collector_batch_used;
+    unsigned long long int collector_batch_dropped;
 };
 
 enum packet_event
@@ -412,6 +578,21 @@ static char const * const error_event_name_table[ERROR_EVENT_COUNT] = {
     [FLOW_MEMORY_ALLOCATION_FAILED] = "Flow memory allocation failed",
 };
 
+static char const * const flow_policy_name_table[FLOW_POLICY_COUNT] = {
+    [FLOW_POLICY_SKIP] = "skip",
+    [FLOW_POLICY_TRACK] = "track",
+    [FLOW_POLICY_DPI] = "dpi",
+    [FLOW_POLICY_DPI_PACKETS] = "dpi-packets",
+};
+
+static char const * const tunnel_type_name_table[TUNNEL_COUNT] = {
+    [TUNNEL_NONE] = "none",
+    [TUNNEL_IPIP] = "ipip",
+    [TUNNEL_GRE] = "gre",
+    [TUNNEL_VXLAN] = "vxlan",
+    [TUNNEL_GTP] = "gtp",
+};
+
 static char const * const daemon_event_name_table[DAEMON_EVENT_COUNT] = {
     [DAEMON_EVENT_INVALID] = "invalid",
     [DAEMON_EVENT_INIT] = "init",
@@ -423,8 +604,22 @@ static char const * const daemon_event_name_table[DAEMON_EVENT_COUNT] = {
 static struct nDPId_reader_thread reader_threads[nDPId_MAX_READER_THREADS] = {};
 static struct nDPIsrvd_address collector_address;
 static MT_VALUE(nDPId_main_thread_shutdown, int) = MT_INIT(0);
+static MT_VALUE(nDPId_detection_module_reload, int) = MT_INIT(0);
 static MT_VALUE(global_flow_id, uint64_t) = MT_INIT(1);
 static int ip4_interface_avail = 0, ip6_interface_avail = 0;
+static uint64_t startup_time = 0; /* usec spent building the detection modules only */
+
+/* built before the reader threads are started and read-only afterwards */
+static struct
+{
+    struct nDPId_policy_node * nodes;
+    size_t node_count;
+    size_t node_capacity;
+    struct nDPId_policy_rule * rules;
+    size_t rule_count;
+    size_t rule_capacity;
+} policy_table = {};
+static __thread uint64_t detection_memory_bytes = 0;
 
 #ifdef ENABLE_MEMORY_PROFILING
 static MT_VALUE(ndpi_memory_alloc_count, uint64_t) = MT_INIT(0);
@@ -456,7 +651,10 @@ static struct
     char * custom_categories_file;
     char * custom_ja3_file;
     char * custom_sha1_file;
+    char * policy_file;
+    uint8_t decapsulate_tunnels; // bitmask of (1 << enum nDPId_tunnel_type)
     char collector_address[UNIX_PATH_MAX];
+    uint8_t collector_tcp_stream;
 #ifdef ENABLE_ZLIB
     uint8_t enable_zlib_compression;
 #endif
@@ -478,11 +676,18 @@ static struct
     unsigned long long int generic_max_idle_time;
     unsigned long long int icmp_max_idle_time;
     unsigned long long int udp_max_idle_time;
+    unsigned long long int udp_max_transaction_time;
+    unsigned long long int adaptive_min_idle_time;
+    unsigned long long int adaptive_max_idle_time;
     unsigned long long int tcp_max_idle_time;
     unsigned long long int tcp_max_post_end_flow_time;
+    unsigned long long int tcp_max_embryonic_time;
+    unsigned long long int tcp_max_post_close_time;
     unsigned long long int max_packets_per_flow_to_send;
     unsigned long long int max_packets_per_flow_to_process;
     unsigned long long int max_packets_per_flow_to_analyse;
+    unsigned long long int service_cache_size;
+    unsigned long long int service_cache_max_age;
 } nDPId_options = {.pidfile = nDPId_PIDFILE,
                    .user = "nobody",
                    .collector_address = COLLECTOR_UNIX_SOCKET,
@@ -501,11 +706,18 @@ static struct
                    .generic_max_idle_time = nDPId_GENERIC_IDLE_TIME,
                    .icmp_max_idle_time = nDPId_ICMP_IDLE_TIME,
                    .udp_max_idle_time = nDPId_UDP_IDLE_TIME,
+                   .udp_max_transaction_time = nDPId_UDP_TRANSACTION_TIME,
+                   .adaptive_min_idle_time = nDPId_ADAPTIVE_MIN_IDLE_TIME,
+                   .adaptive_max_idle_time = nDPId_ADAPTIVE_MAX_IDLE_TIME,
                    .tcp_max_idle_time = nDPId_TCP_IDLE_TIME,
                    .tcp_max_post_end_flow_time = nDPId_TCP_POST_END_FLOW_TIME,
+                   .tcp_max_embryonic_time = nDPId_TCP_EMBRYONIC_TIME,
+                   .tcp_max_post_close_time = nDPId_TCP_POST_CLOSE_TIME,
                    .max_packets_per_flow_to_send = nDPId_PACKETS_PER_FLOW_TO_SEND,
                    .max_packets_per_flow_to_process = nDPId_PACKETS_PER_FLOW_TO_PROCESS,
-                   .max_packets_per_flow_to_analyse = nDPId_PACKETS_PER_FLOW_TO_ANALYZE};
+                   .max_packets_per_flow_to_analyse = nDPId_PACKETS_PER_FLOW_TO_ANALYZE,
+                   .service_cache_size = nDPId_SERVICE_CACHE_SIZE,
+                   .service_cache_max_age = nDPId_SERVICE_CACHE_MAX_AGE};
 
 enum nDPId_subopts
 {
@@ -524,11 +736,18 @@ enum nDPId_subopts
     GENERIC_MAX_IDLE_TIME,
     ICMP_MAX_IDLE_TIME,
     UDP_MAX_IDLE_TIME,
+    UDP_MAX_TRANSACTION_TIME,
     TCP_MAX_IDLE_TIME,
     TCP_MAX_POST_END_FLOW_TIME,
+    TCP_MAX_EMBRYONIC_TIME,
+    TCP_MAX_POST_CLOSE_TIME,
+    ADAPTIVE_MIN_IDLE_TIME,
+    ADAPTIVE_MAX_IDLE_TIME,
     MAX_PACKETS_PER_FLOW_TO_SEND,
     MAX_PACKETS_PER_FLOW_TO_PROCESS,
     MAX_PACKETS_PER_FLOW_TO_ANALYZE,
+    SERVICE_CACHE_SIZE,
+    SERVICE_CACHE_MAX_AGE,
 };
 static char * const subopt_token[] = {[MAX_FLOWS_PER_THREAD] = "max-flows-per-thread",
                                       [MAX_IDLE_FLOWS_PER_THREAD] = "max-idle-flows-per-thread",
@@ -545,11 +764,18 @@ static char * const subopt_token[] = {[MAX_FLOWS_PER_THREAD] = "max-flows-per-th
                                       [GENERIC_MAX_IDLE_TIME] = "generic-max-idle-time",
                                       [ICMP_MAX_IDLE_TIME] = "icmp-max-idle-time",
                                       [UDP_MAX_IDLE_TIME] = "udp-max-idle-time",
+                                      [UDP_MAX_TRANSACTION_TIME] = "udp-max-transaction-time",
                                       [TCP_MAX_IDLE_TIME] = "tcp-max-idle-time",
                                       [TCP_MAX_POST_END_FLOW_TIME] = "tcp-max-post-end-flow-time",
+                                      [TCP_MAX_EMBRYONIC_TIME] = "tcp-max-embryonic-time",
+                                      [TCP_MAX_POST_CLOSE_TIME] = "tcp-max-post-close-time",
+                                      [ADAPTIVE_MIN_IDLE_TIME] = "adaptive-min-idle-time",
+                                      [ADAPTIVE_MAX_IDLE_TIME] = "adaptive-max-idle-time",
                                       [MAX_PACKETS_PER_FLOW_TO_SEND] = "max-packets-per-flow-to-send",
                                       [MAX_PACKETS_PER_FLOW_TO_PROCESS] = "max-packets-per-flow-to-process",
                                       [MAX_PACKETS_PER_FLOW_TO_ANALYZE] = "max-packets-per-flow-to-analyse",
+                                      [SERVICE_CACHE_SIZE] = "service-cache-size",
+                                      [SERVICE_CACHE_MAX_AGE] = "service-cache-max-age",
                                       NULL};
 
 static void sighandler(int signum);
@@ -1127,6 +1353,7 @@ static void * ndpi_malloc_wrapper(size_t const size)
 
     MT_GET_AND_ADD(ndpi_memory_alloc_count, 1);
     MT_GET_AND_ADD(ndpi_memory_alloc_bytes, size);
+    detection_memory_bytes += size;
 
     return (uint8_t *)p + sizeof(uint64_t);
 }
@@ -1137,6 +1364,7 @@ static void ndpi_free_wrapper(void * const freeable)
 
     MT_GET_AND_ADD(ndpi_memory_free_count, 1);
     MT_GET_AND_ADD(ndpi_memory_free_bytes, *(uint64_t *)p);
+    detection_memory_bytes -= *(uint64_t *)p;
 
     free(p);
 }
@@ -1177,6 +1405,25 @@ static void log_memory_usage(struct nDPId_reader_thread const * const reader_thr
 #endif
     }
 }
+#else
+/* Only installed while the detection modules are initialized, see setup_reader_threads(). */
+static void * ndpi_malloc_startup_wrapper(size_t const size)
+{
+    void * const p = malloc(size);
+
+    if (p != NULL)
+    {
+        detection_memory_bytes += malloc_usable_size(p);
+    }
+
+    return p;
+}
+
+static void ndpi_free_startup_wrapper(void * const freeable)
+{
+    detection_memory_bytes -= malloc_usable_size(freeable);
+    free(freeable);
+}
 #endif
 
 static struct nDPId_workflow * init_workflow(char const * const file_or_device)
@@ -1198,6 +1445,7 @@ static struct nDPId_workflow * init_workflow(char const * const file_or_device)
     }
 
     MT_INIT2(workflow->error_or_eof, 0);
+    pthread_mutex_init(&workflow->pending_detection_module_mutex, NULL);
 
     errno = 0;
     if (access(file_or_device, R_OK) != 0 && errno == ENOENT)
@@ -1248,15 +1496,6 @@ static struct nDPId_workflow * init_workflow(char const * const file_or_device)
         pcap_freecode(&fp);
     }
 
-    ndpi_init_prefs init_prefs = ndpi_no_prefs;
-    workflow->ndpi_struct = ndpi_init_detection_module(init_prefs);
-    if (workflow->ndpi_struct == NULL)
-    {
-        logger_early(1, "%s", "BUG: Could not init ndpi detection module");
-        free_workflow(&workflow);
-        return NULL;
-    }
-
     workflow->total_skipped_flows = 0;
     workflow->total_active_flows = 0;
     workflow->max_active_flows = nDPId_options.max_flows_per_thread;
@@ -1282,38 +1521,148 @@ static struct nDPId_workflow * init_workflow(char const * const file_or_device)
         return NULL;
     }
 
+    if (nDPId_options.process_internal_initial_direction != 0 ||
+        nDPId_options.process_external_initial_direction != 0 || nDPId_options.policy_file != NULL)
+    {
+        workflow->skipped_flows = (struct nDPId_skipped_flow *)ndpi_calloc(nDPId_SKIPPED_FLOWS_SET_SIZE,
+                                                                            sizeof(*workflow->skipped_flows));
+        if (workflow->skipped_flows == NULL)
+        {
+            logger_early(1,
+                         "Could not allocate %zu bytes for skipped flow tracking",
+                         nDPId_SKIPPED_FLOWS_SET_SIZE * sizeof(*workflow->skipped_flows));
+            free_workflow(&workflow);
+            return NULL;
+        }
+    }
+
+    if (nDPId_options.adaptive_min_idle_time > 0)
+    {
+        workflow->idle_sketches =
+            (struct nDPId_idle_sketch *)ndpi_calloc(nDPId_IDLE_SKETCHES, sizeof(*workflow->idle_sketches));
+        if (workflow->idle_sketches == NULL)
+        {
+            logger_early(1,
+                         "Could not allocate %zu bytes for adaptive idle times",
+                         nDPId_IDLE_SKETCHES * sizeof(*workflow->idle_sketches));
+            free_workflow(&workflow);
+            return NULL;
+        }
+    }
+
+    if (nDPId_options.service_cache_size > 0)
+    {
+        workflow->service_cache = (struct nDPId_service_cache_entry *)ndpi_calloc(
+            nDPId_options.service_cache_size, sizeof(*workflow->service_cache));
+        if (workflow->service_cache == NULL)
+        {
+            logger_early(1,
+                         "Could not allocate %llu bytes for the service cache",
+                         nDPId_options.service_cache_size * sizeof(*workflow->service_cache));
+            free_workflow(&workflow);
+            return NULL;
+        }
+    }
+
+    if (ndpi_init_serializer_ll(&workflow->ndpi_serializer, ndpi_serialization_format_json, NETWORK_BUFFER_MAX_SIZE) !=
+        0)
+    {
+        logger_early(1, "BUG: Could not init JSON serializer with buffer size: %u bytes", NETWORK_BUFFER_MAX_SIZE);
+        free_workflow(&workflow);
+        return NULL;
+    }
+
+    return workflow;
+}
+
+/*
+ * Builds a libnDPI detection module with all custom protocol, category, JA3 and SHA1 files loaded.
+ * libnDPI keeps per packet state in the detection module, so every reader thread needs its own.
+ */
+static struct nDPId_detection_module * create_detection_module(void)
+{
+    struct nDPId_detection_module * const detection_module =
+        (struct nDPId_detection_module *)ndpi_calloc(1, sizeof(*detection_module));
+    ndpi_init_prefs init_prefs = ndpi_no_prefs;
+
+    if (detection_module == NULL)
+    {
+        return NULL;
+    }
+
+    detection_module->ndpi_struct = ndpi_init_detection_module(init_prefs);
+    if (detection_module->ndpi_struct == NULL)
+    {
+        logger_early(1, "%s", "BUG: Could not init ndpi detection module");
+        ndpi_free(detection_module);
+        return NULL;
+    }
+
     NDPI_PROTOCOL_BITMASK protos;
     NDPI_BITMASK_SET_ALL(protos);
-    ndpi_set_protocol_detection_bitmask2(workflow->ndpi_struct, &protos);
+    ndpi_set_protocol_detection_bitmask2(detection_module->ndpi_struct, &protos);
     if (nDPId_options.custom_protocols_file != NULL)
     {
-        ndpi_load_protocols_file(workflow->ndpi_struct, nDPId_options.custom_protocols_file);
+        ndpi_load_protocols_file(detection_module->ndpi_struct, nDPId_options.custom_protocols_file);
     }
     if (nDPId_options.custom_categories_file != NULL)
     {
-        ndpi_load_categories_file(workflow->ndpi_struct, nDPId_options.custom_categories_file, NULL);
+        ndpi_load_categories_file(detection_module->ndpi_struct, nDPId_options.custom_categories_file, NULL);
     }
     if (nDPId_options.custom_ja3_file != NULL)
     {
-        ndpi_load_malicious_ja3_file(workflow->ndpi_struct, nDPId_options.custom_ja3_file);
+        ndpi_load_malicious_ja3_file(detection_module->ndpi_struct, nDPId_options.custom_ja3_file);
     }
     if (nDPId_options.custom_sha1_file != NULL)
     {
-        ndpi_load_malicious_sha1_file(workflow->ndpi_struct, nDPId_options.custom_sha1_file);
+        ndpi_load_malicious_sha1_file(detection_module->ndpi_struct, nDPId_options.custom_sha1_file);
     }
-    ndpi_finalize_initialization(workflow->ndpi_struct);
+    ndpi_finalize_initialization(detection_module->ndpi_struct);
 
-    ndpi_set_detection_preferences(workflow->ndpi_struct, ndpi_pref_enable_tls_block_dissection, 1);
+    ndpi_set_detection_preferences(detection_module->ndpi_struct, ndpi_pref_enable_tls_block_dissection, 1);
 
-    if (ndpi_init_serializer_ll(&workflow->ndpi_serializer, ndpi_serialization_format_json, NETWORK_BUFFER_MAX_SIZE) !=
-        0)
+    return detection_module;
+}
+
+static void retire_detection_module(struct nDPId_detection_module * const detection_module)
+{
+    if (detection_module == NULL)
     {
-        logger_early(1, "BUG: Could not init JSON serializer with buffer size: %u bytes", NETWORK_BUFFER_MAX_SIZE);
-        free_workflow(&workflow);
-        return NULL;
+        return;
     }
 
-    return workflow;
+    detection_module->retired = 1;
+    if (detection_module->flows == 0)
+    {
+        ndpi_exit_detection_module(detection_module->ndpi_struct);
+        ndpi_free(detection_module);
+    }
+}
+
+/*
+ * Builds the detection module of a workflow. Loading the custom files and building the automata
+ * does not depend on other workflows and runs in parallel, see setup_reader_threads().
+ */
+static int init_detection_module(struct nDPId_workflow * const workflow)
+{
+    uint64_t const memory_before = detection_memory_bytes;
+
+    workflow->detection_module = create_detection_module();
+    if (workflow->detection_module == NULL)
+    {
+        return 1;
+    }
+
+    workflow->detection_memory = detection_memory_bytes - memory_before;
+
+    return 0;
+}
+
+static void * init_detection_module_thread(void * const arg)
+{
+    struct nDPId_workflow * const workflow = (struct nDPId_workflow *)arg;
+
+    return (init_detection_module(workflow) == 0 ? NULL : workflow);
 }
 
 static void free_analysis_data(struct nDPId_flow_extended * const flow_ext)
@@ -1331,31 +1680,50 @@ static void free_analysis_data(struct nDPId_flow_extended * const flow_ext)
     }
 }
 
-static void free_detection_data(struct nDPId_flow * const flow)
+static void acquire_detection_module(struct nDPId_workflow * const workflow, struct nDPId_flow * const flow)
 {
-    ndpi_free_flow_data(&flow->info.detection_data->flow);
-    ndpi_free(flow->info.detection_data);
-    flow->info.detection_data = NULL;
+    flow->detection_module = workflow->detection_module;
+    flow->detection_module->flows++;
 }
 
-static int alloc_detection_data(struct nDPId_flow * const flow)
+static void release_detection_module(struct nDPId_flow * const flow)
 {
-    flow->info.detection_data = (struct nDPId_detection_data *)ndpi_flow_malloc(sizeof(*flow->info.detection_data));
+    struct nDPId_detection_module * const detection_module = flow->detection_module;
+
+    if (detection_module == NULL)
+    {
+        return;
+    }
+    flow->detection_module = NULL;
+
+    detection_module->flows--;
+    if (detection_module->retired != 0)
+    {
+        retire_detection_module(detection_module);
+    }
+}
 
+static void free_detection_data(struct nDPId_flow * const flow)
+{
     if (flow->info.detection_data == NULL)
     {
-        goto error;
+        return;
     }
 
-    memset(flow->info.detection_data, 0, sizeof(*flow->info.detection_data));
+    ndpi_free_flow_data(&flow->info.detection_data->flow);
+    ndpi_free(flow->info.detection_data);
+    flow->info.detection_data = NULL;
+}
 
+static int alloc_flow_analysis(struct nDPId_flow * const flow)
+{
     if (nDPId_options.enable_data_analysis != 0)
     {
         flow->flow_extended.flow_analysis =
             (struct nDPId_flow_analysis *)ndpi_malloc(sizeof(*flow->flow_extended.flow_analysis));
         if (flow->flow_extended.flow_analysis == NULL)
         {
-            goto error;
+            return 1;
         }
 
         ndpi_init_data_analysis(&flow->flow_extended.flow_analysis->iat[FD_SRC2DST],
@@ -1381,13 +1749,51 @@ static int alloc_detection_data(struct nDPId_flow * const flow)
             flow->flow_extended.flow_analysis->pktlen[FD_SRC2DST].values == NULL ||
             flow->flow_extended.flow_analysis->pktlen[FD_DST2SRC].values == NULL)
         {
-            goto error;
+            return 1;
         }
     }
 
+    return 0;
+}
+
+/*
+ * A service cache hit does not need any detection data. The flow stays in FS_INFO without it
+ * until process_packet() finalizes it after the new and packet events were sent.
+ */
+static int alloc_cached_flow_data(struct nDPId_workflow * const workflow, struct nDPId_flow * const flow)
+{
+    acquire_detection_module(workflow, flow);
+
+    if (alloc_flow_analysis(flow) != 0)
+    {
+        release_detection_module(flow);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int alloc_detection_data(struct nDPId_workflow * const workflow, struct nDPId_flow * const flow)
+{
+    flow->info.detection_data = (struct nDPId_detection_data *)ndpi_flow_malloc(sizeof(*flow->info.detection_data));
+
+    if (flow->info.detection_data == NULL)
+    {
+        return 1;
+    }
+
+    memset(flow->info.detection_data, 0, sizeof(*flow->info.detection_data));
+    acquire_detection_module(workflow, flow);
+
+    if (alloc_flow_analysis(flow) != 0)
+    {
+        goto error;
+    }
+
     return 0;
 error:
     free_detection_data(flow);
+    release_detection_module(flow);
     return 1;
 }
 
@@ -1405,8 +1811,9 @@ static void ndpi_flow_info_free(void * const node)
 
         case FS_FINISHED:
         {
-            struct nDPId_flow_extended * const flow_ext = (struct nDPId_flow_extended *)flow_basic;
-            free_analysis_data(flow_ext);
+            struct nDPId_flow * const flow = (struct nDPId_flow *)flow_basic;
+            free_analysis_data(&flow->flow_extended);
+            release_detection_module(flow);
             break;
         }
 
@@ -1415,6 +1822,7 @@ static void ndpi_flow_info_free(void * const node)
             struct nDPId_flow * const flow = (struct nDPId_flow *)flow_basic;
             free_analysis_data(&flow->flow_extended);
             free_detection_data(flow);
+            release_detection_module(flow);
             break;
         }
     }
@@ -1436,16 +1844,18 @@ static void free_workflow(struct nDPId_workflow ** const workflow)
         w->pcap_handle = NULL;
     }
 
-    if (w->ndpi_struct != NULL)
-    {
-        ndpi_exit_detection_module(w->ndpi_struct);
-    }
     for (size_t i = 0; i < w->max_active_flows; i++)
     {
         ndpi_tdestroy(w->ndpi_flows_active[i], ndpi_flow_info_free);
     }
+    retire_detection_module(w->detection_module);
+    retire_detection_module(w->pending_detection_module);
+    pthread_mutex_destroy(&w->pending_detection_module_mutex);
     ndpi_free(w->ndpi_flows_active);
     ndpi_free(w->ndpi_flows_idle);
+    ndpi_free(w->service_cache);
+    ndpi_free(w->skipped_flows);
+    ndpi_free(w->idle_sketches);
     ndpi_term_serializer(&w->ndpi_serializer);
     ndpi_free(w);
     *workflow = NULL;
@@ -1467,56 +1877,342 @@ static char * get_default_pcapdev(char * errbuf)
     return ifname;
 }
 
-static int setup_reader_threads(void)
+static int policy_table_grow(void ** const array, size_t * const capacity, size_t const used, size_t const size)
 {
-    char pcap_error_buffer[PCAP_ERRBUF_SIZE];
+    if (used < *capacity)
+    {
+        return 0;
+    }
 
-    if (nDPId_options.reader_thread_count > nDPId_MAX_READER_THREADS)
+    size_t const new_capacity = (*capacity == 0 ? 64 : *capacity * 2);
+    void * const new_array = ndpi_realloc(*array, *capacity * size, new_capacity * size);
+    if (new_array == NULL)
     {
         return 1;
     }
+    *array = new_array;
+    *capacity = new_capacity;
 
-    if (nDPId_options.pcap_file_or_interface == NULL)
-    {
-        nDPId_options.pcap_file_or_interface = get_default_pcapdev(pcap_error_buffer);
-        if (nDPId_options.pcap_file_or_interface == NULL)
+    return 0;
+}
+
+static uint8_t policy_addr_bit(uint8_t const * const addr, size_t bit)
+{
+    return (addr[bit / 8] >> (7 - bit % 8)) & 1;
+}
+
+static int policy_table_add(enum nDPId_l3_type l3_type,
+                            uint8_t const * const addr,
+                            size_t prefix_len,
+                            uint16_t port,
+                            enum nDPId_flow_policy policy)
+{
+    /* node 0 is the IPv4 root, node 1 the IPv6 root, rule 0 marks the end of a rule chain */
+    if (policy_table.node_count == 0)
+    {
+        if (policy_table_grow((void **)&policy_table.nodes,
+                              &policy_table.node_capacity,
+                              0,
+                              sizeof(*policy_table.nodes)) != 0 ||
+            policy_table_grow((void **)&policy_table.rules,
+                              &policy_table.rule_capacity,
+                              0,
+                              sizeof(*policy_table.rules)) != 0)
         {
-            logger_early(1, "pcap_lookupdev: %.*s", (int)PCAP_ERRBUF_SIZE, pcap_error_buffer);
             return 1;
         }
-        logger_early(0, "Capturing packets from default device: %s", nDPId_options.pcap_file_or_interface);
+        memset(&policy_table.nodes[0], 0, 2 * sizeof(*policy_table.nodes));
+        memset(&policy_table.rules[0], 0, sizeof(*policy_table.rules));
+        policy_table.node_count = 2;
+        policy_table.rule_count = 1;
     }
 
-    errno = 0;
-    if (access(nDPId_options.pcap_file_or_interface, R_OK) != 0 && errno == ENOENT)
+    uint32_t node = (l3_type == L3_IP ? 0 : 1);
+    for (size_t bit = 0; bit < prefix_len; ++bit)
     {
-        errno = 0;
-        if (get_ip_netmask_from_pcap_dev(nDPId_options.pcap_file_or_interface) != 0)
+        uint8_t const child = policy_addr_bit(addr, bit);
+
+        if (policy_table.nodes[node].child[child] == 0)
         {
-            if (errno != 0)
+            if (policy_table_grow((void **)&policy_table.nodes,
+                                  &policy_table.node_capacity,
+                                  policy_table.node_count,
+                                  sizeof(*policy_table.nodes)) != 0)
             {
-                logger_early(1,
-                             "Could not get netmask for pcap device %s: %s",
-                             nDPId_options.pcap_file_or_interface,
-                             strerror(errno));
+                return 1;
             }
-            return 1;
+            memset(&policy_table.nodes[policy_table.node_count], 0, sizeof(*policy_table.nodes));
+            policy_table.nodes[node].child[child] = policy_table.node_count++;
         }
+        node = policy_table.nodes[node].child[child];
     }
-    else
+
+    if (policy_table_grow((void **)&policy_table.rules,
+                          &policy_table.rule_capacity,
+                          policy_table.rule_count,
+                          sizeof(*policy_table.rules)) != 0)
     {
-        if (nDPId_options.process_internal_initial_direction != 0)
-        {
-            logger_early(1, "%s", "You are processing a PCAP file, `-I' ignored");
-            nDPId_options.process_internal_initial_direction = 0;
-        }
-        if (nDPId_options.process_external_initial_direction != 0)
-        {
-            logger_early(1, "%s", "You are processing a PCAP file, `-E' ignored");
-            nDPId_options.process_external_initial_direction = 0;
+        return 1;
+    }
+    policy_table.rules[policy_table.rule_count].next = policy_table.nodes[node].rule;
+    policy_table.rules[policy_table.rule_count].port = port;
+    policy_table.rules[policy_table.rule_count].policy = policy;
+    policy_table.nodes[node].rule = policy_table.rule_count++;
+
+    return 0;
+}
+
+/*
+ * Returns the policy of the longest prefix containing ip, a rule with a matching port wins over one without.
+ * Returns -1 if there is none.
+ */
+static int policy_table_match(enum nDPId_l3_type l3_type,
+                              union nDPId_ip const * const ip,
+                              uint16_t port,
+                              size_t * const prefix_len)
+{
+    uint8_t const * const addr = (l3_type == L3_IP ? (uint8_t const *)&ip->v4.ip : (uint8_t const *)ip->v6.ip);
+    size_t const max_prefix_len = (l3_type == L3_IP ? 32 : 128);
+    uint32_t node = (l3_type == L3_IP ? 0 : 1);
+    int policy = -1;
+
+    for (size_t bit = 0;; ++bit)
+    {
+        int any_port_policy = -1;
+
+        for (uint32_t rule = policy_table.nodes[node].rule; rule != 0; rule = policy_table.rules[rule].next)
+        {
+            if (policy_table.rules[rule].port == port)
+            {
+                any_port_policy = policy_table.rules[rule].policy;
+                break;
+            }
+            if (policy_table.rules[rule].port == 0)
+            {
+                any_port_policy = policy_table.rules[rule].policy;
+            }
+        }
+        if (any_port_policy >= 0)
+        {
+            policy = any_port_policy;
+            *prefix_len = bit;
+        }
+
+        if (bit == max_prefix_len || policy_table.nodes[node].child[policy_addr_bit(addr, bit)] == 0)
+        {
+            break;
+        }
+        node = policy_table.nodes[node].child[policy_addr_bit(addr, bit)];
+    }
+
+    return policy;
+}
+
+/*
+ * Both endpoints of a new flow are looked up, the more specific match wins (destination on a tie).
+ * Flows without any match are processed as usual.
+ */
+static enum nDPId_flow_policy policy_lookup(struct nDPId_flow_basic const * const flow_basic)
+{
+    size_t src_prefix_len = 0;
+    size_t dst_prefix_len = 0;
+    int const src_policy =
+        policy_table_match(flow_basic->l3_type, &flow_basic->src, flow_basic->src_port, &src_prefix_len);
+    int const dst_policy =
+        policy_table_match(flow_basic->l3_type, &flow_basic->dst, flow_basic->dst_port, &dst_prefix_len);
+
+    if (dst_policy >= 0 && (src_policy < 0 || dst_prefix_len >= src_prefix_len))
+    {
+        return dst_policy;
+    }
+    if (src_policy >= 0)
+    {
+        return src_policy;
+    }
+
+    return FLOW_POLICY_DPI_PACKETS;
+}
+
+static int parse_policy_rule(char * const line, char const * const policy_file, size_t line_number)
+{
+    char * saveptr = NULL;
+    char * const policy_str = strtok_r(line, " \t\r\n", &saveptr);
+    char * const prefix_str = strtok_r(NULL, " \t\r\n", &saveptr);
+    char * const port_str = strtok_r(NULL, " \t\r\n", &saveptr);
+    int policy = -1;
+
+    if (policy_str == NULL || policy_str[0] == '#')
+    {
+        return 0;
+    }
+
+    for (size_t i = 0; i < FLOW_POLICY_COUNT; ++i)
+    {
+        if (strcmp(policy_str, flow_policy_name_table[i]) == 0)
+        {
+            policy = i;
+        }
+    }
+    if (policy < 0 || prefix_str == NULL || strtok_r(NULL, " \t\r\n", &saveptr) != NULL)
+    {
+        logger_early(1, "%s:%zu: expected `<policy> <prefix> [port]'", policy_file, line_number);
+        return 1;
+    }
+
+    char * const prefix_len_str = strchr(prefix_str, '/');
+    if (prefix_len_str != NULL)
+    {
+        *prefix_len_str = '\0';
+    }
+
+    uint8_t addr[16];
+    enum nDPId_l3_type l3_type;
+    size_t max_prefix_len;
+    if (inet_pton(AF_INET, prefix_str, addr) == 1)
+    {
+        l3_type = L3_IP;
+        max_prefix_len = 32;
+    }
+    else if (inet_pton(AF_INET6, prefix_str, addr) == 1)
+    {
+        l3_type = L3_IP6;
+        max_prefix_len = 128;
+    }
+    else
+    {
+        logger_early(1, "%s:%zu: invalid address `%s'", policy_file, line_number, prefix_str);
+        return 1;
+    }
+
+    size_t prefix_len = max_prefix_len;
+    if (prefix_len_str != NULL)
+    {
+        char * endptr = NULL;
+        prefix_len = strtoul(prefix_len_str + 1, &endptr, 10);
+        if (prefix_len_str[1] == '\0' || *endptr != '\0' || prefix_len > max_prefix_len)
+        {
+            logger_early(1, "%s:%zu: invalid prefix length `%s'", policy_file, line_number, prefix_len_str + 1);
+            return 1;
+        }
+    }
+
+    unsigned long int port = 0;
+    if (port_str != NULL)
+    {
+        char * endptr = NULL;
+        port = strtoul(port_str, &endptr, 10);
+        if (*endptr != '\0' || port == 0 || port > 65535)
+        {
+            logger_early(1, "%s:%zu: invalid port `%s'", policy_file, line_number, port_str);
+            return 1;
+        }
+    }
+
+    if (policy_table_add(l3_type, addr, prefix_len, port, policy) != 0)
+    {
+        logger_early(1, "%s:%zu: could not allocate memory for the policy table", policy_file, line_number);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int load_policy_file(char const * const policy_file)
+{
+    FILE * const fp = fopen(policy_file, "r");
+    char * line = NULL;
+    size_t line_size = 0;
+    size_t line_number = 0;
+    int retval = 0;
+
+    if (fp == NULL)
+    {
+        logger_early(1, "Could not open policy file %s: %s", policy_file, strerror(errno));
+        return 1;
+    }
+
+    while (retval == 0 && getline(&line, &line_size, fp) > 0)
+    {
+        retval = parse_policy_rule(line, policy_file, ++line_number);
+    }
+
+    free(line);
+    fclose(fp);
+
+    if (retval == 0)
+    {
+        logger_early(0,
+                     "Loaded %zu policy rules from %s",
+                     (policy_table.rule_count > 0 ? policy_table.rule_count - 1 : 0),
+                     policy_file);
+    }
+
+    return retval;
+}
+
+static void free_policy_table(void)
+{
+    ndpi_free(policy_table.nodes);
+    ndpi_free(policy_table.rules);
+    memset(&policy_table, 0, sizeof(policy_table));
+}
+
+static int setup_reader_threads(void)
+{
+    char pcap_error_buffer[PCAP_ERRBUF_SIZE];
+
+    if (nDPId_options.reader_thread_count > nDPId_MAX_READER_THREADS)
+    {
+        return 1;
+    }
+
+    if (nDPId_options.pcap_file_or_interface == NULL)
+    {
+        nDPId_options.pcap_file_or_interface = get_default_pcapdev(pcap_error_buffer);
+        if (nDPId_options.pcap_file_or_interface == NULL)
+        {
+            logger_early(1, "pcap_lookupdev: %.*s", (int)PCAP_ERRBUF_SIZE, pcap_error_buffer);
+            return 1;
+        }
+        logger_early(0, "Capturing packets from default device: %s", nDPId_options.pcap_file_or_interface);
+    }
+
+    errno = 0;
+    if (access(nDPId_options.pcap_file_or_interface, R_OK) != 0 && errno == ENOENT)
+    {
+        errno = 0;
+        if (get_ip_netmask_from_pcap_dev(nDPId_options.pcap_file_or_interface) != 0)
+        {
+            if (errno != 0)
+            {
+                logger_early(1,
+                             "Could not get netmask for pcap device %s: %s",
+                             nDPId_options.pcap_file_or_interface,
+                             strerror(errno));
+            }
+            return 1;
         }
     }
+    else
+    {
+        if (nDPId_options.process_internal_initial_direction != 0)
+        {
+            logger_early(1, "%s", "You are processing a PCAP file, `-I' ignored");
+            nDPId_options.process_internal_initial_direction = 0;
+        }
+        if (nDPId_options.process_external_initial_direction != 0)
+        {
+            logger_early(1, "%s", "You are processing a PCAP file, `-E' ignored");
+            nDPId_options.process_external_initial_direction = 0;
+        }
+    }
+
+    if (nDPId_options.policy_file != NULL && load_policy_file(nDPId_options.policy_file) != 0)
+    {
+        return 1;
+    }
 
+    /* libpcap is not guaranteed to be thread safe, capture handles and filters are set up serially */
     for (unsigned long long int i = 0; i < nDPId_options.reader_thread_count; ++i)
     {
         reader_threads[i].workflow = init_workflow(nDPId_options.pcap_file_or_interface);
@@ -1526,6 +2222,63 @@ static int setup_reader_threads(void)
         }
     }
 
+#ifndef ENABLE_MEMORY_PROFILING
+    set_ndpi_malloc(ndpi_malloc_startup_wrapper);
+    set_ndpi_free(ndpi_free_startup_wrapper);
+#endif
+
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    /*
+     * The first detection module is built alone, libnDPI does some one-time global initialization.
+     * All others are built by one thread each.
+     */
+    int retval = init_detection_module(reader_threads[0].workflow);
+    pthread_t init_threads[nDPId_MAX_READER_THREADS];
+    int init_thread_started[nDPId_MAX_READER_THREADS] = {};
+
+    for (unsigned long long int i = 1; retval == 0 && i < nDPId_options.reader_thread_count; ++i)
+    {
+        if (pthread_create(&init_threads[i], NULL, init_detection_module_thread, reader_threads[i].workflow) == 0)
+        {
+            init_thread_started[i] = 1;
+        }
+        else if (init_detection_module(reader_threads[i].workflow) != 0)
+        {
+            retval = 1;
+        }
+    }
+    for (unsigned long long int i = 1; i < nDPId_options.reader_thread_count; ++i)
+    {
+        void * thread_retval = NULL;
+
+        if (init_thread_started[i] != 0 &&
+            (pthread_join(init_threads[i], &thread_retval) != 0 || thread_retval != NULL))
+        {
+            retval = 1;
+        }
+    }
+
+#ifndef ENABLE_MEMORY_PROFILING
+    set_ndpi_malloc(NULL);
+    set_ndpi_free(NULL);
+#endif
+
+    if (retval != 0)
+    {
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    startup_time = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000ull + (end.tv_nsec - start.tv_nsec) / 1000;
+    logger_early(0,
+                 "Initialized %llu detection modules in %llu ms, detection memory per thread: %llu bytes",
+                 nDPId_options.reader_thread_count,
+                 (unsigned long long int)startup_time / 1000,
+                 (unsigned long long int)reader_threads[0].workflow->detection_memory);
+
     return 0;
 }
 
@@ -1578,69 +2331,391 @@ static int ip_tuples_compare(struct nDPId_flow_basic const * const A, struct nDP
         }
     }
 
-    if (A->src_port < B->src_port)
+    if (A->src_port < B->src_port)
+    {
+        return -1;
+    }
+    if (A->src_port > B->src_port)
+    {
+        return 1;
+    }
+    if (A->dst_port < B->dst_port)
+    {
+        return -1;
+    }
+    if (A->dst_port > B->dst_port)
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+static uint64_t get_l4_protocol_idle_time(uint8_t l4_protocol)
+{
+    switch (l4_protocol)
+    {
+        case IPPROTO_ICMP:
+        case IPPROTO_ICMPV6:
+            return nDPId_options.icmp_max_idle_time;
+        case IPPROTO_TCP:
+            return nDPId_options.tcp_max_idle_time;
+        case IPPROTO_UDP:
+            return nDPId_options.udp_max_idle_time;
+        default:
+            return nDPId_options.generic_max_idle_time;
+    }
+}
+
+static size_t idle_sketch_bucket(uint64_t iat)
+{
+    uint64_t const msec = iat / 1000u;
+
+    if (msec < 4u)
+    {
+        return msec;
+    }
+
+    int const msb = 63 - __builtin_clzll(msec);
+    size_t const bucket = (size_t)(msb - 1) * 4u + ((msec >> (msb - 2)) & 3u);
+
+    return (bucket < nDPId_IDLE_SKETCH_BUCKETS ? bucket : nDPId_IDLE_SKETCH_BUCKETS - 1);
+}
+
+/* Upper bound of all gaps counted in a bucket in usec. */
+static uint64_t idle_sketch_bucket_limit(size_t bucket)
+{
+    if (bucket < 4u)
+    {
+        return (bucket + 1u) * 1000u;
+    }
+
+    return (uint64_t)(5u + bucket % 4u) * 1000u << (bucket / 4u - 1u);
+}
+
+static uint16_t idle_sketch_l7_protocol(struct nDPId_flow_extended const * const flow_ext)
+{
+    return (flow_ext->detected_l7_protocol.app_protocol != NDPI_PROTOCOL_UNKNOWN
+                ? flow_ext->detected_l7_protocol.app_protocol
+                : flow_ext->detected_l7_protocol.master_protocol);
+}
+
+/* Returns NULL if adaptive idle times are disabled or all sketches are in use and `add' is not set. */
+static struct nDPId_idle_sketch * idle_sketch_lookup(struct nDPId_workflow * const workflow,
+                                                     uint16_t l7_protocol,
+                                                     uint8_t l4_protocol,
+                                                     int add)
+{
+    if (workflow->idle_sketches == NULL)
+    {
+        return NULL;
+    }
+
+    size_t const start = ((size_t)l7_protocol * 31u + l4_protocol) & (nDPId_IDLE_SKETCHES - 1);
+    for (size_t i = 0; i < nDPId_IDLE_SKETCHES; ++i)
+    {
+        struct nDPId_idle_sketch * const sketch = &workflow->idle_sketches[(start + i) & (nDPId_IDLE_SKETCHES - 1)];
+
+        if (sketch->used == 0)
+        {
+            if (add == 0)
+            {
+                return NULL;
+            }
+            sketch->used = 1;
+            sketch->l7_protocol = l7_protocol;
+            sketch->l4_protocol = l4_protocol;
+            return sketch;
+        }
+        if (sketch->l7_protocol == l7_protocol && sketch->l4_protocol == l4_protocol)
+        {
+            return sketch;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Adds the largest packet gap of a flow which is about to be free'd to the sketch of its protocols.
+ * The idle time is the nDPId_IDLE_SKETCH_QUANTILE of all gaps times nDPId_IDLE_SKETCH_FACTOR,
+ * clamped to `adaptive-min-idle-time' and `adaptive-max-idle-time'.
+ * Gaps longer than the idle time in use split a flow and are never seen, so the sketch is biased towards
+ * shorter idle times. The learned value never drops below 1/nDPId_IDLE_SKETCH_FLOOR_DIVISOR of the static
+ * idle time of the layer 4 protocol to stop it from shrinking round after round.
+ * Counting expiries as (censored) gaps of the idle time instead would not work: most flows end by expiry.
+ */
+static void idle_sketch_add(struct nDPId_workflow * const workflow, struct nDPId_flow_extended const * const flow_ext)
+{
+    uint16_t const l7_protocol = idle_sketch_l7_protocol(flow_ext);
+
+    if (l7_protocol == NDPI_PROTOCOL_UNKNOWN ||
+        flow_ext->packets_processed[FD_SRC2DST] + flow_ext->packets_processed[FD_DST2SRC] < 2)
+    {
+        return;
+    }
+
+    struct nDPId_idle_sketch * const sketch =
+        idle_sketch_lookup(workflow, l7_protocol, flow_ext->flow_basic.l4_protocol, 1);
+    if (sketch == NULL)
+    {
+        return;
+    }
+
+    if (sketch->samples == nDPId_IDLE_SKETCH_DECAY)
+    {
+        sketch->samples = 0;
+        for (size_t i = 0; i < nDPId_IDLE_SKETCH_BUCKETS; ++i)
+        {
+            sketch->buckets[i] /= 2;
+            sketch->samples += sketch->buckets[i];
+        }
+    }
+    sketch->buckets[idle_sketch_bucket(flow_ext->max_iat)]++;
+    sketch->samples++;
+
+    if (sketch->samples < nDPId_IDLE_SKETCH_MIN_SAMPLES && sketch->idle_time == 0)
+    {
+        return;
+    }
+
+    uint32_t const rank = (sketch->samples * nDPId_IDLE_SKETCH_QUANTILE + 99u) / 100u;
+    uint32_t seen = 0;
+    size_t bucket = 0;
+    for (; bucket < nDPId_IDLE_SKETCH_BUCKETS - 1; ++bucket)
+    {
+        seen += sketch->buckets[bucket];
+        if (seen >= rank)
+        {
+            break;
+        }
+    }
+
+    uint64_t const floor_idle_time =
+        get_l4_protocol_idle_time(flow_ext->flow_basic.l4_protocol) / nDPId_IDLE_SKETCH_FLOOR_DIVISOR;
+    sketch->idle_time = idle_sketch_bucket_limit(bucket) * nDPId_IDLE_SKETCH_FACTOR;
+    if (sketch->idle_time < floor_idle_time)
+    {
+        sketch->idle_time = floor_idle_time;
+    }
+    if (sketch->idle_time < nDPId_options.adaptive_min_idle_time)
+    {
+        sketch->idle_time = nDPId_options.adaptive_min_idle_time;
+    }
+    if (sketch->idle_time > nDPId_options.adaptive_max_idle_time)
+    {
+        sketch->idle_time = nDPId_options.adaptive_max_idle_time;
+    }
+}
+
+static uint64_t get_flow_idle_time(struct nDPId_workflow * const workflow,
+                                   struct nDPId_flow_basic const * const flow_basic)
+{
+    if (flow_basic->udp_transaction_done != 0)
+    {
+        return nDPId_options.udp_max_transaction_time;
+    }
+
+    switch ((enum nDPId_tcp_state)flow_basic->tcp_state)
+    {
+        case TCP_STATE_NONE:
+        case TCP_STATE_ESTABLISHED:
+            break;
+        case TCP_STATE_SYN_SENT:
+        case TCP_STATE_SYN_RECEIVED:
+            return nDPId_options.tcp_max_embryonic_time;
+        case TCP_STATE_CLOSING:
+            return nDPId_options.tcp_max_post_end_flow_time;
+        case TCP_STATE_CLOSED:
+            return nDPId_options.tcp_max_post_close_time;
+    }
+
+    /* every flow in the active trees is a struct nDPId_flow, see add_new_flow() */
+    struct nDPId_idle_sketch const * const sketch =
+        idle_sketch_lookup(workflow,
+                           idle_sketch_l7_protocol((struct nDPId_flow_extended const *)flow_basic),
+                           flow_basic->l4_protocol,
+                           0);
+    if (sketch != NULL && sketch->idle_time != 0)
+    {
+        return sketch->idle_time;
+    }
+
+    return get_l4_protocol_idle_time(flow_basic->l4_protocol);
+}
+
+/*
+ * Idle time announced to clients as `flow_idle_time', clients free flows that were idle for longer.
+ * Never less than the static idle time of the layer 4 protocol, but a learned (adaptive) idle time may exceed it.
+ */
+static uint64_t get_flow_idle_time_external(struct nDPId_workflow * const workflow,
+                                            struct nDPId_flow_basic const * const flow_basic)
+{
+    uint64_t idle_time = get_flow_idle_time(workflow, flow_basic);
+
+    if (idle_time < get_l4_protocol_idle_time(flow_basic->l4_protocol))
+    {
+        idle_time = get_l4_protocol_idle_time(flow_basic->l4_protocol);
+    }
+    idle_time += nDPId_options.flow_scan_interval * 2;
+    if (flow_basic->l4_protocol == IPPROTO_TCP)
+    {
+        idle_time += nDPId_options.tcp_max_post_end_flow_time;
+    }
+
+    return idle_time;
+}
+
+static int is_l4_protocol_timed_out(struct nDPId_workflow * const workflow,
+                                    struct nDPId_flow_basic const * const flow_basic)
+{
+    return get_last_pkt_time(flow_basic) + get_flow_idle_time(workflow, flow_basic) <= workflow->last_thread_time;
+}
+
+/*
+ * A RST only closes a flow if it could have been accepted by the receiver (RFC 5961 3.2), otherwise any spoofed
+ * or stray RST would end the flow early. As the receive window is unknown, a RST is accepted if its sequence number is
+ * at most nDPId_TCP_RST_SEQ_WINDOW ahead of the sender's next sequence number. A RST from a direction that did not send
+ * anything before (e.g. a refused SYN) has to acknowledge everything sent by the other direction (RFC 793 SYN-SENT).
+ */
+static int tcp_rst_valid(struct nDPId_flow_basic const * const flow_basic,
+                         struct ndpi_tcphdr const * const tcp,
+                         enum nDPId_flow_direction direction)
+{
+    enum nDPId_flow_direction const peer = (direction == FD_SRC2DST ? FD_DST2SRC : FD_SRC2DST);
+
+    if ((flow_basic->tcp_seq_seen & (1u << direction)) != 0)
+    {
+        return (uint32_t)(ntohl(tcp->seq) - flow_basic->tcp_next_seq[direction]) < nDPId_TCP_RST_SEQ_WINDOW;
+    }
+
+    return tcp->ack != 0 && (flow_basic->tcp_seq_seen & (1u << peer)) != 0 &&
+           ntohl(tcp->ack_seq) == flow_basic->tcp_next_seq[peer];
+}
+
+/*
+ * Follows the TCP connection of a flow to choose its timeout, see get_flow_idle_time().
+ * A valid RST (see tcp_rst_valid()) or two acknowledged FINs close the flow,
+ * it is free'd with the next flow scan after `tcp-max-post-close-time'.
+ * A flow that never completed the handshake (only SYNs / SYN-ACKs without payload) times out after
+ * `tcp-max-embryonic-time'.
+ * Flows without a SYN (midstream) are considered established.
+ */
+static void tcp_state_update(struct nDPId_flow_basic * const flow_basic,
+                             struct ndpi_tcphdr const * const tcp,
+                             enum nDPId_flow_direction direction,
+                             uint16_t l4_payload_len)
+{
+    enum nDPId_flow_direction const peer = (direction == FD_SRC2DST ? FD_DST2SRC : FD_SRC2DST);
+
+    if (flow_basic->tcp_state == TCP_STATE_CLOSED)
+    {
+        return;
+    }
+    if (tcp->rst != 0)
+    {
+        if (tcp_rst_valid(flow_basic, tcp, direction) != 0)
+        {
+            flow_basic->tcp_state = TCP_STATE_CLOSED;
+        }
+        return;
+    }
+
     {
-        return -1;
+        /* SYN and FIN occupy one sequence number each */
+        uint32_t const next_seq = ntohl(tcp->seq) + l4_payload_len + tcp->syn + tcp->fin;
+
+        if ((flow_basic->tcp_seq_seen & (1u << direction)) == 0 ||
+            (int32_t)(next_seq - flow_basic->tcp_next_seq[direction]) > 0)
+        {
+            flow_basic->tcp_seq_seen |= (1u << direction);
+            flow_basic->tcp_next_seq[direction] = next_seq;
+        }
     }
-    if (A->src_port > B->src_port)
+
+    switch ((enum nDPId_tcp_state)flow_basic->tcp_state)
     {
-        return 1;
+        case TCP_STATE_NONE:
+            if (tcp->syn == 0)
+            {
+                flow_basic->tcp_state = TCP_STATE_ESTABLISHED;
+            }
+            else
+            {
+                flow_basic->tcp_state = (tcp->ack == 0 ? TCP_STATE_SYN_SENT : TCP_STATE_SYN_RECEIVED);
+            }
+            break;
+        case TCP_STATE_SYN_SENT:
+        case TCP_STATE_SYN_RECEIVED:
+            /*
+             * Any non-SYN packet that acknowledges something or carries payload completes the handshake.
+             * With asymmetric captures the other direction is never seen, the client ACK / payload is enough.
+             */
+            if (tcp->syn == 0 && (tcp->ack != 0 || l4_payload_len > 0))
+            {
+                flow_basic->tcp_state = TCP_STATE_ESTABLISHED;
+            }
+            else if (tcp->syn != 0 && tcp->ack != 0 && direction == FD_DST2SRC)
+            {
+                flow_basic->tcp_state = TCP_STATE_SYN_RECEIVED;
+            }
+            break;
+        case TCP_STATE_ESTABLISHED:
+        case TCP_STATE_CLOSING:
+        case TCP_STATE_CLOSED:
+            break;
     }
-    if (A->dst_port < B->dst_port)
+
+    if (tcp->ack != 0 && (flow_basic->tcp_fin_seen & (1u << peer)) != 0 &&
+        (int32_t)(ntohl(tcp->ack_seq) - flow_basic->tcp_fin_ack_seq[peer]) >= 0)
     {
-        return -1;
+        flow_basic->tcp_fin_acked |= (1u << peer);
     }
-    if (A->dst_port > B->dst_port)
+    if (tcp->fin != 0 && (flow_basic->tcp_fin_seen & (1u << direction)) == 0)
     {
-        return 1;
+        /* the FIN occupies one sequence number after the payload */
+        flow_basic->tcp_fin_seen |= (1u << direction);
+        flow_basic->tcp_fin_ack_seq[direction] = ntohl(tcp->seq) + l4_payload_len + 1;
+        flow_basic->tcp_state = TCP_STATE_CLOSING;
     }
 
-    return 0;
-}
-
-static uint64_t get_l4_protocol_idle_time(uint8_t l4_protocol)
-{
-    switch (l4_protocol)
+    if (flow_basic->tcp_fin_acked == 0x03)
     {
-        case IPPROTO_ICMP:
-        case IPPROTO_ICMPV6:
-            return nDPId_options.icmp_max_idle_time;
-        case IPPROTO_TCP:
-            return nDPId_options.tcp_max_idle_time;
-        case IPPROTO_UDP:
-            return nDPId_options.udp_max_idle_time;
-        default:
-            return nDPId_options.generic_max_idle_time;
+        flow_basic->tcp_state = TCP_STATE_CLOSED;
     }
 }
 
-static uint64_t get_l4_protocol_idle_time_external(uint8_t l4_protocol)
+/*
+ * A finished UDP flow of a request/response protocol is done as soon as both directions were seen.
+ * It times out after `udp-max-transaction-time' instead of `udp-max-idle-time', `0' disables this.
+ */
+static void udp_transaction_update(struct nDPId_flow * const flow)
 {
-    uint64_t idle_time = get_l4_protocol_idle_time(l4_protocol);
+    static uint16_t const transaction_protocols[] = {
+        NDPI_PROTOCOL_DNS, NDPI_PROTOCOL_NTP, NDPI_PROTOCOL_SNMP, NDPI_PROTOCOL_RADIUS};
+    struct nDPId_flow_extended * const flow_ext = &flow->flow_extended;
 
-    idle_time += nDPId_options.flow_scan_interval * 2;
-    if (l4_protocol == IPPROTO_TCP)
+    if (nDPId_options.udp_max_transaction_time == 0 || flow_ext->flow_basic.l4_protocol != IPPROTO_UDP ||
+        flow_ext->flow_basic.state != FS_FINISHED || flow_ext->flow_basic.udp_transaction_done != 0 ||
+        flow_ext->packets_processed[FD_SRC2DST] == 0 || flow_ext->packets_processed[FD_DST2SRC] == 0)
     {
-        idle_time += nDPId_options.tcp_max_post_end_flow_time;
+        return;
+    }
+    /* guessed protocols are not reliable enough to end a flow early */
+    if (flow->finished.confidence != NDPI_CONFIDENCE_DPI && flow->finished.confidence != NDPI_CONFIDENCE_DPI_CACHE)
+    {
+        return;
     }
 
-    return idle_time;
-}
-
-static int is_l4_protocol_timed_out(struct nDPId_workflow const * const workflow,
-                                    struct nDPId_flow_basic const * const flow_basic)
-{
-    uint64_t itime = get_l4_protocol_idle_time(flow_basic->l4_protocol);
-
-    return flow_basic->tcp_fin_rst_seen == 1 || get_last_pkt_time(flow_basic) + itime <= workflow->last_thread_time;
-}
-
-static int is_tcp_post_end(struct nDPId_workflow const * const workflow,
-                           struct nDPId_flow_basic const * const flow_basic)
-{
-    return flow_basic->l4_protocol != IPPROTO_TCP || flow_basic->tcp_fin_rst_seen == 0 ||
-           (flow_basic->tcp_fin_rst_seen == 1 &&
-            get_last_pkt_time(flow_basic) + nDPId_options.tcp_max_post_end_flow_time <= workflow->last_thread_time);
+    for (size_t i = 0; i < sizeof(transaction_protocols) / sizeof(transaction_protocols[0]); ++i)
+    {
+        if (flow_ext->detected_l7_protocol.master_protocol == transaction_protocols[i] ||
+            flow_ext->detected_l7_protocol.app_protocol == transaction_protocols[i])
+        {
+            flow_ext->flow_basic.udp_transaction_done = 1;
+            return;
+        }
+    }
 }
 
 static int is_flow_update_required(struct nDPId_workflow const * const workflow,
@@ -1676,22 +2751,19 @@ static void ndpi_idle_scan_walker(void const * const A, ndpi_VISIT which, int de
     {
         if (is_l4_protocol_timed_out(workflow, flow_basic) != 0)
         {
-            if (is_tcp_post_end(workflow, flow_basic) != 0)
+            workflow->ndpi_flows_idle[workflow->cur_idle_flows++] = flow_basic;
+            switch (flow_basic->state)
             {
-                workflow->ndpi_flows_idle[workflow->cur_idle_flows++] = flow_basic;
-                switch (flow_basic->state)
-                {
-                    case FS_UNKNOWN:
-                    case FS_COUNT:
+                case FS_UNKNOWN:
+                case FS_COUNT:
 
-                    case FS_SKIPPED:
-                        break;
+                case FS_SKIPPED:
+                    break;
 
-                    case FS_FINISHED:
-                    case FS_INFO:
-                        workflow->total_idle_flows++;
-                        break;
-                }
+                case FS_FINISHED:
+                case FS_INFO:
+                    workflow->total_idle_flows++;
+                    break;
             }
         }
     }
@@ -1721,6 +2793,15 @@ static int ndpi_workflow_node_cmp(void const * const A, void const * const B)
         return 1;
     }
 
+    if (flow_basic_a->tunnel_key < flow_basic_b->tunnel_key)
+    {
+        return -1;
+    }
+    else if (flow_basic_a->tunnel_key > flow_basic_b->tunnel_key)
+    {
+        return 1;
+    }
+
     return ip_tuples_compare(flow_basic_a, flow_basic_b);
 }
 
@@ -1753,6 +2834,7 @@ static void process_idle_flow(struct nDPId_reader_thread * const reader_thread,
                 {
                     jsonize_flow_event(reader_thread, &flow->flow_extended, FLOW_EVENT_IDLE);
                 }
+                idle_sketch_add(workflow, &flow->flow_extended);
                 break;
             }
 
@@ -1778,11 +2860,14 @@ static void process_idle_flow(struct nDPId_reader_thread * const reader_thread,
                 {
                     uint8_t protocol_was_guessed = 0;
 
-                    if (ndpi_is_protocol_detected(workflow->ndpi_struct,
+                    if (ndpi_is_protocol_detected(flow->detection_module->ndpi_struct,
                                                   flow->info.detection_data->guessed_l7_protocol) == 0)
                     {
-                        flow->info.detection_data->guessed_l7_protocol = ndpi_detection_giveup(
-                            workflow->ndpi_struct, &flow->info.detection_data->flow, 1, &protocol_was_guessed);
+                        flow->info.detection_data->guessed_l7_protocol =
+                            ndpi_detection_giveup(flow->detection_module->ndpi_struct,
+                                                  &flow->info.detection_data->flow,
+                                                  1,
+                                                  &protocol_was_guessed);
                     }
                     else
                     {
@@ -1808,6 +2893,7 @@ static void process_idle_flow(struct nDPId_reader_thread * const reader_thread,
                 {
                     jsonize_flow_event(reader_thread, &flow->flow_extended, FLOW_EVENT_IDLE);
                 }
+                idle_sketch_add(workflow, &flow->flow_extended);
                 break;
             }
         }
@@ -1960,6 +3046,37 @@ static void jsonize_basic(struct nDPId_reader_thread * const reader_thread, int
     ndpi_serialize_string_string(&workflow->ndpi_serializer, "alias", nDPId_options.instance_alias);
 }
 
+static void jsonize_idle_sketches(struct nDPId_workflow * const workflow)
+{
+    ndpi_serialize_start_of_block(&workflow->ndpi_serializer, "adaptive-idle-times");
+    for (size_t i = 0; i < nDPId_IDLE_SKETCHES; ++i)
+    {
+        struct nDPId_idle_sketch const * const sketch = &workflow->idle_sketches[i];
+        char key[64];
+
+        if (sketch->used == 0 || sketch->idle_time == 0)
+        {
+            continue;
+        }
+
+        char const * const l7_name = ndpi_get_proto_name(workflow->detection_module->ndpi_struct, sketch->l7_protocol);
+        switch (sketch->l4_protocol)
+        {
+            case IPPROTO_TCP:
+                snprintf(key, sizeof(key), "tcp.%s", l7_name);
+                break;
+            case IPPROTO_UDP:
+                snprintf(key, sizeof(key), "udp.%s", l7_name);
+                break;
+            default:
+                snprintf(key, sizeof(key), "%u.%s", sketch->l4_protocol, l7_name);
+                break;
+        }
+        ndpi_serialize_string_uint64(&workflow->ndpi_serializer, key, sketch->idle_time);
+    }
+    ndpi_serialize_end_of_block(&workflow->ndpi_serializer);
+}
+
 static void jsonize_daemon(struct nDPId_reader_thread * const reader_thread, enum daemon_event event)
 {
     char const ev[] = "daemon_event_name";
@@ -2023,6 +3140,11 @@ static void jsonize_daemon(struct nDPId_reader_thread * const reader_thread, enu
             ndpi_serialize_string_uint64(&workflow->ndpi_serializer,
                                          "max-packets-per-flow-to-analyse",
                                          nDPId_options.max_packets_per_flow_to_analyse);
+#ifndef NO_MAIN
+            /* Startup time and memory usage vary from run to run. Due to this, `nDPId-test' would be inconsistent. */
+            ndpi_serialize_string_uint64(&workflow->ndpi_serializer, "startup-time", startup_time);
+            ndpi_serialize_string_uint64(&workflow->ndpi_serializer, "detection-memory", workflow->detection_memory);
+#endif
             break;
 
         case DAEMON_EVENT_STATUS:
@@ -2075,6 +3197,10 @@ static void jsonize_daemon(struct nDPId_reader_thread * const reader_thread, enu
                                          "total-events-serialized",
                                          workflow->total_events_serialized +
                                              1 /* DAEMON_EVENT_SHUTDOWN is an event as well */);
+            if (workflow->idle_sketches != NULL)
+            {
+                jsonize_idle_sketches(workflow);
+            }
             break;
     }
     ndpi_serialize_string_uint64(&workflow->ndpi_serializer, "global_ts_usec", workflow->last_global_time);
@@ -2102,7 +3228,7 @@ static void jsonize_flow(struct nDPId_workflow * const workflow, struct nDPId_fl
                                  flow_ext->flow_basic.last_pkt_time[FD_DST2SRC]);
     ndpi_serialize_string_uint64(&workflow->ndpi_serializer,
                                  "flow_idle_time",
-                                 get_l4_protocol_idle_time_external(flow_ext->flow_basic.l4_protocol));
+                                 get_flow_idle_time_external(workflow, &flow_ext->flow_basic));
     ndpi_serialize_string_uint64(&workflow->ndpi_serializer,
                                  "flow_src_min_l4_payload_len",
                                  flow_ext->min_l4_payload_len[FD_SRC2DST]);
@@ -2122,17 +3248,36 @@ static void jsonize_flow(struct nDPId_workflow * const workflow, struct nDPId_fl
                                  "flow_dst_tot_l4_payload_len",
                                  flow_ext->total_l4_payload_len[FD_DST2SRC]);
     ndpi_serialize_string_uint32(&workflow->ndpi_serializer, "midstream", flow_ext->flow_basic.tcp_is_midstream_flow);
+    if (flow_ext->tunnel_type != TUNNEL_NONE)
+    {
+        ndpi_serialize_string_string(
+            &workflow->ndpi_serializer, "flow_tunnel", tunnel_type_name_table[flow_ext->tunnel_type]);
+        ndpi_serialize_string_uint32(&workflow->ndpi_serializer, "flow_tunnel_id", flow_ext->tunnel_id);
+    }
     ndpi_serialize_string_uint64(&workflow->ndpi_serializer, "thread_ts_usec", workflow->last_thread_time);
 }
 
+static void get_current_time(struct timeval * const tval)
+{
+    gettimeofday(tval, NULL);
+}
+
+static int is_collector_tcp_stream(void)
+{
+    return nDPId_options.collector_tcp_stream != 0 &&
+           (collector_address.raw.sa_family == AF_INET || collector_address.raw.sa_family == AF_INET6);
+}
+
 static int connect_to_collector(struct nDPId_reader_thread * const reader_thread)
 {
     if (reader_thread->collector_sockfd >= 0)
     {
         close(reader_thread->collector_sockfd);
     }
+    reader_thread->collector_connecting = 0;
 
-    int sock_type = (collector_address.raw.sa_family == AF_UNIX ? SOCK_STREAM : SOCK_DGRAM);
+    int sock_type =
+        (collector_address.raw.sa_family == AF_UNIX || is_collector_tcp_stream() != 0 ? SOCK_STREAM : SOCK_DGRAM);
     reader_thread->collector_sockfd = socket(collector_address.raw.sa_family, sock_type | SOCK_CLOEXEC, 0);
     if (reader_thread->collector_sockfd < 0)
     {
@@ -2146,26 +3291,244 @@ static int connect_to_collector(struct nDPId_reader_thread * const reader_thread
         return 1;
     }
 
-    if (set_collector_nonblock(reader_thread) != 0)
+    if (is_collector_tcp_stream() != 0)
+    {
+        /* bounds the blocking I/O fallback, a stalled collector gets reconnected */
+        struct timeval send_timeout = {1, 0};
+        if (setsockopt(reader_thread->collector_sockfd,
+                       SOL_SOCKET,
+                       SO_SNDTIMEO,
+                       &send_timeout,
+                       sizeof(send_timeout)) < 0)
+        {
+            return 1;
+        }
+    }
+
+    if (set_collector_nonblock(reader_thread) != 0)
+    {
+        return 1;
+    }
+
+    if (connect(reader_thread->collector_sockfd, &collector_address.raw, collector_address.size) < 0)
+    {
+        if (errno == EINPROGRESS && is_collector_tcp_stream() != 0)
+        {
+            /* completion is checked before the next batch gets flushed */
+            reader_thread->collector_connecting = 1;
+            reader_thread->collector_sock_last_errno = 0;
+            return 0;
+        }
+        reader_thread->collector_sock_last_errno = errno;
+        return 1;
+    }
+
+    if (is_collector_tcp_stream() == 0 && shutdown(reader_thread->collector_sockfd, SHUT_RD) != 0)
+    {
+        reader_thread->collector_sock_last_errno = errno;
+        return 1;
+    }
+
+    reader_thread->collector_sock_last_errno = 0;
+
+    return 0;
+}
+
+static int write_to_collector(struct nDPId_reader_thread * const reader_thread,
+                              char const * const buf,
+                              size_t buf_length)
+{
+    struct nDPId_workflow * const workflow = reader_thread->workflow;
+    int saved_errno;
+    ssize_t written;
+
+    errno = 0;
+    if ((written = write(reader_thread->collector_sockfd, buf, buf_length)) != (ssize_t)buf_length)
+    {
+        /* a short write does not set errno, the remaining data has to be written with blocking I/O */
+        saved_errno = (written > 0 ? EAGAIN : errno);
+        if (saved_errno == EPIPE || written == 0)
+        {
+            logger(1,
+                   "[%8llu, %zu] Lost connection to nDPIsrvd Collector",
+                   workflow->packets_captured,
+                   reader_thread->array_index);
+        }
+        if (saved_errno != EAGAIN)
+        {
+            if (saved_errno == ECONNREFUSED)
+            {
+                logger(1,
+                       "[%8llu, %zu] %s to %s refused by endpoint",
+                       workflow->packets_captured,
+                       reader_thread->array_index,
+                       (collector_address.raw.sa_family == AF_UNIX || is_collector_tcp_stream() != 0 ? "Connection"
+                                                                                                     : "Datagram"),
+                       nDPId_options.collector_address);
+            }
+            reader_thread->collector_sock_last_errno = saved_errno;
+        }
+        else if (collector_address.raw.sa_family == AF_UNIX || is_collector_tcp_stream() != 0)
+        {
+            size_t pos = (written < 0 ? 0 : written);
+            set_collector_block(reader_thread);
+            while ((size_t)(written = write(reader_thread->collector_sockfd, buf + pos, buf_length - pos)) !=
+                   buf_length - pos)
+            {
+                saved_errno = errno;
+                if (saved_errno == EPIPE || written == 0)
+                {
+                    logger(1,
+                           "[%8llu, %zu] Lost connection to nDPIsrvd Collector",
+                           workflow->packets_captured,
+                           reader_thread->array_index);
+                    reader_thread->collector_sock_last_errno = saved_errno;
+                    break;
+                }
+                else if (written < 0)
+                {
+                    logger(1,
+                           "[%8llu, %zu] Send data (blocking I/O) to nDPIsrvd Collector at %s failed: %s",
+                           workflow->packets_captured,
+                           reader_thread->array_index,
+                           nDPId_options.collector_address,
+                           strerror(saved_errno));
+                    reader_thread->collector_sock_last_errno = saved_errno;
+                    break;
+                }
+                else
+                {
+                    pos += written;
+                }
+            }
+            set_collector_nonblock(reader_thread);
+        }
+    }
+
+    return (reader_thread->collector_sock_last_errno != 0);
+}
+
+/*
+ * TCP stream mode: (re)connect without blocking the reader thread longer than `timeout_ms'.
+ * Returns 0 if the connection is established and buffered events may be written.
+ */
+static int check_collector_stream(struct nDPId_reader_thread * const reader_thread, int timeout_ms)
+{
+    struct nDPId_workflow * const workflow = reader_thread->workflow;
+
+    if (reader_thread->collector_sock_last_errno != 0)
+    {
+        struct timeval tval;
+        int saved_errno = reader_thread->collector_sock_last_errno;
+
+        get_current_time(&tval);
+        uint64_t const now = (uint64_t)tval.tv_sec * 1000 * 1000 + tval.tv_usec;
+        if (now - reader_thread->collector_last_connect_attempt < nDPId_COLLECTOR_RECONNECT_INTERVAL)
+        {
+            return 1;
+        }
+        reader_thread->collector_last_connect_attempt = now;
+
+        if (connect_to_collector(reader_thread) != 0)
+        {
+            if (saved_errno != reader_thread->collector_sock_last_errno)
+            {
+                logger(1,
+                       "[%8llu, %zu] Could not connect to nDPIsrvd Collector at %s, will try again later. Error: %s",
+                       workflow->packets_captured,
+                       reader_thread->array_index,
+                       nDPId_options.collector_address,
+                       (reader_thread->collector_sock_last_errno != 0
+                            ? strerror(reader_thread->collector_sock_last_errno)
+                            : "Internal Error."));
+            }
+            return 1;
+        }
+        reader_thread->collector_reconnecting = 1;
+    }
+
+    if (reader_thread->collector_connecting != 0)
+    {
+        struct pollfd pfd = {.fd = reader_thread->collector_sockfd, .events = POLLOUT};
+        int error = 0;
+        socklen_t error_len = sizeof(error);
+
+        if (poll(&pfd, 1, timeout_ms) == 0)
+        {
+            return 1;
+        }
+        if (getsockopt(reader_thread->collector_sockfd, SOL_SOCKET, SO_ERROR, &error, &error_len) != 0)
+        {
+            error = errno;
+        }
+        reader_thread->collector_connecting = 0;
+        if (error != 0)
+        {
+            reader_thread->collector_sock_last_errno = error;
+            return 1;
+        }
+
+        logger(0,
+               "[%8llu, %zu] Connected to nDPIsrvd Collector at %s",
+               workflow->packets_captured,
+               reader_thread->array_index,
+               nDPId_options.collector_address);
+        if (reader_thread->collector_batch_dropped > 0)
+        {
+            logger(1,
+                   "[%8llu, %zu] Dropped %llu events while not connected to nDPIsrvd Collector",
+                   workflow->packets_captured,
+                   reader_thread->array_index,
+                   reader_thread->collector_batch_dropped);
+            reader_thread->collector_batch_dropped = 0;
+        }
+        if (reader_thread->collector_reconnecting != 0)
+        {
+            reader_thread->collector_reconnecting = 0;
+            jsonize_daemon(reader_thread, DAEMON_EVENT_RECONNECT);
+        }
+    }
+
+    return 0;
+}
+
+static void flush_collector_batch(struct nDPId_reader_thread * const reader_thread, int timeout_ms)
+{
+    if (reader_thread->collector_batch_used == 0 || check_collector_stream(reader_thread, timeout_ms) != 0)
+    {
+        return;
+    }
+
+    /* a partially written batch breaks the framing, the connection gets re-established on the next flush */
+    write_to_collector(reader_thread, reader_thread->collector_batch, reader_thread->collector_batch_used);
+    reader_thread->collector_batch_used = 0;
+}
+
+/* TCP stream mode: events are written once per pcap dispatch round or if the batch buffer is full. */
+static void batch_to_collector(struct nDPId_reader_thread * const reader_thread, char const * const buf, size_t len)
+{
+    if (reader_thread->collector_batch == NULL)
     {
-        return 1;
+        reader_thread->collector_batch = (char *)ndpi_malloc(nDPId_COLLECTOR_BATCH_SIZE);
+        if (reader_thread->collector_batch == NULL)
+        {
+            reader_thread->collector_batch_dropped++;
+            return;
+        }
     }
 
-    if (connect(reader_thread->collector_sockfd, &collector_address.raw, collector_address.size) < 0)
+    if (reader_thread->collector_batch_used + len > nDPId_COLLECTOR_BATCH_SIZE)
     {
-        reader_thread->collector_sock_last_errno = errno;
-        return 1;
+        flush_collector_batch(reader_thread, 1000);
     }
-
-    if (shutdown(reader_thread->collector_sockfd, SHUT_RD) != 0)
+    if (reader_thread->collector_batch_used + len > nDPId_COLLECTOR_BATCH_SIZE)
     {
-        reader_thread->collector_sock_last_errno = errno;
-        return 1;
+        reader_thread->collector_batch_dropped++;
+        return;
     }
 
-    reader_thread->collector_sock_last_errno = 0;
-
-    return 0;
+    memcpy(reader_thread->collector_batch + reader_thread->collector_batch_used, buf, len);
+    reader_thread->collector_batch_used += len;
 }
 
 static void send_to_collector(struct nDPId_reader_thread * const reader_thread,
@@ -2195,6 +3558,12 @@ static void send_to_collector(struct nDPId_reader_thread * const reader_thread,
         return;
     }
 
+    if (is_collector_tcp_stream() != 0)
+    {
+        batch_to_collector(reader_thread, newline_json_str, s_ret);
+        return;
+    }
+
     if (reader_thread->collector_sock_last_errno != 0)
     {
         saved_errno = reader_thread->collector_sock_last_errno;
@@ -2228,67 +3597,9 @@ static void send_to_collector(struct nDPId_reader_thread * const reader_thread,
         }
     }
 
-    errno = 0;
-    ssize_t written;
-    if (reader_thread->collector_sock_last_errno == 0 &&
-        (written = write(reader_thread->collector_sockfd, newline_json_str, s_ret)) != s_ret)
+    if (reader_thread->collector_sock_last_errno == 0)
     {
-        saved_errno = errno;
-        if (saved_errno == EPIPE || written == 0)
-        {
-            logger(1,
-                   "[%8llu, %zu] Lost connection to nDPIsrvd Collector",
-                   workflow->packets_captured,
-                   reader_thread->array_index);
-        }
-        if (saved_errno != EAGAIN)
-        {
-            if (saved_errno == ECONNREFUSED)
-            {
-                logger(1,
-                       "[%8llu, %zu] %s to %s refused by endpoint",
-                       workflow->packets_captured,
-                       reader_thread->array_index,
-                       (collector_address.raw.sa_family == AF_UNIX ? "Connection" : "Datagram"),
-                       nDPId_options.collector_address);
-            }
-            reader_thread->collector_sock_last_errno = saved_errno;
-        }
-        else if (collector_address.raw.sa_family == AF_UNIX)
-        {
-            size_t pos = (written < 0 ? 0 : written);
-            set_collector_block(reader_thread);
-            while ((size_t)(written = write(reader_thread->collector_sockfd, newline_json_str + pos, s_ret - pos)) !=
-                   s_ret - pos)
-            {
-                saved_errno = errno;
-                if (saved_errno == EPIPE || written == 0)
-                {
-                    logger(1,
-                           "[%8llu, %zu] Lost connection to nDPIsrvd Collector",
-                           workflow->packets_captured,
-                           reader_thread->array_index);
-                    reader_thread->collector_sock_last_errno = saved_errno;
-                    break;
-                }
-                else if (written < 0)
-                {
-                    logger(1,
-                           "[%8llu, %zu] Send data (blocking I/O) to nDPIsrvd Collector at %s failed: %s",
-                           workflow->packets_captured,
-                           reader_thread->array_index,
-                           nDPId_options.collector_address,
-                           strerror(saved_errno));
-                    reader_thread->collector_sock_last_errno = saved_errno;
-                    break;
-                }
-                else
-                {
-                    pos += written;
-                }
-            }
-            set_collector_nonblock(reader_thread);
-        }
+        write_to_collector(reader_thread, newline_json_str, s_ret);
     }
 }
 
@@ -2547,8 +3858,9 @@ static void jsonize_packet_event(struct nDPId_reader_thread * const reader_threa
                    reader_thread->array_index);
             return;
         }
-        if (flow_ext->packets_processed[FD_SRC2DST] + flow_ext->packets_processed[FD_DST2SRC] >
-            nDPId_options.max_packets_per_flow_to_send)
+        if (flow_ext->flow_basic.no_packet_events != 0 ||
+            flow_ext->packets_processed[FD_SRC2DST] + flow_ext->packets_processed[FD_DST2SRC] >
+                nDPId_options.max_packets_per_flow_to_send)
         {
             return;
         }
@@ -2580,7 +3892,7 @@ static void jsonize_packet_event(struct nDPId_reader_thread * const reader_threa
                                      flow_ext->flow_basic.last_pkt_time[FD_DST2SRC]);
         ndpi_serialize_string_uint64(&workflow->ndpi_serializer,
                                      "flow_idle_time",
-                                     get_l4_protocol_idle_time_external(flow_ext->flow_basic.l4_protocol));
+                                     get_flow_idle_time_external(workflow, &flow_ext->flow_basic));
     }
 
     char base64_data[NETWORK_BUFFER_MAX_SIZE];
@@ -2652,9 +3964,14 @@ static void jsonize_flow_event(struct nDPId_reader_thread * const reader_thread,
             ndpi_serialize_string_int32(&workflow->ndpi_serializer,
                                         "flow_datalink",
                                         pcap_datalink(reader_thread->workflow->pcap_handle));
-            ndpi_serialize_string_uint32(&workflow->ndpi_serializer,
-                                         "flow_max_packets",
-                                         nDPId_options.max_packets_per_flow_to_send);
+            ndpi_serialize_string_uint32(
+                &workflow->ndpi_serializer,
+                "flow_max_packets",
+                (flow_ext->flow_basic.no_packet_events != 0 ? 0 : nDPId_options.max_packets_per_flow_to_send));
+            if ((event == FLOW_EVENT_END || event == FLOW_EVENT_IDLE) && flow_ext->flow_basic.udp_transaction_done != 0)
+            {
+                ndpi_serialize_string_string(&workflow->ndpi_serializer, "flow_end_reason", "udp-transaction");
+            }
 
             if (event == FLOW_EVENT_ANALYSE)
             {
@@ -2665,7 +3982,7 @@ static void jsonize_flow_event(struct nDPId_reader_thread * const reader_thread,
                 struct nDPId_flow * const flow = (struct nDPId_flow *)flow_ext;
 
                 ndpi_serialize_start_of_block(&workflow->ndpi_serializer, "ndpi");
-                ndpi_serialize_proto(workflow->ndpi_struct,
+                ndpi_serialize_proto(flow->detection_module->ndpi_struct,
                                      &workflow->ndpi_serializer,
                                      flow->finished.risk,
                                      flow->finished.confidence,
@@ -2727,7 +4044,7 @@ static void jsonize_flow_detection_event(struct nDPId_reader_thread * const read
 
         case FLOW_EVENT_NOT_DETECTED:
         case FLOW_EVENT_GUESSED:
-            if (ndpi_dpi2json(workflow->ndpi_struct,
+            if (ndpi_dpi2json(flow->detection_module->ndpi_struct,
                               &flow->info.detection_data->flow,
                               flow->info.detection_data->guessed_l7_protocol,
                               &workflow->ndpi_serializer) != 0)
@@ -2741,7 +4058,18 @@ static void jsonize_flow_detection_event(struct nDPId_reader_thread * const read
 
         case FLOW_EVENT_DETECTED:
         case FLOW_EVENT_DETECTION_UPDATE:
-            if (ndpi_dpi2json(workflow->ndpi_struct,
+            if (flow->flow_extended.flow_basic.state == FS_FINISHED)
+            {
+                /* finalized by the service cache, there is no detection data */
+                ndpi_serialize_start_of_block(&workflow->ndpi_serializer, "ndpi");
+                ndpi_serialize_proto(flow->detection_module->ndpi_struct,
+                                     &workflow->ndpi_serializer,
+                                     flow->finished.risk,
+                                     flow->finished.confidence,
+                                     flow->flow_extended.detected_l7_protocol);
+                ndpi_serialize_end_of_block(&workflow->ndpi_serializer);
+            }
+            else if (ndpi_dpi2json(flow->detection_module->ndpi_struct,
                               &flow->info.detection_data->flow,
                               flow->flow_extended.detected_l7_protocol,
                               &workflow->ndpi_serializer) != 0)
@@ -2991,37 +4319,411 @@ static uint32_t murmur3_32(uint8_t const * key, size_t len, uint32_t seed)
     return h;
 }
 
-static uint32_t calculate_ndpi_flow_struct_hash(struct ndpi_flow_struct const * const ndpi_flow)
+/*
+ * Protocol specific metadata that ndpi_dpi2json() serializes for the detected protocol.
+ * Only the union member of that protocol is compared, not the whole ndpi_flow->protos union.
+ */
+static size_t get_detection_metadata(struct ndpi_flow_struct const * const ndpi_flow,
+                                     struct ndpi_proto const * const l7_protocol,
+                                     void const ** const metadata)
+{
+    uint16_t const protocol =
+        (l7_protocol->master_protocol != NDPI_PROTOCOL_UNKNOWN ? l7_protocol->master_protocol
+                                                               : l7_protocol->app_protocol);
+
+    switch (protocol)
+    {
+        case NDPI_PROTOCOL_DNS:
+            *metadata = &ndpi_flow->protos.dns;
+            return sizeof(ndpi_flow->protos.dns);
+        case NDPI_PROTOCOL_NTP:
+            *metadata = &ndpi_flow->protos.ntp;
+            return sizeof(ndpi_flow->protos.ntp);
+        case NDPI_PROTOCOL_DHCP:
+            *metadata = &ndpi_flow->protos.dhcp;
+            return sizeof(ndpi_flow->protos.dhcp);
+        case NDPI_PROTOCOL_BITTORRENT:
+            *metadata = &ndpi_flow->protos.bittorrent;
+            return sizeof(ndpi_flow->protos.bittorrent);
+        case NDPI_PROTOCOL_KERBEROS:
+            *metadata = &ndpi_flow->protos.kerberos_buf;
+            return sizeof(ndpi_flow->protos.kerberos_buf);
+        case NDPI_PROTOCOL_UBNTAC2:
+            *metadata = &ndpi_flow->protos.ubntac2;
+            return sizeof(ndpi_flow->protos.ubntac2);
+        case NDPI_PROTOCOL_SOFTETHER:
+            *metadata = &ndpi_flow->protos.softether;
+            return sizeof(ndpi_flow->protos.softether);
+        case NDPI_PROTOCOL_SSH:
+            *metadata = &ndpi_flow->protos.ssh;
+            return sizeof(ndpi_flow->protos.ssh);
+        case NDPI_PROTOCOL_TLS:
+        case NDPI_PROTOCOL_DTLS:
+        case NDPI_PROTOCOL_QUIC:
+        case NDPI_PROTOCOL_MAIL_SMTPS:
+        case NDPI_PROTOCOL_MAIL_IMAPS:
+        case NDPI_PROTOCOL_MAIL_POPS:
+            *metadata = &ndpi_flow->protos.tls_quic;
+            return sizeof(ndpi_flow->protos.tls_quic);
+        case NDPI_PROTOCOL_HTTP:
+        case NDPI_PROTOCOL_HTTP_CONNECT:
+        case NDPI_PROTOCOL_HTTP_PROXY:
+            *metadata = &ndpi_flow->http;
+            return sizeof(ndpi_flow->http);
+    }
+
+    *metadata = NULL;
+    return 0;
+}
+
+/*
+ * At the time of writing, nDPI has no API function to check if the detection changed
+ * or has some new information available. To not spam nDPIsrvd and clients with the same
+ * detection json string over and over again, the fields that are serialized are compared instead.
+ * Returns 1 if one of them changed since the last call, 0 otherwise.
+ */
+static int update_detection_snapshot(struct nDPId_flow * const flow)
 {
-    /*
-     * This is a kludge, but necessary for now as I do not want to spam nDPIsrvd and clients
-     * with the same detection json string over and over again.
-     * So we are building a hash over the more "stable" parts of the ndpi flow struct.
-     * Stable in terms of they should only change if the detection changes for whatever reason.
-     * At the time of writing, nDPI has no API function to check if the detection changed
-     * or has some new information available. This is far from perfect.
-     */
-    uint32_t hash = murmur3_32((uint8_t const *)&ndpi_flow->protos, sizeof(ndpi_flow->protos), nDPId_FLOW_STRUCT_SEED);
-    hash += ndpi_flow->category;
-    hash += ndpi_flow->risk;
-    hash += ndpi_flow->confidence;
+    struct ndpi_flow_struct const * const ndpi_flow = &flow->info.detection_data->flow;
+    struct nDPId_detection_snapshot snapshot;
+    size_t const host_server_name_len =
+        strnlen((const char *)ndpi_flow->host_server_name, sizeof(ndpi_flow->host_server_name));
+    void const * metadata;
+    size_t const metadata_len =
+        get_detection_metadata(ndpi_flow, &flow->flow_extended.detected_l7_protocol, &metadata);
 
-    const size_t protocol_bitmask_size = sizeof(ndpi_flow->excluded_protocol_bitmask.fds_bits) /
-                                         sizeof(ndpi_flow->excluded_protocol_bitmask.fds_bits[0]);
-    for (size_t i = 0; i < protocol_bitmask_size; ++i)
+    memset(&snapshot, 0, sizeof(snapshot));
+    snapshot.risk = ndpi_flow->risk;
+    if (metadata_len > 0)
     {
-        hash += ndpi_flow->excluded_protocol_bitmask.fds_bits[i];
-        hash += ndpi_flow->excluded_protocol_bitmask.fds_bits[i];
+        snapshot.metadata_hash = murmur3_32((uint8_t const *)metadata, metadata_len, nDPId_FLOW_STRUCT_SEED);
     }
+    snapshot.host_server_name_hash =
+        murmur3_32((uint8_t const *)ndpi_flow->host_server_name, host_server_name_len, nDPId_FLOW_STRUCT_SEED);
+    snapshot.master_protocol = flow->flow_extended.detected_l7_protocol.master_protocol;
+    snapshot.app_protocol = flow->flow_extended.detected_l7_protocol.app_protocol;
+    snapshot.category = ndpi_flow->category;
+    snapshot.host_server_name_len = host_server_name_len;
+    snapshot.confidence = ndpi_flow->confidence;
 
-    size_t host_server_name_len =
-        strnlen((const char *)ndpi_flow->host_server_name, sizeof(ndpi_flow->host_server_name));
-    hash += host_server_name_len;
-    hash += murmur3_32((uint8_t const *)&ndpi_flow->host_server_name,
-                       sizeof(ndpi_flow->host_server_name),
-                       nDPId_FLOW_STRUCT_SEED);
+    if (memcmp(&snapshot, &flow->info.detection_data->last_detection_snapshot, sizeof(snapshot)) == 0)
+    {
+        return 0;
+    }
+    flow->info.detection_data->last_detection_snapshot = snapshot;
+
+    return 1;
+}
+
+static struct nDPId_service_cache_entry * service_cache_set(struct nDPId_workflow * const workflow,
+                                                            struct nDPId_flow_basic const * const flow_basic,
+                                                            struct nDPId_service_cache_key * const key)
+{
+    memset(key, 0, sizeof(*key));
+    switch (flow_basic->l3_type)
+    {
+        case L3_IP:
+            key->server.v4.ip = flow_basic->dst.v4.ip;
+            break;
+        case L3_IP6:
+            key->server.v6.ip[0] = flow_basic->dst.v6.ip[0];
+            key->server.v6.ip[1] = flow_basic->dst.v6.ip[1];
+            break;
+    }
+    key->server_port = flow_basic->dst_port;
+    key->l4_protocol = flow_basic->l4_protocol;
+    key->l3_type = flow_basic->l3_type;
+
+    uint32_t const hash = murmur3_32((uint8_t const *)key, sizeof(*key), nDPId_FLOW_STRUCT_SEED);
+    size_t const set_count = nDPId_options.service_cache_size / nDPId_SERVICE_CACHE_WAYS;
+
+    return &workflow->service_cache[(hash & (set_count - 1)) * nDPId_SERVICE_CACHE_WAYS];
+}
+
+/*
+ * Returns a recent high confidence DPI result for the server of a new flow or NULL.
+ * Entries expire `service-cache-max-age' after they were inserted, hits do not extend their lifetime,
+ * so every service is re-validated by a full detection from time to time.
+ */
+static struct nDPId_service_cache_entry const * service_cache_lookup(struct nDPId_workflow * const workflow,
+                                                                     struct nDPId_flow_basic const * const flow_basic)
+{
+    struct nDPId_service_cache_key key;
+    struct nDPId_service_cache_entry * const set = service_cache_set(workflow, flow_basic, &key);
+
+    for (size_t i = 0; i < nDPId_SERVICE_CACHE_WAYS; ++i)
+    {
+        if (set[i].valid == 0 || memcmp(&set[i].key, &key, sizeof(key)) != 0)
+        {
+            continue;
+        }
+        if (timer_sub(workflow->last_thread_time, set[i].inserted) > nDPId_options.service_cache_max_age ||
+            set[i].confidence != NDPI_CONFIDENCE_DPI)
+        {
+            set[i].valid = 0;
+            return NULL;
+        }
 
-    return hash;
+        set[i].last_used = workflow->last_thread_time;
+        return &set[i];
+    }
+
+    return NULL;
+}
+
+/*
+ * Stores the final result of a fully processed flow. Only DPI detections are cached, any other result
+ * (guessed, not detected, lower confidence) removes a cached entry as the service seems to be ambiguous.
+ * The least recently used entry of a set is replaced.
+ */
+static void service_cache_update(struct nDPId_workflow * const workflow,
+                                 struct nDPId_flow_basic const * const flow_basic,
+                                 struct ndpi_proto const * const l7_protocol,
+                                 ndpi_confidence_t confidence)
+{
+    struct nDPId_service_cache_key key;
+    struct nDPId_service_cache_entry * const set = service_cache_set(workflow, flow_basic, &key);
+    struct nDPId_service_cache_entry * entry = NULL;
+
+    for (size_t i = 0; i < nDPId_SERVICE_CACHE_WAYS; ++i)
+    {
+        if (set[i].valid != 0 && memcmp(&set[i].key, &key, sizeof(key)) == 0)
+        {
+            entry = &set[i];
+            break;
+        }
+    }
+
+    if (l7_protocol == NULL || confidence != NDPI_CONFIDENCE_DPI)
+    {
+        if (entry != NULL)
+        {
+            entry->valid = 0;
+        }
+        return;
+    }
+
+    if (entry == NULL)
+    {
+        entry = &set[0];
+        for (size_t i = 1; i < nDPId_SERVICE_CACHE_WAYS && entry->valid != 0; ++i)
+        {
+            if (set[i].valid == 0 || set[i].last_used < entry->last_used)
+            {
+                entry = &set[i];
+            }
+        }
+    }
+
+    entry->key = key;
+    entry->valid = 1;
+    entry->inserted = entry->last_used = workflow->last_thread_time;
+    entry->l7_protocol = *l7_protocol;
+    entry->confidence = confidence;
+}
+
+/*
+ * Slot and fingerprint of a flow are independent of the packet direction.
+ * The fingerprint is never 0, which marks an empty slot.
+ */
+static void skipped_flow_hash(struct nDPId_flow_basic const * const flow_basic,
+                              uint32_t * const slot_hash,
+                              uint32_t * const fingerprint)
+{
+    struct
+    {
+        union nDPId_ip ip[2];
+        uint16_t port[2];
+        uint8_t l4_protocol;
+        uint8_t l3_type;
+        uint8_t reserved[2];
+        uint32_t tunnel_key;
+    } key;
+    int cmp = memcmp(&flow_basic->src, &flow_basic->dst, sizeof(flow_basic->src));
+    uint8_t const lower = (cmp > 0 || (cmp == 0 && flow_basic->src_port > flow_basic->dst_port));
+
+    memset(&key, 0, sizeof(key));
+    key.ip[lower] = flow_basic->src;
+    key.ip[1 - lower] = flow_basic->dst;
+    key.port[lower] = flow_basic->src_port;
+    key.port[1 - lower] = flow_basic->dst_port;
+    key.l4_protocol = flow_basic->l4_protocol;
+    key.l3_type = flow_basic->l3_type;
+    key.tunnel_key = flow_basic->tunnel_key;
+
+    *slot_hash = murmur3_32((uint8_t const *)&key, sizeof(key), nDPId_FLOW_STRUCT_SEED);
+    *fingerprint = murmur3_32((uint8_t const *)&key, sizeof(key), ~nDPId_FLOW_STRUCT_SEED);
+    if (*fingerprint == 0)
+    {
+        *fingerprint = 1;
+    }
+}
+
+static struct nDPId_skipped_flow * skipped_flow_find(struct nDPId_workflow * const workflow,
+                                                     uint32_t slot_hash,
+                                                     uint32_t fingerprint)
+{
+    size_t slot = slot_hash & (nDPId_SKIPPED_FLOWS_SET_SIZE - 1);
+
+    /* linear probing, the set is never filled completely, see skipped_flow_insert() */
+    while (workflow->skipped_flows[slot].fingerprint != 0 &&
+           (workflow->skipped_flows[slot].fingerprint != fingerprint ||
+            workflow->skipped_flows[slot].slot_hash != slot_hash))
+    {
+        slot = (slot + 1) & (nDPId_SKIPPED_FLOWS_SET_SIZE - 1);
+    }
+
+    return &workflow->skipped_flows[slot];
+}
+
+/* Backward shift deletion, entries behind the deleted one stay reachable without tombstones. */
+static void skipped_flow_delete(struct nDPId_workflow * const workflow, size_t slot)
+{
+    size_t next = slot;
+
+    while (1)
+    {
+        next = (next + 1) & (nDPId_SKIPPED_FLOWS_SET_SIZE - 1);
+        if (workflow->skipped_flows[next].fingerprint == 0)
+        {
+            break;
+        }
+
+        size_t const home = workflow->skipped_flows[next].slot_hash & (nDPId_SKIPPED_FLOWS_SET_SIZE - 1);
+        if (((next - home) & (nDPId_SKIPPED_FLOWS_SET_SIZE - 1)) >=
+            ((next - slot) & (nDPId_SKIPPED_FLOWS_SET_SIZE - 1)))
+        {
+            workflow->skipped_flows[slot] = workflow->skipped_flows[next];
+            slot = next;
+        }
+    }
+
+    memset(&workflow->skipped_flows[slot], 0, sizeof(workflow->skipped_flows[slot]));
+    workflow->skipped_flows_used--;
+}
+
+/*
+ * Called every flow-scan-interval, see do_periodically_work().
+ * Checks the next nDPId_SKIPPED_FLOWS_EXPIRE_SLOTS slots only, the whole set is covered every
+ * nDPId_SKIPPED_FLOWS_SET_SIZE / nDPId_SKIPPED_FLOWS_EXPIRE_SLOTS calls.
+ */
+static void skipped_flows_expire(struct nDPId_workflow * const workflow)
+{
+    size_t slot = workflow->skipped_flows_expire_slot;
+
+    for (size_t i = 0; i < nDPId_SKIPPED_FLOWS_EXPIRE_SLOTS; ++i)
+    {
+        /* a deletion may move another (possibly expired) entry into this slot, but never into an already checked one */
+        while (workflow->skipped_flows[slot].fingerprint != 0 &&
+               workflow->skipped_flows[slot].expires <= workflow->last_thread_time)
+        {
+            skipped_flow_delete(workflow, slot);
+        }
+        slot = (slot + 1) & (nDPId_SKIPPED_FLOWS_SET_SIZE - 1);
+    }
+    workflow->skipped_flows_expire_slot = slot;
+
+    if (workflow->skipped_flows_full != 0 && workflow->skipped_flows_used < nDPId_SKIPPED_FLOWS_SET_SIZE / 4u * 3u)
+    {
+        workflow->skipped_flows_full = 0;
+    }
+}
+
+/* Deletes the entry with the earliest expiry among the next nDPId_SKIPPED_FLOWS_EVICT_PROBES used slots. */
+static void skipped_flow_evict(struct nDPId_workflow * const workflow, size_t slot)
+{
+    size_t victim = slot;
+    size_t probes = 0;
+
+    while (probes < nDPId_SKIPPED_FLOWS_EVICT_PROBES)
+    {
+        if (workflow->skipped_flows[slot].fingerprint != 0)
+        {
+            if (probes++ == 0 || workflow->skipped_flows[slot].expires < workflow->skipped_flows[victim].expires)
+            {
+                victim = slot;
+            }
+        }
+        slot = (slot + 1) & (nDPId_SKIPPED_FLOWS_SET_SIZE - 1);
+    }
+
+    skipped_flow_delete(workflow, victim);
+}
+
+static void skipped_flow_insert(struct nDPId_workflow * const workflow,
+                                struct nDPId_flow_basic const * const flow_basic,
+                                uint32_t slot_hash,
+                                uint32_t fingerprint)
+{
+    struct nDPId_skipped_flow * entry = skipped_flow_find(workflow, slot_hash, fingerprint);
+
+    if (entry->fingerprint == 0)
+    {
+        if (workflow->skipped_flows_used >= nDPId_SKIPPED_FLOWS_SET_SIZE / 4u * 3u)
+        {
+            if (workflow->skipped_flows_full == 0)
+            {
+                workflow->skipped_flows_full = 1;
+                logger(1,
+                       "[%8llu] Skipped flow set full with %zu flows, evicting the ones closest to expiry, "
+                       "see nDPId_SKIPPED_FLOWS_SET_SIZE",
+                       workflow->packets_captured,
+                       workflow->skipped_flows_used);
+            }
+            /*
+             * Forgetting the new flow instead would track it with its next packet (as a midstream flow for TCP),
+             * so the entry expiring first among the next nDPId_SKIPPED_FLOWS_EVICT_PROBES ones makes room.
+             */
+            skipped_flow_evict(workflow, slot_hash & (nDPId_SKIPPED_FLOWS_SET_SIZE - 1));
+            entry = skipped_flow_find(workflow, slot_hash, fingerprint);
+        }
+        entry->slot_hash = slot_hash;
+        entry->fingerprint = fingerprint;
+        workflow->skipped_flows_used++;
+    }
+    entry->expires = workflow->last_thread_time + get_l4_protocol_idle_time(flow_basic->l4_protocol);
+}
+
+/*
+ * Skipped flows are not stored in the flow table. A fingerprint of each is kept until it was idle for the idle time
+ * of its layer 4 protocol, e.g. `tcp-max-idle-time'. Every lookup hit refreshes it. As the fingerprint is independent
+ * of the packet direction, replies of a skipped flow are skipped as well.
+ */
+static int skipped_flow_lookup(struct nDPId_workflow * const workflow, struct nDPId_flow_basic const * const flow_basic)
+{
+    uint32_t slot_hash;
+    uint32_t fingerprint;
+    struct nDPId_skipped_flow * entry;
+
+    if (workflow->skipped_flows == NULL)
+    {
+        return 0;
+    }
+
+    skipped_flow_hash(flow_basic, &slot_hash, &fingerprint);
+    entry = skipped_flow_find(workflow, slot_hash, fingerprint);
+    if (entry->fingerprint == 0)
+    {
+        return 0;
+    }
+    entry->expires = workflow->last_thread_time + get_l4_protocol_idle_time(flow_basic->l4_protocol);
+
+    return 1;
+}
+
+static void skipped_flow_add(struct nDPId_workflow * const workflow, struct nDPId_flow_basic const * const flow_basic)
+{
+    uint32_t slot_hash;
+    uint32_t fingerprint;
+
+    workflow->total_skipped_flows++;
+    if (workflow->skipped_flows == NULL)
+    {
+        return;
+    }
+
+    skipped_flow_hash(flow_basic, &slot_hash, &fingerprint);
+    skipped_flow_insert(workflow, flow_basic, slot_hash, fingerprint);
 }
 
 /* Some constants stolen from ndpiReader. */
@@ -3367,10 +5069,8 @@ static struct nDPId_flow_basic * add_new_flow(struct nDPId_workflow * const work
         case FS_FINISHED: // do not allocate something for FS_FINISHED as we are re-using memory allocated by FS_INFO
             return NULL;
 
-        case FS_SKIPPED:
-            workflow->total_skipped_flows++;
-            s = sizeof(struct nDPId_flow_skipped);
-            break;
+        case FS_SKIPPED: // skipped flows are not stored in the flow table, see skipped_flow_add()
+            return NULL;
 
         case FS_INFO:
             s = sizeof(struct nDPId_flow);
@@ -3391,8 +5091,38 @@ static struct nDPId_flow_basic * add_new_flow(struct nDPId_workflow * const work
         return NULL;
     }
 
-    workflow->cur_active_flows++;
-    return flow_basic;
+    workflow->cur_active_flows++;
+    return flow_basic;
+}
+
+static void swap_detection_module(struct nDPId_reader_thread * const reader_thread)
+{
+    struct nDPId_workflow * const workflow = reader_thread->workflow;
+    struct nDPId_detection_module * detection_module;
+
+    pthread_mutex_lock(&workflow->pending_detection_module_mutex);
+    detection_module = workflow->pending_detection_module;
+    workflow->pending_detection_module = NULL;
+    pthread_mutex_unlock(&workflow->pending_detection_module_mutex);
+
+    if (detection_module == NULL)
+    {
+        return;
+    }
+
+    /* flows in detection keep the old module, new flows use the reloaded one */
+    logger(0,
+           "[%8llu] Detection module reloaded, %llu flows in detection keep the previous one",
+           workflow->packets_captured,
+           workflow->detection_module->flows);
+    retire_detection_module(workflow->detection_module);
+    workflow->detection_module = detection_module;
+
+    /* cached protocol ids may refer to custom protocols of the previous module */
+    if (workflow->service_cache != NULL)
+    {
+        memset(workflow->service_cache, 0, nDPId_options.service_cache_size * sizeof(*workflow->service_cache));
+    }
 }
 
 static void do_periodically_work(struct nDPId_reader_thread * const reader_thread)
@@ -3400,8 +5130,13 @@ static void do_periodically_work(struct nDPId_reader_thread * const reader_threa
     if (reader_thread->workflow->last_scan_time + nDPId_options.flow_scan_interval <=
         reader_thread->workflow->last_global_time)
     {
+        swap_detection_module(reader_thread);
         check_for_idle_flows(reader_thread);
         check_for_flow_updates(reader_thread);
+        if (reader_thread->workflow->skipped_flows != NULL)
+        {
+            skipped_flows_expire(reader_thread->workflow);
+        }
         reader_thread->workflow->last_scan_time = reader_thread->workflow->last_global_time;
     }
     if (reader_thread->workflow->last_status_time + nDPId_options.daemon_status_interval +
@@ -3428,6 +5163,211 @@ static int distribute_single_packet(struct nDPId_reader_thread * const reader_th
             reader_thread->array_index);
 }
 
+/* Returns the layer3 type of an Ethernet frame carried by a tunnel or 0, skips one 802.1Q tag. */
+static uint16_t decapsulate_ethernet(struct pcap_pkthdr const * const header,
+                                     uint8_t const * const packet,
+                                     size_t * const offset)
+{
+    if (header->caplen < *offset + sizeof(struct ndpi_ethhdr))
+    {
+        return 0;
+    }
+
+    uint16_t type = ntohs(((struct ndpi_ethhdr const *)&packet[*offset])->h_proto);
+    *offset += sizeof(struct ndpi_ethhdr);
+    if (type == ETHERTYPE_VLAN)
+    {
+        if (header->caplen < *offset + 4)
+        {
+            return 0;
+        }
+        type = ntohs(*(uint16_t const *)&packet[*offset + 2]);
+        *offset += 4;
+    }
+
+    return type;
+}
+
+/*
+ * Strips one tunnel header of a type enabled with -D.
+ * Afterwards, ip_offset and type describe the inner IP header and the tunnel is stored in tunnel_type / tunnel_id.
+ * Returns 1 if a tunnel was removed, 0 if the packet is not a (complete) tunnel packet. Fragments are not decapsulated.
+ */
+static int decapsulate_tunnel(struct pcap_pkthdr const * const header,
+                              uint8_t const * const packet,
+                              uint16_t * const ip_offset,
+                              uint16_t * const type,
+                              uint8_t * const tunnel_type,
+                              uint32_t * const tunnel_id)
+{
+    size_t offset = *ip_offset;
+    uint16_t inner_type = 0;
+    uint32_t id = 0;
+    uint8_t l4_protocol;
+    enum nDPId_tunnel_type found = TUNNEL_NONE;
+
+    if (*type == ETH_P_IP)
+    {
+        struct ndpi_iphdr const * const ip = (struct ndpi_iphdr const *)&packet[offset];
+
+        if (header->caplen < offset + sizeof(*ip) || ip->ihl < 5 || (ntohs(ip->frag_off) & 0x3FFF) != 0)
+        {
+            return 0;
+        }
+        l4_protocol = ip->protocol;
+        offset += ip->ihl * 4u;
+    }
+    else if (*type == ETH_P_IPV6)
+    {
+        struct ndpi_ipv6hdr const * const ip6 = (struct ndpi_ipv6hdr const *)&packet[offset];
+
+        if (header->caplen < offset + sizeof(*ip6))
+        {
+            return 0;
+        }
+        /* IPv6 extension headers are not followed */
+        l4_protocol = ip6->ip6_hdr.ip6_un1_nxt;
+        offset += sizeof(*ip6);
+    }
+    else
+    {
+        return 0;
+    }
+
+    switch (l4_protocol)
+    {
+        case IPPROTO_IPIP:
+            found = TUNNEL_IPIP;
+            inner_type = ETH_P_IP;
+            break;
+        case IPPROTO_IPV6:
+            found = TUNNEL_IPIP;
+            inner_type = ETH_P_IPV6;
+            break;
+        case IPPROTO_GRE:
+        {
+            if (header->caplen < offset + 4)
+            {
+                return 0;
+            }
+            uint16_t const flags = ntohs(*(uint16_t const *)&packet[offset]);
+            uint16_t const protocol = ntohs(*(uint16_t const *)&packet[offset + 2]);
+
+            /* GRE version 0 without source routing */
+            if ((flags & 0x4007) != 0)
+            {
+                return 0;
+            }
+            offset += 4;
+            offset += ((flags & 0x8000) != 0 ? 4 : 0); // checksum
+            if ((flags & 0x2000) != 0)
+            {
+                if (header->caplen < offset + 4)
+                {
+                    return 0;
+                }
+                id = ntohl(*(uint32_t const *)&packet[offset]);
+                offset += 4;
+            }
+            offset += ((flags & 0x1000) != 0 ? 4 : 0); // sequence number
+
+            found = TUNNEL_GRE;
+            if (protocol == 0x6558 /* Transparent Ethernet Bridging */)
+            {
+                inner_type = decapsulate_ethernet(header, packet, &offset);
+            }
+            else
+            {
+                inner_type = protocol;
+            }
+            break;
+        }
+        case IPPROTO_UDP:
+        {
+            if (header->caplen < offset + sizeof(struct ndpi_udphdr))
+            {
+                return 0;
+            }
+            struct ndpi_udphdr const * const udp = (struct ndpi_udphdr const *)&packet[offset];
+            offset += sizeof(*udp);
+
+            if (ntohs(udp->dest) == nDPId_VXLAN_PORT)
+            {
+                /* flags (I bit set), reserved, 24 bit VNI, reserved */
+                if (header->caplen < offset + 8 || (packet[offset] & 0x08) == 0)
+                {
+                    return 0;
+                }
+                id = ntohl(*(uint32_t const *)&packet[offset + 4]) >> 8;
+                offset += 8;
+
+                found = TUNNEL_VXLAN;
+                inner_type = decapsulate_ethernet(header, packet, &offset);
+            }
+            else if (ntohs(udp->dest) == nDPId_GTP_U_PORT || ntohs(udp->source) == nDPId_GTP_U_PORT)
+            {
+                /* GTPv1 with protocol type GTP, message type G-PDU */
+                if (header->caplen < offset + 8 || (packet[offset] & 0xF0) != 0x30 || packet[offset + 1] != 0xFF)
+                {
+                    return 0;
+                }
+                uint8_t const flags = packet[offset];
+                id = ntohl(*(uint32_t const *)&packet[offset + 4]);
+                offset += 8;
+
+                if ((flags & 0x07) != 0)
+                {
+                    /* sequence number, N-PDU number and next extension header type */
+                    if (header->caplen < offset + 4)
+                    {
+                        return 0;
+                    }
+                    uint8_t next_extension = ((flags & 0x04) != 0 ? packet[offset + 3] : 0);
+                    offset += 4;
+                    while (next_extension != 0)
+                    {
+                        /* length in units of four bytes, the last byte is the next extension header type */
+                        if (header->caplen < offset + 1 || packet[offset] == 0 ||
+                            header->caplen < offset + packet[offset] * 4u)
+                        {
+                            return 0;
+                        }
+                        offset += packet[offset] * 4u;
+                        next_extension = packet[offset - 1];
+                    }
+                }
+
+                found = TUNNEL_GTP;
+                if (header->caplen > offset && (packet[offset] >> 4) == 4)
+                {
+                    inner_type = ETH_P_IP;
+                }
+                else if (header->caplen > offset && (packet[offset] >> 4) == 6)
+                {
+                    inner_type = ETH_P_IPV6;
+                }
+            }
+            break;
+        }
+        default:
+            break;
+    }
+
+    if (found == TUNNEL_NONE || (nDPId_options.decapsulate_tunnels & (1u << found)) == 0 ||
+        (inner_type != ETH_P_IP && inner_type != ETH_P_IPV6) || offset > UINT16_MAX ||
+        header->caplen < offset + (inner_type == ETH_P_IP ? sizeof(struct ndpi_iphdr) : sizeof(struct ndpi_ipv6hdr)))
+    {
+        return 0;
+    }
+
+    *ip_offset = (uint16_t)offset;
+    *type = inner_type;
+    *tunnel_type = found;
+    *tunnel_id = id;
+
+    return 1;
+}
+
 static void ndpi_process_packet(uint8_t * const args,
                                 struct pcap_pkthdr const * const header,
                                 uint8_t const * const packet)
@@ -3442,6 +5382,7 @@ static void ndpi_process_packet(uint8_t * const args,
     struct nDPId_flow * flow_to_process;
 
     uint8_t is_new_flow = 0;
+    struct nDPId_service_cache_entry const * service_cache_entry = NULL;
 
     const struct ndpi_iphdr * ip;
     struct ndpi_ipv6hdr * ip6;
@@ -3449,6 +5390,10 @@ static void ndpi_process_packet(uint8_t * const args,
 
     uint64_t time_us;
     uint64_t last_pkt_time;
+    uint64_t flow_iat = 0;
+
+    uint8_t tunnel_type = TUNNEL_NONE;
+    uint32_t tunnel_id = 0;
 
     uint16_t ip_offset = 0;
     uint16_t ip_size;
@@ -3489,6 +5434,21 @@ static void ndpi_process_packet(uint8_t * const args,
         return;
     }
 
+    if (nDPId_options.decapsulate_tunnels != 0)
+    {
+        for (size_t depth = 0; depth < nDPId_MAX_TUNNEL_DEPTH; ++depth)
+        {
+            if (decapsulate_tunnel(header, packet, &ip_offset, &type, &tunnel_type, &tunnel_id) == 0)
+            {
+                break;
+            }
+        }
+        if (tunnel_type == TUNNEL_VXLAN || tunnel_type == TUNNEL_GRE)
+        {
+            flow_basic.tunnel_key = tunnel_id;
+        }
+    }
+
     if (type == ETH_P_IP)
     {
         ip = (struct ndpi_iphdr *)&packet[ip_offset];
@@ -3743,7 +5703,7 @@ static void ndpi_process_packet(uint8_t * const args,
             }
             break;
     }
-    flow_basic.hashval += flow_basic.l4_protocol + flow_basic.src_port + flow_basic.dst_port;
+    flow_basic.hashval += flow_basic.l4_protocol + flow_basic.src_port + flow_basic.dst_port + flow_basic.tunnel_key;
 
     hashed_index = flow_basic.hashval % workflow->max_active_flows;
     direction = FD_SRC2DST;
@@ -3775,6 +5735,11 @@ static void ndpi_process_packet(uint8_t * const args,
         flow_basic.dst_port = orig_dst_port;
     }
 
+    if (tree_result == NULL && skipped_flow_lookup(workflow, &flow_basic) != 0)
+    {
+        return;
+    }
+
     if (tree_result == NULL)
     {
         /* flow still not found, must be new or midstream */
@@ -3793,54 +5758,32 @@ static void ndpi_process_packet(uint8_t * const args,
                 subnet = &nDPId_options.pcap_dev_subnet6;
                 break;
         }
+        enum nDPId_flow_policy policy = FLOW_POLICY_DPI_PACKETS;
         if (nDPId_options.process_internal_initial_direction != 0 && flow_basic.tcp_is_midstream_flow == 0)
         {
             if (is_ip_in_subnet(&flow_basic.src, netmask, subnet, flow_basic.l3_type) == 0)
             {
-                if (add_new_flow(workflow, &flow_basic, FS_SKIPPED, hashed_index) == NULL)
-                {
-                    jsonize_error_eventf(reader_thread,
-                                         FLOW_MEMORY_ALLOCATION_FAILED,
-                                         "%s%zu",
-                                         "size",
-                                         sizeof(struct nDPId_flow_skipped));
-                    jsonize_packet_event(reader_thread,
-                                         header,
-                                         packet,
-                                         type,
-                                         ip_offset,
-                                         (l4_ptr - packet),
-                                         l4_len,
-                                         NULL,
-                                         PACKET_EVENT_PAYLOAD);
-                }
-                return;
+                policy = FLOW_POLICY_SKIP;
             }
         }
         else if (nDPId_options.process_external_initial_direction != 0 && flow_basic.tcp_is_midstream_flow == 0)
         {
             if (is_ip_in_subnet(&flow_basic.src, netmask, subnet, flow_basic.l3_type) != 0)
             {
-                if (add_new_flow(workflow, &flow_basic, FS_SKIPPED, hashed_index) == NULL)
-                {
-                    jsonize_error_eventf(reader_thread,
-                                         FLOW_MEMORY_ALLOCATION_FAILED,
-                                         "%s%zu",
-                                         "size",
-                                         sizeof(struct nDPId_flow_skipped));
-                    jsonize_packet_event(reader_thread,
-                                         header,
-                                         packet,
-                                         type,
-                                         ip_offset,
-                                         (l4_ptr - packet),
-                                         l4_len,
-                                         NULL,
-                                         PACKET_EVENT_PAYLOAD);
-                }
-                return;
+                policy = FLOW_POLICY_SKIP;
             }
         }
+        if (policy != FLOW_POLICY_SKIP && policy_table.node_count > 0)
+        {
+            policy = policy_lookup(&flow_basic);
+        }
+
+        if (policy == FLOW_POLICY_SKIP)
+        {
+            skipped_flow_add(workflow, &flow_basic);
+            return;
+        }
+        flow_basic.no_packet_events = (policy == FLOW_POLICY_TRACK || policy == FLOW_POLICY_DPI);
 
         if (workflow->cur_active_flows == workflow->max_active_flows)
         {
@@ -3898,8 +5841,24 @@ static void ndpi_process_packet(uint8_t * const args,
 
         workflow->total_active_flows++;
         flow_to_process->flow_extended.flow_id = MT_GET_AND_ADD(global_flow_id, 1);
+        flow_to_process->flow_extended.tunnel_type = tunnel_type;
+        flow_to_process->flow_extended.tunnel_id = tunnel_id;
 
-        if (alloc_detection_data(flow_to_process) != 0)
+        if (workflow->service_cache != NULL && policy != FLOW_POLICY_TRACK && flow_basic.tcp_is_midstream_flow == 0)
+        {
+            service_cache_entry = service_cache_lookup(workflow, &flow_basic);
+        }
+
+        if (policy == FLOW_POLICY_TRACK)
+        {
+            /* tracked without detection, nothing to allocate */
+            acquire_detection_module(workflow, flow_to_process);
+            flow_to_process->flow_extended.flow_basic.state = FS_FINISHED;
+            flow_to_process->finished.risk = NDPI_NO_RISK;
+            flow_to_process->finished.confidence = NDPI_CONFIDENCE_UNKNOWN;
+        }
+        else if ((service_cache_entry != NULL ? alloc_cached_flow_data(workflow, flow_to_process)
+                                              : alloc_detection_data(workflow, flow_to_process)) != 0)
         {
             jsonize_error_eventf(
                 reader_thread, FLOW_MEMORY_ALLOCATION_FAILED, "%s%zu", "size", sizeof(*flow_to_process));
@@ -3917,6 +5876,7 @@ static void ndpi_process_packet(uint8_t * const args,
         struct nDPId_flow_basic * const flow_basic_to_process = *(struct nDPId_flow_basic **)tree_result;
         /* Update last seen timestamp for timeout handling. */
         last_pkt_time = flow_basic_to_process->last_pkt_time[direction];
+        flow_iat = timer_sub(workflow->last_thread_time, get_last_pkt_time(flow_basic_to_process));
         flow_basic_to_process->last_pkt_time[direction] = workflow->last_thread_time;
         /* TCP-FIN/TCP-RST: indicates that at least one side wants to end the connection. */
         if (flow_basic.tcp_fin_rst_seen != 0)
@@ -3959,6 +5919,15 @@ static void ndpi_process_packet(uint8_t * const args,
         }
     }
 
+    if (tcp != NULL)
+    {
+        tcp_state_update(&flow_to_process->flow_extended.flow_basic, tcp, direction, l4_payload_len);
+    }
+
+    if (flow_iat > flow_to_process->flow_extended.max_iat)
+    {
+        flow_to_process->flow_extended.max_iat = flow_iat;
+    }
     flow_to_process->flow_extended.packets_processed[direction]++;
     flow_to_process->flow_extended.total_l4_payload_len[direction] += l4_payload_len;
     workflow->packets_processed++;
@@ -4020,12 +5989,29 @@ static void ndpi_process_packet(uint8_t * const args,
                          &flow_to_process->flow_extended,
                          PACKET_EVENT_PAYLOAD_FLOW);
 
+    if (service_cache_entry != NULL)
+    {
+        /* A recent flow to the same service was detected with high confidence, skip the detection process. */
+        flow_to_process->flow_extended.flow_basic.state = FS_FINISHED;
+        flow_to_process->flow_extended.detected_l7_protocol = service_cache_entry->l7_protocol;
+        flow_to_process->finished.risk = NDPI_NO_RISK;
+        flow_to_process->finished.confidence = NDPI_CONFIDENCE_DPI_CACHE;
+
+        workflow->total_detected_flows++;
+        workflow->total_service_cache_hits++;
+        jsonize_flow_detection_event(reader_thread, flow_to_process, FLOW_EVENT_DETECTED);
+        return;
+    }
+
     if (flow_to_process->flow_extended.flow_basic.state != FS_INFO)
     {
         /* Only FS_INFO goes through the whole detection process. */
+        udp_transaction_update(flow_to_process);
         return;
     }
 
+    struct ndpi_detection_module_struct * const ndpi_struct = flow_to_process->detection_module->ndpi_struct;
+
     if (flow_to_process->info.detection_data->flow.num_processed_pkts ==
         nDPId_options.max_packets_per_flow_to_process - 1)
     {
@@ -4039,7 +6025,7 @@ static void ndpi_process_packet(uint8_t * const args,
             /* last chance to guess something, better then nothing */
             uint8_t protocol_was_guessed = 0;
             flow_to_process->info.detection_data->guessed_l7_protocol = ndpi_detection_giveup(
-                workflow->ndpi_struct, &flow_to_process->info.detection_data->flow, 1, &protocol_was_guessed);
+                ndpi_struct, &flow_to_process->info.detection_data->flow, 1, &protocol_was_guessed);
             if (protocol_was_guessed != 0)
             {
                 workflow->total_guessed_flows++;
@@ -4054,40 +6040,34 @@ static void ndpi_process_packet(uint8_t * const args,
     }
 
     flow_to_process->flow_extended.detected_l7_protocol =
-        ndpi_detection_process_packet(workflow->ndpi_struct,
+        ndpi_detection_process_packet(ndpi_struct,
                                       &flow_to_process->info.detection_data->flow,
                                       ip != NULL ? (uint8_t *)ip : (uint8_t *)ip6,
                                       ip_size,
                                       workflow->last_thread_time / 1000,
                                       NULL);
 
-    if (ndpi_is_protocol_detected(workflow->ndpi_struct, flow_to_process->flow_extended.detected_l7_protocol) != 0 &&
+    if (ndpi_is_protocol_detected(ndpi_struct, flow_to_process->flow_extended.detected_l7_protocol) != 0 &&
         flow_to_process->info.detection_completed == 0)
     {
         flow_to_process->info.detection_completed = 1;
         workflow->total_detected_flows++;
         jsonize_flow_detection_event(reader_thread, flow_to_process, FLOW_EVENT_DETECTED);
-        flow_to_process->info.detection_data->last_ndpi_flow_struct_hash =
-            calculate_ndpi_flow_struct_hash(&flow_to_process->info.detection_data->flow);
+        update_detection_snapshot(flow_to_process);
     }
-    else if (flow_to_process->info.detection_completed == 1)
+    else if (flow_to_process->info.detection_completed == 1 && update_detection_snapshot(flow_to_process) != 0)
     {
-        uint32_t hash = calculate_ndpi_flow_struct_hash(&flow_to_process->info.detection_data->flow);
-        if (hash != flow_to_process->info.detection_data->last_ndpi_flow_struct_hash)
-        {
-            workflow->total_flow_detection_updates++;
-            jsonize_flow_detection_event(reader_thread, flow_to_process, FLOW_EVENT_DETECTION_UPDATE);
-            flow_to_process->info.detection_data->last_ndpi_flow_struct_hash = hash;
-        }
+        workflow->total_flow_detection_updates++;
+        jsonize_flow_detection_event(reader_thread, flow_to_process, FLOW_EVENT_DETECTION_UPDATE);
     }
 
     if (flow_to_process->info.detection_data->flow.num_processed_pkts ==
             nDPId_options.max_packets_per_flow_to_process ||
         (flow_to_process->info.detection_completed == 1 &&
-         ndpi_extra_dissection_possible(workflow->ndpi_struct, &flow_to_process->info.detection_data->flow) == 0))
+         ndpi_extra_dissection_possible(ndpi_struct, &flow_to_process->info.detection_data->flow) == 0))
     {
         struct ndpi_proto detected_l7_protocol = flow_to_process->flow_extended.detected_l7_protocol;
-        if (ndpi_is_protocol_detected(workflow->ndpi_struct, detected_l7_protocol) == 0)
+        if (ndpi_is_protocol_detected(ndpi_struct, detected_l7_protocol) == 0)
         {
             detected_l7_protocol = flow_to_process->info.detection_data->guessed_l7_protocol;
         }
@@ -4095,6 +6075,14 @@ static void ndpi_process_packet(uint8_t * const args,
         ndpi_risk risk = flow_to_process->info.detection_data->flow.risk;
         ndpi_confidence_t confidence = flow_to_process->info.detection_data->flow.confidence;
 
+        if (workflow->service_cache != NULL && flow_to_process->flow_extended.flow_basic.tcp_is_midstream_flow == 0)
+        {
+            service_cache_update(workflow,
+                                 &flow_to_process->flow_extended.flow_basic,
+                                 (flow_to_process->info.detection_completed != 0 ? &detected_l7_protocol : NULL),
+                                 confidence);
+        }
+
         free_detection_data(flow_to_process);
 
         flow_to_process->flow_extended.flow_basic.state = FS_FINISHED;
@@ -4102,6 +6090,7 @@ static void ndpi_process_packet(uint8_t * const args,
         flow->flow_extended.detected_l7_protocol = detected_l7_protocol;
         flow->finished.risk = risk;
         flow->finished.confidence = confidence;
+        udp_transaction_update(flow);
     }
 
 #ifdef ENABLE_ZLIB
@@ -4112,11 +6101,6 @@ static void ndpi_process_packet(uint8_t * const args,
 #endif
 }
 
-static void get_current_time(struct timeval * const tval)
-{
-    gettimeofday(tval, NULL);
-}
-
 static void ndpi_log_flow_walker(void const * const A, ndpi_VISIT which, int depth, void * const user_data)
 {
     struct nDPId_reader_thread const * const reader_thread = (struct nDPId_reader_thread *)user_data;
@@ -4148,7 +6132,7 @@ static void ndpi_log_flow_walker(void const * const A, ndpi_VISIT which, int dep
                 struct nDPId_flow const * const flow = (struct nDPId_flow *)flow_basic;
 
                 uint64_t last_seen = get_last_pkt_time(flow_basic);
-                uint64_t idle_time = get_l4_protocol_idle_time_external(flow->flow_extended.flow_basic.l4_protocol);
+                uint64_t idle_time = get_flow_idle_time_external(reader_thread->workflow, flow_basic);
                 logger(0,
                        "[%2zu][%4llu][last-seen: %13llu][last-update: %13llu][idle-time: %7llu][time-until-timeout: "
                        "%7llu]",
@@ -4168,7 +6152,7 @@ static void ndpi_log_flow_walker(void const * const A, ndpi_VISIT which, int dep
                 struct nDPId_flow const * const flow = (struct nDPId_flow *)flow_basic;
 
                 uint64_t last_seen = get_last_pkt_time(flow_basic);
-                uint64_t idle_time = get_l4_protocol_idle_time_external(flow->flow_extended.flow_basic.l4_protocol);
+                uint64_t idle_time = get_flow_idle_time_external(reader_thread->workflow, flow_basic);
                 logger(0,
                        "[%2zu][%4llu][last-seen: %13llu][last-update: %13llu][idle-time: %7llu][time-until-timeout: "
                        "%7llu]",
@@ -4373,6 +6357,8 @@ static void run_pcap_loop(struct nDPId_reader_thread * const reader_thread)
                         logger(1, "Unknown event data 0x%llx returned", (unsigned long long int)events[i].data.u64);
                     }
                 }
+
+                flush_collector_batch(reader_thread, 0);
             }
         }
     }
@@ -4407,6 +6393,7 @@ static void * processing_thread(void * const ndpi_thread_arg)
     }
 
     run_pcap_loop(reader_thread);
+    flush_collector_batch(reader_thread, 1000);
     set_collector_block(reader_thread);
     MT_GET_AND_ADD(reader_thread->workflow->error_or_eof, 1);
     return NULL;
@@ -4542,6 +6529,7 @@ static void process_remaining_flows(void)
         }
 
         jsonize_daemon(&reader_threads[i], DAEMON_EVENT_SHUTDOWN);
+        flush_collector_batch(&reader_threads[i], 1000);
     }
 }
 
@@ -4557,6 +6545,7 @@ static int stop_reader_threads(void)
     unsigned long long int total_flows_detected = 0;
     unsigned long long int total_flow_detection_updates = 0;
     unsigned long long int total_flow_updates = 0;
+    unsigned long long int total_service_cache_hits = 0;
 
     for (unsigned long long int i = 0; i < nDPId_options.reader_thread_count; ++i)
     {
@@ -4598,6 +6587,7 @@ static int stop_reader_threads(void)
         total_flows_detected += reader_threads[i].workflow->total_detected_flows;
         total_flow_detection_updates += reader_threads[i].workflow->total_flow_detection_updates;
         total_flow_updates += reader_threads[i].workflow->total_flow_updates;
+        total_service_cache_hits += reader_threads[i].workflow->total_service_cache_hits;
 
         printf(
             "Stopping Thread %2zu, processed %llu packets, %llu bytes\n"
@@ -4628,6 +6618,7 @@ static int stop_reader_threads(void)
     printf("Total flows not detected.....: %llu\n", total_not_detected);
     printf("Total flow updates...........: %llu\n", total_flow_updates);
     printf("Total flow detections updates: %llu\n", total_flow_detection_updates);
+    printf("Total service cache hits.....: %llu\n", total_service_cache_hits);
 
     return 0;
 }
@@ -4636,6 +6627,9 @@ static void free_reader_threads(void)
 {
     for (unsigned long long int i = 0; i < nDPId_options.reader_thread_count; ++i)
     {
+        ndpi_free(reader_threads[i].collector_batch);
+        reader_threads[i].collector_batch = NULL;
+
         if (reader_threads[i].workflow == NULL)
         {
             continue;
@@ -4643,11 +6637,16 @@ static void free_reader_threads(void)
 
         free_workflow(&reader_threads[i].workflow);
     }
+    free_policy_table();
 }
 
 static void sighandler(int signum)
 {
-    (void)signum;
+    if (signum == SIGHUP)
+    {
+        MT_GET_AND_ADD(nDPId_detection_module_reload, 1);
+        return;
+    }
 
     if (MT_GET_AND_ADD(nDPId_main_thread_shutdown, 0) == 0)
     {
@@ -4655,6 +6654,35 @@ static void sighandler(int signum)
     }
 }
 
+/*
+ * Builds new detection modules with the current content of all custom files.
+ * Reader threads keep capturing meanwhile and swap them in with their next flow scan.
+ */
+static void reload_detection_modules(void)
+{
+    logger(0, "%s", "Reloading custom protocol, category, JA3 and SHA1 files");
+
+    for (unsigned long long int i = 0; i < nDPId_options.reader_thread_count; ++i)
+    {
+        struct nDPId_workflow * const workflow = reader_threads[i].workflow;
+        struct nDPId_detection_module * detection_module = create_detection_module();
+
+        if (detection_module == NULL)
+        {
+            logger(1, "Could not reload the detection module of reader thread %llu", i);
+            continue;
+        }
+
+        /* a module which was not swapped in yet is outdated */
+        pthread_mutex_lock(&workflow->pending_detection_module_mutex);
+        struct nDPId_detection_module * const outdated = workflow->pending_detection_module;
+        workflow->pending_detection_module = detection_module;
+        pthread_mutex_unlock(&workflow->pending_detection_module_mutex);
+
+        retire_detection_module(outdated);
+    }
+}
+
 static void print_subopt_usage(void)
 {
     int index = MAX_FLOWS_PER_THREAD;
@@ -4706,12 +6734,27 @@ static void print_subopt_usage(void)
                 case UDP_MAX_IDLE_TIME:
                     fprintf(stderr, "%llu\n", nDPId_options.udp_max_idle_time);
                     break;
+                case UDP_MAX_TRANSACTION_TIME:
+                    fprintf(stderr, "%llu\n", nDPId_options.udp_max_transaction_time);
+                    break;
                 case TCP_MAX_IDLE_TIME:
                     fprintf(stderr, "%llu\n", nDPId_options.tcp_max_idle_time);
                     break;
                 case TCP_MAX_POST_END_FLOW_TIME:
                     fprintf(stderr, "%llu\n", nDPId_options.tcp_max_post_end_flow_time);
                     break;
+                case TCP_MAX_EMBRYONIC_TIME:
+                    fprintf(stderr, "%llu\n", nDPId_options.tcp_max_embryonic_time);
+                    break;
+                case TCP_MAX_POST_CLOSE_TIME:
+                    fprintf(stderr, "%llu\n", nDPId_options.tcp_max_post_close_time);
+                    break;
+                case ADAPTIVE_MIN_IDLE_TIME:
+                    fprintf(stderr, "%llu\n", nDPId_options.adaptive_min_idle_time);
+                    break;
+                case ADAPTIVE_MAX_IDLE_TIME:
+                    fprintf(stderr, "%llu\n", nDPId_options.adaptive_max_idle_time);
+                    break;
                 case MAX_PACKETS_PER_FLOW_TO_SEND:
                     fprintf(stderr, "%llu\n", nDPId_options.max_packets_per_flow_to_send);
                     break;
@@ -4721,6 +6764,12 @@ static void print_subopt_usage(void)
                 case MAX_PACKETS_PER_FLOW_TO_ANALYZE:
                     fprintf(stderr, "%llu\n", nDPId_options.max_packets_per_flow_to_analyse);
                     break;
+                case SERVICE_CACHE_SIZE:
+                    fprintf(stderr, "%llu\n", nDPId_options.service_cache_size);
+                    break;
+                case SERVICE_CACHE_MAX_AGE:
+                    fprintf(stderr, "%llu\n", nDPId_options.service_cache_max_age);
+                    break;
             }
         }
         else
@@ -4731,6 +6780,40 @@ static void print_subopt_usage(void)
     } while (1);
 }
 
+static int parse_tunnel_types(char const * const tunnel_types)
+{
+    char * const types = strdup(tunnel_types);
+    char * saveptr = NULL;
+    int retval = 0;
+
+    if (types == NULL)
+    {
+        return 1;
+    }
+
+    for (char * type = strtok_r(types, ",", &saveptr); type != NULL; type = strtok_r(NULL, ",", &saveptr))
+    {
+        size_t i;
+
+        for (i = TUNNEL_NONE + 1; i < TUNNEL_COUNT; ++i)
+        {
+            if (strcmp(type, tunnel_type_name_table[i]) == 0)
+            {
+                nDPId_options.decapsulate_tunnels |= (1u << i);
+                break;
+            }
+        }
+        if (i == TUNNEL_COUNT)
+        {
+            logger_early(1, "Unknown tunnel type `%s', expected one of: ipip, gre, vxlan, gtp", type);
+            retval = 1;
+        }
+    }
+
+    free(types);
+    return retval;
+}
+
 static int nDPId_parse_options(int argc, char ** argv)
 {
     int opt;
@@ -4739,13 +6822,13 @@ static int nDPId_parse_options(int argc, char ** argv)
         "Usage: %s "
         "[-i pcap-file/interface] [-I] [-E] [-B bpf-filter]\n"
         "\t  \t"
-        "[-l] [-L logfile] [-c address] "
+        "[-l] [-L logfile] [-c address] [-T] "
         "[-d] [-p pidfile]\n"
         "\t  \t"
         "[-u user] [-g group] "
-        "[-P path] [-C path] [-J path]\n"
+        "[-P path] [-C path] [-J path] [-S path]\n"
         "\t  \t"
-        "[-a instance-alias] [-A]\n"
+        "[-R path] [-D tunnel[,tunnel...]] [-a instance-alias] [-A]\n"
         "\t \t"
         "[-o subopt=value]\n"
         "\t  \t"
@@ -4759,6 +6842,8 @@ static int nDPId_parse_options(int argc, char ** argv)
         "\t-l\tLog all messages to stderr.\n"
         "\t-L\tLog all messages to a log file.\n"
         "\t-c\tPath to a UNIX socket (nDPIsrvd Collector) or a custom UDP endpoint.\n"
+        "\t-T\tConnect to a TCP nDPIsrvd Collector (see nDPIsrvd -t) if -c is a host:port.\n"
+        "\t  \tEvents are batched and the connection is re-established if lost.\n"
         "\t-d\tForking into background after initialization.\n"
         "\t-p\tWrite the daemon PID to the given file path.\n"
         "\t-u\tChange UID to the numeric value of user.\n"
@@ -4769,6 +6854,11 @@ static int nDPId_parse_options(int argc, char ** argv)
         "\t  \tSee: https://sslbl.abuse.ch/blacklist/ja3_fingerprints.csv\n"
         "\t-S\tLoad a nDPI SSL SHA1 hash blacklist file.\n"
         "\t  \tSee: https://sslbl.abuse.ch/blacklist/sslblacklist.csv\n"
+        "\t  \tThe files of -P, -C, -J and -S are reloaded on SIGHUP.\n"
+        "\t-R\tLoad a per prefix flow policy file.\n"
+        "\t  \tEach line: <skip|track|dpi|dpi-packets> <address>[/prefix-length] [port]\n"
+        "\t-D\tDecapsulate tunnels before flow tracking, inner flows are tracked individually.\n"
+        "\t  \tTunnel types: ipip, gre, vxlan, gtp (GTP-U)\n"
         "\t-a\tSet an alias name of this daemon instance which will\n"
         "\t  \tbe part of every JSON message.\n"
         "\t  \tThis value is required for correct flow handling of\n"
@@ -4783,7 +6873,7 @@ static int nDPId_parse_options(int argc, char ** argv)
         "\t-v\tversion\n"
         "\t-h\tthis\n\n";
 
-    while ((opt = getopt(argc, argv, "i:IEB:lL:c:dp:u:g:P:C:J:S:a:Azo:vh")) != -1)
+    while ((opt = getopt(argc, argv, "i:IEB:lL:c:Tdp:u:g:P:C:J:S:R:D:a:Azo:vh")) != -1)
     {
         switch (opt)
         {
@@ -4812,6 +6902,9 @@ static int nDPId_parse_options(int argc, char ** argv)
                 strncpy(nDPId_options.collector_address, optarg, sizeof(nDPId_options.collector_address) - 1);
                 nDPId_options.collector_address[sizeof(nDPId_options.collector_address) - 1] = '\0';
                 break;
+            case 'T':
+                nDPId_options.collector_tcp_stream = 1;
+                break;
             case 'd':
                 daemonize_enable();
                 break;
@@ -4837,6 +6930,15 @@ static int nDPId_parse_options(int argc, char ** argv)
             case 'S':
                 nDPId_options.custom_sha1_file = strdup(optarg);
                 break;
+            case 'R':
+                nDPId_options.policy_file = strdup(optarg);
+                break;
+            case 'D':
+                if (parse_tunnel_types(optarg) != 0)
+                {
+                    return 1;
+                }
+                break;
             case 'a':
                 nDPId_options.instance_alias = strdup(optarg);
                 break;
@@ -4929,12 +7031,27 @@ static int nDPId_parse_options(int argc, char ** argv)
                         case UDP_MAX_IDLE_TIME:
                             nDPId_options.udp_max_idle_time = value_llu;
                             break;
+                        case UDP_MAX_TRANSACTION_TIME:
+                            nDPId_options.udp_max_transaction_time = value_llu;
+                            break;
                         case TCP_MAX_IDLE_TIME:
                             nDPId_options.tcp_max_idle_time = value_llu;
                             break;
                         case TCP_MAX_POST_END_FLOW_TIME:
                             nDPId_options.tcp_max_post_end_flow_time = value_llu;
                             break;
+                        case TCP_MAX_EMBRYONIC_TIME:
+                            nDPId_options.tcp_max_embryonic_time = value_llu;
+                            break;
+                        case TCP_MAX_POST_CLOSE_TIME:
+                            nDPId_options.tcp_max_post_close_time = value_llu;
+                            break;
+                        case ADAPTIVE_MIN_IDLE_TIME:
+                            nDPId_options.adaptive_min_idle_time = value_llu;
+                            break;
+                        case ADAPTIVE_MAX_IDLE_TIME:
+                            nDPId_options.adaptive_max_idle_time = value_llu;
+                            break;
                         case MAX_PACKETS_PER_FLOW_TO_SEND:
                             nDPId_options.max_packets_per_flow_to_send = value_llu;
                             break;
@@ -4944,6 +7061,12 @@ static int nDPId_parse_options(int argc, char ** argv)
                         case MAX_PACKETS_PER_FLOW_TO_ANALYZE:
                             nDPId_options.max_packets_per_flow_to_analyse = value_llu;
                             break;
+                        case SERVICE_CACHE_SIZE:
+                            nDPId_options.service_cache_size = value_llu;
+                            break;
+                        case SERVICE_CACHE_MAX_AGE:
+                            nDPId_options.service_cache_max_age = value_llu;
+                            break;
                     }
                 }
                 break;
@@ -5089,6 +7212,38 @@ static int validate_options(void)
                      nDPId_options.udp_max_idle_time);
         retval = 1;
     }
+    if (nDPId_options.udp_max_transaction_time > nDPId_options.udp_max_idle_time)
+    {
+        logger_early(1,
+                     "Value not in range: udp-max-transaction-time[%llu] <= udp-max-idle-time[%llu]",
+                     nDPId_options.udp_max_transaction_time,
+                     nDPId_options.udp_max_idle_time);
+        retval = 1;
+    }
+    if (nDPId_options.adaptive_min_idle_time > nDPId_options.adaptive_max_idle_time)
+    {
+        logger_early(1,
+                     "Value not in range: adaptive-min-idle-time[%llu] <= adaptive-max-idle-time[%llu]",
+                     nDPId_options.adaptive_min_idle_time,
+                     nDPId_options.adaptive_max_idle_time);
+        retval = 1;
+    }
+    if (nDPId_options.tcp_max_embryonic_time > nDPId_options.tcp_max_idle_time)
+    {
+        logger_early(1,
+                     "Value not in range: tcp-max-embryonic-time[%llu] <= tcp-max-idle-time[%llu]",
+                     nDPId_options.tcp_max_embryonic_time,
+                     nDPId_options.tcp_max_idle_time);
+        retval = 1;
+    }
+    if (nDPId_options.tcp_max_post_close_time > nDPId_options.tcp_max_post_end_flow_time)
+    {
+        logger_early(1,
+                     "Value not in range: tcp-max-post-close-time[%llu] <= tcp-max-post-end-flow-time[%llu]",
+                     nDPId_options.tcp_max_post_close_time,
+                     nDPId_options.tcp_max_post_end_flow_time);
+        retval = 1;
+    }
     if (nDPId_options.process_internal_initial_direction != 0 && nDPId_options.process_external_initial_direction != 0)
     {
         logger_early(1, "%s", "Internal and External packet processing does not make sense as this is the default.");
@@ -5108,6 +7263,16 @@ static int validate_options(void)
                      nDPId_options.max_packets_per_flow_to_process);
         retval = 1;
     }
+    if (nDPId_options.service_cache_size > 0 &&
+        (nDPId_options.service_cache_size < nDPId_SERVICE_CACHE_WAYS ||
+         (nDPId_options.service_cache_size & (nDPId_options.service_cache_size - 1)) != 0))
+    {
+        logger_early(1,
+                     "Value not a power of two >= %u: service-cache-size[%llu]",
+                     nDPId_SERVICE_CACHE_WAYS,
+                     nDPId_options.service_cache_size);
+        retval = 1;
+    }
     if (nDPId_options.max_packets_per_flow_to_send > 30)
     {
         logger_early(1, "%s", "Higher values of max-packets-per-flow-to-send may cause superfluous network usage.");
@@ -5180,10 +7345,18 @@ int main(int argc, char ** argv)
 
     signal(SIGINT, sighandler);
     signal(SIGTERM, sighandler);
+    signal(SIGHUP, sighandler);
     signal(SIGPIPE, SIG_IGN);
 
     while (MT_GET_AND_ADD(nDPId_main_thread_shutdown, 0) == 0 && processing_threads_error_or_eof() == 0)
     {
+        int const reload_requests = MT_GET_AND_ADD(nDPId_detection_module_reload, 0);
+        if (reload_requests != 0)
+        {
+            /* several SIGHUPs in a row need only one reload */
+            MT_GET_AND_SUB(nDPId_detection_module_reload, reload_requests);
+            reload_detection_modules();
+        }
         sleep(1);
     }
 
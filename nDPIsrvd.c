@@ -5,6 +5,7 @@
 #include <netinet/tcp.h>
 #include <pwd.h>
 #include <signal.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -13,8 +14,14 @@
 #include <sys/signalfd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
+#ifdef ENABLE_IO_URING
+#include <liburing.h>
+#include <poll.h>
+#endif
+
 #include "config.h"
 #include "nDPIsrvd.h"
 #include "utils.h"
@@ -22,6 +29,7 @@
 enum sock_type
 {
     COLLECTOR_UN,
+    COLLECTOR_IN,
     DISTRIBUTOR_UN,
     DISTRIBUTOR_IN,
 };
@@ -32,10 +40,42 @@ struct nDPIsrvd_write_buffer
     size_t written;
 };
 
+#define nDPIsrvd_LATENCY_BUCKETS 8
+
+/* upper bounds of the delivery latency histogram buckets, the last bucket is +Inf */
+static nDPIsrvd_ull const latency_bucket_bounds_usec[nDPIsrvd_LATENCY_BUCKETS - 1] = {
+    10, 100, 1000, 10000, 100000, 1000000, 10000000};
+
+struct latency_histogram
+{
+    nDPIsrvd_ull buckets[nDPIsrvd_LATENCY_BUCKETS];
+    nDPIsrvd_ull count;
+    nDPIsrvd_ull sum_usec;
+    nDPIsrvd_ull max_usec;
+};
+
+struct remote_stats
+{
+    uint64_t connected_usec;
+    nDPIsrvd_ull lines; /* received by a collector / queued for a distributor */
+    nDPIsrvd_ull bytes; /* received by a collector / written to a distributor */
+    nDPIsrvd_ull max_queue_depth;
+    nDPIsrvd_ull blocking_drains;
+    nDPIsrvd_ull blocking_drain_usec;
+    uint64_t pending_since_usec; /* collector receive time of the oldest unsent line */
+    struct latency_histogram latency;
+};
+
 struct remote_desc
 {
     enum sock_type sock_type;
     int fd;
+    struct remote_stats stats;
+#ifdef ENABLE_IO_URING
+    uint32_t uring_generation;
+    size_t uring_send_in_flight;
+    int uring_closing; /* disconnected, but the kernel still owns the main write buffer, see uring_release_remote() */
+#endif
 
     union
     {
@@ -46,20 +86,32 @@ struct remote_desc
             pid_t pid;
 
             struct nDPIsrvd_json_buffer main_read_buffer;
-        } event_collector_un;
+        } event_collector_un; /* UNIX socket */
+        struct
+        {
+            struct sockaddr_storage peer;
+            char peer_addr[INET6_ADDRSTRLEN + 2]; /* IPv6 addresses in brackets, see set_peer_address() */
+            uint16_t peer_port;
+            unsigned long long int json_bytes;
+
+            struct nDPIsrvd_json_buffer main_read_buffer;
+        } event_collector_in; /* TCP/IP socket */
         struct
         {
             struct sockaddr_un peer;
             pid_t pid;
             char * user_name;
+            int aggregated; /* receives consolidated flow records only */
+            int metrics;    /* receives a single OpenMetrics response, see stats_send_openmetrics() */
 
             struct nDPIsrvd_write_buffer main_write_buffer;
             UT_array * additional_write_buffers;
         } event_distributor_un; /* UNIX socket */
         struct
         {
-            struct sockaddr_in peer;
-            char peer_addr[INET_ADDRSTRLEN];
+            struct sockaddr_storage peer;
+            char peer_addr[INET6_ADDRSTRLEN + 2]; /* IPv6 addresses in brackets, see set_peer_address() */
+            uint16_t peer_port;
 
             struct nDPIsrvd_write_buffer main_write_buffer;
             UT_array * additional_write_buffers;
@@ -74,29 +126,142 @@ static struct
     nDPIsrvd_ull desc_used;
 } remotes = {NULL, 0, 0};
 
+/* last known state of a flow which `new' event already left the catch-up ring */
+struct catchup_flow
+{
+    char * key; /* alias '\0' source '\0' flow_id */
+    size_t key_length;
+    struct nDPIsrvd_buffer new_event;
+    struct nDPIsrvd_buffer detection_event;
+    uint64_t expires_usec; /* last event + flow_idle_time + catch-up max age, see catchup_expire_flows() */
+    UT_hash_handle hh;
+};
+
+struct catchup_entry_header
+{
+    uint64_t recv_time_usec;
+    uint32_t length; /* 0 marks a wrap-around to the beginning of the ring */
+};
+
+static struct
+{
+    uint8_t * data;
+    size_t size;
+    size_t head;
+    size_t tail;
+    size_t used;
+    struct catchup_flow * flow_table;
+    uint64_t last_flow_table_scan;
+} catchup = {NULL, 0, 0, 0, 0, NULL, 0};
+
+/* consolidated state of a flow for distributors connected to the aggregation socket */
+struct aggregation_flow
+{
+    char * key; /* alias '\0' source '\0' flow_id */
+    size_t key_length;
+    struct nDPIsrvd_buffer ndpi; /* latest `ndpi' object seen for this flow */
+    char detection_event_name[24];
+    unsigned long long int flow_events;
+    unsigned long long int packet_events;
+    uint64_t last_record_usec;
+    UT_hash_handle hh;
+};
+
+/* top-level keys of an event line, see parse_event_keys() */
+struct event_keys
+{
+    jsmntok_t const * root;
+    jsmntok_t const * flow_event_name;
+    jsmntok_t const * packet_event_name;
+    jsmntok_t const * daemon_event_name;
+    jsmntok_t const * ndpi;
+    jsmntok_t const * flow_idle_time;
+    char key[256];
+    size_t source_key_length; /* alias '\0' source '\0' */
+    size_t key_length;        /* source key + flow_id, equals source_key_length if there is no flow_id */
+};
+
+static struct aggregation_flow * aggregation_flow_table = NULL;
+
+static struct
+{
+    nDPIsrvd_ull collector_connections;
+    nDPIsrvd_ull distributor_connections;
+    nDPIsrvd_ull collector_lines;
+    nDPIsrvd_ull collector_bytes;
+    nDPIsrvd_ull collector_protocol_errors;
+    nDPIsrvd_ull collector_truncated_parses;
+    nDPIsrvd_ull distributor_lines;
+    nDPIsrvd_ull distributor_bytes;
+    nDPIsrvd_ull distributor_slow_disconnects;
+    nDPIsrvd_ull distributor_bytes_dropped;
+    nDPIsrvd_ull blocking_drains;
+    nDPIsrvd_ull blocking_drain_usec;
+    struct latency_histogram latency;
+    uint64_t last_event_usec;
+    char hostname[64];
+} nDPIsrvd_stats = {};
+
 static int nDPIsrvd_main_thread_shutdown = 0;
 static int collector_un_sockfd = -1;
+static int collector_in_sockfd = -1;
 static int distributor_un_sockfd = -1;
 static int distributor_in_sockfd = -1;
+static int catchup_un_sockfd = -1;
+static int aggregation_un_sockfd = -1;
+static int metrics_un_sockfd = -1;
 static struct nDPIsrvd_address distributor_in_address = {
     .raw.sa_family = 0xFFFF,
 };
+static struct nDPIsrvd_address collector_in_address = {
+    .raw.sa_family = 0xFFFF,
+};
 
 static struct
 {
     char * pidfile;
     char * collector_un_sockpath;
+    char * collector_in_address;
     char * distributor_un_sockpath;
     char * distributor_in_address;
+    char * catchup_un_sockpath;
+    nDPIsrvd_ull catchup_ring_size;
+    nDPIsrvd_ull catchup_max_age;
+    char * aggregation_un_sockpath;
+    nDPIsrvd_ull aggregation_interim_interval;
+    char * metrics_un_sockpath;
+    nDPIsrvd_ull stats_event_interval;
     nDPIsrvd_ull max_remote_descriptors;
     char * user;
     char * group;
     nDPIsrvd_ull max_write_buffers;
     int bufferbloat_fallback_to_blocking;
-} nDPIsrvd_options = {.max_remote_descriptors = nDPIsrvd_MAX_REMOTE_DESCRIPTORS,
+    int use_io_uring;
+} nDPIsrvd_options = {.catchup_ring_size = nDPIsrvd_CATCHUP_RING_SIZE,
+                      .catchup_max_age = nDPIsrvd_CATCHUP_MAX_AGE,
+                      .aggregation_interim_interval = nDPIsrvd_AGGREGATION_INTERIM_INTERVAL,
+                      .stats_event_interval = nDPIsrvd_STATS_EVENT_INTERVAL,
+                      .max_remote_descriptors = nDPIsrvd_MAX_REMOTE_DESCRIPTORS,
                       .max_write_buffers = nDPIsrvd_MAX_WRITE_BUFFERS,
                       .bufferbloat_fallback_to_blocking = 1};
 
+#ifdef ENABLE_IO_URING
+enum uring_op
+{
+    URING_OP_ACCEPT = 1,
+    URING_OP_READ,
+    URING_OP_POLL,
+    URING_OP_SEND,
+    URING_OP_SIGNAL,
+};
+
+static struct io_uring uring;
+static int uring_enabled = 0;
+static uint32_t uring_generation = 0;
+static uint8_t * uring_read_buffers = NULL;
+static struct signalfd_siginfo uring_siginfo;
+#endif
+
 static void logger_nDPIsrvd(struct remote_desc const * const remote,
                             char const * const prefix,
                             char const * const format,
@@ -109,6 +274,14 @@ static int del_event(int epollfd, int fd);
 static int del_out_event(int epollfd, struct remote_desc * const remote);
 static void disconnect_client(int epollfd, struct remote_desc * const current);
 static int drain_write_buffers_blocking(struct remote_desc * const remote);
+static int is_metrics_remote(struct remote_desc const * const remote);
+static int distribute_collector_data(int epollfd, struct remote_desc * const current);
+static void distribute_line(
+    int epollfd, int aggregated, uint8_t const * const line, size_t line_length, uint64_t recv_usec);
+#ifdef ENABLE_IO_URING
+static int uring_add_read(struct remote_desc * const remote);
+static int uring_add_send(struct remote_desc * const remote);
+#endif
 
 static void nDPIsrvd_buffer_array_copy(void * dst, const void * src)
 {
@@ -153,6 +326,53 @@ void nDPIsrvd_memprof_log(char const * const format, ...)
 #endif
 #endif
 
+static int is_io_uring_active(void)
+{
+#ifdef ENABLE_IO_URING
+    return uring_enabled;
+#else
+    return 0;
+#endif
+}
+
+static int is_remote_closing(struct remote_desc const * const remote)
+{
+#ifdef ENABLE_IO_URING
+    return remote->uring_closing;
+#else
+    (void)remote;
+    return 0;
+#endif
+}
+
+static uint64_t get_monotonic_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u * 1000u + ts.tv_nsec / 1000u;
+}
+
+static void latency_histogram_add(struct latency_histogram * const histogram, nDPIsrvd_ull latency_usec)
+{
+    size_t i;
+
+    for (i = 0; i < nDPIsrvd_LATENCY_BUCKETS - 1; ++i)
+    {
+        if (latency_usec <= latency_bucket_bounds_usec[i])
+        {
+            break;
+        }
+    }
+    histogram->buckets[i]++;
+    histogram->count++;
+    histogram->sum_usec += latency_usec;
+    if (latency_usec > histogram->max_usec)
+    {
+        histogram->max_usec = latency_usec;
+    }
+}
+
 static struct nDPIsrvd_json_buffer * get_read_buffer(struct remote_desc * const remote)
 {
     switch (remote->sock_type)
@@ -160,6 +380,27 @@ static struct nDPIsrvd_json_buffer * get_read_buffer(struct remote_desc * const
         case COLLECTOR_UN:
             return &remote->event_collector_un.main_read_buffer;
 
+        case COLLECTOR_IN:
+            return &remote->event_collector_in.main_read_buffer;
+
+        case DISTRIBUTOR_UN:
+        case DISTRIBUTOR_IN:
+            return NULL;
+    }
+
+    return NULL;
+}
+
+static unsigned long long int * get_collector_json_bytes(struct remote_desc * const remote)
+{
+    switch (remote->sock_type)
+    {
+        case COLLECTOR_UN:
+            return &remote->event_collector_un.json_bytes;
+
+        case COLLECTOR_IN:
+            return &remote->event_collector_in.json_bytes;
+
         case DISTRIBUTOR_UN:
         case DISTRIBUTOR_IN:
             return NULL;
@@ -173,6 +414,7 @@ static struct nDPIsrvd_write_buffer * get_write_buffer(struct remote_desc * cons
     switch (remote->sock_type)
     {
         case COLLECTOR_UN:
+        case COLLECTOR_IN:
             return NULL;
 
         case DISTRIBUTOR_UN:
@@ -190,6 +432,7 @@ static UT_array * get_additional_write_buffers(struct remote_desc * const remote
     switch (remote->sock_type)
     {
         case COLLECTOR_UN:
+        case COLLECTOR_IN:
             return NULL;
 
         case DISTRIBUTOR_UN:
@@ -202,8 +445,32 @@ static UT_array * get_additional_write_buffers(struct remote_desc * const remote
     return NULL;
 }
 
+/* Record the delivery latency once all pending data of a distributor was written. */
+static void stats_check_flushed(struct remote_desc * const remote)
+{
+    struct nDPIsrvd_write_buffer * const write_buffer = get_write_buffer(remote);
+    UT_array * const additional_write_buffers = get_additional_write_buffers(remote);
+
+    if (remote->stats.pending_since_usec == 0 || write_buffer == NULL || additional_write_buffers == NULL ||
+        write_buffer->buf.used > 0 || utarray_len(additional_write_buffers) > 0)
+    {
+        return;
+    }
+
+    nDPIsrvd_ull const latency_usec = get_monotonic_usec() - remote->stats.pending_since_usec;
+    latency_histogram_add(&remote->stats.latency, latency_usec);
+    latency_histogram_add(&nDPIsrvd_stats.latency, latency_usec);
+    remote->stats.pending_since_usec = 0;
+}
+
+static void stats_add_written(struct remote_desc * const remote, size_t bytes)
+{
+    remote->stats.bytes += bytes;
+    nDPIsrvd_stats.distributor_bytes += bytes;
+}
+
 static int add_to_additional_write_buffers(struct remote_desc * const remote,
-                                           uint8_t * const buf,
+                                           uint8_t const * const buf,
                                            nDPIsrvd_ull json_string_length)
 {
     struct nDPIsrvd_write_buffer buf_src = {};
@@ -216,12 +483,14 @@ static int add_to_additional_write_buffers(struct remote_desc * const remote,
 
     if (utarray_len(additional_write_buffers) >= nDPIsrvd_options.max_write_buffers)
     {
-        if (nDPIsrvd_options.bufferbloat_fallback_to_blocking == 0)
+        /* blocking I/O would interfere with in-flight io_uring sends */
+        if (nDPIsrvd_options.bufferbloat_fallback_to_blocking == 0 || is_io_uring_active() != 0)
         {
             logger_nDPIsrvd(remote,
                             "Buffer limit for",
                             "for reached, remote too slow: %u lines",
                             utarray_len(additional_write_buffers));
+            nDPIsrvd_stats.distributor_slow_disconnects++;
             return -1;
         }
         else
@@ -237,9 +506,14 @@ static int add_to_additional_write_buffers(struct remote_desc * const remote,
         }
     }
 
-    buf_src.buf.ptr.raw = buf;
+    /* the array copy ctor duplicates the data */
+    buf_src.buf.ptr.raw = (uint8_t *)buf;
     buf_src.buf.used = buf_src.buf.max = json_string_length;
     utarray_push_back(additional_write_buffers, &buf_src);
+    if (utarray_len(additional_write_buffers) > remote->stats.max_queue_depth)
+    {
+        remote->stats.max_queue_depth = utarray_len(additional_write_buffers);
+    }
 
     return 0;
 }
@@ -271,12 +545,21 @@ static void logger_nDPIsrvd(struct remote_desc const * const remote,
                    prefix,
                    (int)sizeof(remote->event_distributor_in.peer_addr),
                    remote->event_distributor_in.peer_addr,
-                   ntohs(remote->event_distributor_in.peer.sin_port),
+                   remote->event_distributor_in.peer_port,
                    logbuf);
             break;
         case COLLECTOR_UN:
             logger(1, "%s PID %d %s", prefix, remote->event_collector_un.pid, logbuf);
             break;
+        case COLLECTOR_IN:
+            logger(1,
+                   "%s %.*s:%u %s",
+                   prefix,
+                   (int)sizeof(remote->event_collector_in.peer_addr),
+                   remote->event_collector_in.peer_addr,
+                   remote->event_collector_in.peer_port,
+                   logbuf);
+            break;
     }
 
     va_end(ap);
@@ -324,6 +607,7 @@ static int drain_main_buffer(struct remote_desc * const remote)
     }
 
     write_buffer->buf.used -= bytes_written;
+    stats_add_written(remote, bytes_written);
     return 0;
 }
 
@@ -355,6 +639,7 @@ static int drain_write_buffers(struct remote_desc * const remote)
                 return -1;
             default:
                 buf->written += written;
+                stats_add_written(remote, written);
                 if (buf->written == buf->buf.max)
                 {
                     utarray_erase(additional_write_buffers, 0, 1);
@@ -369,6 +654,7 @@ static int drain_write_buffers(struct remote_desc * const remote)
 static int drain_write_buffers_blocking(struct remote_desc * const remote)
 {
     int retval = 0;
+    uint64_t const start_usec = get_monotonic_usec();
 
     if (fcntl_del_flags(remote->fd, O_NONBLOCK) != 0)
     {
@@ -386,6 +672,12 @@ static int drain_write_buffers_blocking(struct remote_desc * const remote)
         return -1;
     }
 
+    uint64_t const drain_usec = get_monotonic_usec() - start_usec;
+    remote->stats.blocking_drains++;
+    remote->stats.blocking_drain_usec += drain_usec;
+    nDPIsrvd_stats.blocking_drains++;
+    nDPIsrvd_stats.blocking_drain_usec += drain_usec;
+
     return retval;
 }
 
@@ -403,8 +695,14 @@ static int handle_outgoing_data(int epollfd, struct remote_desc * const remote)
         disconnect_client(epollfd, remote);
         return -1;
     }
-    if (utarray_len(additional_write_buffers) == 0)
+    stats_check_flushed(remote);
+    if (utarray_len(additional_write_buffers) == 0 && get_write_buffer(remote)->buf.used == 0)
     {
+        if (is_metrics_remote(remote) != 0)
+        {
+            disconnect_client(epollfd, remote);
+            return 0;
+        }
         return del_out_event(epollfd, remote);
     }
 
@@ -435,6 +733,91 @@ static int fcntl_del_flags(int fd, int flags)
     return fcntl(fd, F_SETFL, cur_flags & ~flags);
 }
 
+static int create_optional_un_socket(char const * const name, char const * const sockpath, int * const sockfd)
+{
+    struct sockaddr_un addr;
+    addr.sun_family = AF_UNIX;
+
+    *sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (*sockfd < 0)
+    {
+        logger(1, "Error creating UNIX socket: %s", strerror(errno));
+        return 1;
+    }
+
+    int written = snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", sockpath);
+    if (written < 0)
+    {
+        logger(1, "snprintf failed: %s", strerror(errno));
+        return 1;
+    }
+    else if (written == sizeof(addr.sun_path))
+    {
+        logger(1,
+               "%s UNIX socket path too long, current/max: %zu/%zu",
+               name,
+               strlen(sockpath),
+               sizeof(addr.sun_path) - 1);
+        return 1;
+    }
+
+    if (bind(*sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        logger(1, "Error binding %s socket to `%s': %s", name, sockpath, strerror(errno));
+        return 1;
+    }
+
+    if (listen(*sockfd, 16) < 0 || fcntl_add_flags(*sockfd, O_NONBLOCK) != 0)
+    {
+        logger(1, "Error setting up %s socket `%s': %s", name, sockpath, strerror(errno));
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * SO_REUSEPORT lets several nDPIsrvd instances listen on the same collector port,
+ * the kernel balances incoming nDPId connections between them.
+ */
+static int create_collector_in_socket(void)
+{
+    int opt = 1;
+
+    collector_in_sockfd = socket(collector_in_address.raw.sa_family, SOCK_STREAM, 0);
+    if (collector_in_sockfd < 0)
+    {
+        logger(1, "Error creating TCP/IP socket: %s", strerror(errno));
+        return 1;
+    }
+
+    if (setsockopt(collector_in_sockfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+        setsockopt(collector_in_sockfd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
+    {
+        logger(1, "Setting TCP/IP socket option SO_REUSEADDR/SO_REUSEPORT failed: %s", strerror(errno));
+    }
+
+    if (bind(collector_in_sockfd, &collector_in_address.raw, collector_in_address.size) < 0)
+    {
+        logger(1,
+               "Error binding Collector TCP/IP socket to %s: %s",
+               nDPIsrvd_options.collector_in_address,
+               strerror(errno));
+        return 1;
+    }
+
+    if (listen(collector_in_sockfd, 16) < 0 || fcntl_add_flags(collector_in_sockfd, O_NONBLOCK) != 0)
+    {
+        logger(1,
+               "Error setting up Collector TCP/IP socket %s: %s",
+               nDPIsrvd_options.collector_in_address,
+               strerror(errno));
+        return 1;
+    }
+
+    return 0;
+}
+
 static int create_listen_sockets(void)
 {
     collector_un_sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
@@ -559,6 +942,31 @@ static int create_listen_sockets(void)
         }
     }
 
+    if (nDPIsrvd_options.collector_in_address != NULL && create_collector_in_socket() != 0)
+    {
+        return 3;
+    }
+
+    if (nDPIsrvd_options.catchup_un_sockpath != NULL &&
+        create_optional_un_socket(
+            "Catch-up distributor", nDPIsrvd_options.catchup_un_sockpath, &catchup_un_sockfd) != 0)
+    {
+        return 3;
+    }
+
+    if (nDPIsrvd_options.aggregation_un_sockpath != NULL &&
+        create_optional_un_socket(
+            "Aggregation distributor", nDPIsrvd_options.aggregation_un_sockpath, &aggregation_un_sockfd) != 0)
+    {
+        return 3;
+    }
+
+    if (nDPIsrvd_options.metrics_un_sockpath != NULL &&
+        create_optional_un_socket("Metrics", nDPIsrvd_options.metrics_un_sockpath, &metrics_un_sockfd) != 0)
+    {
+        return 3;
+    }
+
     if (listen(collector_un_sockfd, 16) < 0 || listen(distributor_un_sockfd, 16) < 0)
     {
         logger(1, "Error listening UNIX socket: %s", strerror(errno));
@@ -596,18 +1004,35 @@ static struct remote_desc * get_remote_descriptor(enum sock_type type, int remot
 
     for (size_t i = 0; i < remotes.desc_size; ++i)
     {
-        if (remotes.desc[i].fd == -1)
+        if (remotes.desc[i].fd == -1 && is_remote_closing(&remotes.desc[i]) == 0)
         {
             remotes.desc_used++;
 
+            struct nDPIsrvd_json_buffer * json_buffer = NULL;
             struct nDPIsrvd_write_buffer * write_buffer = NULL;
             UT_array ** additional_write_buffers = NULL;
 
             switch (type)
             {
                 case COLLECTOR_UN:
-                    if (nDPIsrvd_json_buffer_init(&remotes.desc[i].event_collector_un.main_read_buffer,
-                                                  max_buffer_size) != 0)
+                case COLLECTOR_IN:
+                    json_buffer = (type == COLLECTOR_UN ? &remotes.desc[i].event_collector_un.main_read_buffer
+                                                        : &remotes.desc[i].event_collector_in.main_read_buffer);
+#ifdef ENABLE_IO_URING
+                    if (uring_enabled != 0)
+                    {
+                        /* collector reads go into the registered buffer of this slot */
+                        json_buffer->buf.ptr.raw = uring_read_buffers + i * NETWORK_BUFFER_MAX_SIZE;
+                        json_buffer->buf.used = 0;
+                        json_buffer->buf.max = NETWORK_BUFFER_MAX_SIZE;
+                        json_buffer->read_offset = 0ul;
+                        json_buffer->json_string_start = 0ul;
+                        json_buffer->json_string_length = 0ull;
+                        json_buffer->json_string = NULL;
+                        break;
+                    }
+#endif
+                    if (nDPIsrvd_json_buffer_init(json_buffer, max_buffer_size) != 0)
                     {
                         logger(1, "Read/JSON buffer init failed, size: %zu bytes", max_buffer_size);
                         return NULL;
@@ -640,6 +1065,11 @@ static struct remote_desc * get_remote_descriptor(enum sock_type type, int remot
 
             remotes.desc[i].sock_type = type;
             remotes.desc[i].fd = remote_fd;
+            remotes.desc[i].stats.connected_usec = get_monotonic_usec();
+#ifdef ENABLE_IO_URING
+            remotes.desc[i].uring_generation = ++uring_generation;
+            remotes.desc[i].uring_send_in_flight = 0;
+#endif
             return &remotes.desc[i];
         }
     }
@@ -652,23 +1082,59 @@ static void free_remote(int epollfd, struct remote_desc * remote)
 {
     if (remote->fd > -1)
     {
-        errno = 0;
-        del_event(epollfd, remote->fd);
-        if (errno != 0)
+        if (is_io_uring_active() == 0)
+        {
+            errno = 0;
+            del_event(epollfd, remote->fd);
+            if (errno != 0)
+            {
+                logger_nDPIsrvd(remote, "Could not delete event from epoll for connection", ": %s", strerror(errno));
+            }
+        }
+        else
+        {
+            /* wake up all in-flight io_uring requests, their completions are ignored */
+            shutdown(remote->fd, SHUT_RDWR);
+#ifdef ENABLE_IO_URING
+            /* a pending send still references the main write buffer, it is released with its completion */
+            remote->uring_closing = (remote->uring_send_in_flight != 0);
+#endif
+        }
+
+        /* everything still buffered for a distributor is lost */
+        if (get_write_buffer(remote) != NULL && get_additional_write_buffers(remote) != NULL)
         {
-            logger_nDPIsrvd(remote, "Could not delete event from epoll for connection", ": %s", strerror(errno));
+            UT_array * const additional_write_buffers = get_additional_write_buffers(remote);
+            struct nDPIsrvd_write_buffer * buf = NULL;
+
+            nDPIsrvd_stats.distributor_bytes_dropped += get_write_buffer(remote)->buf.used;
+            while ((buf = (struct nDPIsrvd_write_buffer *)utarray_next(additional_write_buffers, buf)) != NULL)
+            {
+                nDPIsrvd_stats.distributor_bytes_dropped += buf->buf.used - buf->written;
+            }
         }
+
         errno = 0;
         close(remote->fd);
 
         switch (remote->sock_type)
         {
             case COLLECTOR_UN:
+            case COLLECTOR_IN:
                 if (errno != 0)
                 {
                     logger_nDPIsrvd(remote, "Error closing collector connection", ": %s", strerror(errno));
                 }
-                nDPIsrvd_json_buffer_free(&remote->event_collector_un.main_read_buffer);
+                logger_nDPIsrvd(remote,
+                                "Collector",
+                                "received %llu lines / %llu bytes in %llu sec",
+                                remote->stats.lines,
+                                remote->stats.bytes,
+                                (get_monotonic_usec() - remote->stats.connected_usec) / (1000ull * 1000ull));
+                if (is_io_uring_active() == 0)
+                {
+                    nDPIsrvd_json_buffer_free(get_read_buffer(remote));
+                }
                 break;
             case DISTRIBUTOR_UN:
                 if (errno != 0)
@@ -679,7 +1145,10 @@ static void free_remote(int epollfd, struct remote_desc * remote)
                 {
                     utarray_free(remote->event_distributor_un.additional_write_buffers);
                 }
-                nDPIsrvd_buffer_free(&remote->event_distributor_un.main_write_buffer.buf);
+                if (is_remote_closing(remote) == 0)
+                {
+                    nDPIsrvd_buffer_free(&remote->event_distributor_un.main_write_buffer.buf);
+                }
                 free(remote->event_distributor_un.user_name);
                 break;
             case DISTRIBUTOR_IN:
@@ -691,16 +1160,45 @@ static void free_remote(int epollfd, struct remote_desc * remote)
                 {
                     utarray_free(remote->event_distributor_in.additional_write_buffers);
                 }
-                nDPIsrvd_buffer_free(&remote->event_distributor_in.main_write_buffer.buf);
+                if (is_remote_closing(remote) == 0)
+                {
+                    nDPIsrvd_buffer_free(&remote->event_distributor_in.main_write_buffer.buf);
+                }
                 break;
         }
 
+#ifdef ENABLE_IO_URING
+        if (remote->uring_closing != 0)
+        {
+            struct remote_desc const closing = *remote;
+
+            /* keep the slot (and its buffer) until the send completion arrives */
+            memset(remote, 0, sizeof(*remote));
+            remote->sock_type = closing.sock_type;
+            remote->fd = -1;
+            remote->uring_generation = closing.uring_generation;
+            remote->uring_closing = 1;
+            *get_write_buffer(remote) = *get_write_buffer((struct remote_desc *)&closing);
+            return;
+        }
+#endif
+
         memset(remote, 0, sizeof(*remote));
         remote->fd = -1;
         remotes.desc_used--;
     }
 }
 
+#ifdef ENABLE_IO_URING
+static void uring_release_remote(struct remote_desc * const remote)
+{
+    nDPIsrvd_buffer_free(&get_write_buffer(remote)->buf);
+    memset(remote, 0, sizeof(*remote));
+    remote->fd = -1;
+    remotes.desc_used--;
+}
+#endif
+
 static void free_remotes(int epollfd)
 {
     for (size_t i = 0; i < remotes.desc_size; ++i)
@@ -733,6 +1231,12 @@ static int add_in_event_fd(int epollfd, int fd)
 
 static int add_in_event(int epollfd, struct remote_desc * const remote)
 {
+#ifdef ENABLE_IO_URING
+    if (uring_enabled != 0)
+    {
+        return uring_add_read(remote);
+    }
+#endif
     return add_event(epollfd, EPOLLIN, remote->fd, remote);
 }
 
@@ -766,675 +1270,2643 @@ static void disconnect_client(int epollfd, struct remote_desc * const remote)
     free_remote(epollfd, remote);
 }
 
-static int nDPIsrvd_parse_options(int argc, char ** argv)
+static int set_buffer_content(struct nDPIsrvd_buffer * const buffer, uint8_t const * const data, size_t data_length)
 {
-    int opt;
+    nDPIsrvd_buffer_free(buffer);
+    if (nDPIsrvd_buffer_init(buffer, data_length) != 0)
+    {
+        return 1;
+    }
+    memcpy(buffer->ptr.raw, data, data_length);
+    buffer->used = data_length;
+
+    return 0;
+}
+
+static int json_token_equals(char const * const json, jsmntok_t const * const token, char const * const str)
+{
+    size_t const length = strlen(str);
+
+    return (size_t)(token->end - token->start) == length && strncmp(json + token->start, str, length) == 0;
+}
+
+static int is_detection_event(char const * const json, jsmntok_t const * const flow_event_name)
+{
+    return json_token_equals(json, flow_event_name, "guessed") != 0 ||
+           json_token_equals(json, flow_event_name, "detected") != 0 ||
+           json_token_equals(json, flow_event_name, "detection-update") != 0 ||
+           json_token_equals(json, flow_event_name, "not-detected") != 0;
+}
 
-    while ((opt = getopt(argc, argv, "lL:c:dp:s:S:m:u:g:C:Dvh")) != -1)
+/*
+ * Tokenize a framed event line and build the flow key `alias \0 source \0 flow_id' from it.
+ * Returns a pointer to the JSON object within the line or NULL if the line does not carry alias/source.
+ * The returned tokens are valid until the next call.
+ */
+static char const * parse_event_keys(uint8_t const * const line, size_t line_length, struct event_keys * const keys)
+{
+    static jsmn_parser parser;
+    static jsmntok_t tokens[nDPIsrvd_MAX_JSON_TOKENS];
+    char const * const json = (char const *)line + NETWORK_BUFFER_LENGTH_DIGITS;
+    jsmntok_t const * alias = NULL;
+    jsmntok_t const * source = NULL;
+    jsmntok_t const * flow_id = NULL;
+
+    keys->root = NULL;
+    keys->flow_event_name = NULL;
+    keys->packet_event_name = NULL;
+    keys->daemon_event_name = NULL;
+    keys->ndpi = NULL;
+    keys->flow_idle_time = NULL;
+    keys->source_key_length = keys->key_length = 0;
+
+    jsmn_init(&parser);
+    int tokens_found =
+        jsmn_parse(&parser, json, line_length - NETWORK_BUFFER_LENGTH_DIGITS, tokens, nDPIsrvd_MAX_JSON_TOKENS);
+    if (tokens_found == JSMN_ERROR_NOMEM)
     {
-        switch (opt)
+        /*
+         * Out of tokens: use what was parsed so far. All keys required here precede the large nested
+         * objects in nDPId events, unfinished tokens (end < 0) are ignored below.
+         */
+        tokens_found = parser.toknext;
+        if (tokens_found > 0)
         {
-            case 'l':
-                enable_console_logger();
-                break;
-            case 'L':
-                if (enable_file_logger(optarg) != 0)
-                {
-                    return 1;
-                }
-                break;
-            case 'c':
-                free(nDPIsrvd_options.collector_un_sockpath);
-                nDPIsrvd_options.collector_un_sockpath = strdup(optarg);
-                break;
-            case 'd':
-                daemonize_enable();
-                break;
-            case 'p':
-                free(nDPIsrvd_options.pidfile);
-                nDPIsrvd_options.pidfile = strdup(optarg);
-                break;
-            case 's':
-                free(nDPIsrvd_options.distributor_un_sockpath);
-                nDPIsrvd_options.distributor_un_sockpath = strdup(optarg);
-                break;
-            case 'S':
-                free(nDPIsrvd_options.distributor_in_address);
-                nDPIsrvd_options.distributor_in_address = strdup(optarg);
-                break;
-            case 'm':
-                if (str_value_to_ull(optarg, &nDPIsrvd_options.max_remote_descriptors) != CONVERSION_OK)
-                {
-                    fprintf(stderr, "%s: Argument for `-C' is not a number: %s\n", argv[0], optarg);
+            char const * const end = memrchr(json, '}', line_length - NETWORK_BUFFER_LENGTH_DIGITS);
+
+            tokens[0].end = (end != NULL ? end - json + 1 : -1);
+        }
+        if (nDPIsrvd_stats.collector_truncated_parses++ == 0)
+        {
+            logger(1,
+                   "JSON line with more than %d tokens, only parsing its leading keys (counted in statistics)",
+                   nDPIsrvd_MAX_JSON_TOKENS);
+        }
+    }
+    if (tokens_found < 1 || tokens[0].type != JSMN_OBJECT || tokens[0].end < 0)
+    {
+        return NULL;
+    }
+    keys->root = &tokens[0];
+
+    for (int i = 1; i < tokens_found - 1; ++i)
+    {
+        if (tokens[i].parent != 0 || tokens[i].type != JSMN_STRING || tokens[i + 1].end < 0)
+        {
+            continue;
+        }
+
+        if (json_token_equals(json, &tokens[i], "flow_event_name") != 0)
+        {
+            keys->flow_event_name = &tokens[i + 1];
+        }
+        else if (json_token_equals(json, &tokens[i], "packet_event_name") != 0)
+        {
+            keys->packet_event_name = &tokens[i + 1];
+        }
+        else if (json_token_equals(json, &tokens[i], "daemon_event_name") != 0)
+        {
+            keys->daemon_event_name = &tokens[i + 1];
+        }
+        else if (json_token_equals(json, &tokens[i], "ndpi") != 0)
+        {
+            keys->ndpi = &tokens[i + 1];
+        }
+        else if (json_token_equals(json, &tokens[i], "alias") != 0)
+        {
+            alias = &tokens[i + 1];
+        }
+        else if (json_token_equals(json, &tokens[i], "source") != 0)
+        {
+            source = &tokens[i + 1];
+        }
+        else if (json_token_equals(json, &tokens[i], "flow_id") != 0)
+        {
+            flow_id = &tokens[i + 1];
+        }
+        else if (json_token_equals(json, &tokens[i], "flow_idle_time") != 0)
+        {
+            keys->flow_idle_time = &tokens[i + 1];
+        }
+    }
+
+    if (alias == NULL || source == NULL)
+    {
+        return NULL;
+    }
+
+    keys->source_key_length = snprintf(keys->key,
+                                       sizeof(keys->key),
+                                       "%.*s%c%.*s%c",
+                                       alias->end - alias->start,
+                                       json + alias->start,
+                                       '\0',
+                                       source->end - source->start,
+                                       json + source->start,
+                                       '\0');
+    if (keys->source_key_length >= sizeof(keys->key))
+    {
+        return NULL;
+    }
+    keys->key_length = keys->source_key_length;
+
+    if (flow_id != NULL && keys->key_length + (flow_id->end - flow_id->start) < sizeof(keys->key))
+    {
+        memcpy(keys->key + keys->key_length, json + flow_id->start, flow_id->end - flow_id->start);
+        keys->key_length += flow_id->end - flow_id->start;
+    }
+
+    return json;
+}
+
+static void catchup_free_flow(struct catchup_flow * const flow)
+{
+    HASH_DEL(catchup.flow_table, flow);
+    nDPIsrvd_buffer_free(&flow->new_event);
+    nDPIsrvd_buffer_free(&flow->detection_event);
+    nDPIsrvd_free(flow->key);
+    nDPIsrvd_free(flow);
+}
+
+/*
+ * nDPId sends an event for every flow at least once per announced flow_idle_time (flow updates),
+ * a flow without any event for longer than that plus the catch-up max age is gone.
+ */
+static void catchup_refresh_flow(struct catchup_flow * const flow,
+                                 char const * const json,
+                                 struct event_keys const * const keys,
+                                 uint64_t recv_time_usec)
+{
+    nDPIsrvd_ull flow_idle_time = 0;
+
+    if (keys->flow_idle_time != NULL)
+    {
+        char value[32];
+
+        snprintf(value,
+                 sizeof(value),
+                 "%.*s",
+                 keys->flow_idle_time->end - keys->flow_idle_time->start,
+                 json + keys->flow_idle_time->start);
+        if (str_value_to_ull(value, &flow_idle_time) != CONVERSION_OK)
+        {
+            flow_idle_time = 0;
+        }
+    }
+    else if (flow->expires_usec != 0)
+    {
+        /* events without flow_idle_time do not shorten the lifetime of a flow */
+        return;
+    }
+
+    flow->expires_usec = recv_time_usec + flow_idle_time + TIME_S_TO_US(nDPIsrvd_options.catchup_max_age);
+}
+
+/* Flow state of sources that died or whose end/idle events got lost, checked once per catch-up max age. */
+static void catchup_expire_flows(uint64_t now)
+{
+    struct catchup_flow * flow;
+    struct catchup_flow * tmp;
+
+    if (now - catchup.last_flow_table_scan < TIME_S_TO_US(nDPIsrvd_options.catchup_max_age))
+    {
+        return;
+    }
+    catchup.last_flow_table_scan = now;
+
+    HASH_ITER(hh, catchup.flow_table, flow, tmp)
+    {
+        if (flow->expires_usec <= now)
+        {
+            catchup_free_flow(flow);
+        }
+    }
+}
+
+/* Apply an event which was evicted from the ring to the flow state table. */
+static void catchup_update_flow_state(uint8_t const * const line, size_t line_length, uint64_t recv_time_usec)
+{
+    struct event_keys keys;
+    char const * const json = parse_event_keys(line, line_length, &keys);
+    struct catchup_flow * flow = NULL;
+
+    if (json == NULL)
+    {
+        return;
+    }
+
+    if (keys.daemon_event_name != NULL)
+    {
+        /* a (re-)started daemon does not know anything about flows of its predecessor */
+        if (json_token_equals(json, keys.daemon_event_name, "init") != 0)
+        {
+            struct catchup_flow * tmp;
+
+            HASH_ITER(hh, catchup.flow_table, flow, tmp)
+            {
+                if (flow->key_length > keys.source_key_length &&
+                    memcmp(flow->key, keys.key, keys.source_key_length) == 0)
+                {
+                    catchup_free_flow(flow);
+                }
+            }
+        }
+        return;
+    }
+
+    if (keys.key_length == keys.source_key_length)
+    {
+        return;
+    }
+
+    HASH_FIND(hh, catchup.flow_table, keys.key, keys.key_length, flow);
+
+    if (keys.flow_event_name == NULL)
+    {
+        /* packet events keep a flow alive as well */
+        if (flow != NULL && keys.packet_event_name != NULL)
+        {
+            catchup_refresh_flow(flow, json, &keys, recv_time_usec);
+        }
+        return;
+    }
+
+    if (json_token_equals(json, keys.flow_event_name, "end") != 0 ||
+        json_token_equals(json, keys.flow_event_name, "idle") != 0)
+    {
+        if (flow != NULL)
+        {
+            catchup_free_flow(flow);
+        }
+        return;
+    }
+
+    if (json_token_equals(json, keys.flow_event_name, "new") == 0 &&
+        is_detection_event(json, keys.flow_event_name) == 0)
+    {
+        if (flow != NULL)
+        {
+            catchup_refresh_flow(flow, json, &keys, recv_time_usec);
+        }
+        return;
+    }
+
+    if (flow == NULL)
+    {
+        flow = (struct catchup_flow *)nDPIsrvd_calloc(1, sizeof(*flow));
+        if (flow == NULL)
+        {
+            return;
+        }
+        flow->key = (char *)nDPIsrvd_malloc(keys.key_length);
+        if (flow->key == NULL)
+        {
+            nDPIsrvd_free(flow);
+            return;
+        }
+        memcpy(flow->key, keys.key, keys.key_length);
+        flow->key_length = keys.key_length;
+        HASH_ADD_KEYPTR(hh, catchup.flow_table, flow->key, flow->key_length, flow);
+    }
+    catchup_refresh_flow(flow, json, &keys, recv_time_usec);
+
+    if (set_buffer_content(json_token_equals(json, keys.flow_event_name, "new") != 0 ? &flow->new_event
+                                                                                    : &flow->detection_event,
+                           line,
+                           line_length) != 0)
+    {
+        logger(1, "Catch-up flow state buffer init failed, size: %zu bytes", line_length);
+    }
+}
+
+static void catchup_evict_oldest(void)
+{
+    struct catchup_entry_header hdr;
+
+    if (catchup.size - catchup.head < sizeof(hdr))
+    {
+        catchup.used -= catchup.size - catchup.head;
+        catchup.head = 0;
+    }
+    else
+    {
+        memcpy(&hdr, catchup.data + catchup.head, sizeof(hdr));
+        if (hdr.length == 0)
+        {
+            catchup.used -= catchup.size - catchup.head;
+            catchup.head = 0;
+        }
+        else
+        {
+            catchup_update_flow_state(catchup.data + catchup.head + sizeof(hdr), hdr.length, hdr.recv_time_usec);
+            catchup.head += sizeof(hdr) + hdr.length;
+            catchup.used -= sizeof(hdr) + hdr.length;
+        }
+    }
+
+    if (catchup.used == 0)
+    {
+        catchup.head = catchup.tail = 0;
+    }
+}
+
+static void catchup_evict_expired(uint64_t now)
+{
+    struct catchup_entry_header hdr;
+
+    while (catchup.used > 0)
+    {
+        if (catchup.size - catchup.head >= sizeof(hdr))
+        {
+            memcpy(&hdr, catchup.data + catchup.head, sizeof(hdr));
+            if (hdr.length != 0 && now - hdr.recv_time_usec <= TIME_S_TO_US(nDPIsrvd_options.catchup_max_age))
+            {
+                break;
+            }
+        }
+        catchup_evict_oldest();
+    }
+
+    catchup_expire_flows(now);
+}
+
+static void catchup_add_event(uint8_t const * const line, size_t line_length)
+{
+    struct catchup_entry_header const hdr = {.recv_time_usec = get_monotonic_usec(), .length = line_length};
+    size_t const needed = sizeof(hdr) + line_length;
+
+    if (catchup.data == NULL || needed > catchup.size)
+    {
+        return;
+    }
+
+    catchup_evict_expired(hdr.recv_time_usec);
+    while (1)
+    {
+        if (catchup.used == 0 || catchup.tail > catchup.head)
+        {
+            if (needed <= catchup.size - catchup.tail)
+            {
+                break;
+            }
+
+            /* not enough space left at the end, continue at the beginning of the ring */
+            if (catchup.size - catchup.tail >= sizeof(hdr))
+            {
+                struct catchup_entry_header const wrap = {.recv_time_usec = hdr.recv_time_usec, .length = 0};
+                memcpy(catchup.data + catchup.tail, &wrap, sizeof(wrap));
+            }
+            catchup.used += catchup.size - catchup.tail;
+            catchup.tail = 0;
+        }
+        else if (needed <= catchup.head - catchup.tail)
+        {
+            break;
+        }
+        else
+        {
+            catchup_evict_oldest();
+        }
+    }
+
+    memcpy(catchup.data + catchup.tail, &hdr, sizeof(hdr));
+    memcpy(catchup.data + catchup.tail + sizeof(hdr), line, line_length);
+    catchup.tail += needed;
+    catchup.used += needed;
+}
+
+static int catchup_flush_chunk(struct remote_desc * const remote, struct nDPIsrvd_buffer * const chunk)
+{
+    struct nDPIsrvd_write_buffer * const write_buffer = get_write_buffer(remote);
+    UT_array * const additional_write_buffers = get_additional_write_buffers(remote);
+
+    if (chunk->used == 0)
+    {
+        return 0;
+    }
+    if (write_buffer == NULL || additional_write_buffers == NULL)
+    {
+        return -1;
+    }
+
+    if (utarray_len(additional_write_buffers) == 0 && chunk->used <= write_buffer->buf.max - write_buffer->buf.used)
+    {
+        memcpy(write_buffer->buf.ptr.raw + write_buffer->buf.used, chunk->ptr.raw, chunk->used);
+        write_buffer->buf.used += chunk->used;
+    }
+    else if (add_to_additional_write_buffers(remote, chunk->ptr.raw, chunk->used) != 0)
+    {
+        return -1;
+    }
+    chunk->used = 0;
+
+    return 0;
+}
+
+static int catchup_add_line(struct remote_desc * const remote,
+                            struct nDPIsrvd_buffer * const chunk,
+                            uint8_t const * const line,
+                            size_t line_length)
+{
+    if (line_length > chunk->max - chunk->used && catchup_flush_chunk(remote, chunk) != 0)
+    {
+        return -1;
+    }
+
+    memcpy(chunk->ptr.raw + chunk->used, line, line_length);
+    chunk->used += line_length;
+
+    return 0;
+}
+
+/* Queue the flow state snapshot followed by the ring tail for a new catch-up distributor. */
+static int catchup_send_to_remote(int epollfd, struct remote_desc * const remote)
+{
+    struct nDPIsrvd_buffer chunk = {};
+    struct catchup_flow * flow;
+    struct catchup_flow * tmp;
+    size_t pos;
+    size_t remaining;
+    int retval = 0;
+
+    if (nDPIsrvd_buffer_init(&chunk, NETWORK_BUFFER_MAX_SIZE) != 0)
+    {
+        return -1;
+    }
+
+    catchup_evict_expired(get_monotonic_usec());
+
+    HASH_ITER(hh, catchup.flow_table, flow, tmp)
+    {
+        if ((flow->new_event.used > 0 &&
+             catchup_add_line(remote, &chunk, flow->new_event.ptr.raw, flow->new_event.used) != 0) ||
+            (flow->detection_event.used > 0 &&
+             catchup_add_line(remote, &chunk, flow->detection_event.ptr.raw, flow->detection_event.used) != 0))
+        {
+            retval = -1;
+            goto out;
+        }
+    }
+
+    pos = catchup.head;
+    remaining = catchup.used;
+    while (remaining > 0)
+    {
+        struct catchup_entry_header hdr;
+
+        if (catchup.size - pos >= sizeof(hdr))
+        {
+            memcpy(&hdr, catchup.data + pos, sizeof(hdr));
+        }
+        else
+        {
+            hdr.length = 0;
+        }
+
+        if (hdr.length == 0)
+        {
+            remaining -= catchup.size - pos;
+            pos = 0;
+            continue;
+        }
+
+        if (catchup_add_line(remote, &chunk, catchup.data + pos + sizeof(hdr), hdr.length) != 0)
+        {
+            retval = -1;
+            goto out;
+        }
+        pos += sizeof(hdr) + hdr.length;
+        remaining -= sizeof(hdr) + hdr.length;
+    }
+
+    if (catchup_flush_chunk(remote, &chunk) != 0)
+    {
+        retval = -1;
+        goto out;
+    }
+
+#ifdef ENABLE_IO_URING
+    if (uring_enabled != 0)
+    {
+        retval = uring_add_send(remote);
+        goto out;
+    }
+#endif
+    if (add_out_event(epollfd, remote) != 0)
+    {
+        retval = -1;
+    }
+
+out:
+    nDPIsrvd_buffer_free(&chunk);
+    return retval;
+}
+
+static int setup_catchup(void)
+{
+    if (nDPIsrvd_options.catchup_un_sockpath == NULL)
+    {
+        return 0;
+    }
+
+    catchup.data = (uint8_t *)nDPIsrvd_malloc(nDPIsrvd_options.catchup_ring_size);
+    if (catchup.data == NULL)
+    {
+        return 1;
+    }
+    catchup.size = nDPIsrvd_options.catchup_ring_size;
+    catchup.head = catchup.tail = catchup.used = 0;
+
+    return 0;
+}
+
+static void free_catchup(void)
+{
+    struct catchup_flow * flow;
+    struct catchup_flow * tmp;
+
+    HASH_ITER(hh, catchup.flow_table, flow, tmp)
+    {
+        catchup_free_flow(flow);
+    }
+    nDPIsrvd_free(catchup.data);
+    catchup.data = NULL;
+    catchup.size = 0;
+}
+
+static void aggregation_free_flow(struct aggregation_flow * const flow)
+{
+    HASH_DEL(aggregation_flow_table, flow);
+    nDPIsrvd_buffer_free(&flow->ndpi);
+    nDPIsrvd_free(flow->key);
+    nDPIsrvd_free(flow);
+}
+
+/* Extend the flow event with the aggregated counters and the latest detection result and distribute it. */
+static void aggregation_send_record(int epollfd,
+                                    char const * const json,
+                                    struct event_keys const * const keys,
+                                    struct aggregation_flow const * const flow,
+                                    int final,
+                                    uint64_t recv_usec)
+{
+    static char record[NETWORK_BUFFER_MAX_SIZE];
+    char length_digits[NETWORK_BUFFER_LENGTH_DIGITS + 1];
+    int const append_ndpi = (keys->ndpi == NULL && flow->ndpi.used > 0);
+    int const has_detection = (flow->detection_event_name[0] != '\0');
+
+    /* the flow event w/o its closing brace */
+    int const json_length = keys->root->end - keys->root->start - 1;
+    int written = snprintf(record + NETWORK_BUFFER_LENGTH_DIGITS,
+                           sizeof(record) - NETWORK_BUFFER_LENGTH_DIGITS,
+                           "%.*s,\"aggregate\":{\"final\":%d,\"flow_events\":%llu,\"packet_events\":%llu"
+                           "%s%s%s}%s%.*s}\n",
+                           json_length,
+                           json + keys->root->start,
+                           final,
+                           flow->flow_events,
+                           flow->packet_events,
+                           (has_detection != 0 ? ",\"detection_event_name\":\"" : ""),
+                           flow->detection_event_name,
+                           (has_detection != 0 ? "\"" : ""),
+                           (append_ndpi != 0 ? ",\"ndpi\":" : ""),
+                           (append_ndpi != 0 ? (int)flow->ndpi.used : 0),
+                           (append_ndpi != 0 ? flow->ndpi.ptr.text : ""));
+    if (written < 0 || (size_t)written >= sizeof(record) - NETWORK_BUFFER_LENGTH_DIGITS)
+    {
+        logger(1, "Aggregated flow record too big, dropping it: %d bytes", written);
+        return;
+    }
+
+    snprintf(length_digits, sizeof(length_digits), "%0" NETWORK_BUFFER_LENGTH_DIGITS_STR "d", written);
+    memcpy(record, length_digits, NETWORK_BUFFER_LENGTH_DIGITS);
+
+    distribute_line(epollfd, 1, (uint8_t const *)record, NETWORK_BUFFER_LENGTH_DIGITS + written, recv_usec);
+}
+
+/* Merge an event into the aggregation table, emit a record at end/idle or if an interim record is due. */
+static void aggregation_add_event(int epollfd, uint8_t const * const line, size_t line_length, uint64_t recv_usec)
+{
+    struct event_keys keys;
+    char const * json;
+    struct aggregation_flow * flow = NULL;
+    uint64_t now;
+    int final;
+
+    if (aggregation_un_sockfd < 0)
+    {
+        return;
+    }
+
+    json = parse_event_keys(line, line_length, &keys);
+    if (json == NULL)
+    {
+        return;
+    }
+
+    if (keys.daemon_event_name != NULL)
+    {
+        if (json_token_equals(json, keys.daemon_event_name, "init") != 0)
+        {
+            struct aggregation_flow * tmp;
+
+            HASH_ITER(hh, aggregation_flow_table, flow, tmp)
+            {
+                if (flow->key_length > keys.source_key_length &&
+                    memcmp(flow->key, keys.key, keys.source_key_length) == 0)
+                {
+                    aggregation_free_flow(flow);
+                }
+            }
+        }
+        return;
+    }
+
+    if (keys.key_length == keys.source_key_length)
+    {
+        return;
+    }
+
+    HASH_FIND(hh, aggregation_flow_table, keys.key, keys.key_length, flow);
+
+    if (keys.packet_event_name != NULL)
+    {
+        if (flow != NULL)
+        {
+            flow->packet_events++;
+        }
+        return;
+    }
+
+    if (keys.flow_event_name == NULL)
+    {
+        return;
+    }
+
+    now = recv_usec;
+    if (flow == NULL)
+    {
+        flow = (struct aggregation_flow *)nDPIsrvd_calloc(1, sizeof(*flow));
+        if (flow == NULL)
+        {
+            return;
+        }
+        flow->key = (char *)nDPIsrvd_malloc(keys.key_length);
+        if (flow->key == NULL)
+        {
+            nDPIsrvd_free(flow);
+            return;
+        }
+        memcpy(flow->key, keys.key, keys.key_length);
+        flow->key_length = keys.key_length;
+        flow->last_record_usec = now;
+        HASH_ADD_KEYPTR(hh, aggregation_flow_table, flow->key, flow->key_length, flow);
+    }
+
+    flow->flow_events++;
+    if (keys.ndpi != NULL && set_buffer_content(&flow->ndpi,
+                                                (uint8_t const *)json + keys.ndpi->start,
+                                                keys.ndpi->end - keys.ndpi->start) != 0)
+    {
+        logger(1, "Aggregation nDPI buffer init failed, size: %d bytes", keys.ndpi->end - keys.ndpi->start);
+    }
+    if (is_detection_event(json, keys.flow_event_name) != 0)
+    {
+        snprintf(flow->detection_event_name,
+                 sizeof(flow->detection_event_name),
+                 "%.*s",
+                 keys.flow_event_name->end - keys.flow_event_name->start,
+                 json + keys.flow_event_name->start);
+    }
+
+    final = (json_token_equals(json, keys.flow_event_name, "end") != 0 ||
+             json_token_equals(json, keys.flow_event_name, "idle") != 0);
+    if (final != 0 || (nDPIsrvd_options.aggregation_interim_interval > 0 &&
+                       now - flow->last_record_usec >= TIME_S_TO_US(nDPIsrvd_options.aggregation_interim_interval)))
+    {
+        aggregation_send_record(epollfd, json, &keys, flow, final, recv_usec);
+        flow->last_record_usec = now;
+    }
+
+    if (final != 0)
+    {
+        aggregation_free_flow(flow);
+    }
+}
+
+static void free_aggregation(void)
+{
+    struct aggregation_flow * flow;
+    struct aggregation_flow * tmp;
+
+    HASH_ITER(hh, aggregation_flow_table, flow, tmp)
+    {
+        aggregation_free_flow(flow);
+    }
+}
+
+static int is_aggregation_remote(struct remote_desc const * const remote)
+{
+    return remote->sock_type == DISTRIBUTOR_UN && remote->event_distributor_un.aggregated != 0;
+}
+
+static int is_metrics_remote(struct remote_desc const * const remote)
+{
+    return remote->sock_type == DISTRIBUTOR_UN && remote->event_distributor_un.metrics != 0;
+}
+
+static int stats_append(struct nDPIsrvd_buffer * const buffer, char const * const format, ...)
+{
+    va_list ap;
+    int written;
+
+    if (buffer->used >= buffer->max)
+    {
+        return 1;
+    }
+
+    va_start(ap, format);
+    written = vsnprintf(buffer->ptr.text + buffer->used, buffer->max - buffer->used, format, ap);
+    va_end(ap);
+
+    if (written < 0 || (size_t)written >= buffer->max - buffer->used)
+    {
+        buffer->used = buffer->max;
+        return 1;
+    }
+    buffer->used += written;
+
+    return 0;
+}
+
+static char const * stats_remote_type(struct remote_desc const * const remote)
+{
+    switch (remote->sock_type)
+    {
+        case COLLECTOR_UN:
+            return "collector";
+        case COLLECTOR_IN:
+            return "collector-tcp";
+        case DISTRIBUTOR_UN:
+            return (is_aggregation_remote(remote) != 0 ? "aggregation-distributor" : "distributor");
+        case DISTRIBUTOR_IN:
+            return "distributor-tcp";
+    }
+
+    return "unknown";
+}
+
+static void stats_remote_peer(struct remote_desc const * const remote, char * const peer, size_t peer_size)
+{
+    switch (remote->sock_type)
+    {
+        case COLLECTOR_UN:
+            snprintf(peer, peer_size, "%d", remote->event_collector_un.pid);
+            break;
+        case COLLECTOR_IN:
+            snprintf(peer,
+                     peer_size,
+                     "%.*s:%u",
+                     (int)sizeof(remote->event_collector_in.peer_addr),
+                     remote->event_collector_in.peer_addr,
+                     remote->event_collector_in.peer_port);
+            break;
+        case DISTRIBUTOR_UN:
+            snprintf(peer, peer_size, "%d", remote->event_distributor_un.pid);
+            break;
+        case DISTRIBUTOR_IN:
+            snprintf(peer,
+                     peer_size,
+                     "%.*s:%u",
+                     (int)sizeof(remote->event_distributor_in.peer_addr),
+                     remote->event_distributor_in.peer_addr,
+                     remote->event_distributor_in.peer_port);
+            break;
+    }
+}
+
+static nDPIsrvd_ull stats_queue_depth(struct remote_desc * const remote)
+{
+    UT_array * const additional_write_buffers = get_additional_write_buffers(remote);
+
+    return (additional_write_buffers != NULL ? utarray_len(additional_write_buffers) : 0);
+}
+
+static void stats_append_seconds(struct nDPIsrvd_buffer * const buffer, nDPIsrvd_ull usec)
+{
+    stats_append(buffer, "%llu.%06llu", usec / 1000000ull, usec % 1000000ull);
+}
+
+static void stats_append_counter(struct nDPIsrvd_buffer * const buffer,
+                                 char const * const name,
+                                 char const * const help,
+                                 nDPIsrvd_ull value)
+{
+    stats_append(buffer,
+                 "# TYPE ndpisrvd_%s counter\n# HELP ndpisrvd_%s %s\nndpisrvd_%s_total %llu\n",
+                 name,
+                 name,
+                 help,
+                 name,
+                 value);
+}
+
+/* OpenMetrics text exposition served on the metrics socket (-M). */
+static void stats_build_openmetrics(struct nDPIsrvd_buffer * const buffer)
+{
+    static char const * const latency_bucket_labels[nDPIsrvd_LATENCY_BUCKETS] = {
+        "0.00001", "0.0001", "0.001", "0.01", "0.1", "1.0", "10.0", "+Inf"};
+    static struct
+    {
+        char const * const name;
+        char const * const type;
+        char const * const help;
+        size_t const offset; /* within struct remote_stats, (size_t)-1 for the current queue depth */
+        int const is_usec;
+    } const remote_families[] = {
+        {"remote_lines", "counter", "JSON lines received by a collector or queued for a distributor.",
+         offsetof(struct remote_stats, lines), 0},
+        {"remote_bytes", "counter", "Bytes received by a collector or written to a distributor.",
+         offsetof(struct remote_stats, bytes), 0},
+        {"remote_queue_depth", "gauge", "Additional write buffers queued for a distributor.", (size_t)-1, 0},
+        {"remote_queue_depth_max", "gauge", "Maximum number of additional write buffers queued.",
+         offsetof(struct remote_stats, max_queue_depth), 0},
+        {"remote_blocking_drains", "counter", "Blocking drains of a distributor after its buffer limit was reached.",
+         offsetof(struct remote_stats, blocking_drains), 0},
+        {"remote_blocking_drain_seconds", "counter", "Time spent in blocking drains of a distributor.",
+         offsetof(struct remote_stats, blocking_drain_usec), 1},
+        {"remote_delivery_latency_seconds_max", "gauge", "Highest collector receive to distributor write latency.",
+         offsetof(struct remote_stats, latency.max_usec), 1},
+    };
+    struct latency_histogram const * const latency = &nDPIsrvd_stats.latency;
+    nDPIsrvd_ull cumulative = 0;
+
+    buffer->used = 0;
+    stats_append(buffer,
+                 "# TYPE ndpisrvd_remotes gauge\n# HELP ndpisrvd_remotes Connected remotes.\nndpisrvd_remotes %llu\n",
+                 remotes.desc_used);
+    stats_append_counter(buffer,
+                         "collector_connections",
+                         "Accepted collector connections.",
+                         nDPIsrvd_stats.collector_connections);
+    stats_append_counter(buffer,
+                         "distributor_connections",
+                         "Accepted distributor connections.",
+                         nDPIsrvd_stats.distributor_connections);
+    stats_append_counter(buffer, "collector_lines", "JSON lines received.", nDPIsrvd_stats.collector_lines);
+    stats_append_counter(buffer, "collector_bytes", "JSON bytes received.", nDPIsrvd_stats.collector_bytes);
+    stats_append_counter(buffer,
+                         "collector_protocol_errors",
+                         "Collectors disconnected due to protocol errors.",
+                         nDPIsrvd_stats.collector_protocol_errors);
+    stats_append_counter(buffer,
+                         "collector_truncated_parses",
+                         "JSON lines with too many tokens, only their leading keys were parsed.",
+                         nDPIsrvd_stats.collector_truncated_parses);
+    stats_append_counter(buffer,
+                         "distributor_lines",
+                         "JSON lines queued for distributors.",
+                         nDPIsrvd_stats.distributor_lines);
+    stats_append_counter(buffer,
+                         "distributor_bytes",
+                         "Bytes written to distributors.",
+                         nDPIsrvd_stats.distributor_bytes);
+    stats_append_counter(buffer,
+                         "distributor_slow_disconnects",
+                         "Distributors disconnected because their buffer limit was reached.",
+                         nDPIsrvd_stats.distributor_slow_disconnects);
+    stats_append_counter(buffer,
+                         "distributor_bytes_dropped",
+                         "Buffered bytes discarded when a distributor disconnected.",
+                         nDPIsrvd_stats.distributor_bytes_dropped);
+    stats_append_counter(buffer,
+                         "blocking_drains",
+                         "Blocking drains after a distributor buffer limit was reached.",
+                         nDPIsrvd_stats.blocking_drains);
+    stats_append(buffer,
+                 "# TYPE ndpisrvd_blocking_drain_seconds counter\n"
+                 "# HELP ndpisrvd_blocking_drain_seconds Time spent in blocking drains.\n"
+                 "ndpisrvd_blocking_drain_seconds_total ");
+    stats_append_seconds(buffer, nDPIsrvd_stats.blocking_drain_usec);
+
+    stats_append(buffer,
+                 "\n# TYPE ndpisrvd_delivery_latency_seconds histogram\n"
+                 "# HELP ndpisrvd_delivery_latency_seconds Collector receive to distributor write latency.\n");
+    for (size_t i = 0; i < nDPIsrvd_LATENCY_BUCKETS; ++i)
+    {
+        cumulative += latency->buckets[i];
+        stats_append(buffer,
+                     "ndpisrvd_delivery_latency_seconds_bucket{le=\"%s\"} %llu\n",
+                     latency_bucket_labels[i],
+                     cumulative);
+    }
+    stats_append(buffer, "ndpisrvd_delivery_latency_seconds_sum ");
+    stats_append_seconds(buffer, latency->sum_usec);
+    stats_append(buffer, "\nndpisrvd_delivery_latency_seconds_count %llu\n", latency->count);
+
+    for (size_t f = 0; f < sizeof(remote_families) / sizeof(remote_families[0]); ++f)
+    {
+        int const is_counter = (strcmp(remote_families[f].type, "counter") == 0);
+
+        stats_append(buffer,
+                     "# TYPE ndpisrvd_%s %s\n# HELP ndpisrvd_%s %s\n",
+                     remote_families[f].name,
+                     remote_families[f].type,
+                     remote_families[f].name,
+                     remote_families[f].help);
+        for (size_t i = 0; i < remotes.desc_size; ++i)
+        {
+            struct remote_desc * const remote = &remotes.desc[i];
+            char peer[INET6_ADDRSTRLEN + 8];
+            nDPIsrvd_ull value;
+
+            if (remote->fd < 0 || is_metrics_remote(remote) != 0)
+            {
+                continue;
+            }
+
+            if (remote_families[f].offset == (size_t)-1)
+            {
+                value = stats_queue_depth(remote);
+            }
+            else
+            {
+                memcpy(&value, (uint8_t const *)&remote->stats + remote_families[f].offset, sizeof(value));
+            }
+
+            stats_remote_peer(remote, peer, sizeof(peer));
+            stats_append(buffer,
+                         "ndpisrvd_%s%s{remote=\"%zu\",type=\"%s\",peer=\"%s\"} ",
+                         remote_families[f].name,
+                         (is_counter != 0 ? "_total" : ""),
+                         i,
+                         stats_remote_type(remote),
+                         peer);
+            if (remote_families[f].is_usec != 0)
+            {
+                stats_append_seconds(buffer, value);
+            }
+            else
+            {
+                stats_append(buffer, "%llu", value);
+            }
+            stats_append(buffer, "\n");
+        }
+    }
+
+    stats_append(buffer, "# EOF\n");
+}
+
+/*
+ * The response is queued like JSON lines for a distributor and written from the main loop.
+ * The connection is closed once it was written completely, see handle_outgoing_data() and uring_handle_send().
+ * A reader that does not keep up is dropped by stats_check_metrics_remotes() instead of getting a partial response.
+ */
+static int stats_send_openmetrics(int epollfd, struct remote_desc * const remote)
+{
+    struct nDPIsrvd_buffer buffer = {};
+    struct nDPIsrvd_write_buffer * const write_buffer = get_write_buffer(remote);
+    size_t queued;
+    int retval = 0;
+
+    if (write_buffer == NULL || nDPIsrvd_buffer_init(&buffer, 4096 + remotes.desc_used * 2048) != 0)
+    {
+        return -1;
+    }
+    stats_build_openmetrics(&buffer);
+
+    /* io_uring refills the main write buffer with whole additional buffers only, so none may be larger */
+    queued = write_buffer->buf.max - write_buffer->buf.used;
+    if (queued > buffer.used)
+    {
+        queued = buffer.used;
+    }
+    memcpy(write_buffer->buf.ptr.raw + write_buffer->buf.used, buffer.ptr.raw, queued);
+    write_buffer->buf.used += queued;
+    while (queued < buffer.used)
+    {
+        size_t const chunk_size =
+            (buffer.used - queued < write_buffer->buf.max ? buffer.used - queued : write_buffer->buf.max);
+
+        if (add_to_additional_write_buffers(remote, buffer.ptr.raw + queued, chunk_size) != 0)
+        {
+            retval = -1;
+            goto out;
+        }
+        queued += chunk_size;
+    }
+
+#ifdef ENABLE_IO_URING
+    if (uring_enabled != 0)
+    {
+        retval = uring_add_send(remote);
+        goto out;
+    }
+#endif
+    /* metrics clients are not expected to send anything, only wait until the socket is writable */
+    retval = add_event(epollfd, EPOLLOUT, remote->fd, remote);
+
+out:
+    nDPIsrvd_buffer_free(&buffer);
+    return retval;
+}
+
+static void stats_check_metrics_remotes(int epollfd)
+{
+    static uint64_t last_check_usec = 0;
+    uint64_t const now = get_monotonic_usec();
+
+    if (metrics_un_sockfd < 0 || now - last_check_usec < TIME_S_TO_US(1u))
+    {
+        return;
+    }
+    last_check_usec = now;
+
+    for (size_t i = 0; i < remotes.desc_size; ++i)
+    {
+        if (remotes.desc[i].fd < 0 || is_metrics_remote(&remotes.desc[i]) == 0 ||
+            now - remotes.desc[i].stats.connected_usec < nDPIsrvd_METRICS_SEND_TIMEOUT)
+        {
+            continue;
+        }
+
+        logger_nDPIsrvd(&remotes.desc[i], "Metrics client", "did not read the full response in time, dropping it");
+        disconnect_client(epollfd, &remotes.desc[i]);
+    }
+}
+
+static int nDPIsrvd_parse_options(int argc, char ** argv)
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "lL:c:t:dp:s:S:r:R:a:A:I:M:e:m:u:g:C:DUvh")) != -1)
+    {
+        switch (opt)
+        {
+            case 'l':
+                enable_console_logger();
+                break;
+            case 'L':
+                if (enable_file_logger(optarg) != 0)
+                {
+                    return 1;
+                }
+                break;
+            case 'c':
+                free(nDPIsrvd_options.collector_un_sockpath);
+                nDPIsrvd_options.collector_un_sockpath = strdup(optarg);
+                break;
+            case 't':
+                free(nDPIsrvd_options.collector_in_address);
+                nDPIsrvd_options.collector_in_address = strdup(optarg);
+                break;
+            case 'd':
+                daemonize_enable();
+                break;
+            case 'p':
+                free(nDPIsrvd_options.pidfile);
+                nDPIsrvd_options.pidfile = strdup(optarg);
+                break;
+            case 's':
+                free(nDPIsrvd_options.distributor_un_sockpath);
+                nDPIsrvd_options.distributor_un_sockpath = strdup(optarg);
+                break;
+            case 'S':
+                free(nDPIsrvd_options.distributor_in_address);
+                nDPIsrvd_options.distributor_in_address = strdup(optarg);
+                break;
+            case 'r':
+                free(nDPIsrvd_options.catchup_un_sockpath);
+                nDPIsrvd_options.catchup_un_sockpath = strdup(optarg);
+                break;
+            case 'R':
+                if (str_value_to_ull(optarg, &nDPIsrvd_options.catchup_ring_size) != CONVERSION_OK)
+                {
+                    fprintf(stderr, "%s: Argument for `-R' is not a number: %s\n", argv[0], optarg);
+                    return 1;
+                }
+                break;
+            case 'a':
+                if (str_value_to_ull(optarg, &nDPIsrvd_options.catchup_max_age) != CONVERSION_OK)
+                {
+                    fprintf(stderr, "%s: Argument for `-a' is not a number: %s\n", argv[0], optarg);
+                    return 1;
+                }
+                break;
+            case 'A':
+                free(nDPIsrvd_options.aggregation_un_sockpath);
+                nDPIsrvd_options.aggregation_un_sockpath = strdup(optarg);
+                break;
+            case 'I':
+                if (str_value_to_ull(optarg, &nDPIsrvd_options.aggregation_interim_interval) != CONVERSION_OK)
+                {
+                    fprintf(stderr, "%s: Argument for `-I' is not a number: %s\n", argv[0], optarg);
+                    return 1;
+                }
+                break;
+            case 'M':
+                free(nDPIsrvd_options.metrics_un_sockpath);
+                nDPIsrvd_options.metrics_un_sockpath = strdup(optarg);
+                break;
+            case 'e':
+                if (str_value_to_ull(optarg, &nDPIsrvd_options.stats_event_interval) != CONVERSION_OK)
+                {
+                    fprintf(stderr, "%s: Argument for `-e' is not a number: %s\n", argv[0], optarg);
+                    return 1;
+                }
+                break;
+            case 'm':
+                if (str_value_to_ull(optarg, &nDPIsrvd_options.max_remote_descriptors) != CONVERSION_OK)
+                {
+                    fprintf(stderr, "%s: Argument for `-C' is not a number: %s\n", argv[0], optarg);
+                    return 1;
+                }
+                break;
+            case 'u':
+                free(nDPIsrvd_options.user);
+                nDPIsrvd_options.user = strdup(optarg);
+                break;
+            case 'g':
+                free(nDPIsrvd_options.group);
+                nDPIsrvd_options.group = strdup(optarg);
+                break;
+            case 'C':
+                if (str_value_to_ull(optarg, &nDPIsrvd_options.max_write_buffers) != CONVERSION_OK)
+                {
+                    fprintf(stderr, "%s: Argument for `-C' is not a number: %s\n", argv[0], optarg);
+                    return 1;
+                }
+                break;
+            case 'D':
+                nDPIsrvd_options.bufferbloat_fallback_to_blocking = 0;
+                break;
+            case 'U':
+#ifdef ENABLE_IO_URING
+                nDPIsrvd_options.use_io_uring = 1;
+                break;
+#else
+                logger_early(1, "%s", "nDPIsrvd was built w/o io_uring support");
+                return 1;
+#endif
+            case 'v':
+                fprintf(stderr, "%s", get_nDPId_version());
+                return 1;
+            case 'h':
+            default:
+                fprintf(stderr, "%s\n", get_nDPId_version());
+                fprintf(stderr,
+                        "Usage: %s [-l] [-L logfile] [-c path-to-unix-sock] [-t collector-host:port]\n"
+                        "\t[-d] [-p pidfile]\n"
+                        "\t[-s path-to-distributor-unix-socket] [-S distributor-host:port]\n"
+                        "\t[-r path-to-catchup-distributor-unix-socket]\n"
+                        "\t[-R max-catchup-ring-bytes] [-a max-catchup-ring-age-seconds]\n"
+                        "\t[-A path-to-aggregation-distributor-unix-socket]\n"
+                        "\t[-I aggregation-interim-record-interval-seconds]\n"
+                        "\t[-M path-to-metrics-unix-socket] [-e statistics-event-interval-seconds]\n"
+                        "\t[-m max-remote-descriptors] [-u user] [-g group]\n"
+                        "\t[-C max-buffered-collector-json-lines] [-D] [-U]\n"
+                        "\t[-v] [-h]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+
+    if (nDPIsrvd_options.pidfile == NULL)
+    {
+        nDPIsrvd_options.pidfile = strdup(nDPIsrvd_PIDFILE);
+    }
+    if (is_path_absolute("Pidfile", nDPIsrvd_options.pidfile) != 0)
+    {
+        return 1;
+    }
+
+    if (nDPIsrvd_options.collector_un_sockpath == NULL)
+    {
+        nDPIsrvd_options.collector_un_sockpath = strdup(COLLECTOR_UNIX_SOCKET);
+    }
+    if (is_path_absolute("Collector UNIX socket", nDPIsrvd_options.collector_un_sockpath) != 0)
+    {
+        return 1;
+    }
+
+    if (nDPIsrvd_options.distributor_un_sockpath == NULL)
+    {
+        nDPIsrvd_options.distributor_un_sockpath = strdup(DISTRIBUTOR_UNIX_SOCKET);
+    }
+    if (is_path_absolute("Distributor UNIX socket", nDPIsrvd_options.distributor_un_sockpath) != 0)
+    {
+        return 1;
+    }
+
+    if (nDPIsrvd_options.catchup_un_sockpath != NULL)
+    {
+        if (is_path_absolute("Catch-up distributor UNIX socket", nDPIsrvd_options.catchup_un_sockpath) != 0)
+        {
+            return 1;
+        }
+        if (nDPIsrvd_options.catchup_ring_size < NETWORK_BUFFER_MAX_SIZE)
+        {
+            logger_early(1,
+                         "%s: Catch-up ring size too small: %llu < %u",
+                         argv[0],
+                         nDPIsrvd_options.catchup_ring_size,
+                         NETWORK_BUFFER_MAX_SIZE);
+            return 1;
+        }
+    }
+
+    if (nDPIsrvd_options.aggregation_un_sockpath != NULL &&
+        is_path_absolute("Aggregation distributor UNIX socket", nDPIsrvd_options.aggregation_un_sockpath) != 0)
+    {
+        return 1;
+    }
+
+    if (nDPIsrvd_options.metrics_un_sockpath != NULL &&
+        is_path_absolute("Metrics UNIX socket", nDPIsrvd_options.metrics_un_sockpath) != 0)
+    {
+        return 1;
+    }
+
+    if (nDPIsrvd_options.distributor_in_address != NULL)
+    {
+        if (nDPIsrvd_setup_address(&distributor_in_address, nDPIsrvd_options.distributor_in_address) != 0)
+        {
+            logger_early(1, "%s: Could not parse address %s", argv[0], nDPIsrvd_options.distributor_in_address);
+            return 1;
+        }
+        if (distributor_in_address.raw.sa_family == AF_UNIX)
+        {
+            logger_early(1,
+                         "%s: You've requested to setup another UNIX socket `%s', but there is already one at `%s'",
+                         argv[0],
+                         nDPIsrvd_options.distributor_in_address,
+                         nDPIsrvd_options.distributor_un_sockpath);
+            return 1;
+        }
+    }
+
+    if (nDPIsrvd_options.collector_in_address != NULL)
+    {
+        if (nDPIsrvd_setup_address(&collector_in_address, nDPIsrvd_options.collector_in_address) != 0)
+        {
+            logger_early(1, "%s: Could not parse address %s", argv[0], nDPIsrvd_options.collector_in_address);
+            return 1;
+        }
+        if (collector_in_address.raw.sa_family == AF_UNIX)
+        {
+            logger_early(1,
+                         "%s: You've requested to setup another UNIX socket `%s', but there is already one at `%s'",
+                         argv[0],
+                         nDPIsrvd_options.collector_in_address,
+                         nDPIsrvd_options.collector_un_sockpath);
+            return 1;
+        }
+    }
+
+    if (optind < argc)
+    {
+        logger_early(1, "%s: Unexpected argument after options", argv[0]);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Printable address and host byte order port of a TCP/IP peer, IPv6 addresses are put in brackets. */
+static int set_peer_address(struct sockaddr_storage const * const peer,
+                            char * const peer_addr,
+                            size_t peer_addr_size,
+                            uint16_t * const peer_port)
+{
+    char addr[INET6_ADDRSTRLEN];
+
+    switch (peer->ss_family)
+    {
+        case AF_INET:
+        {
+            struct sockaddr_in const * const in = (struct sockaddr_in const *)peer;
+
+            if (inet_ntop(AF_INET, &in->sin_addr, addr, sizeof(addr)) == NULL)
+            {
+                return 1;
+            }
+            snprintf(peer_addr, peer_addr_size, "%s", addr);
+            *peer_port = ntohs(in->sin_port);
+            return 0;
+        }
+        case AF_INET6:
+        {
+            struct sockaddr_in6 const * const in6 = (struct sockaddr_in6 const *)peer;
+
+            if (inet_ntop(AF_INET6, &in6->sin6_addr, addr, sizeof(addr)) == NULL)
+            {
+                return 1;
+            }
+            snprintf(peer_addr, peer_addr_size, "[%s]", addr);
+            *peer_port = ntohs(in6->sin6_port);
+            return 0;
+        }
+    }
+
+    errno = EAFNOSUPPORT;
+    return 1;
+}
+
+static struct remote_desc * accept_remote(int server_fd,
+                                          int client_fd,
+                                          enum sock_type socktype,
+                                          struct sockaddr * const sockaddr,
+                                          socklen_t * const addrlen)
+{
+    if (client_fd < 0)
+    {
+        client_fd = accept(server_fd, sockaddr, addrlen);
+        if (client_fd < 0)
+        {
+            logger(1, "Accept failed: %s", strerror(errno));
+            return NULL;
+        }
+    }
+    else if (getpeername(client_fd, sockaddr, addrlen) != 0)
+    {
+        /* already accepted e.g. by an io_uring multishot accept */
+        logger(1, "Could not get peer address: %s", strerror(errno));
+        close(client_fd);
+        return NULL;
+    }
+
+    struct remote_desc * current = get_remote_descriptor(socktype, client_fd, NETWORK_BUFFER_MAX_SIZE);
+    if (current == NULL)
+    {
+        return NULL;
+    }
+
+    return current;
+}
+
+static int new_connection(int epollfd, int eventfd, int client_fd)
+{
+    union
+    {
+        struct sockaddr_un saddr_collector_un;
+        struct sockaddr_storage saddr_collector_in;
+        struct sockaddr_un saddr_distributor_un;
+        struct sockaddr_storage saddr_distributor_in;
+    } sockaddr;
+
+    socklen_t peer_addr_len;
+    enum sock_type stype;
+    int server_fd;
+    if (eventfd == collector_un_sockfd)
+    {
+        peer_addr_len = sizeof(sockaddr.saddr_collector_un);
+        stype = COLLECTOR_UN;
+        server_fd = collector_un_sockfd;
+    }
+    else if (eventfd == collector_in_sockfd)
+    {
+        peer_addr_len = sizeof(sockaddr.saddr_collector_in);
+        stype = COLLECTOR_IN;
+        server_fd = collector_in_sockfd;
+    }
+    else if (eventfd == distributor_un_sockfd || eventfd == catchup_un_sockfd || eventfd == aggregation_un_sockfd ||
+             eventfd == metrics_un_sockfd)
+    {
+        peer_addr_len = sizeof(sockaddr.saddr_distributor_un);
+        stype = DISTRIBUTOR_UN;
+        server_fd = eventfd;
+    }
+    else if (eventfd == distributor_in_sockfd)
+    {
+        peer_addr_len = sizeof(sockaddr.saddr_distributor_in);
+        stype = DISTRIBUTOR_IN;
+        server_fd = distributor_in_sockfd;
+    }
+    else
+    {
+        return 1;
+    }
+
+    struct remote_desc * const current =
+        accept_remote(server_fd, client_fd, stype, (struct sockaddr *)&sockaddr, &peer_addr_len);
+    if (current == NULL)
+    {
+        return 1;
+    }
+
+    int sockopt;
+    switch (current->sock_type)
+    {
+        case COLLECTOR_UN:
+            current->event_collector_un.peer = sockaddr.saddr_collector_un;
+            current->event_collector_un.json_bytes = 0;
+
+            sockopt = NETWORK_BUFFER_MAX_SIZE;
+            if (setsockopt(current->fd, SOL_SOCKET, SO_RCVBUF, &sockopt, sizeof(sockopt)) < 0)
+            {
+                logger(1, "Error setting socket option SO_RCVBUF: %s", strerror(errno));
+                return 1;
+            }
+
+            struct ucred ucred = {};
+            socklen_t ucred_len = sizeof(ucred);
+            if (getsockopt(current->fd, SOL_SOCKET, SO_PEERCRED, &ucred, &ucred_len) == -1)
+            {
+                logger(1, "Error getting credentials from UNIX socket: %s", strerror(errno));
+                return 1;
+            }
+
+            current->event_collector_un.pid = ucred.pid;
+
+            logger_nDPIsrvd(current, "New collector connection from", "");
+            nDPIsrvd_stats.collector_connections++;
+            break;
+        case COLLECTOR_IN:
+            current->event_collector_in.peer = sockaddr.saddr_collector_in;
+            current->event_collector_in.json_bytes = 0;
+
+            sockopt = NETWORK_BUFFER_MAX_SIZE;
+            if (setsockopt(current->fd, SOL_SOCKET, SO_RCVBUF, &sockopt, sizeof(sockopt)) < 0)
+            {
+                logger(1, "Error setting socket option SO_RCVBUF: %s", strerror(errno));
+                return 1;
+            }
+
+            if (set_peer_address(&current->event_collector_in.peer,
+                                 &current->event_collector_in.peer_addr[0],
+                                 sizeof(current->event_collector_in.peer_addr),
+                                 &current->event_collector_in.peer_port) != 0)
+            {
+                logger(1, "Error converting an internet address: %s", strerror(errno));
+                return 1;
+            }
+
+            logger_nDPIsrvd(current, "New collector connection from", "");
+            nDPIsrvd_stats.collector_connections++;
+            break;
+        case DISTRIBUTOR_UN:
+        case DISTRIBUTOR_IN:
+            if (current->sock_type == DISTRIBUTOR_UN)
+            {
+                current->event_distributor_un.peer = sockaddr.saddr_distributor_un;
+                current->event_distributor_un.aggregated = (server_fd == aggregation_un_sockfd);
+                current->event_distributor_un.metrics = (server_fd == metrics_un_sockfd);
+
+                struct ucred ucred = {};
+                socklen_t ucred_len = sizeof(ucred);
+                if (getsockopt(current->fd, SOL_SOCKET, SO_PEERCRED, &ucred, &ucred_len) == -1)
+                {
+                    logger(1, "Error getting credentials from UNIX socket: %s", strerror(errno));
                     return 1;
                 }
-                break;
-            case 'u':
-                free(nDPIsrvd_options.user);
-                nDPIsrvd_options.user = strdup(optarg);
-                break;
-            case 'g':
-                free(nDPIsrvd_options.group);
-                nDPIsrvd_options.group = strdup(optarg);
-                break;
-            case 'C':
-                if (str_value_to_ull(optarg, &nDPIsrvd_options.max_write_buffers) != CONVERSION_OK)
+
+                struct passwd pwnam = {};
+                struct passwd * pwres = NULL;
+                ssize_t pwsiz = sysconf(_SC_GETPW_R_SIZE_MAX);
+                if (pwsiz == -1)
                 {
-                    fprintf(stderr, "%s: Argument for `-C' is not a number: %s\n", argv[0], optarg);
+                    pwsiz = BUFSIZ;
+                }
+                char buf[pwsiz];
+                if (getpwuid_r(ucred.uid, &pwnam, &buf[0], pwsiz, &pwres) != 0)
+                {
+                    logger(1, "Could not get passwd entry for user id %u", ucred.uid);
                     return 1;
                 }
-                break;
-            case 'D':
-                nDPIsrvd_options.bufferbloat_fallback_to_blocking = 0;
-                break;
-            case 'v':
-                fprintf(stderr, "%s", get_nDPId_version());
-                return 1;
-            case 'h':
-            default:
-                fprintf(stderr, "%s\n", get_nDPId_version());
-                fprintf(stderr,
-                        "Usage: %s [-l] [-L logfile] [-c path-to-unix-sock] [-d] [-p pidfile]\n"
-                        "\t[-s path-to-distributor-unix-socket] [-S distributor-host:port]\n"
-                        "\t[-m max-remote-descriptors] [-u user] [-g group]\n"
-                        "\t[-C max-buffered-collector-json-lines] [-D]\n"
-                        "\t[-v] [-h]\n",
-                        argv[0]);
+
+                current->event_distributor_un.pid = ucred.pid;
+                current->event_distributor_un.user_name = strdup(pwres->pw_name);
+            }
+            else
+            {
+                current->event_distributor_in.peer = sockaddr.saddr_distributor_in;
+
+                sockopt = 1;
+                if (setsockopt(current->fd, SOL_SOCKET, SO_RCVBUF, &sockopt, sizeof(sockopt)) < 0)
+                {
+                    logger(1, "Error setting socket option SO_RCVBUF: %s", strerror(errno));
+                    return 1;
+                }
+
+                if (set_peer_address(&current->event_distributor_in.peer,
+                                     &current->event_distributor_in.peer_addr[0],
+                                     sizeof(current->event_distributor_in.peer_addr),
+                                     &current->event_distributor_in.peer_port) != 0)
+                {
+                    logger(1, "Error converting an internet address: %s", strerror(errno));
+                    return 1;
+                }
+            }
+
+            sockopt = NETWORK_BUFFER_MAX_SIZE;
+            if (setsockopt(current->fd, SOL_SOCKET, SO_SNDBUF, &sockopt, sizeof(sockopt)) < 0)
+            {
+                logger(1, "Error setting socket option SO_SNDBUF: %s", strerror(errno));
                 return 1;
+            }
+
+            {
+                struct timeval send_timeout = {1, 0};
+                if (setsockopt(current->fd, SOL_SOCKET, SO_SNDTIMEO, (char *)&send_timeout, sizeof(send_timeout)) != 0)
+                {
+                    logger(1, "Error setting socket option send timeout: %s", strerror(errno));
+                }
+            }
+
+            if (is_metrics_remote(current) != 0)
+            {
+                break;
+            }
+            logger_nDPIsrvd(current, "New distributor connection from", "");
+            nDPIsrvd_stats.distributor_connections++;
+            break;
+    }
+
+    /* nonblocking fd is mandatory for epoll, io_uring polls blocking fds on its own */
+    if (is_io_uring_active() == 0 && fcntl_add_flags(current->fd, O_NONBLOCK) != 0)
+    {
+        logger(1, "Error setting fd flags to non-blocking mode: %s", strerror(errno));
+        disconnect_client(epollfd, current);
+        return 1;
+    }
+
+    /* shutdown writing end for collector clients */
+    if (current->sock_type == COLLECTOR_UN || current->sock_type == COLLECTOR_IN)
+    {
+        shutdown(current->fd, SHUT_WR); // collector
+        /* shutdown reading end for distributor clients does not work due to epoll usage */
+    }
+
+    if (is_metrics_remote(current) != 0)
+    {
+        if (stats_send_openmetrics(epollfd, current) != 0)
+        {
+            logger_nDPIsrvd(current, "Could not send metrics to", "");
+            disconnect_client(epollfd, current);
+            return 1;
+        }
+        return 0;
+    }
+
+    /* setup epoll event */
+    if (add_in_event(epollfd, current) != 0)
+    {
+        logger(1, "Error adding input event to %d: %s", current->fd, strerror(errno));
+        disconnect_client(epollfd, current);
+        return 1;
+    }
+
+    if (server_fd == catchup_un_sockfd && catchup_send_to_remote(epollfd, current) != 0)
+    {
+        logger_nDPIsrvd(current, "Could not send catch-up data to", "");
+        disconnect_client(epollfd, current);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int handle_collector_protocol(int epollfd, struct remote_desc * const current)
+{
+    struct nDPIsrvd_json_buffer * const json_read_buffer = get_read_buffer(current);
+    unsigned long long int * const json_bytes = get_collector_json_bytes(current);
+    char * json_str_start = NULL;
+
+    if (json_read_buffer == NULL || json_bytes == NULL)
+    {
+        return 1;
+    }
+
+    if (json_read_buffer->buf.ptr.text[NETWORK_BUFFER_LENGTH_DIGITS] != '{')
+    {
+        logger_nDPIsrvd(current,
+                        "BUG: Collector connection",
+                        "JSON invalid opening character: '%c'",
+                        json_read_buffer->buf.ptr.text[NETWORK_BUFFER_LENGTH_DIGITS]);
+        disconnect_client(epollfd, current);
+        return 1;
+    }
+
+    errno = 0;
+    *json_bytes = strtoull(json_read_buffer->buf.ptr.text, &json_str_start, 10);
+    *json_bytes += json_str_start - json_read_buffer->buf.ptr.text;
+
+    if (errno == ERANGE)
+    {
+        logger_nDPIsrvd(current, "BUG: Collector connection", "JSON string length exceeds numceric limits");
+        disconnect_client(epollfd, current);
+        return 1;
+    }
+
+    if (json_str_start == json_read_buffer->buf.ptr.text)
+    {
+        logger_nDPIsrvd(current,
+                        "BUG: Collector connection",
+                        "missing JSON string length in protocol preamble: \"%.*s\"",
+                        NETWORK_BUFFER_LENGTH_DIGITS,
+                        json_read_buffer->buf.ptr.text);
+        disconnect_client(epollfd, current);
+        return 1;
+    }
+
+    if (json_str_start - json_read_buffer->buf.ptr.text != NETWORK_BUFFER_LENGTH_DIGITS)
+    {
+        logger_nDPIsrvd(current,
+                        "BUG: Collector connection",
+                        "invalid collector protocol data received. Expected protocol preamble of size %u bytes, got "
+                        "%ld "
+                        "bytes",
+                        NETWORK_BUFFER_LENGTH_DIGITS,
+                        (long int)(json_str_start - json_read_buffer->buf.ptr.text));
+    }
+
+    if (*json_bytes > json_read_buffer->buf.max)
+    {
+        logger_nDPIsrvd(current,
+                        "BUG: Collector connection",
+                        "JSON string too big: %llu > %zu",
+                        *json_bytes,
+                        json_read_buffer->buf.max);
+        disconnect_client(epollfd, current);
+        return 1;
+    }
+
+    if (*json_bytes > json_read_buffer->buf.used)
+    {
+        return 1;
+    }
+
+    if (json_read_buffer->buf.ptr.text[*json_bytes - 2] != '}' ||
+        json_read_buffer->buf.ptr.text[*json_bytes - 1] != '\n')
+    {
+        logger_nDPIsrvd(current,
+                        "BUG: Collector connection",
+                        "invalid JSON string: %.*s",
+                        (int)*json_bytes,
+                        json_read_buffer->buf.ptr.text);
+        disconnect_client(epollfd, current);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int handle_incoming_data(int epollfd, struct remote_desc * const current)
+{
+    struct nDPIsrvd_json_buffer * const json_read_buffer = get_read_buffer(current);
+
+    if (json_read_buffer == NULL)
+    {
+        unsigned char garbage = 0;
+
+        if (read(current->fd, &garbage, sizeof(garbage)) == sizeof(garbage))
+        {
+            logger_nDPIsrvd(current, "Received data from", "who is not allowed to send us some.");
+        }
+        else
+        {
+            logger_nDPIsrvd(current, "Distributor connection", "closed");
+        }
+        disconnect_client(epollfd, current);
+        return 1;
+    }
+
+    /* read JSON strings (or parts) from the UNIX socket (collecting) */
+    if (json_read_buffer->buf.used == json_read_buffer->buf.max)
+    {
+        logger_nDPIsrvd(current,
+                        "Collector connection",
+                        "read buffer (%zu bytes) full. No more read possible.",
+                        json_read_buffer->buf.max);
+    }
+    else
+    {
+        errno = 0;
+        ssize_t bytes_read = read(current->fd,
+                                  json_read_buffer->buf.ptr.raw + json_read_buffer->buf.used,
+                                  json_read_buffer->buf.max - json_read_buffer->buf.used);
+        if (bytes_read < 0 || errno != 0)
+        {
+            logger_nDPIsrvd(current, "Could not read remote", ": %s", strerror(errno));
+            disconnect_client(epollfd, current);
+            return 1;
+        }
+        if (bytes_read == 0)
+        {
+            logger_nDPIsrvd(current, "Collector connection", "closed during read");
+            disconnect_client(epollfd, current);
+            return 1;
         }
+        json_read_buffer->buf.used += bytes_read;
     }
 
-    if (nDPIsrvd_options.pidfile == NULL)
-    {
-        nDPIsrvd_options.pidfile = strdup(nDPIsrvd_PIDFILE);
-    }
-    if (is_path_absolute("Pidfile", nDPIsrvd_options.pidfile) != 0)
-    {
-        return 1;
-    }
+    return distribute_collector_data(epollfd, current);
+}
 
-    if (nDPIsrvd_options.collector_un_sockpath == NULL)
+/* Queue a line for all distributors either connected to the aggregation socket or not. */
+static void distribute_line(
+    int epollfd, int aggregated, uint8_t const * const line, size_t line_length, uint64_t recv_usec)
+{
+    for (size_t i = 0; i < remotes.desc_size; ++i)
     {
-        nDPIsrvd_options.collector_un_sockpath = strdup(COLLECTOR_UNIX_SOCKET);
+        struct nDPIsrvd_write_buffer * const write_buffer = get_write_buffer(&remotes.desc[i]);
+        UT_array * const additional_write_buffers = get_additional_write_buffers(&remotes.desc[i]);
+
+        if (remotes.desc[i].fd < 0 || write_buffer == NULL || additional_write_buffers == NULL ||
+            is_metrics_remote(&remotes.desc[i]) != 0 || is_aggregation_remote(&remotes.desc[i]) != aggregated)
+        {
+            continue;
+        }
+
+        /* pending data implies that the output event was already added */
+        int const was_pending = (write_buffer->buf.used > 0 || utarray_len(additional_write_buffers) > 0);
+
+        remotes.desc[i].stats.lines++;
+        nDPIsrvd_stats.distributor_lines++;
+        if (was_pending == 0)
+        {
+            remotes.desc[i].stats.pending_since_usec = recv_usec;
+        }
+
+        if (line_length > write_buffer->buf.max - write_buffer->buf.used || utarray_len(additional_write_buffers) > 0)
+        {
+            if (utarray_len(additional_write_buffers) == 0 && is_io_uring_active() == 0)
+            {
+#if 0
+                logger_nDPIsrvd(&remotes.desc[i],
+                                   "Distributor",
+                                   "buffer capacity threshold (%zu bytes) reached, caching JSON strings.",
+                                   remotes.desc[i].buf.used);
+#endif
+                errno = 0;
+                if (add_out_event(epollfd, &remotes.desc[i]) != 0)
+                {
+                    logger_nDPIsrvd(&remotes.desc[i], "Could not add event to", ", disconnecting: %s", strerror(errno));
+                    disconnect_client(epollfd, &remotes.desc[i]);
+                    continue;
+                }
+            }
+            if (add_to_additional_write_buffers(&remotes.desc[i], line, line_length) != 0)
+            {
+                disconnect_client(epollfd, &remotes.desc[i]);
+                continue;
+            }
+        }
+        else
+        {
+            memcpy(write_buffer->buf.ptr.raw + write_buffer->buf.used, line, line_length);
+            write_buffer->buf.used += line_length;
+        }
+
+        if (is_io_uring_active() != 0)
+        {
+            /* sends are submitted as one batch after all lines were distributed */
+            continue;
+        }
+
+        if (drain_main_buffer(&remotes.desc[i]) != 0)
+        {
+            disconnect_client(epollfd, &remotes.desc[i]);
+            continue;
+        }
+        stats_check_flushed(&remotes.desc[i]);
+
+        /* a remote lagging behind would otherwise keep the tail of a burst until the next line arrives */
+        if (was_pending == 0 && write_buffer->buf.used > 0 && utarray_len(additional_write_buffers) == 0 &&
+            add_out_event(epollfd, &remotes.desc[i]) != 0)
+        {
+            logger_nDPIsrvd(&remotes.desc[i], "Could not add event to", ", disconnecting: %s", strerror(errno));
+            disconnect_client(epollfd, &remotes.desc[i]);
+        }
     }
-    if (is_path_absolute("Collector UNIX socket", nDPIsrvd_options.collector_un_sockpath) != 0)
+}
+
+static int distribute_collector_data(int epollfd, struct remote_desc * const current)
+{
+    struct nDPIsrvd_json_buffer * const json_read_buffer = get_read_buffer(current);
+    unsigned long long int * const json_bytes = get_collector_json_bytes(current);
+    uint64_t const recv_usec = get_monotonic_usec();
+
+    if (json_read_buffer == NULL || json_bytes == NULL)
     {
         return 1;
     }
 
-    if (nDPIsrvd_options.distributor_un_sockpath == NULL)
+    while (json_read_buffer->buf.used >= NETWORK_BUFFER_LENGTH_DIGITS + 1)
     {
-        nDPIsrvd_options.distributor_un_sockpath = strdup(DISTRIBUTOR_UNIX_SOCKET);
+        if (handle_collector_protocol(epollfd, current) != 0)
+        {
+            if (current->fd < 0)
+            {
+                nDPIsrvd_stats.collector_protocol_errors++;
+            }
+            break;
+        }
+
+        current->stats.lines++;
+        current->stats.bytes += *json_bytes;
+        nDPIsrvd_stats.collector_lines++;
+        nDPIsrvd_stats.collector_bytes += *json_bytes;
+
+        distribute_line(epollfd, 0, json_read_buffer->buf.ptr.raw, *json_bytes, recv_usec);
+        aggregation_add_event(epollfd, json_read_buffer->buf.ptr.raw, *json_bytes, recv_usec);
+        catchup_add_event(json_read_buffer->buf.ptr.raw, *json_bytes);
+
+        memmove(json_read_buffer->buf.ptr.raw,
+                json_read_buffer->buf.ptr.raw + *json_bytes,
+                json_read_buffer->buf.used - *json_bytes);
+        json_read_buffer->buf.used -= *json_bytes;
+        *json_bytes = 0;
     }
-    if (is_path_absolute("Distributor UNIX socket", nDPIsrvd_options.distributor_un_sockpath) != 0)
+
+    return 0;
+}
+
+/*
+ * Synthetic event distributed every `-e' seconds.
+ * It carries alias/source, so that consumer libraries treat it like an event of an unknown type.
+ * Per remote details are omitted if they would exceed the token limit of the consumer libraries.
+ */
+static int stats_build_event(struct nDPIsrvd_buffer * const buffer)
+{
+    struct timespec ts;
+    struct latency_histogram const * const latency = &nDPIsrvd_stats.latency;
+    size_t tokens_used = 72;
+    nDPIsrvd_ull remotes_omitted = 0;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    buffer->used = NETWORK_BUFFER_LENGTH_DIGITS;
+    stats_append(buffer,
+                 "{\"srvd_event_id\":0,\"srvd_event_name\":\"statistics\",\"alias\":\"%s\",\"source\":\"nDPIsrvd\","
+                 "\"global_ts_usec\":%llu,\"remotes_connected\":%llu,"
+                 "\"collector_connections\":%llu,\"distributor_connections\":%llu,"
+                 "\"collector_lines\":%llu,\"collector_bytes\":%llu,\"collector_protocol_errors\":%llu,"
+                 "\"collector_truncated_parses\":%llu,\"distributor_lines\":%llu,\"distributor_bytes\":%llu,"
+                 "\"distributor_slow_disconnects\":%llu,\"distributor_bytes_dropped\":%llu,"
+                 "\"blocking_drains\":%llu,\"blocking_drain_usec\":%llu,"
+                 "\"latency_usec\":{\"count\":%llu,\"sum\":%llu,\"max\":%llu,\"buckets\":{",
+                 nDPIsrvd_stats.hostname,
+                 (nDPIsrvd_ull)ts.tv_sec * 1000ull * 1000ull + ts.tv_nsec / 1000,
+                 remotes.desc_used,
+                 nDPIsrvd_stats.collector_connections,
+                 nDPIsrvd_stats.distributor_connections,
+                 nDPIsrvd_stats.collector_lines,
+                 nDPIsrvd_stats.collector_bytes,
+                 nDPIsrvd_stats.collector_protocol_errors,
+                 nDPIsrvd_stats.collector_truncated_parses,
+                 nDPIsrvd_stats.distributor_lines,
+                 nDPIsrvd_stats.distributor_bytes,
+                 nDPIsrvd_stats.distributor_slow_disconnects,
+                 nDPIsrvd_stats.distributor_bytes_dropped,
+                 nDPIsrvd_stats.blocking_drains,
+                 nDPIsrvd_stats.blocking_drain_usec,
+                 latency->count,
+                 latency->sum_usec,
+                 latency->max_usec);
+    /* non-cumulative counts per upper bound in microseconds */
+    for (size_t i = 0; i < nDPIsrvd_LATENCY_BUCKETS; ++i)
     {
-        return 1;
+        if (i < nDPIsrvd_LATENCY_BUCKETS - 1)
+        {
+            stats_append(buffer, "\"%llu\":%llu,", latency_bucket_bounds_usec[i], latency->buckets[i]);
+        }
+        else
+        {
+            stats_append(buffer, "\"inf\":%llu}},\"remotes\":{", latency->buckets[i]);
+        }
     }
 
-    if (nDPIsrvd_options.distributor_in_address != NULL)
+    for (size_t i = 0, remotes_added = 0; i < remotes.desc_size; ++i)
     {
-        if (nDPIsrvd_setup_address(&distributor_in_address, nDPIsrvd_options.distributor_in_address) != 0)
+        struct remote_desc * const remote = &remotes.desc[i];
+        char peer[INET6_ADDRSTRLEN + 8];
+
+        if (remote->fd < 0 || is_metrics_remote(remote) != 0)
         {
-            logger_early(1, "%s: Could not parse address %s", argv[0], nDPIsrvd_options.distributor_in_address);
-            return 1;
+            continue;
         }
-        if (distributor_in_address.raw.sa_family == AF_UNIX)
+        /* 1 key + 1 object + 11 key/value pairs */
+        if (tokens_used + 24 > nDPIsrvd_MAX_JSON_TOKENS)
         {
-            logger_early(1,
-                         "%s: You've requested to setup another UNIX socket `%s', but there is already one at `%s'",
-                         argv[0],
-                         nDPIsrvd_options.distributor_in_address,
-                         nDPIsrvd_options.distributor_un_sockpath);
-            return 1;
+            remotes_omitted++;
+            continue;
         }
+        tokens_used += 24;
+
+        stats_remote_peer(remote, peer, sizeof(peer));
+        stats_append(buffer,
+                     "%s\"%zu\":{\"type\":\"%s\",\"peer\":\"%s\",\"connected_usec\":%llu,"
+                     "\"lines\":%llu,\"bytes\":%llu,\"queue_depth\":%llu,\"max_queue_depth\":%llu,"
+                     "\"blocking_drains\":%llu,\"blocking_drain_usec\":%llu,"
+                     "\"latency_count\":%llu,\"latency_max_usec\":%llu}",
+                     (remotes_added++ > 0 ? "," : ""),
+                     i,
+                     stats_remote_type(remote),
+                     peer,
+                     (nDPIsrvd_ull)(get_monotonic_usec() - remote->stats.connected_usec),
+                     remote->stats.lines,
+                     remote->stats.bytes,
+                     stats_queue_depth(remote),
+                     remote->stats.max_queue_depth,
+                     remote->stats.blocking_drains,
+                     remote->stats.blocking_drain_usec,
+                     remote->stats.latency.count,
+                     remote->stats.latency.max_usec);
     }
+    stats_append(buffer, "},\"remotes_omitted\":%llu}\n", remotes_omitted);
 
-    if (optind < argc)
+    if (buffer->used >= buffer->max)
     {
-        logger_early(1, "%s: Unexpected argument after options", argv[0]);
         return 1;
     }
 
+    char length_digits[NETWORK_BUFFER_LENGTH_DIGITS + 1];
+    snprintf(length_digits,
+             sizeof(length_digits),
+             "%0" NETWORK_BUFFER_LENGTH_DIGITS_STR "zu",
+             buffer->used - NETWORK_BUFFER_LENGTH_DIGITS);
+    memcpy(buffer->ptr.raw, length_digits, NETWORK_BUFFER_LENGTH_DIGITS);
+
     return 0;
 }
 
-static struct remote_desc * accept_remote(int server_fd,
-                                          enum sock_type socktype,
-                                          struct sockaddr * const sockaddr,
-                                          socklen_t * const addrlen)
+static void stats_event_check(int epollfd)
 {
-    int client_fd = accept(server_fd, sockaddr, addrlen);
-    if (client_fd < 0)
+    static struct nDPIsrvd_buffer buffer = {};
+    uint64_t const now = get_monotonic_usec();
+
+    if (nDPIsrvd_options.stats_event_interval == 0)
     {
-        logger(1, "Accept failed: %s", strerror(errno));
-        return NULL;
+        return;
+    }
+    if (nDPIsrvd_stats.last_event_usec == 0)
+    {
+        nDPIsrvd_stats.last_event_usec = now;
+        if (gethostname(nDPIsrvd_stats.hostname, sizeof(nDPIsrvd_stats.hostname)) != 0)
+        {
+            snprintf(nDPIsrvd_stats.hostname, sizeof(nDPIsrvd_stats.hostname), "%s", "nDPIsrvd");
+        }
+        nDPIsrvd_stats.hostname[sizeof(nDPIsrvd_stats.hostname) - 1] = '\0';
+        return;
+    }
+    if (now - nDPIsrvd_stats.last_event_usec < TIME_S_TO_US(nDPIsrvd_options.stats_event_interval))
+    {
+        return;
     }
+    nDPIsrvd_stats.last_event_usec = now;
 
-    struct remote_desc * current = get_remote_descriptor(socktype, client_fd, NETWORK_BUFFER_MAX_SIZE);
-    if (current == NULL)
+    if (buffer.ptr.raw == NULL && nDPIsrvd_buffer_init(&buffer, NETWORK_BUFFER_MAX_SIZE) != 0)
     {
-        return NULL;
+        return;
     }
 
-    return current;
+    if (stats_build_event(&buffer) != 0)
+    {
+        logger(1, "Statistics event exceeds %u bytes, dropping it", NETWORK_BUFFER_MAX_SIZE);
+        return;
+    }
+    distribute_line(epollfd, 0, buffer.ptr.raw, buffer.used, now);
+    distribute_line(epollfd, 1, buffer.ptr.raw, buffer.used, now);
 }
 
-static int new_connection(int epollfd, int eventfd)
+static int handle_data_event(int epollfd, struct epoll_event * const event)
 {
-    union
+    struct remote_desc * current = (struct remote_desc *)event->data.ptr;
+
+    if ((event->events & EPOLLIN) == 0 && (event->events & EPOLLOUT) == 0)
     {
-        struct sockaddr_un saddr_collector_un;
-        struct sockaddr_un saddr_distributor_un;
-        struct sockaddr_in saddr_distributor_in;
-    } sockaddr;
+        logger(1, "Can not handle event mask: %d", event->events);
+        return 1;
+    }
 
-    socklen_t peer_addr_len;
-    enum sock_type stype;
-    int server_fd;
-    if (eventfd == collector_un_sockfd)
+    if (current == NULL)
     {
-        peer_addr_len = sizeof(sockaddr.saddr_collector_un);
-        stype = COLLECTOR_UN;
-        server_fd = collector_un_sockfd;
+        logger(1, "%s", "Remote descriptor got from event data invalid.");
+        return 1;
     }
-    else if (eventfd == distributor_un_sockfd)
+
+    if (current->fd < 0)
     {
-        peer_addr_len = sizeof(sockaddr.saddr_distributor_un);
-        stype = DISTRIBUTOR_UN;
-        server_fd = distributor_un_sockfd;
+        logger(1, "File descriptor `%d' got from event data invalid.", current->fd);
+        return 1;
     }
-    else if (eventfd == distributor_in_sockfd)
+
+    if ((event->events & EPOLLIN) != 0)
     {
-        peer_addr_len = sizeof(sockaddr.saddr_distributor_in);
-        stype = DISTRIBUTOR_IN;
-        server_fd = distributor_in_sockfd;
+        return handle_incoming_data(epollfd, current);
     }
     else
     {
-        return 1;
+        return handle_outgoing_data(epollfd, current);
     }
+}
 
-    struct remote_desc * const current = accept_remote(server_fd, stype, (struct sockaddr *)&sockaddr, &peer_addr_len);
-    if (current == NULL)
+static int setup_signalfd(int epollfd)
+{
+    sigset_t mask;
+    int sfd;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGQUIT);
+
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1)
     {
-        return 1;
+        return -1;
+    }
+    sfd = signalfd(-1, &mask, 0);
+    if (sfd == -1)
+    {
+        return -1;
     }
 
-    int sockopt;
-    switch (current->sock_type)
+    if (is_io_uring_active() != 0)
     {
-        case COLLECTOR_UN:
-            current->event_collector_un.peer = sockaddr.saddr_collector_un;
-            current->event_collector_un.json_bytes = 0;
+        /* blocking reads are submitted to the io_uring, see uring_add_signal_read() */
+        return sfd;
+    }
 
-            sockopt = NETWORK_BUFFER_MAX_SIZE;
-            if (setsockopt(current->fd, SOL_SOCKET, SO_RCVBUF, &sockopt, sizeof(sockopt)) < 0)
-            {
-                logger(1, "Error setting socket option SO_RCVBUF: %s", strerror(errno));
-                return 1;
-            }
+    if (add_in_event_fd(epollfd, sfd) != 0)
+    {
+        return -1;
+    }
 
-            struct ucred ucred = {};
-            socklen_t ucred_len = sizeof(ucred);
-            if (getsockopt(current->fd, SOL_SOCKET, SO_PEERCRED, &ucred, &ucred_len) == -1)
-            {
-                logger(1, "Error getting credentials from UNIX socket: %s", strerror(errno));
-                return 1;
-            }
+    if (fcntl_add_flags(sfd, O_NONBLOCK) != 0)
+    {
+        return -1;
+    }
 
-            current->event_collector_un.pid = ucred.pid;
+    return sfd;
+}
 
-            logger_nDPIsrvd(current, "New collector connection from", "");
-            break;
-        case DISTRIBUTOR_UN:
-        case DISTRIBUTOR_IN:
-            if (current->sock_type == DISTRIBUTOR_UN)
-            {
-                current->event_distributor_un.peer = sockaddr.saddr_distributor_un;
+static int is_listen_sockfd(int fd)
+{
+    return fd == collector_un_sockfd || fd == collector_in_sockfd || fd == distributor_un_sockfd ||
+           fd == distributor_in_sockfd ||
+           fd == catchup_un_sockfd || fd == aggregation_un_sockfd || fd == metrics_un_sockfd;
+}
 
-                struct ucred ucred = {};
-                socklen_t ucred_len = sizeof(ucred);
-                if (getsockopt(current->fd, SOL_SOCKET, SO_PEERCRED, &ucred, &ucred_len) == -1)
-                {
-                    logger(1, "Error getting credentials from UNIX socket: %s", strerror(errno));
-                    return 1;
-                }
+static int mainloop(int epollfd)
+{
+    struct epoll_event events[32];
+    size_t const events_size = sizeof(events) / sizeof(events[0]);
+    int signalfd = setup_signalfd(epollfd);
 
-                struct passwd pwnam = {};
-                struct passwd * pwres = NULL;
-                ssize_t pwsiz = sysconf(_SC_GETPW_R_SIZE_MAX);
-                if (pwsiz == -1)
+    while (nDPIsrvd_main_thread_shutdown == 0)
+    {
+        int nready = epoll_wait(epollfd, events, events_size, 1000);
+
+        for (int i = 0; i < nready; i++)
+        {
+            if ((events[i].events & EPOLLERR) != 0 || (events[i].events & EPOLLHUP) != 0)
+            {
+                if (is_listen_sockfd(events[i].data.fd) == 0)
                 {
-                    pwsiz = BUFSIZ;
+                    struct remote_desc * const current = (struct remote_desc *)events[i].data.ptr;
+                    switch (current->sock_type)
+                    {
+                        case COLLECTOR_UN:
+                        case COLLECTOR_IN:
+                            logger_nDPIsrvd(current, "Collector connection", "closed");
+                            break;
+                        case DISTRIBUTOR_UN:
+                        case DISTRIBUTOR_IN:
+                            logger_nDPIsrvd(current, "Distributor connection", "closed");
+                            break;
+                    }
+                    disconnect_client(epollfd, current);
                 }
-                char buf[pwsiz];
-                if (getpwuid_r(ucred.uid, &pwnam, &buf[0], pwsiz, &pwres) != 0)
+                else
                 {
-                    logger(1, "Could not get passwd entry for user id %u", ucred.uid);
-                    return 1;
+                    logger(1, "Epoll event error: %s", (errno != 0 ? strerror(errno) : "unknown"));
                 }
+                continue;
+            }
 
-                current->event_distributor_un.pid = ucred.pid;
-                current->event_distributor_un.user_name = strdup(pwres->pw_name);
+            if (is_listen_sockfd(events[i].data.fd) != 0)
+            {
+                /* New connection to collector / distributor. */
+                if (new_connection(epollfd, events[i].data.fd, -1) != 0)
+                {
+                    continue;
+                }
             }
-            else
+            else if (events[i].data.fd == signalfd)
             {
-                current->event_distributor_in.peer = sockaddr.saddr_distributor_in;
+                struct signalfd_siginfo fdsi;
+                ssize_t s;
 
-                sockopt = 1;
-                if (setsockopt(current->fd, SOL_SOCKET, SO_RCVBUF, &sockopt, sizeof(sockopt)) < 0)
+                s = read(signalfd, &fdsi, sizeof(struct signalfd_siginfo));
+                if (s != sizeof(struct signalfd_siginfo))
                 {
-                    logger(1, "Error setting socket option SO_RCVBUF: %s", strerror(errno));
-                    return 1;
+                    logger(1,
+                           "Invalid signal fd read size. Got %zd, wanted %zu bytes.",
+                           s,
+                           sizeof(struct signalfd_siginfo));
+                    continue;
                 }
 
-                if (inet_ntop(current->event_distributor_in.peer.sin_family,
-                              &current->event_distributor_in.peer.sin_addr,
-                              &current->event_distributor_in.peer_addr[0],
-                              sizeof(current->event_distributor_in.peer_addr)) == NULL)
+                if (fdsi.ssi_signo == SIGINT || fdsi.ssi_signo == SIGTERM || fdsi.ssi_signo == SIGQUIT)
                 {
-                    logger(1, "Error converting an internet address: %s", strerror(errno));
-                    return 1;
+                    nDPIsrvd_main_thread_shutdown = 1;
+                    break;
                 }
             }
-
-            sockopt = NETWORK_BUFFER_MAX_SIZE;
-            if (setsockopt(current->fd, SOL_SOCKET, SO_SNDBUF, &sockopt, sizeof(sockopt)) < 0)
-            {
-                logger(1, "Error setting socket option SO_SNDBUF: %s", strerror(errno));
-                return 1;
-            }
-
+            else
             {
-                struct timeval send_timeout = {1, 0};
-                if (setsockopt(current->fd, SOL_SOCKET, SO_SNDTIMEO, (char *)&send_timeout, sizeof(send_timeout)) != 0)
+                /* Incoming data / Outoing data ready to receive / send. */
+                if (handle_data_event(epollfd, &events[i]) != 0)
                 {
-                    logger(1, "Error setting socket option send timeout: %s", strerror(errno));
+                    /* do nothing */
                 }
             }
+        }
 
-            logger_nDPIsrvd(current, "New distributor connection from", "");
-            break;
+        stats_event_check(epollfd);
+        stats_check_metrics_remotes(epollfd);
     }
 
-    /* nonblocking fd is mandatory */
-    if (fcntl_add_flags(current->fd, O_NONBLOCK) != 0)
+    close(signalfd);
+    free_remotes(epollfd);
+
+    return 0;
+}
+
+#ifdef ENABLE_IO_URING
+/* user data layout: op (8 bit) | remote index or fd (24 bit) | remote generation (32 bit) */
+static uint64_t uring_user_data(enum uring_op op, uint32_t index, uint32_t generation)
+{
+    return ((uint64_t)op << 56) | ((uint64_t)(index & 0xFFFFFF) << 32) | generation;
+}
+
+static struct io_uring_sqe * uring_get_sqe(void)
+{
+    struct io_uring_sqe * sqe = io_uring_get_sqe(&uring);
+
+    if (sqe == NULL)
     {
-        logger(1, "Error setting fd flags to non-blocking mode: %s", strerror(errno));
-        disconnect_client(epollfd, current);
-        return 1;
+        /* submission queue full, flush it and try again */
+        io_uring_submit(&uring);
+        sqe = io_uring_get_sqe(&uring);
     }
-
-    /* shutdown writing end for collector clients */
-    if (current->sock_type == COLLECTOR_UN)
+    if (sqe == NULL)
     {
-        shutdown(current->fd, SHUT_WR); // collector
-        /* shutdown reading end for distributor clients does not work due to epoll usage */
+        logger(1, "%s", "io_uring submission queue full");
     }
 
-    /* setup epoll event */
-    if (add_in_event(epollfd, current) != 0)
+    return sqe;
+}
+
+static int uring_add_accept(int server_fd)
+{
+    struct io_uring_sqe * const sqe = uring_get_sqe();
+
+    if (sqe == NULL)
     {
-        logger(1, "Error adding input event to %d: %s", current->fd, strerror(errno));
-        disconnect_client(epollfd, current);
-        return 1;
+        return -1;
     }
 
+    io_uring_prep_multishot_accept(sqe, server_fd, NULL, NULL, 0);
+    io_uring_sqe_set_data64(sqe, uring_user_data(URING_OP_ACCEPT, server_fd, 0));
+
     return 0;
 }
 
-static int handle_collector_protocol(int epollfd, struct remote_desc * const current)
+static int uring_add_signal_read(int signalfd)
 {
-    struct nDPIsrvd_json_buffer * const json_read_buffer = get_read_buffer(current);
-    char * json_str_start = NULL;
+    struct io_uring_sqe * const sqe = uring_get_sqe();
 
-    if (json_read_buffer == NULL)
+    if (sqe == NULL)
     {
-        return 1;
+        return -1;
     }
 
-    if (json_read_buffer->buf.ptr.text[NETWORK_BUFFER_LENGTH_DIGITS] != '{')
-    {
-        logger_nDPIsrvd(current,
-                        "BUG: Collector connection",
-                        "JSON invalid opening character: '%c'",
-                        json_read_buffer->buf.ptr.text[NETWORK_BUFFER_LENGTH_DIGITS]);
-        disconnect_client(epollfd, current);
-        return 1;
-    }
+    io_uring_prep_read(sqe, signalfd, &uring_siginfo, sizeof(uring_siginfo), 0);
+    io_uring_sqe_set_data64(sqe, uring_user_data(URING_OP_SIGNAL, signalfd, 0));
 
-    errno = 0;
-    current->event_collector_un.json_bytes = strtoull(json_read_buffer->buf.ptr.text, &json_str_start, 10);
-    current->event_collector_un.json_bytes += json_str_start - json_read_buffer->buf.ptr.text;
+    return 0;
+}
 
-    if (errno == ERANGE)
+static int uring_add_read(struct remote_desc * const remote)
+{
+    uint32_t const index = remote - remotes.desc;
+    struct nDPIsrvd_json_buffer * const json_read_buffer = get_read_buffer(remote);
+    struct io_uring_sqe * sqe;
+
+    if (json_read_buffer != NULL && json_read_buffer->buf.used == json_read_buffer->buf.max)
     {
-        logger_nDPIsrvd(current, "BUG: Collector connection", "JSON string length exceeds numceric limits");
-        disconnect_client(epollfd, current);
-        return 1;
+        logger_nDPIsrvd(remote,
+                        "Collector connection",
+                        "read buffer (%zu bytes) full. No more read possible.",
+                        json_read_buffer->buf.max);
+        return -1;
     }
 
-    if (json_str_start == json_read_buffer->buf.ptr.text)
+    sqe = uring_get_sqe();
+    if (sqe == NULL)
     {
-        logger_nDPIsrvd(current,
-                        "BUG: Collector connection",
-                        "missing JSON string length in protocol preamble: \"%.*s\"",
-                        NETWORK_BUFFER_LENGTH_DIGITS,
-                        json_read_buffer->buf.ptr.text);
-        disconnect_client(epollfd, current);
-        return 1;
+        return -1;
     }
 
-    if (json_str_start - json_read_buffer->buf.ptr.text != NETWORK_BUFFER_LENGTH_DIGITS)
+    if (json_read_buffer != NULL)
     {
-        logger_nDPIsrvd(current,
-                        "BUG: Collector connection",
-                        "invalid collector protocol data received. Expected protocol preamble of size %u bytes, got "
-                        "%ld "
-                        "bytes",
-                        NETWORK_BUFFER_LENGTH_DIGITS,
-                        (long int)(json_str_start - json_read_buffer->buf.ptr.text));
+        io_uring_prep_read_fixed(sqe,
+                                 remote->fd,
+                                 json_read_buffer->buf.ptr.raw + json_read_buffer->buf.used,
+                                 json_read_buffer->buf.max - json_read_buffer->buf.used,
+                                 0,
+                                 index);
+        io_uring_sqe_set_data64(sqe, uring_user_data(URING_OP_READ, index, remote->uring_generation));
     }
-
-    if (current->event_collector_un.json_bytes > json_read_buffer->buf.max)
+    else
     {
-        logger_nDPIsrvd(current,
-                        "BUG: Collector connection",
-                        "JSON string too big: %llu > %zu",
-                        current->event_collector_un.json_bytes,
-                        json_read_buffer->buf.max);
-        disconnect_client(epollfd, current);
-        return 1;
+        /* distributors are not allowed to send anything, but we need to know if they hang up */
+        io_uring_prep_poll_add(sqe, remote->fd, POLLIN | POLLRDHUP);
+        io_uring_sqe_set_data64(sqe, uring_user_data(URING_OP_POLL, index, remote->uring_generation));
     }
 
-    if (current->event_collector_un.json_bytes > json_read_buffer->buf.used)
+    return 0;
+}
+
+static int uring_add_send(struct remote_desc * const remote)
+{
+    uint32_t const index = remote - remotes.desc;
+    struct nDPIsrvd_write_buffer * const write_buffer = get_write_buffer(remote);
+    struct io_uring_sqe * sqe;
+
+    if (write_buffer == NULL)
     {
-        return 1;
+        return -1;
+    }
+    if (remote->uring_send_in_flight != 0 || write_buffer->buf.used == 0)
+    {
+        return 0;
     }
 
-    if (json_read_buffer->buf.ptr.text[current->event_collector_un.json_bytes - 2] != '}' ||
-        json_read_buffer->buf.ptr.text[current->event_collector_un.json_bytes - 1] != '\n')
+    sqe = uring_get_sqe();
+    if (sqe == NULL)
     {
-        logger_nDPIsrvd(current,
-                        "BUG: Collector connection",
-                        "invalid JSON string: %.*s",
-                        (int)current->event_collector_un.json_bytes,
-                        json_read_buffer->buf.ptr.text);
-        disconnect_client(epollfd, current);
-        return 1;
+        return -1;
     }
 
+    /*
+     * The kernel owns [0, used) of the main write buffer until the completion arrives.
+     * New JSON lines may still be appended after it.
+     */
+    io_uring_prep_send(sqe, remote->fd, write_buffer->buf.ptr.raw, write_buffer->buf.used, MSG_NOSIGNAL);
+    io_uring_sqe_set_data64(sqe, uring_user_data(URING_OP_SEND, index, remote->uring_generation));
+    remote->uring_send_in_flight = write_buffer->buf.used;
+
     return 0;
 }
 
-static int handle_incoming_data(int epollfd, struct remote_desc * const current)
+static void uring_flush_sends(void)
 {
-    struct nDPIsrvd_json_buffer * const json_read_buffer = get_read_buffer(current);
-
-    if (json_read_buffer == NULL)
+    for (size_t i = 0; i < remotes.desc_size; ++i)
     {
-        unsigned char garbage = 0;
-
-        if (read(current->fd, &garbage, sizeof(garbage)) == sizeof(garbage))
+        if (remotes.desc[i].fd < 0 || get_write_buffer(&remotes.desc[i]) == NULL)
         {
-            logger_nDPIsrvd(current, "Received data from", "who is not allowed to send us some.");
+            continue;
         }
-        else
+
+        if (uring_add_send(&remotes.desc[i]) != 0)
         {
-            logger_nDPIsrvd(current, "Distributor connection", "closed");
+            disconnect_client(-1, &remotes.desc[i]);
         }
-        disconnect_client(epollfd, current);
-        return 1;
     }
+}
 
-    /* read JSON strings (or parts) from the UNIX socket (collecting) */
-    if (json_read_buffer->buf.used == json_read_buffer->buf.max)
+static void uring_handle_read(struct remote_desc * const remote, int res)
+{
+    struct nDPIsrvd_json_buffer * const json_read_buffer = get_read_buffer(remote);
+
+    if (res == -EAGAIN || res == -EINTR)
     {
-        logger_nDPIsrvd(current,
-                        "Collector connection",
-                        "read buffer (%zu bytes) full. No more read possible.",
-                        json_read_buffer->buf.max);
+        res = 0;
     }
-    else
+    else if (res < 0)
     {
-        errno = 0;
-        ssize_t bytes_read = read(current->fd,
-                                  json_read_buffer->buf.ptr.raw + json_read_buffer->buf.used,
-                                  json_read_buffer->buf.max - json_read_buffer->buf.used);
-        if (bytes_read < 0 || errno != 0)
+        logger_nDPIsrvd(remote, "Could not read remote", ": %s", strerror(-res));
+        disconnect_client(-1, remote);
+        return;
+    }
+    else if (res == 0)
+    {
+        logger_nDPIsrvd(remote, "Collector connection", "closed during read");
+        disconnect_client(-1, remote);
+        return;
+    }
+
+    json_read_buffer->buf.used += res;
+    distribute_collector_data(-1, remote);
+
+    if (remote->fd >= 0 && uring_add_read(remote) != 0)
+    {
+        disconnect_client(-1, remote);
+    }
+    uring_flush_sends();
+}
+
+static void uring_handle_send(struct remote_desc * const remote, int res)
+{
+    struct nDPIsrvd_write_buffer * const write_buffer = get_write_buffer(remote);
+    UT_array * const additional_write_buffers = get_additional_write_buffers(remote);
+
+    remote->uring_send_in_flight = 0;
+    if (res == -EAGAIN || res == -EINTR)
+    {
+        res = 0;
+    }
+    else if (res <= 0)
+    {
+        logger_nDPIsrvd(remote, "Distributor connection", "closed, send failed: %s", strerror(-res));
+        disconnect_client(-1, remote);
+        return;
+    }
+
+    if ((size_t)res < write_buffer->buf.used)
+    {
+        memmove(write_buffer->buf.ptr.raw, write_buffer->buf.ptr.raw + res, write_buffer->buf.used - res);
+    }
+    write_buffer->buf.used -= res;
+    stats_add_written(remote, res);
+
+    /* refill the main write buffer with cached JSON lines, so the next send covers as much as possible */
+    while (utarray_len(additional_write_buffers) > 0)
+    {
+        struct nDPIsrvd_write_buffer * const buf =
+            (struct nDPIsrvd_write_buffer *)utarray_front(additional_write_buffers);
+        size_t const remaining = buf->buf.used - buf->written;
+
+        if (remaining > write_buffer->buf.max - write_buffer->buf.used)
         {
-            logger_nDPIsrvd(current, "Could not read remote", ": %s", strerror(errno));
-            disconnect_client(epollfd, current);
-            return 1;
+            break;
         }
-        if (bytes_read == 0)
-        {
-            logger_nDPIsrvd(current, "Collector connection", "closed during read");
-            disconnect_client(epollfd, current);
-            return 1;
+
+        memcpy(write_buffer->buf.ptr.raw + write_buffer->buf.used, buf->buf.ptr.raw + buf->written, remaining);
+        write_buffer->buf.used += remaining;
+        utarray_erase(additional_write_buffers, 0, 1);
+    }
+    stats_check_flushed(remote);
+
+    if (is_metrics_remote(remote) != 0 && write_buffer->buf.used == 0)
+    {
+        disconnect_client(-1, remote);
+        return;
+    }
+
+    if (uring_add_send(remote) != 0)
+    {
+        disconnect_client(-1, remote);
+    }
+}
+
+static void uring_handle_completion(struct io_uring_cqe const * const cqe)
+{
+    uint64_t const user_data = io_uring_cqe_get_data64(cqe);
+    enum uring_op const op = (enum uring_op)(user_data >> 56);
+    uint32_t const index = (user_data >> 32) & 0xFFFFFF;
+    uint32_t const generation = user_data & 0xFFFFFFFF;
+    struct remote_desc * current;
+
+    switch (op)
+    {
+        case URING_OP_ACCEPT:
+            if ((cqe->flags & IORING_CQE_F_MORE) == 0 && uring_add_accept(index) != 0)
+            {
+                logger(1, "Could not re-arm accept for fd %u", index);
+            }
+            if (cqe->res < 0)
+            {
+                logger(1, "Accept failed: %s", strerror(-cqe->res));
+                return;
+            }
+            new_connection(-1, index, cqe->res);
+            return;
+
+        case URING_OP_SIGNAL:
+            if (cqe->res != sizeof(uring_siginfo))
+            {
+                logger(1,
+                       "Invalid signal fd read size. Got %d, wanted %zu bytes.",
+                       cqe->res,
+                       sizeof(uring_siginfo));
+            }
+            else if (uring_siginfo.ssi_signo == SIGINT || uring_siginfo.ssi_signo == SIGTERM ||
+                     uring_siginfo.ssi_signo == SIGQUIT)
+            {
+                nDPIsrvd_main_thread_shutdown = 1;
+                return;
+            }
+            if (uring_add_signal_read(index) != 0)
+            {
+                logger(1, "%s", "Could not re-arm signal fd read");
+            }
+            return;
+
+        case URING_OP_READ:
+        case URING_OP_POLL:
+        case URING_OP_SEND:
+            break;
+    }
+
+    if (index >= remotes.desc_size)
+    {
+        logger(1, "BUG: io_uring completion for an invalid remote descriptor: %u", index);
+        return;
+    }
+
+    current = &remotes.desc[index];
+    if (current->uring_closing != 0)
+    {
+        if (op == URING_OP_SEND && current->uring_generation == generation)
+        {
+            /* the kernel does not reference the main write buffer anymore */
+            uring_release_remote(current);
         }
-        json_read_buffer->buf.used += bytes_read;
+        return;
+    }
+    if (current->fd < 0 || current->uring_generation != generation)
+    {
+        /* completion of a request that belonged to an already disconnected remote */
+        return;
     }
 
-    while (json_read_buffer->buf.used >= NETWORK_BUFFER_LENGTH_DIGITS + 1)
+    switch (op)
     {
-        if (handle_collector_protocol(epollfd, current) != 0)
-        {
+        case URING_OP_READ:
+            uring_handle_read(current, cqe->res);
             break;
-        }
+        case URING_OP_POLL:
+            handle_incoming_data(-1, current);
+            break;
+        case URING_OP_SEND:
+            uring_handle_send(current, cqe->res);
+            break;
+        case URING_OP_ACCEPT:
+        case URING_OP_SIGNAL:
+            break;
+    }
+}
 
-        for (size_t i = 0; i < remotes.desc_size; ++i)
-        {
-            struct nDPIsrvd_write_buffer * const write_buffer = get_write_buffer(&remotes.desc[i]);
-            UT_array * const additional_write_buffers = get_additional_write_buffers(&remotes.desc[i]);
+static int mainloop_uring(void)
+{
+    int signalfd = setup_signalfd(-1);
 
-            if (remotes.desc[i].fd < 0 || write_buffer == NULL || additional_write_buffers == NULL)
-            {
-                continue;
-            }
+    if (signalfd < 0 || uring_add_signal_read(signalfd) != 0)
+    {
+        logger(1, "%s", "Could not setup signal fd for io_uring");
+    }
 
-            if (current->event_collector_un.json_bytes > write_buffer->buf.max - write_buffer->buf.used ||
-                utarray_len(additional_write_buffers) > 0)
-            {
-                if (utarray_len(additional_write_buffers) == 0)
-                {
-#if 0
-                    logger_nDPIsrvd(&remotes.desc[i],
-                                       "Distributor",
-                                       "buffer capacity threshold (%zu bytes) reached, caching JSON strings.",
-                                       remotes.desc[i].buf.used);
-#endif
-                    errno = 0;
-                    if (add_out_event(epollfd, &remotes.desc[i]) != 0)
-                    {
-                        logger_nDPIsrvd(&remotes.desc[i],
-                                        "Could not add event to",
-                                        ", disconnecting: %s",
-                                        strerror(errno));
-                        disconnect_client(epollfd, &remotes.desc[i]);
-                        continue;
-                    }
-                }
-                if (add_to_additional_write_buffers(&remotes.desc[i],
-                                                    json_read_buffer->buf.ptr.raw,
-                                                    current->event_collector_un.json_bytes) != 0)
-                {
-                    disconnect_client(epollfd, &remotes.desc[i]);
-                    continue;
-                }
-            }
-            else
-            {
-                memcpy(write_buffer->buf.ptr.raw + write_buffer->buf.used,
-                       json_read_buffer->buf.ptr.raw,
-                       current->event_collector_un.json_bytes);
-                write_buffer->buf.used += current->event_collector_un.json_bytes;
-            }
+    while (nDPIsrvd_main_thread_shutdown == 0)
+    {
+        struct io_uring_cqe * cqe;
+        struct __kernel_timespec timeout = {.tv_sec = 1, .tv_nsec = 0};
+        unsigned int head;
+        unsigned int completions = 0;
 
-            if (drain_main_buffer(&remotes.desc[i]) != 0)
+        int ret = io_uring_submit_and_wait_timeout(&uring, &cqe, 1, &timeout, NULL);
+        if (ret < 0 && ret != -ETIME && ret != -EINTR)
+        {
+            logger(1, "io_uring submit/wait failed: %s", strerror(-ret));
+            break;
+        }
+
+        io_uring_for_each_cqe(&uring, head, cqe)
+        {
+            uring_handle_completion(cqe);
+            completions++;
+            if (nDPIsrvd_main_thread_shutdown != 0)
             {
-                disconnect_client(epollfd, &remotes.desc[i]);
+                break;
             }
         }
+        io_uring_cq_advance(&uring, completions);
 
-        memmove(json_read_buffer->buf.ptr.raw,
-                json_read_buffer->buf.ptr.raw + current->event_collector_un.json_bytes,
-                json_read_buffer->buf.used - current->event_collector_un.json_bytes);
-        json_read_buffer->buf.used -= current->event_collector_un.json_bytes;
-        current->event_collector_un.json_bytes = 0;
+        stats_event_check(-1);
+        stats_check_metrics_remotes(-1);
+        uring_flush_sends();
     }
 
+    close(signalfd);
+    free_remotes(-1);
+
     return 0;
 }
 
-static int handle_data_event(int epollfd, struct epoll_event * const event)
+static int setup_io_uring(void)
 {
-    struct remote_desc * current = (struct remote_desc *)event->data.ptr;
+    struct iovec * iovecs = NULL;
+    int ret;
 
-    if ((event->events & EPOLLIN) == 0 && (event->events & EPOLLOUT) == 0)
+    if (remotes.desc_size > 0xFFFFFF)
     {
-        logger(1, "Can not handle event mask: %d", event->events);
-        return 1;
+        logger(1, "Too many remote descriptors for io_uring: %llu", remotes.desc_size);
+        return -1;
     }
 
-    if (current == NULL)
+    ret = io_uring_queue_init(nDPIsrvd_IO_URING_ENTRIES, &uring, 0);
+    if (ret < 0)
     {
-        logger(1, "%s", "Remote descriptor got from event data invalid.");
-        return 1;
+        logger(1, "Error creating io_uring: %s, falling back to epoll", strerror(-ret));
+        return -1;
     }
 
-    if (current->fd < 0)
+    uring_read_buffers = (uint8_t *)nDPIsrvd_calloc(remotes.desc_size, NETWORK_BUFFER_MAX_SIZE);
+    iovecs = (struct iovec *)nDPIsrvd_calloc(remotes.desc_size, sizeof(*iovecs));
+    if (uring_read_buffers == NULL || iovecs == NULL)
     {
-        logger(1, "File descriptor `%d' got from event data invalid.", current->fd);
-        return 1;
+        logger(1, "%s", "Could not allocate io_uring read buffers, falling back to epoll");
+        goto error;
     }
 
-    if ((event->events & EPOLLIN) != 0)
+    for (size_t i = 0; i < remotes.desc_size; ++i)
     {
-        return handle_incoming_data(epollfd, current);
+        iovecs[i].iov_base = uring_read_buffers + i * NETWORK_BUFFER_MAX_SIZE;
+        iovecs[i].iov_len = NETWORK_BUFFER_MAX_SIZE;
     }
-    else
+    ret = io_uring_register_buffers(&uring, iovecs, remotes.desc_size);
+    if (ret < 0)
     {
-        return handle_outgoing_data(epollfd, current);
+        logger(1, "Error registering io_uring read buffers: %s, falling back to epoll", strerror(-ret));
+        goto error;
+    }
+    nDPIsrvd_free(iovecs);
+    iovecs = NULL;
+
+    /* io_uring requests would fail with EAGAIN instead of waiting on non-blocking fds */
+    if (fcntl_del_flags(collector_un_sockfd, O_NONBLOCK) != 0 ||
+        (collector_in_sockfd >= 0 && fcntl_del_flags(collector_in_sockfd, O_NONBLOCK) != 0) ||
+        fcntl_del_flags(distributor_un_sockfd, O_NONBLOCK) != 0 ||
+        (distributor_in_sockfd >= 0 && fcntl_del_flags(distributor_in_sockfd, O_NONBLOCK) != 0) ||
+        (catchup_un_sockfd >= 0 && fcntl_del_flags(catchup_un_sockfd, O_NONBLOCK) != 0) ||
+        (aggregation_un_sockfd >= 0 && fcntl_del_flags(aggregation_un_sockfd, O_NONBLOCK) != 0) ||
+        (metrics_un_sockfd >= 0 && fcntl_del_flags(metrics_un_sockfd, O_NONBLOCK) != 0))
+    {
+        logger(1, "Error setting listen sockets to blocking mode: %s, falling back to epoll", strerror(errno));
+        goto error;
     }
-}
 
-static int setup_signalfd(int epollfd)
-{
-    sigset_t mask;
-    int sfd;
+    if (uring_add_accept(collector_un_sockfd) != 0 || uring_add_accept(distributor_un_sockfd) != 0 ||
+        (collector_in_sockfd >= 0 && uring_add_accept(collector_in_sockfd) != 0) ||
+        (distributor_in_sockfd >= 0 && uring_add_accept(distributor_in_sockfd) != 0) ||
+        (catchup_un_sockfd >= 0 && uring_add_accept(catchup_un_sockfd) != 0) ||
+        (aggregation_un_sockfd >= 0 && uring_add_accept(aggregation_un_sockfd) != 0) ||
+        (metrics_un_sockfd >= 0 && uring_add_accept(metrics_un_sockfd) != 0))
+    {
+        goto error;
+    }
 
-    sigemptyset(&mask);
-    sigaddset(&mask, SIGINT);
-    sigaddset(&mask, SIGTERM);
-    sigaddset(&mask, SIGQUIT);
+    uring_enabled = 1;
+    logger(0, "%s", "Using io_uring event loop");
 
-    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1)
+    return 0;
+error:
+    fcntl_add_flags(collector_un_sockfd, O_NONBLOCK);
+    fcntl_add_flags(distributor_un_sockfd, O_NONBLOCK);
+    if (collector_in_sockfd >= 0)
     {
-        return -1;
+        fcntl_add_flags(collector_in_sockfd, O_NONBLOCK);
     }
-    sfd = signalfd(-1, &mask, 0);
-    if (sfd == -1)
+    if (distributor_in_sockfd >= 0)
     {
-        return -1;
+        fcntl_add_flags(distributor_in_sockfd, O_NONBLOCK);
     }
-
-    if (add_in_event_fd(epollfd, sfd) != 0)
+    if (catchup_un_sockfd >= 0)
     {
-        return -1;
+        fcntl_add_flags(catchup_un_sockfd, O_NONBLOCK);
     }
-
-    if (fcntl_add_flags(sfd, O_NONBLOCK) != 0)
+    if (aggregation_un_sockfd >= 0)
     {
-        return -1;
+        fcntl_add_flags(aggregation_un_sockfd, O_NONBLOCK);
     }
-
-    return sfd;
+    if (metrics_un_sockfd >= 0)
+    {
+        fcntl_add_flags(metrics_un_sockfd, O_NONBLOCK);
+    }
+    io_uring_queue_exit(&uring);
+    nDPIsrvd_free(iovecs);
+    nDPIsrvd_free(uring_read_buffers);
+    uring_read_buffers = NULL;
+    return -1;
 }
 
-static int mainloop(int epollfd)
+static void close_io_uring(void)
 {
-    struct epoll_event events[32];
-    size_t const events_size = sizeof(events) / sizeof(events[0]);
-    int signalfd = setup_signalfd(epollfd);
-
-    while (nDPIsrvd_main_thread_shutdown == 0)
+    io_uring_queue_exit(&uring);
+    for (size_t i = 0; i < remotes.desc_size; ++i)
     {
-        int nready = epoll_wait(epollfd, events, events_size, 1000);
-
-        for (int i = 0; i < nready; i++)
+        if (remotes.desc[i].uring_closing != 0)
         {
-            if ((events[i].events & EPOLLERR) != 0 || (events[i].events & EPOLLHUP) != 0)
-            {
-                if (events[i].data.fd != collector_un_sockfd && events[i].data.fd != distributor_un_sockfd &&
-                    events[i].data.fd != distributor_in_sockfd)
-                {
-                    struct remote_desc * const current = (struct remote_desc *)events[i].data.ptr;
-                    switch (current->sock_type)
-                    {
-                        case COLLECTOR_UN:
-                            logger_nDPIsrvd(current, "Collector connection", "closed");
-                            break;
-                        case DISTRIBUTOR_UN:
-                        case DISTRIBUTOR_IN:
-                            logger_nDPIsrvd(current, "Distributor connection", "closed");
-                            break;
-                    }
-                    disconnect_client(epollfd, current);
-                }
-                else
-                {
-                    logger(1, "Epoll event error: %s", (errno != 0 ? strerror(errno) : "unknown"));
-                }
-                continue;
-            }
-
-            if (events[i].data.fd == collector_un_sockfd || events[i].data.fd == distributor_un_sockfd ||
-                events[i].data.fd == distributor_in_sockfd)
-            {
-                /* New connection to collector / distributor. */
-                if (new_connection(epollfd, events[i].data.fd) != 0)
-                {
-                    continue;
-                }
-            }
-            else if (events[i].data.fd == signalfd)
-            {
-                struct signalfd_siginfo fdsi;
-                ssize_t s;
-
-                s = read(signalfd, &fdsi, sizeof(struct signalfd_siginfo));
-                if (s != sizeof(struct signalfd_siginfo))
-                {
-                    logger(1,
-                           "Invalid signal fd read size. Got %zd, wanted %zu bytes.",
-                           s,
-                           sizeof(struct signalfd_siginfo));
-                    continue;
-                }
-
-                if (fdsi.ssi_signo == SIGINT || fdsi.ssi_signo == SIGTERM || fdsi.ssi_signo == SIGQUIT)
-                {
-                    nDPIsrvd_main_thread_shutdown = 1;
-                    break;
-                }
-            }
-            else
-            {
-                /* Incoming data / Outoing data ready to receive / send. */
-                if (handle_data_event(epollfd, &events[i]) != 0)
-                {
-                    /* do nothing */
-                }
-            }
+            uring_release_remote(&remotes.desc[i]);
         }
     }
-
-    close(signalfd);
-    free_remotes(epollfd);
-
-    return 0;
+    nDPIsrvd_free(uring_read_buffers);
+    uring_read_buffers = NULL;
+    uring_enabled = 0;
 }
+#endif
 
 static int create_evq(void)
 {
@@ -1456,6 +3928,15 @@ static int setup_event_queue(void)
         return -1;
     }
 
+    if (collector_in_sockfd >= 0)
+    {
+        if (add_in_event_fd(epollfd, collector_in_sockfd) != 0)
+        {
+            logger(1, "Error adding collector TCP/IP socket fd to epoll: %s", strerror(errno));
+            return -1;
+        }
+    }
+
     if (add_in_event_fd(epollfd, distributor_un_sockfd) != 0)
     {
         logger(1, "Error adding distributor UNIX socket fd to epoll: %s", strerror(errno));
@@ -1471,6 +3952,33 @@ static int setup_event_queue(void)
         }
     }
 
+    if (catchup_un_sockfd >= 0)
+    {
+        if (add_in_event_fd(epollfd, catchup_un_sockfd) != 0)
+        {
+            logger(1, "Error adding catch-up distributor UNIX socket fd to epoll: %s", strerror(errno));
+            return -1;
+        }
+    }
+
+    if (aggregation_un_sockfd >= 0)
+    {
+        if (add_in_event_fd(epollfd, aggregation_un_sockfd) != 0)
+        {
+            logger(1, "Error adding aggregation distributor UNIX socket fd to epoll: %s", strerror(errno));
+            return -1;
+        }
+    }
+
+    if (metrics_un_sockfd >= 0)
+    {
+        if (add_in_event_fd(epollfd, metrics_un_sockfd) != 0)
+        {
+            logger(1, "Error adding metrics UNIX socket fd to epoll: %s", strerror(errno));
+            return -1;
+        }
+    }
+
     return epollfd;
 }
 
@@ -1545,6 +4053,34 @@ int main(int argc, char ** argv)
         return 1;
     }
 
+    if (nDPIsrvd_options.catchup_un_sockpath != NULL && access(nDPIsrvd_options.catchup_un_sockpath, F_OK) == 0)
+    {
+        logger_early(1,
+                     "UNIX socket `%s' exists; nDPIsrvd already running? "
+                     "Please remove the socket manually or change socket path.",
+                     nDPIsrvd_options.catchup_un_sockpath);
+        return 1;
+    }
+
+    if (nDPIsrvd_options.aggregation_un_sockpath != NULL &&
+        access(nDPIsrvd_options.aggregation_un_sockpath, F_OK) == 0)
+    {
+        logger_early(1,
+                     "UNIX socket `%s' exists; nDPIsrvd already running? "
+                     "Please remove the socket manually or change socket path.",
+                     nDPIsrvd_options.aggregation_un_sockpath);
+        return 1;
+    }
+
+    if (nDPIsrvd_options.metrics_un_sockpath != NULL && access(nDPIsrvd_options.metrics_un_sockpath, F_OK) == 0)
+    {
+        logger_early(1,
+                     "UNIX socket `%s' exists; nDPIsrvd already running? "
+                     "Please remove the socket manually or change socket path.",
+                     nDPIsrvd_options.metrics_un_sockpath);
+        return 1;
+    }
+
     log_app_info();
 
     if (daemonize_with_pidfile(nDPIsrvd_options.pidfile) != 0)
@@ -1557,6 +4093,12 @@ int main(int argc, char ** argv)
         goto error;
     }
 
+    if (setup_catchup() != 0)
+    {
+        logger(1, "Could not allocate catch-up ring: %llu bytes", nDPIsrvd_options.catchup_ring_size);
+        goto error;
+    }
+
     switch (create_listen_sockets())
     {
         case 0:
@@ -1573,7 +4115,35 @@ int main(int argc, char ** argv)
     }
 
     logger(0, "collector UNIX socket listen on `%s'", nDPIsrvd_options.collector_un_sockpath);
+    if (nDPIsrvd_options.collector_in_address != NULL)
+    {
+        logger(0, "collector TCP/IP socket listen on %s", nDPIsrvd_options.collector_in_address);
+    }
     logger(0, "distributor UNIX listen on `%s'", nDPIsrvd_options.distributor_un_sockpath);
+    if (nDPIsrvd_options.catchup_un_sockpath != NULL)
+    {
+        logger(0,
+               "catch-up distributor UNIX listen on `%s', ring: %llu bytes / %llu sec",
+               nDPIsrvd_options.catchup_un_sockpath,
+               nDPIsrvd_options.catchup_ring_size,
+               nDPIsrvd_options.catchup_max_age);
+    }
+    if (nDPIsrvd_options.aggregation_un_sockpath != NULL)
+    {
+        logger(0, "aggregation distributor UNIX listen on `%s'", nDPIsrvd_options.aggregation_un_sockpath);
+        if (nDPIsrvd_options.aggregation_interim_interval > 0)
+        {
+            logger(0, "aggregation interim records every %llu sec", nDPIsrvd_options.aggregation_interim_interval);
+        }
+    }
+    if (nDPIsrvd_options.metrics_un_sockpath != NULL)
+    {
+        logger(0, "metrics UNIX listen on `%s'", nDPIsrvd_options.metrics_un_sockpath);
+    }
+    if (nDPIsrvd_options.stats_event_interval > 0)
+    {
+        logger(0, "statistics events every %llu sec", nDPIsrvd_options.stats_event_interval);
+    }
     switch (distributor_in_address.raw.sa_family)
     {
         default:
@@ -1588,6 +4158,12 @@ int main(int argc, char ** argv)
         case 0xFFFF:
             break;
     }
+    if (collector_in_address.raw.sa_family == AF_INET || collector_in_address.raw.sa_family == AF_INET6)
+    {
+        logger(1,
+               "Please keep in mind that everyone with access to the device/network is able "
+               "to inject events through the Collector TCP Socket. You've been warned!");
+    }
 
     errno = 0;
     if (nDPIsrvd_options.user != NULL && change_user_group(nDPIsrvd_options.user,
@@ -1619,22 +4195,50 @@ int main(int argc, char ** argv)
     signal(SIGTERM, SIG_IGN);
     signal(SIGQUIT, SIG_IGN);
 
-    epollfd = setup_event_queue();
-    if (epollfd < 0)
+#ifdef ENABLE_IO_URING
+    if (nDPIsrvd_options.use_io_uring != 0 && setup_io_uring() == 0)
     {
-        goto error_unlink_sockets;
+        retval = mainloop_uring();
+        close_io_uring();
     }
+    else
+#endif
+    {
+        epollfd = setup_event_queue();
+        if (epollfd < 0)
+        {
+            goto error_unlink_sockets;
+        }
 
-    retval = mainloop(epollfd);
-    close_event_queue(epollfd);
+        retval = mainloop(epollfd);
+        close_event_queue(epollfd);
+    }
 
 error_unlink_sockets:
     unlink(nDPIsrvd_options.collector_un_sockpath);
     unlink(nDPIsrvd_options.distributor_un_sockpath);
+    if (nDPIsrvd_options.catchup_un_sockpath != NULL)
+    {
+        unlink(nDPIsrvd_options.catchup_un_sockpath);
+    }
+    if (nDPIsrvd_options.aggregation_un_sockpath != NULL)
+    {
+        unlink(nDPIsrvd_options.aggregation_un_sockpath);
+    }
+    if (nDPIsrvd_options.metrics_un_sockpath != NULL)
+    {
+        unlink(nDPIsrvd_options.metrics_un_sockpath);
+    }
 error:
     close(collector_un_sockfd);
+    close(collector_in_sockfd);
     close(distributor_un_sockfd);
     close(distributor_in_sockfd);
+    close(catchup_un_sockfd);
+    close(aggregation_un_sockfd);
+    close(metrics_un_sockfd);
+    free_catchup();
+    free_aggregation();
 
     daemonize_shutdown(nDPIsrvd_options.pidfile);
     logger(0, "Bye.");
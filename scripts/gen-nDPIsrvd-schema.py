@@ -0,0 +1,363 @@
+#!/usr/bin/env python3
+#
+# Generate C code for dependencies/nDPIsrvd.h from the nDPId JSON schema files:
+#
+#  nDPIsrvd_keys.h:   a perfect hash table for all JSON keys listed in the schemas,
+#                     used to map known keys to fixed token slots without a hash table lookup.
+#                     Keys not found in the schemas are still handled by the dynamic (uthash) token table.
+#  nDPIsrvd_events.h: typed views for daemon/error/flow/packet events and their decoders.
+#
+# Usage: ./scripts/gen-nDPIsrvd-schema.py [schema-dir] [output-dir]
+#
+
+import glob
+import json
+import os
+import re
+import sys
+
+KEY_STRLEN = 32  # nDPIsrvd_JSON_KEY_STRLEN
+BUCKET_COUNT = 64
+SLOT_BITS = 8
+SLOT_COUNT = 1 << SLOT_BITS
+MAX_DISPLACEMENT = 65535
+
+HEADER_COMMENT = '/* Generated by scripts/gen-nDPIsrvd-schema.py from the JSON schema files, do not edit. */'
+
+
+def collect_keys(obj, keys):
+    if isinstance(obj, dict):
+        for name, value in obj.items():
+            if name == 'properties' and isinstance(value, dict):
+                keys.update(value.keys())
+            collect_keys(value, keys)
+    elif isinstance(obj, list):
+        for value in obj:
+            collect_keys(value, keys)
+
+
+def key_hash(key):
+    # must match nDPIsrvd_key_hash() in the generated header
+    h = 2166136261
+    for c in key.encode('ascii'):
+        h ^= c
+        h = (h * 16777619) & 0xFFFFFFFF
+    return h
+
+
+def key_slot(h, displacement):
+    # must match nDPIsrvd_known_key_index() in the generated header
+    return (((h ^ displacement) * 2654435761) & 0xFFFFFFFF) >> (32 - SLOT_BITS)
+
+
+def key_enum(key):
+    return 'nDPIsrvd_KEY_' + re.sub('[^A-Za-z0-9]', '_', key).upper()
+
+
+def key_member(key):
+    return re.sub('[^A-Za-z0-9]', '_', key).lower()
+
+
+def build_table(keys):
+    buckets = [[] for _ in range(BUCKET_COUNT)]
+    for key in keys:
+        buckets[key_hash(key) % BUCKET_COUNT].append(key)
+
+    displacements = [0] * BUCKET_COUNT
+    slots = [None] * SLOT_COUNT
+    # place the largest buckets first, they are the hardest to fit
+    for bucket_index in sorted(range(BUCKET_COUNT), key=lambda i: len(buckets[i]), reverse=True):
+        bucket = buckets[bucket_index]
+        if len(bucket) == 0:
+            break
+        for displacement in range(1, MAX_DISPLACEMENT + 1):
+            wanted = [key_slot(key_hash(key), displacement) for key in bucket]
+            if len(set(wanted)) == len(wanted) and all(slots[slot] is None for slot in wanted):
+                break
+        else:
+            raise RuntimeError('No displacement found for bucket {}: {}'.format(bucket_index, bucket))
+        displacements[bucket_index] = displacement
+        for key, slot in zip(bucket, wanted):
+            slots[slot] = key
+
+    return displacements, slots
+
+
+def format_array(values, per_line):
+    lines = []
+    for i in range(0, len(values), per_line):
+        lines.append('    ' + ', '.join(values[i:i + per_line]) + ',')
+    return '\n'.join(lines)
+
+
+def generate_keys_header(keys):
+    displacements, slots = build_table(keys)
+    slot_to_key = [str(keys.index(key)) if key is not None else '-1' for key in slots]
+
+    return '''{header_comment}
+#ifndef NDPISRVD_KEYS_H
+#define NDPISRVD_KEYS_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define nDPIsrvd_KNOWN_KEYS {key_count}u
+#define nDPIsrvd_KEY_BUCKETS {bucket_count}u
+#define nDPIsrvd_KEY_SLOT_BITS {slot_bits}u
+#define nDPIsrvd_KEY_SLOTS (1u << nDPIsrvd_KEY_SLOT_BITS)
+
+enum nDPIsrvd_known_key
+{{
+{key_enums}
+}};
+
+static char const * const nDPIsrvd_known_keys[nDPIsrvd_KNOWN_KEYS] = {{
+{keys}
+}};
+
+static uint8_t const nDPIsrvd_known_key_lengths[nDPIsrvd_KNOWN_KEYS] = {{
+{lengths}
+}};
+
+static uint16_t const nDPIsrvd_key_displacements[nDPIsrvd_KEY_BUCKETS] = {{
+{displacements}
+}};
+
+static int16_t const nDPIsrvd_key_slots[nDPIsrvd_KEY_SLOTS] = {{
+{slots}
+}};
+
+static inline uint32_t nDPIsrvd_key_hash(char const * const key, size_t key_length)
+{{
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < key_length; ++i)
+    {{
+        hash ^= (uint8_t)key[i];
+        hash *= 16777619u;
+    }}
+
+    return hash;
+}}
+
+/*
+ * Returns the index of a key listed in the schema files or -1 if the key is unknown.
+ * Hash and displace: the key hash selects a bucket whose displacement was chosen so that all of its keys
+ * end up in distinct slots.
+ */
+static inline int nDPIsrvd_known_key_index(char const * const key, size_t key_length)
+{{
+    uint32_t const hash = nDPIsrvd_key_hash(key, key_length);
+    uint32_t const displaced = hash ^ nDPIsrvd_key_displacements[hash % nDPIsrvd_KEY_BUCKETS];
+    int const index = nDPIsrvd_key_slots[(displaced * 2654435761u) >> (32u - nDPIsrvd_KEY_SLOT_BITS)];
+
+    if (index < 0 || nDPIsrvd_known_key_lengths[index] != key_length ||
+        memcmp(nDPIsrvd_known_keys[index], key, key_length) != 0)
+    {{
+        return -1;
+    }}
+
+    return index;
+}}
+
+#endif
+'''.format(header_comment=HEADER_COMMENT,
+           key_count=len(keys),
+           bucket_count=BUCKET_COUNT,
+           slot_bits=SLOT_BITS,
+           key_enums='\n'.join('    {} = {},'.format(key_enum(key), i) for i, key in enumerate(keys)),
+           keys='\n'.join('    "{}",'.format(key) for key in keys),
+           lengths=format_array([str(len(key)) for key in keys], 16),
+           displacements=format_array([str(d) for d in displacements], 16),
+           slots=format_array(slot_to_key, 16))
+
+
+def leaf_keys(properties, result):
+    for name, prop in properties.items():
+        result.append(name)
+        if isinstance(prop.get('properties'), dict):
+            leaf_keys(prop['properties'], result)
+    return result
+
+
+def is_typed_object(prop, key_counts):
+    # Token values are stored per key name, not per path. Nested members are only generated if their keys are
+    # unique within the event, otherwise e.g. data_analysis.iat.c_to_s_min and data_analysis.pktlen.c_to_s_min
+    # would refer to the same token.
+    properties = prop.get('properties')
+    if not isinstance(properties, dict) or len(properties) == 0:
+        return False
+    for name in properties:
+        if key_counts[name] != 1 or re.match('^[A-Za-z_]', name) is None:
+            return False
+    return True
+
+
+def format_call(prefix, function, args):
+    line = '    {}{}({});'.format(prefix, function, ', '.join(args))
+    if len(line) <= 120:
+        return [line]
+    pad = ' ' * (4 + len(prefix) + len(function) + 1)
+    lines = ['    {}{}({},'.format(prefix, function, args[0])]
+    lines += [pad + arg + ',' for arg in args[1:-1]]
+    lines.append(pad + args[-1] + ');')
+    return lines
+
+
+def generate_members(properties, key_counts, indent):
+    lines = []
+    for name, prop in properties.items():
+        pad = ' ' * indent
+        if is_typed_object(prop, key_counts):
+            lines.append(pad + 'struct')
+            lines.append(pad + '{')
+            lines.append(pad + '    struct nDPIsrvd_json_token const * token;')
+            lines += generate_members(prop['properties'], key_counts, indent + 4)
+            lines.append(pad + '}} {};'.format(key_member(name)))
+        elif prop.get('type') == 'number':
+            lines.append(pad + 'struct nDPIsrvd_json_number {};'.format(key_member(name)))
+        else:
+            lines.append(pad + 'struct nDPIsrvd_json_token const * {};'.format(key_member(name)))
+    return lines
+
+
+def generate_decoder(properties, key_counts, path):
+    lines = []
+    for name, prop in properties.items():
+        member = path + key_member(name)
+        args = ['tokens', 'generation', key_enum(name)]
+        if is_typed_object(prop, key_counts):
+            lines += format_call('event->{}.token = '.format(member), 'nDPIsrvd_event_token', args)
+            lines += generate_decoder(prop['properties'], key_counts, member + '.')
+        elif prop.get('type') == 'number':
+            lines += format_call('', 'nDPIsrvd_event_number', ['&event->' + member] + args)
+        else:
+            lines += format_call('event->{} = '.format(member), 'nDPIsrvd_event_token', args)
+    return lines
+
+
+def generate_events_header(schemas):
+    type_enums = ['    nDPIsrvd_EVENT_UNKNOWN = 0,']
+    structs = []
+    decoders = []
+    union_members = []
+    dispatch = []
+
+    for event_type, schema in schemas:
+        properties = schema['properties']
+        key_counts = {}
+        for name in leaf_keys(properties, []):
+            key_counts[name] = key_counts.get(name, 0) + 1
+
+        type_enums.append('    nDPIsrvd_EVENT_{},'.format(event_type.upper()))
+        structs.append('struct nDPIsrvd_{}_event\n{{\n{}\n}};'.format(
+                       event_type, '\n'.join(generate_members(properties, key_counts, 4))))
+        prototype = 'static inline void nDPIsrvd_decode_{}_event('.format(event_type)
+        decoders.append('''{prototype}struct nDPIsrvd_json_token const * const tokens,
+{pad}nDPIsrvd_ull generation,
+{pad}struct nDPIsrvd_{event_type}_event * const event)
+{{
+{body}
+}}'''.format(prototype=prototype,
+             pad=' ' * len(prototype),
+             event_type=event_type,
+             body='\n'.join(generate_decoder(properties, key_counts, ''))))
+        union_members.append('        struct nDPIsrvd_{0}_event {0};'.format(event_type))
+        dispatch.append('''    if (tokens[{key}].generation == generation)
+    {{
+        event->type = nDPIsrvd_EVENT_{upper};
+        nDPIsrvd_decode_{event_type}_event(tokens, generation, &event->{event_type});
+        return event->type;
+    }}'''.format(key=key_enum(event_type + '_event_name'), upper=event_type.upper(), event_type=event_type))
+
+    return '''{header_comment}
+#ifndef NDPISRVD_EVENTS_H
+#define NDPISRVD_EVENTS_H 1
+
+/*
+ * Typed views of the events described by the schema files, filled by nDPIsrvd_parse_all() once per line
+ * if an event callback was set with nDPIsrvd_set_event_callback().
+ * String, boolean and object values are tokens, numbers are converted on first access via nDPIsrvd_number_to_ull().
+ * Members are NULL / have no token if the key was not part of the current line.
+ * This file is included by nDPIsrvd.h and requires its token types and helpers.
+ */
+
+enum nDPIsrvd_event_type
+{{
+{type_enums}
+}};
+
+{structs}
+
+struct nDPIsrvd_event
+{{
+    enum nDPIsrvd_event_type type;
+    union
+    {{
+{union_members}
+    }};
+}};
+
+{decoders}
+
+static inline enum nDPIsrvd_event_type nDPIsrvd_decode_event(struct nDPIsrvd_json_token const * const tokens,
+                                                             nDPIsrvd_ull generation,
+                                                             struct nDPIsrvd_event * const event)
+{{
+{dispatch}
+
+    event->type = nDPIsrvd_EVENT_UNKNOWN;
+    return event->type;
+}}
+
+#endif
+'''.format(header_comment=HEADER_COMMENT,
+           type_enums='\n'.join(type_enums),
+           structs='\n\n'.join(structs),
+           union_members='\n'.join(union_members),
+           decoders='\n\n'.join(decoders),
+           dispatch='\n'.join(dispatch))
+
+
+def main():
+    mydir = os.path.dirname(os.path.realpath(__file__))
+    schema_dir = sys.argv[1] if len(sys.argv) > 1 else os.path.join(mydir, '..', 'schema')
+    output_dir = sys.argv[2] if len(sys.argv) > 2 else os.path.join(mydir, '..', 'dependencies')
+
+    keys = set()
+    schemas = []
+    for path in sorted(glob.glob(os.path.join(schema_dir, '*_event_schema.json'))):
+        with open(path, 'r') as f:
+            schema = json.load(f)
+        collect_keys(schema, keys)
+        schemas.append((os.path.basename(path)[:-len('_event_schema.json')], schema))
+    keys = sorted(keys)
+    if len(keys) == 0:
+        sys.stderr.write('No keys found in {}\n'.format(schema_dir))
+        return 1
+    if len(keys) > SLOT_COUNT * 3 // 4:
+        sys.stderr.write('Too many keys ({}), increase SLOT_COUNT\n'.format(len(keys)))
+        return 1
+    for key in keys:
+        if len(key) >= KEY_STRLEN:
+            sys.stderr.write('Key "{}" exceeds nDPIsrvd_JSON_KEY_STRLEN\n'.format(key))
+            return 1
+    if len(set(key_enum(key) for key in keys)) != len(keys):
+        sys.stderr.write('Keys are not unique after conversion to C identifiers\n')
+        return 1
+    for event_type, _ in schemas:
+        if event_type + '_event_name' not in keys:
+            sys.stderr.write('Schema for {} events does not describe {}_event_name\n'.format(event_type, event_type))
+            return 1
+
+    with open(os.path.join(output_dir, 'nDPIsrvd_keys.h'), 'w') as f:
+        f.write(generate_keys_header(keys))
+    with open(os.path.join(output_dir, 'nDPIsrvd_events.h'), 'w') as f:
+        f.write(generate_events_header(schemas))
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+#
+# Replay recorded nDPId JSON events through nDPIsrvd and measure the
+# collector -> distributor throughput. Used to compare the epoll and
+# io_uring (-U) event loops under the same synthetic load.
+#
+
+import argparse
+import glob
+import os
+import selectors
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+
+def load_corpus(corpus_dir, rounds):
+    data = bytearray()
+    for path in sorted(glob.glob(os.path.join(corpus_dir, '*.out'))):
+        with open(path, 'rb') as f:
+            for line in f:
+                # skip the nDPId-test summary, keep framed JSON lines only
+                if line[:5].isdigit() and line[5:6] == b'{':
+                    data += line
+    return bytes(data) * rounds
+
+
+def wait_for_socket(path, timeout=5.0):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        if os.path.exists(path):
+            return True
+        time.sleep(0.01)
+    return False
+
+
+def run_once(nDPIsrvd, extra_args, corpus, distributors):
+    with tempfile.TemporaryDirectory(prefix='nDPIsrvd-bench-') as tmpdir:
+        collector_path = os.path.join(tmpdir, 'collector.sock')
+        distributor_path = os.path.join(tmpdir, 'distributor.sock')
+        args = [nDPIsrvd, '-c', collector_path, '-s', distributor_path,
+                '-p', os.path.join(tmpdir, 'nDPIsrvd.pid'), '-L', os.path.join(tmpdir, 'nDPIsrvd.log'),
+                '-m', str(distributors + 4)] + extra_args
+        proc = subprocess.Popen(args, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        try:
+            if not wait_for_socket(collector_path) or not wait_for_socket(distributor_path):
+                raise RuntimeError('nDPIsrvd did not create its sockets: {}'.format(' '.join(args)))
+
+            sel = selectors.DefaultSelector()
+            received = {}
+            for _ in range(distributors):
+                sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+                sock.connect(distributor_path)
+                sock.setblocking(False)
+                sel.register(sock, selectors.EVENT_READ)
+                received[sock] = 0
+            time.sleep(0.1)
+
+            collector = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            collector.connect(collector_path)
+            collector.setblocking(False)
+            sel.register(collector, selectors.EVENT_WRITE)
+
+            view = memoryview(corpus)
+            sent = 0
+            start = time.perf_counter()
+            while min(received.values()) < len(corpus):
+                for key, _ in sel.select(timeout=5.0):
+                    if key.fileobj is collector:
+                        try:
+                            sent += collector.send(view[sent:sent + 65536])
+                        except BlockingIOError:
+                            continue
+                        if sent == len(corpus):
+                            sel.unregister(collector)
+                        continue
+                    chunk = key.fileobj.recv(1048576)
+                    if len(chunk) == 0:
+                        raise RuntimeError('Distributor connection closed by nDPIsrvd')
+                    received[key.fileobj] += len(chunk)
+                if proc.poll() is not None:
+                    raise RuntimeError('nDPIsrvd exited unexpectedly with {}'.format(proc.returncode))
+            elapsed = time.perf_counter() - start
+
+            collector.close()
+            for sock in received:
+                sock.close()
+            return elapsed
+        finally:
+            proc.terminate()
+            proc.wait()
+
+
+def main():
+    mydir = os.path.dirname(os.path.realpath(__file__))
+    parser = argparse.ArgumentParser(description='nDPIsrvd collector/distributor throughput benchmark')
+    parser.add_argument('nDPIsrvd', help='path to the nDPIsrvd executable')
+    parser.add_argument('--corpus', default=os.path.join(mydir, '..', 'test', 'results'),
+                        help='directory with recorded nDPId JSON events (*.out)')
+    parser.add_argument('--rounds', type=int, default=4, help='replay the corpus N times')
+    parser.add_argument('--distributors', type=int, default=4, help='number of distributor clients')
+    parser.add_argument('--compare-io-uring', action='store_true',
+                        help='run a second pass with the io_uring event loop (-U)')
+    args = parser.parse_args()
+
+    corpus = load_corpus(args.corpus, args.rounds)
+    if len(corpus) == 0:
+        sys.stderr.write('No events found in {}\n'.format(args.corpus))
+        return 1
+    lines = corpus.count(b'\n')
+
+    runs = [('epoll', [])]
+    if args.compare_io_uring:
+        runs.append(('io_uring', ['-U']))
+
+    for name, extra_args in runs:
+        elapsed = run_once(args.nDPIsrvd, extra_args, corpus, args.distributors)
+        print('{:<10} {:>10} lines {:>8.2f} MiB x {} distributors: {:>7.3f} s, {:>10.0f} lines/s, {:>8.2f} MiB/s'.format(
+              name, lines, len(corpus) / 1048576, args.distributors, elapsed,
+              lines / elapsed, len(corpus) / 1048576 / elapsed))
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())